@@ -9,8 +9,14 @@ expr
     | (ADD | SUB) expr  # UnaryOp
     | expr (MUL | DIV) expr  # BinaryOp
     | expr (ADD | SUB) expr  # BinaryOp
-    | CELL  # OfCell
-    | NUMBER  # OfLiteral
+    | FUNCTION '(' arg (',' arg)* ')'  # Function
+    | (SHEET? CELL | REF)  # Cell
+    | NUMBER  # Literal
+    ;
+
+arg
+    : SHEET? CELL ':' CELL  # Range
+    | expr  # Argument
     ;
 
 
@@ -27,5 +33,10 @@ ADD: '+' ;
 SUB: '-' ;
 MUL: '*' ;
 DIV: '/' ;
+FUNCTION: 'SUM' | 'AVERAGE' | 'MIN' | 'MAX' ;
 CELL: [A-Z]+[0-9]+ ;
+// a reference deleted by a structural edit, as the formulas print it
+REF: '#REF!' ;
+// the name of another sheet of the workbook, A1!B2 is the cell B2 of a sheet named A1
+SHEET: [A-Za-z_][A-Za-z0-9_]* '!' ;
 WS: [ \t\n\r]+ -> skip ;
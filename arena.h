@@ -0,0 +1,95 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Destroys an object placed into an Arena without releasing its memory
+struct ArenaDeleter {
+    template <typename T>
+    void operator()(T* ptr) const {
+        ptr->~T();
+    }
+};
+
+template <typename T>
+using ArenaPtr = std::unique_ptr<T, ArenaDeleter>;
+
+// Bump allocator for the nodes and cell params of one formula. Allocation only moves a pointer inside
+// the current block, the blocks are released all at once together with the arena, so objects must not
+// outlive it. Not thread-safe, a formula is built by one thread and only read afterwards.
+class Arena {
+
+private:
+
+    static constexpr size_t INITIAL_BLOCK_SIZE = 256;
+    static constexpr size_t MAX_BLOCK_SIZE = 16 * 1024;
+
+    std::vector<std::unique_ptr<std::byte[]>> blocks_;
+    std::byte* current_ = nullptr;
+    size_t available_ = 0;
+    size_t next_block_size_ = INITIAL_BLOCK_SIZE;
+    size_t allocated_bytes_ = 0;
+
+    void AddBlock(size_t min_size) {
+
+        size_t block_size = std::max(next_block_size_, min_size);
+
+        blocks_.push_back(std::make_unique<std::byte[]>(block_size));
+        current_ = blocks_.back().get();
+        available_ = block_size;
+        allocated_bytes_ += block_size;
+
+        next_block_size_ = std::min(next_block_size_ * 2, MAX_BLOCK_SIZE);
+    }
+
+    static size_t GetPadding(const std::byte* ptr, size_t alignment) {
+        return (alignment - reinterpret_cast<uintptr_t>(ptr) % alignment) % alignment;
+    }
+
+public:
+
+    Arena() = default;
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    void* Allocate(size_t size, size_t alignment) {
+
+        size_t padding = GetPadding(current_, alignment);
+
+        if (current_ == nullptr || padding + size > available_) {
+            AddBlock(size + alignment);
+            padding = GetPadding(current_, alignment);
+        }
+
+        std::byte* result = current_ + padding;
+
+        current_ += padding + size;
+        available_ -= padding + size;
+
+        return result;
+    }
+
+    // for objects with a non-trivial destructor
+    template <typename T, typename... Args>
+    ArenaPtr<T> Make(Args&&... args) {
+        return ArenaPtr<T>(new (Allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...));
+    }
+
+    // for trivially destructible objects which are simply dropped together with the arena
+    template <typename T, typename... Args>
+    T* New(Args&&... args) {
+        static_assert(std::is_trivially_destructible_v<T>, "use Make for objects with a destructor");
+        return new (Allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    }
+
+    size_t GetAllocatedBytes() const {
+        return allocated_bytes_;
+    }
+};
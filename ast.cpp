@@ -1,7 +1,110 @@
 #include "ast.h"
 
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+
 namespace Ast {
 
+namespace {
+
+// the one place the operations are calculated, so folded literals equal the evaluated results
+double Calculate(OpCode code, double lhs, double rhs) {
+    switch (code) {
+        case OpCode::ADD: return lhs + rhs;
+        case OpCode::SUB: return lhs - rhs;
+        case OpCode::MUL: return lhs * rhs;
+        default:          return lhs / rhs;
+    }
+}
+
+template <typename T>
+void AppendBytes(std::string& key, T value) {
+    key.append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+// four accumulators fill the lanes of a vector register, a single one would serialize the loop on its latency
+template <typename Op>
+double Reduce(const double* values, size_t size, double init, Op op) {
+
+    constexpr size_t LANES = 4;
+
+    double lanes[LANES] = {init, init, init, init};
+
+    size_t i = 0;
+
+    for (; i + LANES <= size; i += LANES) {
+        for (size_t lane = 0; lane < LANES; ++lane) {
+            lanes[lane] = op(lanes[lane], values[i + lane]);
+        }
+    }
+
+    for (; i < size; ++i) {
+        lanes[0] = op(lanes[0], values[i]);
+    }
+
+    return op(op(lanes[0], lanes[1]), op(lanes[2], lanes[3]));
+}
+
+// both corners of a range span along one axis move if the span starts at or after the insertion point,
+// otherwise only a span containing the insertion point grows
+bool InsertIntoSpan(int& first, int& last, int before, int count) {
+
+    if (last < before) return false;
+
+    if (first >= before) first += count;
+    last += count;
+
+    return true;
+}
+
+enum class SpanDeletion {
+    NONE,
+    SHIFTED,
+    SHRUNK,
+    DELETED
+};
+
+SpanDeletion DeleteFromSpan(int& first, int& last, int start, int count) {
+
+    int end = start + count;
+
+    if (last < start) return SpanDeletion::NONE;
+
+    if (first >= end) {
+        first -= count;
+        last -= count;
+        return SpanDeletion::SHIFTED;
+    }
+
+    if (first >= start && last < end) return SpanDeletion::DELETED;
+
+    // the parts of the span left on both sides of the deleted lines close up
+    first = std::min(first, start);
+    last = last >= end ? last - count : start - 1;
+
+    return SpanDeletion::SHRUNK;
+}
+
+}
+
+std::string_view ToString(Function function) {
+    switch (function) {
+        case Function::SUM:     return "SUM";
+        case Function::AVERAGE: return "AVERAGE";
+        case Function::MIN:     return "MIN";
+        default:                return "MAX";
+    }
+}
+
+std::optional<Function> FunctionFromString(std::string_view name) {
+    for (Function function: {Function::SUM, Function::AVERAGE, Function::MIN, Function::MAX}) {
+        if (ToString(function) == name) return function;
+    }
+    return std::nullopt;
+}
+
 char ToString(BinaryOperator op) {
     switch (op) {
         case BinaryOperator::ADD: return '+';
@@ -11,7 +114,7 @@ char ToString(BinaryOperator op) {
     }
 }
 
-char Ast::ToString(UnaryOperator op) {
+char ToString(UnaryOperator op) {
     switch (op) {
         case UnaryOperator::PLUS:   return '+';
         case UnaryOperator::MINUS:  return '-';
@@ -42,35 +145,39 @@ const BinaryOp& Node::AsBinaryOp() const {
     return *std::get<BinaryOpPtr>(*this);
 }
 
+const FunctionCall& Node::AsFunctionCall() const {
+    return *std::get<FunctionCallPtr>(*this);
+}
+
 Ast::Node Node::OfLiteral(std::string literal) {
-    return Node(Ast::Literal{std::move(literal)});
+    double number = std::strtod(literal.c_str(), nullptr);
+    return Node(Ast::Literal{std::move(literal), number});
 }
 
 Ast::Node Node::OfCellParamPtr(CellParamPtr id) {
-    if(!(*id)->IsValid()) throw FormulaException("invalid position");
     return Node(id);
 }
 
-Ast::Node Node::OfParentheses(Node token) {
-    return token.IsCell() || token.IsLiteral() || token.IsParentheses() ?
-    std::move(token) : Node(std::make_unique<Ast::Parentheses>(std::move(token)));
+Ast::Node Node::OfParentheses(Arena& arena, Node token) {
+    return token.IsCell() || token.IsLiteral() || token.IsParentheses() || token.IsFunctionCall() || token.IsExternal() ?
+    std::move(token) : Node(arena.Make<Ast::Parentheses>(std::move(token)));
 }
 
-Ast::Node Node::Unary(Ast::Node token, UnaryOperator op) {
-    return Node(std::make_unique<UnaryOp>(SimplifyUnaryParentheses(std::move(token)), op));
+Ast::Node Node::Unary(Arena& arena, Ast::Node token, UnaryOperator op) {
+    return Node(arena.Make<UnaryOp>(SimplifyUnaryParentheses(std::move(token)), op));
 }
 
-Ast::Node Node::UnaryPlus(Node token) {
-    return Node(std::make_unique<UnaryOp>(SimplifyUnaryParentheses(std::move(token)), UnaryOperator::PLUS));
+Ast::Node Node::UnaryPlus(Arena& arena, Node token) {
+    return Unary(arena, std::move(token), UnaryOperator::PLUS);
 }
 
-Ast::Node Node::UnaryMinus(Node token) {
-    return Node(std::make_unique<UnaryOp>(SimplifyUnaryParentheses(std::move(token)), UnaryOperator::MINUS));
+Ast::Node Node::UnaryMinus(Arena& arena, Node token) {
+    return Unary(arena, std::move(token), UnaryOperator::MINUS);
 }
 
-Ast::Node Node::Binary(Ast::Node lhs, Ast::Node rhs, BinaryOperator op) {
+Ast::Node Node::Binary(Arena& arena, Ast::Node lhs, Ast::Node rhs, BinaryOperator op) {
     return Node(
-        std::make_unique<BinaryOp>(
+        arena.Make<BinaryOp>(
             SimplifyBinaryParentheses(op, std::move(lhs), true),
             SimplifyBinaryParentheses(op, std::move(rhs), false),
             op
@@ -78,97 +185,167 @@ Ast::Node Node::Binary(Ast::Node lhs, Ast::Node rhs, BinaryOperator op) {
     );
 }
 
-Ast::Node Node::BinaryAdd(Node lhs, Node rhs) {
-    return Node(
-        std::make_unique<BinaryOp>(
-            SimplifyBinaryParentheses(BinaryOperator::ADD, std::move(lhs), true),
-            SimplifyBinaryParentheses(BinaryOperator::ADD, std::move(rhs), false),
-            BinaryOperator::ADD
-        )
-    );
+Ast::Node Node::BinaryAdd(Arena& arena, Node lhs, Node rhs) {
+    return Binary(arena, std::move(lhs), std::move(rhs), BinaryOperator::ADD);
 }
 
-Ast::Node Node::BinarySub(Node lhs, Node rhs) {
-    return Node(
-        std::make_unique<BinaryOp>(
-            SimplifyBinaryParentheses(BinaryOperator::SUB, std::move(lhs), true),
-            SimplifyBinaryParentheses(BinaryOperator::SUB, std::move(rhs), false),
-            BinaryOperator::SUB
-        )
-    );
+Ast::Node Node::BinarySub(Arena& arena, Node lhs, Node rhs) {
+    return Binary(arena, std::move(lhs), std::move(rhs), BinaryOperator::SUB);
 }
 
-Ast::Node Node::BinaryMul(Node lhs, Node rhs) {
-    return Node(
-        std::make_unique<BinaryOp>(
-            SimplifyBinaryParentheses(BinaryOperator::MUL, std::move(lhs), true),
-            SimplifyBinaryParentheses(BinaryOperator::MUL, std::move(rhs), false),
-            BinaryOperator::MUL
-        )
-    );
+Ast::Node Node::BinaryMul(Arena& arena, Node lhs, Node rhs) {
+    return Binary(arena, std::move(lhs), std::move(rhs), BinaryOperator::MUL);
 }
 
-Ast::Node Node::BinaryDiv(Node lhs, Node rhs) {
-    return Node(
-        std::make_unique<BinaryOp>(
-            SimplifyBinaryParentheses(BinaryOperator::DIV, std::move(lhs), true),
-            SimplifyBinaryParentheses(BinaryOperator::DIV, std::move(rhs), false),
-            BinaryOperator::DIV
-        )
-    );
+Ast::Node Node::BinaryDiv(Arena& arena, Node lhs, Node rhs) {
+    return Binary(arena, std::move(lhs), std::move(rhs), BinaryOperator::DIV);
+}
 
+Ast::Node Node::OfRangeParamPtr(RangeParamPtr range) {
+    return Node(range);
 }
 
-IFormula::Value Node::Evaluate(const ISheet& sheet) const {
+Ast::Node Node::OfFunctionCall(Arena& arena, Function function, std::vector<Ast::Node> args) {
 
-    if (IsLiteral()) {
-        return AsLiteral().AsDouble();
-    } else if (IsCell()) {
+    // arguments are separated by commas, so none of them needs parentheses
+    for (Ast::Node& arg: args) {
+        if (arg.IsParentheses()) arg = arg.AsMutableParentheses().Extract();
+    }
 
-        const CellParam& param = AsCell();
+    return Node(arena.Make<FunctionCall>(function, std::move(args)));
+}
 
-        if (param == std::nullopt) return FormulaError(FormulaError::Category::Ref);
+Ast::Node Node::OfExternalParamPtr(ExternalParamPtr external) {
+    return Node(external);
+}
 
-        const ICell* cell = sheet.GetCell(*param);
+IFormula::Value EvaluateCell(const ISheet& sheet, const CellParam& param, Position origin) {
 
-        if (cell == nullptr) return 0.;
+    if (param == std::nullopt) return FormulaError(FormulaError::Category::Ref);
 
-        ICell::Value cell_value = cell->GetValue();
+    const ICell* cell = sheet.GetCell(Shift(*param, origin));
 
-        if (std::holds_alternative<std::string>(cell_value)) {
+    if (cell == nullptr) return 0.;
 
-            const auto& cell_str_value = std::get<std::string>(cell_value);
+    // text cells keep the number they mean, so nothing is copied or parsed here
+    std::optional<ICell::NumericValue> value = cell->GetNumericValue();
 
-            if (cell_str_value.empty()) return 0.;
+    return value ? *value : IFormula::Value(0.);
+}
 
-            try {
+IFormula::Value EvaluateExternalCell(const ISheet& sheet, const ExternalParam& param) {
 
-                // TODO replace with separate method?
-                size_t idx;
+    const ISheet* external_sheet = sheet.FindSheet(param.sheet);
 
-                double value = std::stod(cell_str_value, &idx);
+    if (external_sheet == nullptr) return FormulaError(FormulaError::Category::Ref);
 
-                if (idx < cell_str_value.size()) {
-                    return FormulaError(FormulaError::Category::Value);
-                }
+    return EvaluateCell(*external_sheet, param.range ? CellParam(param.range->first) : std::nullopt, Position {0, 0});
+}
 
-                return value;
+void Aggregator::Flush() {
 
-            } catch (std::exception& err) {
-                return FormulaError(FormulaError::Category::Value);
-            }
-        } else if (std::holds_alternative<double>(cell_value)) {
-            return std::get<double>(cell_value);
-        } else {
-            return std::get<FormulaError>(cell_value);
-        }
+    if (chunk_size_ == 0) return;
+
+    switch (function_) {
+
+        case Function::MIN:
+            result_ = Reduce(chunk_, chunk_size_, count_ > 0 ? result_ : chunk_[0], [](double lhs, double rhs) {
+                return rhs < lhs ? rhs : lhs;
+            });
+            break;
+
+        case Function::MAX:
+            result_ = Reduce(chunk_, chunk_size_, count_ > 0 ? result_ : chunk_[0], [](double lhs, double rhs) {
+                return rhs > lhs ? rhs : lhs;
+            });
+            break;
+
+        default:
+            result_ += Reduce(chunk_, chunk_size_, 0., [](double lhs, double rhs) {
+                return lhs + rhs;
+            });
+    }
+
+    count_ += chunk_size_;
+    chunk_size_ = 0;
+}
+
+void Aggregator::AddCellValue(const ICell& cell) {
+
+    std::optional<ICell::NumericValue> value = cell.GetNumericValue();
+
+    // empty cells are skipped, so they don't count for AVERAGE
+    if (!value) return;
+
+    if (std::holds_alternative<double>(*value)) {
+        Add(std::get<double>(*value));
+    } else {
+        error_ = std::get<FormulaError>(*value);
+    }
+}
+
+void Aggregator::AddRange(const ISheet& sheet, const RangeParam& range, Position origin) {
+
+    if (error_) return;
+
+    if (range == std::nullopt) {
+        error_ = FormulaError(FormulaError::Category::Ref);
+        return;
+    }
+
+    sheet.ForEachCellInRange(Shift(*range, origin), [this](Position, const ICell& cell) {
+        if (!error_) AddCellValue(cell);
+    });
+}
+
+void Aggregator::AddExternalRange(const ISheet& sheet, const ExternalParam& param) {
+
+    if (error_) return;
+
+    const ISheet* external_sheet = sheet.FindSheet(param.sheet);
+
+    if (external_sheet == nullptr) {
+        error_ = FormulaError(FormulaError::Category::Ref);
+        return;
+    }
+
+    AddRange(*external_sheet, param.range, Position {0, 0});
+}
+
+IFormula::Value Aggregator::GetResult() {
+
+    if (error_) return *error_;
+
+    Flush();
+
+    if (count_ == 0) {
+        if (function_ == Function::AVERAGE) return FormulaError(FormulaError::Category::Div0);
+        return 0.;
+    }
+
+    double result = function_ == Function::AVERAGE ? result_ / static_cast<double>(count_) : result_;
+
+    if (!std::isfinite(result)) return FormulaError(FormulaError::Category::Div0);
+
+    return result;
+}
+
+IFormula::Value Node::Evaluate(const ISheet& sheet, Position origin) const {
 
+    if (IsLiteral()) {
+        double value = AsLiteral().AsDouble();
+        if (std::isfinite(value)) return value;
+        return FormulaError(FormulaError::Category::Div0);
+    } else if (IsCell()) {
+        return EvaluateCell(sheet, AsCell(), origin);
+    } else if (IsExternal()) {
+        return EvaluateExternalCell(sheet, AsExternal());
     } else if (IsParentheses()) {
-        return AsParentheses().GetContent().Evaluate(sheet);
+        return AsParentheses().GetContent().Evaluate(sheet, origin);
     } else if (IsUnaryOp()) {
 
         const auto& unary_op = AsUnaryOp();
-        IFormula::Value token = unary_op.GetToken().Evaluate(sheet);
+        IFormula::Value token = unary_op.GetToken().Evaluate(sheet, origin);
 
         if (std::holds_alternative<double>(token)) {
             double value = std::get<double>(token);
@@ -181,13 +358,13 @@ IFormula::Value Node::Evaluate(const ISheet& sheet) const {
 
         const auto& binary_op = AsBinaryOp();
 
-        IFormula::Value lhs = binary_op.GetLhs().Evaluate(sheet);
+        IFormula::Value lhs = binary_op.GetLhs().Evaluate(sheet, origin);
 
         if (std::holds_alternative<FormulaError>(lhs)) {
             return lhs;
         }
 
-        IFormula::Value rhs = binary_op.GetRhs().Evaluate(sheet);
+        IFormula::Value rhs = binary_op.GetRhs().Evaluate(sheet, origin);
 
         if (std::holds_alternative<FormulaError>(rhs)) {
             return rhs;
@@ -210,26 +387,452 @@ IFormula::Value Node::Evaluate(const ISheet& sheet) const {
         } else {
             return FormulaError(FormulaError::Category::Div0);
         }
+    } else if (IsFunctionCall()) {
+
+        const auto& call = AsFunctionCall();
+
+        Aggregator aggregator(call.GetFunction());
+
+        // value arguments go before the ranges and the ranges of this sheet before the ones of other sheets,
+        // the same order Program uses
+        for (const Ast::Node& arg: call.GetArgs()) {
+
+            if (arg.IsRange() || arg.IsExternalRange()) continue;
+
+            IFormula::Value value = arg.Evaluate(sheet, origin);
+
+            if (std::holds_alternative<FormulaError>(value)) return value;
+
+            aggregator.Add(std::get<double>(value));
+        }
+
+        for (const Ast::Node& arg: call.GetArgs()) {
+            if (arg.IsRange()) aggregator.AddRange(sheet, arg.AsRange(), origin);
+        }
+
+        for (const Ast::Node& arg: call.GetArgs()) {
+            if (arg.IsExternalRange()) aggregator.AddExternalRange(sheet, arg.AsExternal());
+        }
+
+        return aggregator.GetResult();
+    }
+
+    return FormulaError(FormulaError::Category::Value);
+}
+
+void Program::Push(Instruction instruction, int stack_change) {
+    code_.push_back(instruction);
+    stack_depth_ += stack_change;
+    max_stack_depth_ = std::max(max_stack_depth_, stack_depth_);
+}
+
+void Program::EmitLiteral(double value) {
+    Push(Instruction {OpCode::PUSH_LITERAL, 0, value}, 1);
+}
+
+void Program::EmitCell(uint32_t slot) {
+    Push(Instruction {OpCode::PUSH_CELL, slot, 0.}, 1);
+}
+
+void Program::EmitExternalCell(uint32_t slot) {
+    Push(Instruction {OpCode::PUSH_EXTERNAL, slot, 0.}, 1);
+}
+
+bool Program::EndsWithLiterals(size_t count) const {
+    return count <= code_.size() && std::all_of(code_.end() - count, code_.end(), [](const Instruction& instruction) {
+        return instruction.code == OpCode::PUSH_LITERAL;
+    });
+}
+
+void Program::EmitCall(
+    Function function,
+    uint32_t value_count,
+    std::vector<uint32_t> range_slots,
+    std::vector<uint32_t> external_slots
+) {
+
+    // an aggregate of literals is a literal as well, unless it is an error
+    if (range_slots.empty() && external_slots.empty() && EndsWithLiterals(value_count)) {
+
+        Aggregator aggregator(function);
+
+        for (auto it = code_.end() - value_count; it != code_.end(); ++it) {
+            aggregator.Add(it->value);
+        }
+
+        IFormula::Value value = aggregator.GetResult();
+
+        if (std::holds_alternative<double>(value)) {
+            code_.resize(code_.size() - value_count);
+            stack_depth_ -= value_count;
+            EmitLiteral(std::get<double>(value));
+            return;
+        }
     }
 
-    return 0.;
+    auto index = static_cast<uint32_t>(calls_.size());
+    calls_.push_back(Call {function, value_count, std::move(range_slots), std::move(external_slots)});
+    Push(Instruction {OpCode::CALL, index, 0.}, 1 - static_cast<int>(value_count));
+}
+
+void Program::EmitUnaryOp(UnaryOperator op) {
+
+    // unary plus doesn't change the operand, so it isn't worth an instruction
+    if (op == UnaryOperator::PLUS) return;
+
+    // the last instruction computes the operand
+    if (code_.empty() || (code_.back().code != OpCode::PUSH_LITERAL && code_.back().code != OpCode::NEGATE)) {
+        Push(Instruction {OpCode::NEGATE, 0, 0.}, 0);
+    } else if (code_.back().code == OpCode::PUSH_LITERAL) {
+        code_.back().value = -code_.back().value;
+    } else {
+        code_.pop_back();
+    }
 }
 
-std::string Node::BuildExpression() const {
+void Program::EmitBinaryOp(BinaryOperator op) {
+
+    OpCode code;
+
+    switch (op) {
+        case BinaryOperator::ADD: code = OpCode::ADD; break;
+        case BinaryOperator::SUB: code = OpCode::SUB; break;
+        case BinaryOperator::MUL: code = OpCode::MUL; break;
+        default:                  code = OpCode::DIV; break;
+    }
+
+    // a non-finite result stays an operation, the evaluation turns it into an error
+    if (EndsWithLiterals(2)) {
+
+        double result = Calculate(code, code_[code_.size() - 2].value, code_.back().value);
+
+        if (std::isfinite(result)) {
+            code_.pop_back();
+            code_.back().value = result;
+            stack_depth_--;
+            return;
+        }
+    }
+
+    Push(Instruction {code, 0, 0.}, -1);
+}
+
+void Program::ShareCommonSubexpressions(size_t cell_slot_count, size_t range_slot_count, size_t external_slot_count) {
+
+    size_t cell_count = 0;
+    size_t range_count = 0;
+    size_t external_count = 0;
+
+    for (const Instruction& instruction: code_) {
+        if (instruction.code == OpCode::PUSH_CELL) cell_count++;
+        if (instruction.code == OpCode::PUSH_EXTERNAL) external_count++;
+        if (instruction.code == OpCode::CALL) {
+            range_count += calls_[instruction.slot].range_slots.size();
+            external_count += calls_[instruction.slot].external_slots.size();
+        }
+    }
+
+    // operations on literals are folded, so a repeated subexpression repeats a cell or a range
+    if (cell_count == cell_slot_count && range_count == range_slot_count && external_count == external_slot_count) return;
+
+    constexpr uint32_t NO_TEMP = UINT32_MAX;
+
+    struct ValueNode {
+        Instruction instruction;
+        size_t first_operand;
+        size_t operand_count;
+        uint32_t uses;
+        uint32_t temp;
+    };
+
+    std::vector<ValueNode> nodes;
+    std::vector<uint32_t> operands;
+    std::vector<uint32_t> stack;
+    std::unordered_map<std::string, uint32_t> numbers;
+    std::string key;
+
+    // value numbering: equal instructions applied to equal operands become one node
+    for (const Instruction& instruction: code_) {
+
+        size_t operand_count;
+
+        switch (instruction.code) {
+            case OpCode::PUSH_LITERAL:
+            case OpCode::PUSH_CELL:
+            case OpCode::PUSH_EXTERNAL: operand_count = 0; break;
+            case OpCode::NEGATE:    operand_count = 1; break;
+            case OpCode::CALL:      operand_count = calls_[instruction.slot].value_count; break;
+            default:                operand_count = 2; break;
+        }
+
+        key.clear();
+        AppendBytes(key, instruction.code);
+
+        // calls are equal by their function and ranges, not by their index
+        if (instruction.code == OpCode::CALL) {
+            const Call& call = calls_[instruction.slot];
+            AppendBytes(key, call.function);
+            AppendBytes(key, call.range_slots.size());
+            for (uint32_t range_slot: call.range_slots) AppendBytes(key, range_slot);
+            AppendBytes(key, call.external_slots.size());
+            for (uint32_t external_slot: call.external_slots) AppendBytes(key, external_slot);
+        } else {
+            AppendBytes(key, instruction.slot);
+            AppendBytes(key, instruction.value);
+        }
+
+        for (size_t i = stack.size() - operand_count; i < stack.size(); ++i) {
+            AppendBytes(key, stack[i]);
+        }
+
+        auto [it, inserted] = numbers.emplace(key, static_cast<uint32_t>(nodes.size()));
+
+        if (inserted) {
+
+            for (size_t i = stack.size() - operand_count; i < stack.size(); ++i) {
+                nodes[stack[i]].uses++;
+            }
+
+            nodes.push_back(ValueNode {instruction, operands.size(), operand_count, 0, NO_TEMP});
+            operands.insert(operands.end(), stack.end() - operand_count, stack.end());
+        }
+
+        stack.resize(stack.size() - operand_count);
+        stack.push_back(it->second);
+    }
+
+    uint32_t temp_count = 0;
+
+    for (ValueNode& node: nodes) {
+        if (node.uses > 1 && node.instruction.code != OpCode::PUSH_LITERAL) node.temp = temp_count++;
+    }
+
+    if (temp_count == 0) return;
+
+    // the nodes are emitted again in the original operand order, later uses of a shared node load its value
+    struct Frame {
+        uint32_t node;
+        size_t next;
+    };
+
+    std::vector<bool> stored(temp_count, false);
+    std::vector<Frame> frames {Frame {stack.back(), 0}};
+
+    code_.clear();
+    stack_depth_ = 0;
+    max_stack_depth_ = 0;
+
+    while (!frames.empty()) {
+
+        Frame& frame = frames.back();
+        const ValueNode& node = nodes[frame.node];
+
+        if (frame.next == 0 && node.temp != NO_TEMP && stored[node.temp]) {
+            Push(Instruction {OpCode::LOAD_TEMP, node.temp, 0.}, 1);
+            frames.pop_back();
+            continue;
+        }
+
+        if (frame.next < node.operand_count) {
+            uint32_t operand = operands[node.first_operand + frame.next++];
+            frames.push_back(Frame {operand, 0});
+            continue;
+        }
+
+        Push(node.instruction, 1 - static_cast<int>(node.operand_count));
+
+        if (node.temp != NO_TEMP) {
+            Push(Instruction {OpCode::STORE_TEMP, node.temp, 0.}, 0);
+            stored[node.temp] = true;
+        }
+
+        frames.pop_back();
+    }
+
+    temp_count_ = temp_count;
+}
+
+IFormula::Value Program::Execute(
+    const ISheet& sheet,
+    const std::vector<CellParamPtr>& slots,
+    const std::vector<RangeParamPtr>& range_slots,
+    const std::vector<ExternalParamPtr>& external_slots,
+    Position origin
+) const {
+
+    double inline_stack[INLINE_STACK_SIZE];
+    std::vector<double> heap_stack;
+
+    double* stack = inline_stack;
+
+    if (max_stack_depth_ > INLINE_STACK_SIZE) {
+        heap_stack.resize(max_stack_depth_);
+        stack = heap_stack.data();
+    }
+
+    double inline_temps[INLINE_TEMP_COUNT];
+    std::vector<double> heap_temps;
+
+    double* temps = inline_temps;
+
+    if (temp_count_ > INLINE_TEMP_COUNT) {
+        heap_temps.resize(temp_count_);
+        temps = heap_temps.data();
+    }
+
+    size_t top = 0;
+
+    // operands are evaluated in the same order as in the tree, so the first error met is the
+    // same one Node::Evaluate would return
+    for (const Instruction& instruction: code_) {
+
+        switch (instruction.code) {
+
+            case OpCode::PUSH_LITERAL:
+                stack[top++] = instruction.value;
+                break;
+
+            case OpCode::PUSH_CELL: {
+
+                IFormula::Value value = EvaluateCell(sheet, *slots[instruction.slot], origin);
+
+                if (std::holds_alternative<FormulaError>(value)) return value;
+
+                stack[top++] = std::get<double>(value);
+                break;
+            }
+
+            case OpCode::PUSH_EXTERNAL: {
+
+                IFormula::Value value = EvaluateExternalCell(sheet, *external_slots[instruction.slot]);
+
+                if (std::holds_alternative<FormulaError>(value)) return value;
+
+                stack[top++] = std::get<double>(value);
+                break;
+            }
+
+            case OpCode::CALL: {
+
+                const Call& call = calls_[instruction.slot];
+
+                Aggregator aggregator(call.function);
+
+                top -= call.value_count;
+
+                for (size_t i = 0; i < call.value_count; ++i) {
+                    aggregator.Add(stack[top + i]);
+                }
+
+                for (uint32_t range_slot: call.range_slots) {
+                    aggregator.AddRange(sheet, *range_slots[range_slot], origin);
+                }
+
+                for (uint32_t external_slot: call.external_slots) {
+                    aggregator.AddExternalRange(sheet, *external_slots[external_slot]);
+                }
+
+                IFormula::Value value = aggregator.GetResult();
+
+                if (std::holds_alternative<FormulaError>(value)) return value;
+
+                stack[top++] = std::get<double>(value);
+                break;
+            }
+
+            case OpCode::NEGATE:
+                stack[top - 1] = -stack[top - 1];
+                break;
+
+            case OpCode::STORE_TEMP:
+                temps[instruction.slot] = stack[top - 1];
+                break;
+
+            case OpCode::LOAD_TEMP:
+                stack[top++] = temps[instruction.slot];
+                break;
+
+            default: {
+
+                double rhs_value = stack[--top];
+                double& lhs_value = stack[top - 1];
+
+                lhs_value = Calculate(instruction.code, lhs_value, rhs_value);
+
+                if (!std::isfinite(lhs_value)) return FormulaError(FormulaError::Category::Div0);
+            }
+        }
+    }
+
+    // an overflowing literal is the only operand no operation checked
+    if (!std::isfinite(stack[0])) return FormulaError(FormulaError::Category::Div0);
+
+    return stack[0];
+}
+
+std::string Node::BuildExpression(Position origin) const {
+    std::string expression;
+    AppendExpression(expression, origin);
+    return expression;
+}
+
+void Node::AppendExpression(std::string& expression, Position origin) const {
     if (IsLiteral()) {
-        return AsLiteral().value;
+        expression += AsLiteral().value;
     } else if (IsCell()) {
         const CellParam& param = AsCell();
-        return param != std::nullopt ? param->ToString() : "#REF!";
+        if (param != std::nullopt) {
+            char buffer[Position::kMaxStringLength];
+            expression.append(buffer, Shift(*param, origin).ToString(buffer));
+        } else {
+            expression += "#REF!";
+        }
+    } else if (IsExternal()) {
+        const ExternalParam& param = AsExternal();
+        if (param.range) {
+            char buffer[Position::kMaxStringLength];
+            expression += param.sheet;
+            expression += '!';
+            expression.append(buffer, param.range->first.ToString(buffer));
+            if (!param.is_cell) {
+                expression += ':';
+                expression.append(buffer, param.range->last.ToString(buffer));
+            }
+        } else {
+            expression += "#REF!";
+        }
     } else if (IsParentheses()) {
-        return '(' + AsParentheses().GetContent().BuildExpression() + ')';
+        expression += '(';
+        AsParentheses().GetContent().AppendExpression(expression, origin);
+        expression += ')';
     } else if (IsUnaryOp()) {
         const auto& unary_op = AsUnaryOp();
-        return ToString(unary_op.GetOp()) + unary_op.GetToken().BuildExpression();
+        expression += ToString(unary_op.GetOp());
+        unary_op.GetToken().AppendExpression(expression, origin);
     } else if (IsBinaryOp()) {
         const auto& binary_op = AsBinaryOp();
-        return binary_op.GetLhs().BuildExpression() + ToString(binary_op.GetOp()) +
-               binary_op.GetRhs().BuildExpression();
+        binary_op.GetLhs().AppendExpression(expression, origin);
+        expression += ToString(binary_op.GetOp());
+        binary_op.GetRhs().AppendExpression(expression, origin);
+    } else if (IsRange()) {
+        const RangeParam& param = AsRange();
+        if (param != std::nullopt) {
+            char buffer[Position::kMaxStringLength];
+            expression.append(buffer, Shift(param->first, origin).ToString(buffer));
+            expression += ':';
+            expression.append(buffer, Shift(param->last, origin).ToString(buffer));
+        } else {
+            expression += "#REF!";
+        }
+    } else if (IsFunctionCall()) {
+        const auto& call = AsFunctionCall();
+        expression += ToString(call.GetFunction());
+        expression += '(';
+        for (size_t i = 0; i < call.GetArgs().size(); ++i) {
+            if (i > 0) expression += ',';
+            call.GetArgs()[i].AppendExpression(expression, origin);
+        }
+        expression += ')';
     }
 }
 
@@ -263,14 +866,28 @@ Ast::Node Node::SimplifyBinaryParentheses(BinaryOperator parent_op, Ast::Node ch
     return parentheses.Extract();
 }
 
-TreeBuilder& TreeBuilder::AddLiteral(std::string literal) {
-    node_stack_.push(Ast::Node::OfLiteral(std::move(literal)));
+TreeBuilder& TreeBuilder::AddLiteral(std::string_view literal) {
+    node_stack_.push(Ast::Node::OfLiteral(std::string(literal)));
+    program_.EmitLiteral(node_stack_.top().AsLiteral().AsDouble());
     return *this;
 }
 
-TreeBuilder& TreeBuilder::AddCell(const std::string& cell_name) {
-    const CellParamPtr& cell_param = cell_cache_.GetOrInsert(Position::FromString(cell_name));
-    node_stack_.push(Ast::Node::OfCellParamPtr(cell_param));
+TreeBuilder& TreeBuilder::AddCell(std::string_view cell_name) {
+
+    Position pos = Position::FromString(cell_name);
+
+    if (!pos.IsValid()) throw FormulaException("invalid position");
+
+    uint32_t slot = cell_cache_.GetOrInsert(*arena_, Position {pos.row - origin_.row, pos.col - origin_.col});
+    node_stack_.push(Ast::Node::OfCellParamPtr(cell_cache_.GetSlot(slot)));
+    program_.EmitCell(slot);
+    return *this;
+}
+
+TreeBuilder& TreeBuilder::AddDeletedCell() {
+    uint32_t slot = cell_cache_.InsertDeleted(*arena_);
+    node_stack_.push(Ast::Node::OfCellParamPtr(cell_cache_.GetSlot(slot)));
+    program_.EmitCell(slot);
     return *this;
 }
 
@@ -279,7 +896,7 @@ TreeBuilder& TreeBuilder::AddParentheses() {
     Ast::Node content = std::move(node_stack_.top());
     node_stack_.pop();
 
-    node_stack_.push(Ast::Node::OfParentheses(std::move(content)));
+    node_stack_.push(Ast::Node::OfParentheses(*arena_, std::move(content)));
 
     return *this;
 }
@@ -289,7 +906,8 @@ TreeBuilder& TreeBuilder::AddUnaryOp(UnaryOperator op) {
     Ast::Node content = std::move(node_stack_.top());
     node_stack_.pop();
 
-    node_stack_.push(Ast::Node::Unary(std::move(content), op));
+    node_stack_.push(Ast::Node::Unary(*arena_, std::move(content), op));
+    program_.EmitUnaryOp(op);
 
     return *this;
 }
@@ -302,7 +920,93 @@ TreeBuilder& TreeBuilder::AddBinaryOp(BinaryOperator op) {
     Ast::Node lhs = std::move(node_stack_.top());
     node_stack_.pop();
 
-    node_stack_.push(Ast::Node::Binary(std::move(lhs), std::move(rhs), op));
+    node_stack_.push(Ast::Node::Binary(*arena_, std::move(lhs), std::move(rhs), op));
+    program_.EmitBinaryOp(op);
+
+    return *this;
+}
+
+TreeBuilder& TreeBuilder::AddRange(std::string_view first_cell, std::string_view last_cell) {
+
+    Position first = Position::FromString(first_cell);
+    Position last = Position::FromString(last_cell);
+
+    if (!first.IsValid() || !last.IsValid()) throw FormulaException("invalid position");
+
+    Range range {
+        Position {std::min(first.row, last.row) - origin_.row, std::min(first.col, last.col) - origin_.col},
+        Position {std::max(first.row, last.row) - origin_.row, std::max(first.col, last.col) - origin_.col}
+    };
+
+    uint32_t slot = cell_cache_.GetOrInsertRange(*arena_, range);
+    node_stack_.push(Ast::Node::OfRangeParamPtr(cell_cache_.GetRangeSlot(slot)));
+    range_slot_stack_.push_back(slot);
+
+    return *this;
+}
+
+TreeBuilder& TreeBuilder::AddFunction(Function function, size_t arg_count) {
+
+    std::vector<Ast::Node> args(arg_count);
+
+    for (size_t i = arg_count; i > 0; --i) {
+        args[i - 1] = std::move(node_stack_.top());
+        node_stack_.pop();
+    }
+
+    // ranges are only function arguments, so the last ones on the stack belong to this call
+    size_t range_count = std::count_if(args.begin(), args.end(), [](const Ast::Node& arg) {
+        return arg.IsRange();
+    });
+
+    size_t external_count = std::count_if(args.begin(), args.end(), [](const Ast::Node& arg) {
+        return arg.IsExternalRange();
+    });
+
+    std::vector<uint32_t> range_slots(range_slot_stack_.end() - range_count, range_slot_stack_.end());
+    range_slot_stack_.resize(range_slot_stack_.size() - range_count);
+
+    std::vector<uint32_t> external_slots(external_slot_stack_.end() - external_count, external_slot_stack_.end());
+    external_slot_stack_.resize(external_slot_stack_.size() - external_count);
+
+    program_.EmitCall(
+        function,
+        static_cast<uint32_t>(arg_count - range_count - external_count),
+        std::move(range_slots),
+        std::move(external_slots)
+    );
+    node_stack_.push(Ast::Node::OfFunctionCall(*arena_, function, std::move(args)));
+
+    return *this;
+}
+
+TreeBuilder& TreeBuilder::AddExternalCell(std::string_view sheet, std::string_view cell_name) {
+
+    Position pos = Position::FromString(cell_name);
+
+    if (!pos.IsValid()) throw FormulaException("invalid position");
+
+    uint32_t slot = cell_cache_.GetOrInsertExternal(*arena_, sheet, Range {pos, pos}, true);
+    node_stack_.push(Ast::Node::OfExternalParamPtr(cell_cache_.GetExternalSlot(slot)));
+    program_.EmitExternalCell(slot);
+    return *this;
+}
+
+TreeBuilder& TreeBuilder::AddExternalRange(std::string_view sheet, std::string_view first_cell, std::string_view last_cell) {
+
+    Position first = Position::FromString(first_cell);
+    Position last = Position::FromString(last_cell);
+
+    if (!first.IsValid() || !last.IsValid()) throw FormulaException("invalid position");
+
+    Range range {
+        Position {std::min(first.row, last.row), std::min(first.col, last.col)},
+        Position {std::max(first.row, last.row), std::max(first.col, last.col)}
+    };
+
+    uint32_t slot = cell_cache_.GetOrInsertExternal(*arena_, sheet, range, false);
+    node_stack_.push(Ast::Node::OfExternalParamPtr(cell_cache_.GetExternalSlot(slot)));
+    external_slot_stack_.push_back(slot);
 
     return *this;
 }
@@ -312,24 +1016,163 @@ Ast::Tree TreeBuilder::Build() {
     Ast::Node root = std::move(node_stack_.top());
     node_stack_.pop();
 
-    return Ast::Tree(std::move(root), std::move(cell_cache_));
+    program_.ShareCommonSubexpressions(
+        cell_cache_.GetSlots().size(),
+        cell_cache_.GetRangeSlots().size(),
+        cell_cache_.GetExternalSlots().size()
+    );
+
+    return Ast::Tree(std::move(arena_), std::move(root), std::move(cell_cache_), std::move(program_));
 }
 
-const CellParamPtr& CellParamCache::GetOrInsert(Position position) {
+uint32_t CellParamCache::GetOrInsert(Arena& arena, Position position) {
 
-    std::map<int, CellParamPtr>& row = cell_params_[position.row];
+    std::map<int, uint32_t>& row = cell_params_[position.row];
 
     if (auto col_it = row.find(position.col); col_it != row.end()) {
         return col_it->second;
     } else {
-        auto inserted = row.emplace(position.col, std::make_shared<std::optional<Position>>(position));
-        return inserted.first->second;
+        auto slot = static_cast<uint32_t>(slots_.size());
+        slots_.push_back(arena.New<CellParam>(position));
+        row.emplace(position.col, slot);
+        return slot;
+    }
+}
+
+uint32_t CellParamCache::InsertDeleted(Arena& arena) {
+    slots_.push_back(arena.New<CellParam>(std::nullopt));
+    return static_cast<uint32_t>(slots_.size() - 1);
+}
+
+uint32_t CellParamCache::GetOrInsertRange(Arena& arena, Range range) {
+
+    // formulas have few ranges, a linear search beats a map here
+    for (uint32_t slot = 0; slot < range_slots_.size(); ++slot) {
+        if (*range_slots_[slot] == range) return slot;
+    }
+
+    range_slots_.push_back(arena.New<RangeParam>(range));
+
+    return static_cast<uint32_t>(range_slots_.size() - 1);
+}
+
+uint32_t CellParamCache::GetOrInsertExternal(Arena& arena, std::string_view sheet, Range range, bool is_cell) {
+
+    for (uint32_t slot = 0; slot < external_slots_.size(); ++slot) {
+        const ExternalParam& param = *external_slots_[slot];
+        if (param.sheet == sheet && param.range == range && param.is_cell == is_cell) return slot;
+    }
+
+    auto* name = static_cast<char*>(arena.Allocate(sheet.size(), alignof(char)));
+    std::memcpy(name, sheet.data(), sheet.size());
+
+    external_slots_.push_back(arena.New<ExternalParam>(ExternalParam {std::string_view(name, sheet.size()), range, is_cell}));
+
+    return static_cast<uint32_t>(external_slots_.size() - 1);
+}
+
+size_t CellParamCache::InsertIntoRanges(int Position::* coordinate, int before, int count) {
+
+    size_t updated_ranges_count = 0;
+
+    for (RangeParamPtr param: range_slots_) {
+        if (*param != std::nullopt && InsertIntoSpan((*param)->first.*coordinate, (*param)->last.*coordinate, before, count)) {
+            updated_ranges_count++;
+        }
+    }
+
+    return updated_ranges_count;
+}
+
+std::pair<size_t, size_t> CellParamCache::DeleteFromRanges(int Position::* coordinate, int start, int count) {
+
+    // a shrunk range covers other cells than before, so it counts as a changed reference
+    size_t changed_ranges_count = 0;
+    size_t updated_ranges_count = 0;
+
+    for (RangeParamPtr param: range_slots_) {
+
+        if (*param == std::nullopt) continue;
+
+        switch (DeleteFromSpan((*param)->first.*coordinate, (*param)->last.*coordinate, start, count)) {
+
+            case SpanDeletion::NONE:
+                break;
+
+            case SpanDeletion::SHIFTED:
+                updated_ranges_count++;
+                break;
+
+            case SpanDeletion::SHRUNK:
+                changed_ranges_count++;
+                break;
+
+            case SpanDeletion::DELETED:
+                param->reset();
+                changed_ranges_count++;
+                break;
+        }
+    }
+
+    return std::make_pair(changed_ranges_count, updated_ranges_count);
+}
+
+size_t CellParamCache::InsertIntoExternal(std::string_view sheet, int Position::* coordinate, int before, int count) {
+
+    size_t updated_count = 0;
+
+    for (ExternalParamPtr param: external_slots_) {
+        if (param->sheet == sheet && param->range != std::nullopt
+            && InsertIntoSpan(param->range->first.*coordinate, param->range->last.*coordinate, before, count)) {
+            updated_count++;
+        }
+    }
+
+    return updated_count;
+}
+
+std::pair<size_t, size_t> CellParamCache::DeleteFromExternal(
+    std::string_view sheet,
+    int Position::* coordinate,
+    int start,
+    int count
+) {
+
+    size_t changed_count = 0;
+    size_t updated_count = 0;
+
+    for (ExternalParamPtr param: external_slots_) {
+
+        if (param->sheet != sheet || param->range == std::nullopt) continue;
+
+        switch (DeleteFromSpan(param->range->first.*coordinate, param->range->last.*coordinate, start, count)) {
+
+            case SpanDeletion::NONE:
+                break;
+
+            case SpanDeletion::SHIFTED:
+                updated_count++;
+                break;
+
+            case SpanDeletion::SHRUNK:
+                changed_count++;
+                break;
+
+            case SpanDeletion::DELETED:
+                param->range.reset();
+                changed_count++;
+                break;
+        }
     }
+
+    return std::make_pair(changed_count, updated_count);
 }
 
 size_t CellParamCache::HandleInsertedRows(int before, int count) {
 
-    if (cell_params_.empty()) return 0;
+    size_t updated_ranges_count = InsertIntoRanges(&Position::row, before, count);
+
+    if (cell_params_.empty()) return updated_ranges_count;
 
     std::vector<int> keys_to_update;
 
@@ -343,9 +1186,9 @@ size_t CellParamCache::HandleInsertedRows(int before, int count) {
 
         int updated_row = key + count;
 
-        for (auto&[_, ptr]: cell_params_.at(key)) {
+        for (auto&[_, slot]: cell_params_.at(key)) {
 
-            CellParam& cell_param = *ptr;
+            CellParam& cell_param = *slots_[slot];
 
             if (cell_param != std::nullopt) {
                 cell_param->row = updated_row;
@@ -358,12 +1201,12 @@ size_t CellParamCache::HandleInsertedRows(int before, int count) {
         cell_params_.insert(std::move(entry));
     }
 
-    return updated_cell_params_count;
+    return updated_cell_params_count + updated_ranges_count;
 }
 
 size_t CellParamCache::HandleInsertedCols(int before, int count) {
 
-    size_t updated_cell_params_count = 0;
+    size_t updated_cell_params_count = InsertIntoRanges(&Position::col, before, count);
 
     std::vector<int> keys_to_update;
 
@@ -375,7 +1218,7 @@ size_t CellParamCache::HandleInsertedCols(int before, int count) {
 
         for (int key: keys_to_update) {
 
-            CellParam& param = *row.at(key);
+            CellParam& param = *slots_[row.at(key)];
 
             if (param != std::nullopt) {
                 param->col = key + count;
@@ -395,8 +1238,7 @@ size_t CellParamCache::HandleInsertedCols(int before, int count) {
 
 std::pair<size_t, size_t> CellParamCache::HandleDeletedRows(int start, int count) {
 
-    size_t deleted_cell_params_count = 0;
-    size_t updated_cell_params_count = 0;
+    auto [deleted_cell_params_count, updated_cell_params_count] = DeleteFromRanges(&Position::row, start, count);
 
     std::vector<int> keys_to_delete;
     std::vector<int> keys_to_update;
@@ -412,21 +1254,23 @@ std::pair<size_t, size_t> CellParamCache::HandleDeletedRows(int start, int count
     }
 
     for (int key: keys_to_delete) {
-        for (auto& [_, ptr]: cell_params_.at(key)) {
-            ptr->reset();
+        for (auto& [_, slot]: cell_params_.at(key)) {
+            slots_[slot]->reset();
             deleted_cell_params_count++;
         }
 
         cell_params_.erase(key);
     }
 
-    for (int key: keys_to_update) {
+    // shifted from the lowest row, so a moved row never lands on the key of one not moved yet
+    for (auto key_it = keys_to_update.rbegin(); key_it != keys_to_update.rend(); key_it++) {
 
+        int key = *key_it;
         int updated_row = key - count;
 
-        for (auto&[_, ptr]: cell_params_.at(key)) {
+        for (auto&[_, slot]: cell_params_.at(key)) {
 
-            CellParam& cell_param = *ptr;
+            CellParam& cell_param = *slots_[slot];
 
             if (cell_param != std::nullopt) {
                 cell_param->row = updated_row;
@@ -444,14 +1288,14 @@ std::pair<size_t, size_t> CellParamCache::HandleDeletedRows(int start, int count
 
 std::pair<size_t, size_t> CellParamCache::HandleDeletedCols(int start, int count) {
 
-    size_t deleted_cell_params_count = 0;
-    size_t updated_cell_params_count = 0;
+    auto [deleted_cell_params_count, updated_cell_params_count] = DeleteFromRanges(&Position::col, start, count);
 
     std::vector<int> keys_to_delete;
     std::vector<int> keys_to_update;
 
-    for (auto&[_, row]: cell_params_) {
+    for (auto row_it = cell_params_.begin(); row_it != cell_params_.end();) {
 
+        auto& row = row_it->second;
         auto it = row.rbegin();
 
         for (; it != row.rend() && it->first >= start + count; it++) {
@@ -463,7 +1307,7 @@ std::pair<size_t, size_t> CellParamCache::HandleDeletedCols(int start, int count
         }
 
         for (int key: keys_to_delete) {
-            CellParam& param = *row.at(key);
+            CellParam& param = *slots_[row.at(key)];
 
             if (param != std::nullopt) {
                 param.reset();
@@ -473,9 +1317,11 @@ std::pair<size_t, size_t> CellParamCache::HandleDeletedCols(int start, int count
             row.erase(key);
         }
 
-        for (int key: keys_to_update) {
+        for (auto key_it = keys_to_update.rbegin(); key_it != keys_to_update.rend(); key_it++) {
+
+            int key = *key_it;
 
-            CellParam& param = *row.at(key);
+            CellParam& param = *slots_[row.at(key)];
 
             if (param != std::nullopt) {
                 param->col = key - count;
@@ -489,22 +1335,75 @@ std::pair<size_t, size_t> CellParamCache::HandleDeletedCols(int start, int count
 
         keys_to_delete.clear();
         keys_to_update.clear();
+
+        // an empty row would block the key of a row shifted onto it by a later deletion of rows
+        row_it = row.empty() ? cell_params_.erase(row_it) : std::next(row_it);
     }
 
     return std::make_pair(deleted_cell_params_count, updated_cell_params_count);
 }
 
-std::vector<Position> CellParamCache::GetReferencedCells() const {
+std::vector<Position> CellParamCache::GetReferencedCells(Position origin) const {
 
     std::vector<Position> result;
 
+    // shifting keeps the order
     for (const auto&[row_index, row]: cell_params_) {
         for (const auto&[col_index, _]: row) {
-            result.push_back(Position {row_index, col_index});
+            result.push_back(Position {row_index + origin.row, col_index + origin.col});
         }
     }
 
     return result;
 }
 
+std::vector<Range> CellParamCache::GetReferencedRanges(Position origin) const {
+
+    std::vector<Range> result;
+
+    for (RangeParamPtr param: range_slots_) {
+        if (*param != std::nullopt) result.push_back(Shift(**param, origin));
+    }
+
+    // structural edits may make two ranges of the formula the same
+    std::sort(result.begin(), result.end());
+    result.erase(std::unique(result.begin(), result.end()), result.end());
+
+    return result;
+}
+
+std::vector<ExternalReference> CellParamCache::GetExternalReferences() const {
+
+    std::vector<ExternalReference> result;
+
+    for (ExternalParamPtr param: external_slots_) {
+        if (param->range) result.push_back(ExternalReference {std::string(param->sheet), *param->range});
+    }
+
+    // a cell and the range of the same cell are one reference
+    std::sort(result.begin(), result.end());
+    result.erase(std::unique(result.begin(), result.end()), result.end());
+
+    return result;
+}
+
+std::optional<int> CellParamCache::GetMinReferenced(int Position::* coordinate) const {
+
+    std::optional<int> result;
+
+    auto update = [&result](int value) {
+        if (result == std::nullopt || value < *result) result = value;
+    };
+
+    for (CellParamPtr param: slots_) {
+        if (*param != std::nullopt) update((**param).*coordinate);
+    }
+
+    for (RangeParamPtr param: range_slots_) {
+        if (*param != std::nullopt) update((*param)->first.*coordinate);
+    }
+
+    return result;
+}
+
 }
\ No newline at end of file
@@ -1,15 +1,20 @@
 #pragma once
 
+#include "arena.h"
 #include "formula.h"
 
 #include <cmath>
+#include <cstdint>
 #include <string>
+#include <string_view>
 #include <variant>
 #include <memory>
+#include <optional>
 #include <unordered_map>
 #include <map>
 #include <stack>
 #include <set>
+#include <vector>
 
 namespace Ast {
 
@@ -27,31 +32,63 @@ enum BinaryOperator {
     DIV
 };
 
+enum class Function {
+    SUM,
+    AVERAGE,
+    MIN,
+    MAX
+};
+
+std::string_view ToString(Function function);
+
+std::optional<Function> FunctionFromString(std::string_view name);
+
 using CellParam = std::optional<Position>;
-using CellParamPtr = std::shared_ptr<CellParam>;
+// cell params live in the arena of their formula, nodes and slots share them by pointer,
+// so renaming a cell param through a slot is seen by the node as well
+using CellParamPtr = CellParam*;
+
+// a range is a single dependency of the formula however many cells it covers
+using RangeParam = std::optional<Range>;
+using RangeParamPtr = RangeParam*;
+
+// a cell or a range of another sheet of the workbook. It is absolute: the structural edits of the sheet
+// of the formula don't move it, the ones of the sheet it reads do. The name is placed in the arena of the
+// formula as well
+struct ExternalParam {
+    std::string_view sheet;
+    // nullopt once the cells are deleted from the sheet
+    std::optional<Range> range;
+    bool is_cell;
+};
+using ExternalParamPtr = ExternalParam*;
 
 char ToString(BinaryOperator op);
 
 struct Literal {
     std::string value;
+    double number;
 
     double AsDouble() const {
-        return std::stod(value);
+        return number;
     }
 };
 
 class Parentheses;
-using ParenthesesPtr = std::unique_ptr<Parentheses>;
+using ParenthesesPtr = ArenaPtr<Parentheses>;
 
 class UnaryOp;
-using UnaryOpPtr = std::unique_ptr<UnaryOp>;
+using UnaryOpPtr = ArenaPtr<UnaryOp>;
 
 class BinaryOp;
-using BinaryOpPtr = std::unique_ptr<BinaryOp>;
+using BinaryOpPtr = ArenaPtr<BinaryOp>;
+
+class FunctionCall;
+using FunctionCallPtr = ArenaPtr<FunctionCall>;
 
 class Node;
 
-class Node : std::variant<Literal, CellParamPtr, ParenthesesPtr, UnaryOpPtr, BinaryOpPtr> {
+class Node : std::variant<Literal, CellParamPtr, ParenthesesPtr, UnaryOpPtr, BinaryOpPtr, RangeParamPtr, FunctionCallPtr, ExternalParamPtr> {
 
 private:
 
@@ -101,6 +138,23 @@ public:
         return std::holds_alternative<BinaryOpPtr>(*this);
     }
 
+    bool IsRange() const {
+        return std::holds_alternative<RangeParamPtr>(*this);
+    }
+
+    bool IsFunctionCall() const {
+        return std::holds_alternative<FunctionCallPtr>(*this);
+    }
+
+    bool IsExternal() const {
+        return std::holds_alternative<ExternalParamPtr>(*this);
+    }
+
+    // a range of another sheet is a function argument like a range of this one
+    bool IsExternalRange() const {
+        return IsExternal() && !AsExternal().is_cell;
+    }
+
     //endregion
 
     //region node type converters
@@ -125,6 +179,16 @@ public:
 
     const BinaryOp& AsBinaryOp() const;
 
+    const RangeParam& AsRange() const {
+        return *std::get<RangeParamPtr>(*this);
+    }
+
+    const FunctionCall& AsFunctionCall() const;
+
+    const ExternalParam& AsExternal() const {
+        return *std::get<ExternalParamPtr>(*this);
+    }
+
     //endregion
 
     //region static initializers
@@ -133,29 +197,39 @@ public:
 
     static Ast::Node OfCellParamPtr(CellParamPtr id);
 
-    static Ast::Node OfParentheses(Ast::Node token);
+    static Ast::Node OfParentheses(Arena& arena, Ast::Node token);
+
+    static Ast::Node Unary(Arena& arena, Ast::Node token, UnaryOperator op);
+
+    static Ast::Node UnaryMinus(Arena& arena, Ast::Node token);
+
+    static Ast::Node UnaryPlus(Arena& arena, Ast::Node token);
 
-    static Ast::Node Unary(Ast::Node token, UnaryOperator op);
+    static Ast::Node Binary(Arena& arena, Ast::Node lhs, Ast::Node rhs, BinaryOperator op);
 
-    static Ast::Node UnaryMinus(Ast::Node token);
+    static Ast::Node BinaryAdd(Arena& arena, Ast::Node lhs, Ast::Node rhs);
 
-    static Ast::Node UnaryPlus(Ast::Node token);
+    static Ast::Node BinarySub(Arena& arena, Ast::Node lhs, Ast::Node rhs);
 
-    static Ast::Node Binary(Ast::Node lhs, Ast::Node rhs, BinaryOperator op);
+    static Ast::Node BinaryMul(Arena& arena, Ast::Node lhs, Ast::Node rhs);
 
-    static Ast::Node BinaryAdd(Ast::Node lhs, Ast::Node rhs);
+    static Ast::Node BinaryDiv(Arena& arena, Ast::Node lhs, Ast::Node rhs);
 
-    static Ast::Node BinarySub(Ast::Node lhs, Ast::Node rhs);
+    static Ast::Node OfRangeParamPtr(RangeParamPtr range);
 
-    static Ast::Node BinaryMul(Ast::Node lhs, Ast::Node rhs);
+    static Ast::Node OfFunctionCall(Arena& arena, Function function, std::vector<Ast::Node> args);
 
-    static Ast::Node BinaryDiv(Ast::Node lhs, Ast::Node rhs);
+    static Ast::Node OfExternalParamPtr(ExternalParamPtr external);
 
     //endregion
 
-    IFormula::Value Evaluate(const ISheet& sheet) const;
+    // cell params are relative to the origin, it is the top left cell for a formula with absolute references
 
-    std::string BuildExpression() const;
+    IFormula::Value Evaluate(const ISheet& sheet, Position origin) const;
+
+    std::string BuildExpression(Position origin) const;
+
+    void AppendExpression(std::string& expression, Position origin) const;
 
 };
 
@@ -221,13 +295,204 @@ public:
     }
 };
 
+class FunctionCall {
+private:
+    Function function_;
+    std::vector<Ast::Node> args_;
+
+public:
+
+    FunctionCall(Function function, std::vector<Ast::Node>&& args): function_(function), args_(std::move(args)) {}
+
+    Function GetFunction() const {
+        return function_;
+    }
+
+    const std::vector<Ast::Node>& GetArgs() const {
+        return args_;
+    }
+};
+
+inline Position Shift(Position pos, Position origin) {
+    return Position {pos.row + origin.row, pos.col + origin.col};
+}
+
+inline Range Shift(Range range, Position origin) {
+    return Range {Shift(range.first, origin), Shift(range.last, origin)};
+}
+
+// Evaluates a referenced cell as a formula operand: empty cells are zeros, text cells must hold a number
+IFormula::Value EvaluateCell(const ISheet& sheet, const CellParam& param, Position origin);
+
+// Evaluates a cell of another sheet the same way, a sheet missing from the workbook is a #REF! error
+IFormula::Value EvaluateExternalCell(const ISheet& sheet, const ExternalParam& param);
+
+// Accumulates the operands of an aggregate function. Empty cells of a range are skipped, text cells must
+// hold a number. Values are gathered into a fixed chunk that is reduced with independent accumulators,
+// so the reduction loop has no dependency between iterations and vectorizes.
+class Aggregator {
+private:
+    static constexpr size_t CHUNK_SIZE = 256;
+
+    Function function_;
+    double chunk_[CHUNK_SIZE];
+    size_t chunk_size_ = 0;
+    double result_ = 0.;
+    size_t count_ = 0;
+    std::optional<FormulaError> error_;
+
+    void Flush();
+
+    void AddCellValue(const ICell& cell);
+
+public:
+
+    explicit Aggregator(Function function): function_(function) {}
+
+    void Add(double value) {
+        chunk_[chunk_size_++] = value;
+        if (chunk_size_ == CHUNK_SIZE) Flush();
+    }
+
+    // cells are visited in row-major order and the first error met is the result
+    void AddRange(const ISheet& sheet, const RangeParam& range, Position origin);
+
+    void AddExternalRange(const ISheet& sheet, const ExternalParam& param);
+
+    IFormula::Value GetResult();
+};
+
+enum class OpCode : uint8_t {
+    PUSH_LITERAL,
+    PUSH_CELL,
+    PUSH_EXTERNAL,
+    CALL,
+    NEGATE,
+    // temporaries hold shared subexpressions: STORE_TEMP copies the top of the stack, LOAD_TEMP pushes it back
+    STORE_TEMP,
+    LOAD_TEMP,
+    ADD,
+    SUB,
+    MUL,
+    DIV
+};
+
+struct Instruction {
+    OpCode code;
+    uint32_t slot;
+    double value;
+};
+
+// Flat postfix form of a formula. Literals are stored pre-parsed, cells are referenced by
+// slot index in CellParamCache, so evaluation needs neither the tree nor string conversions.
+// A CALL takes its value arguments from the stack and scans its ranges, the ones of this sheet before the
+// ones of other sheets, its slot indexes the calls.
+// Operations on literals are folded while emitting, the tree keeps the expression as it was written.
+class Program {
+private:
+    static constexpr size_t INLINE_STACK_SIZE = 16;
+    static constexpr size_t INLINE_TEMP_COUNT = 8;
+
+    struct Call {
+        Function function;
+        uint32_t value_count;
+        std::vector<uint32_t> range_slots;
+        std::vector<uint32_t> external_slots;
+    };
+
+    std::vector<Instruction> code_;
+    std::vector<Call> calls_;
+    size_t stack_depth_ = 0;
+    size_t max_stack_depth_ = 0;
+    uint32_t temp_count_ = 0;
+
+    void Push(Instruction instruction, int stack_change);
+
+    // the last count instructions push literals, so they are the operands of the next operation
+    bool EndsWithLiterals(size_t count) const;
+
+public:
+
+    void EmitLiteral(double value);
+
+    void EmitCell(uint32_t slot);
+
+    void EmitExternalCell(uint32_t slot);
+
+    void EmitUnaryOp(UnaryOperator op);
+
+    void EmitBinaryOp(BinaryOperator op);
+
+    void EmitCall(
+        Function function,
+        uint32_t value_count,
+        std::vector<uint32_t> range_slots,
+        std::vector<uint32_t> external_slots
+    );
+
+    // computes every repeated subexpression once: its first occurrence stores the value in a temporary,
+    // the later ones load it. Operands keep their order, so the first error met stays the same.
+    // The slot counts are the distinct cells, ranges and references to other sheets of the formula
+    void ShareCommonSubexpressions(size_t cell_slot_count, size_t range_slot_count, size_t external_slot_count);
+
+    IFormula::Value Execute(
+        const ISheet& sheet,
+        const std::vector<CellParamPtr>& slots,
+        const std::vector<RangeParamPtr>& range_slots,
+        const std::vector<ExternalParamPtr>& external_slots,
+        Position origin
+    ) const;
+
+    const std::vector<Instruction>& GetCode() const {
+        return code_;
+    }
+};
+
 class CellParamCache {
 private:
-    std::map<int, std::map<int, CellParamPtr>> cell_params_;
+    std::map<int, std::map<int, uint32_t>> cell_params_;
+    std::vector<CellParamPtr> slots_;
+    std::vector<RangeParamPtr> range_slots_;
+    std::vector<ExternalParamPtr> external_slots_;
+
+    size_t InsertIntoRanges(int Position::* coordinate, int before, int count);
+
+    std::pair<size_t, size_t> DeleteFromRanges(int Position::* coordinate, int start, int count);
 
 public:
 
-    const CellParamPtr& GetOrInsert(Position position);
+    uint32_t GetOrInsert(Arena& arena, Position position);
+
+    uint32_t GetOrInsertRange(Arena& arena, Range range);
+
+    // a reference deleted before the formula was parsed, it is left out of the referenced cells
+    uint32_t InsertDeleted(Arena& arena);
+
+    uint32_t GetOrInsertExternal(Arena& arena, std::string_view sheet, Range range, bool is_cell);
+
+    const CellParamPtr& GetSlot(uint32_t slot) const {
+        return slots_[slot];
+    }
+
+    const std::vector<CellParamPtr>& GetSlots() const {
+        return slots_;
+    }
+
+    const RangeParamPtr& GetRangeSlot(uint32_t slot) const {
+        return range_slots_[slot];
+    }
+
+    const std::vector<RangeParamPtr>& GetRangeSlots() const {
+        return range_slots_;
+    }
+
+    const ExternalParamPtr& GetExternalSlot(uint32_t slot) const {
+        return external_slots_[slot];
+    }
+
+    const std::vector<ExternalParamPtr>& GetExternalSlots() const {
+        return external_slots_;
+    }
 
     size_t HandleInsertedRows(int before, int count);
 
@@ -237,31 +502,104 @@ public:
 
     std::pair<size_t, size_t> HandleDeletedCols(int start, int count);
 
-    std::vector<Position> GetReferencedCells() const;
+    // a structural edit of the named sheet moves the references to it like the ones of the sheet of the formula
+    size_t InsertIntoExternal(std::string_view sheet, int Position::* coordinate, int before, int count);
+
+    std::pair<size_t, size_t> DeleteFromExternal(std::string_view sheet, int Position::* coordinate, int start, int count);
+
+    // the deleted references to other sheets count as deleted ranges, they are written as #REF! as well
+    bool HasDeletedRanges() const {
+        return std::any_of(range_slots_.begin(), range_slots_.end(), [](RangeParamPtr param) {
+            return *param == std::nullopt;
+        }) || std::any_of(external_slots_.begin(), external_slots_.end(), [](ExternalParamPtr param) {
+            return param->range == std::nullopt;
+        });
+    }
+
+    std::vector<Position> GetReferencedCells(Position origin) const;
+
+    std::vector<Range> GetReferencedRanges(Position origin) const;
+
+    std::vector<ExternalReference> GetExternalReferences() const;
+
+    // the least row or column of the cell params and ranges, nullopt for a formula without references
+    std::optional<int> GetMinReferenced(int Position::* coordinate) const;
 };
 
+// A parsed formula. Its cell params are either absolute positions or, for a template shared by formulas
+// filled down or right, offsets from the cell the formula was written in. A template is read only:
+// the structural edits are for trees with absolute positions, which have the default origin.
 class Tree {
 private:
+    // declared first to be destroyed last, the nodes and cell params are placed in it
+    std::unique_ptr<Arena> arena_;
     Ast::Node root_;
     CellParamCache cell_cache_;
+    Program program_;
 
 public:
 
     Tree(
+        std::unique_ptr<Arena> arena,
         Ast::Node root,
-        CellParamCache cell_cache
-    ) : root_(std::move(root)), cell_cache_(std::move(cell_cache)) {}
+        CellParamCache cell_cache,
+        Program program
+    ) : arena_(std::move(arena)),
+        root_(std::move(root)),
+        cell_cache_(std::move(cell_cache)),
+        program_(std::move(program)) {}
+
+    Tree(Tree&&) = default;
+
+    // the members are moved one by one, so the old tree is moved out first to be destroyed before its arena
+    Tree& operator=(Tree&& other) noexcept {
+
+        Tree old(std::move(*this));
+
+        arena_ = std::move(other.arena_);
+        root_ = std::move(other.root_);
+        cell_cache_ = std::move(other.cell_cache_);
+        program_ = std::move(other.program_);
+
+        return *this;
+    }
+
+    IFormula::Value Evaluate(const ISheet& sheet, Position origin = Position {0, 0}) const {
+        return program_.Execute(
+            sheet,
+            cell_cache_.GetSlots(),
+            cell_cache_.GetRangeSlots(),
+            cell_cache_.GetExternalSlots(),
+            origin
+        );
+    }
+
+    // walks the tree the program was compiled from, the reference the program is checked against
+    IFormula::Value EvaluateTree(const ISheet& sheet, Position origin = Position {0, 0}) const {
+        return root_.Evaluate(sheet, origin);
+    }
+
+    std::string BuildExpression(Position origin = Position {0, 0}) const {
+        return root_.BuildExpression(origin);
+    }
+
+    std::vector<Position> GetReferencedCells(Position origin = Position {0, 0}) const {
+        return cell_cache_.GetReferencedCells(origin);
+    }
 
-    IFormula::Value Evaluate(const ISheet& sheet) const {
-        return root_.Evaluate(sheet);
+    std::vector<Range> GetReferencedRanges(Position origin = Position {0, 0}) const {
+        return cell_cache_.GetReferencedRanges(origin);
     }
 
-    std::string BuildExpression() const {
-        return root_.BuildExpression();
+    // absolute, so the same for every origin
+    std::vector<ExternalReference> GetExternalReferences() const {
+        return cell_cache_.GetExternalReferences();
     }
 
-    std::vector<Position> GetReferencedCells() const {
-        return cell_cache_.GetReferencedCells();
+    std::optional<int> GetMinReferenced(int Position::* coordinate, Position origin = Position {0, 0}) const {
+        std::optional<int> min_referenced = cell_cache_.GetMinReferenced(coordinate);
+        if (min_referenced) *min_referenced += origin.*coordinate;
+        return min_referenced;
     }
 
     size_t HandleInsertedRows(int before, int count) {
@@ -280,18 +618,52 @@ public:
         return cell_cache_.HandleDeletedCols(first, count);
     }
 
+    size_t HandleExternalInsertedRows(std::string_view sheet, int before, int count) {
+        return cell_cache_.InsertIntoExternal(sheet, &Position::row, before, count);
+    }
+
+    size_t HandleExternalInsertedCols(std::string_view sheet, int before, int count) {
+        return cell_cache_.InsertIntoExternal(sheet, &Position::col, before, count);
+    }
+
+    std::pair<size_t, size_t> HandleExternalDeletedRows(std::string_view sheet, int first, int count) {
+        return cell_cache_.DeleteFromExternal(sheet, &Position::row, first, count);
+    }
+
+    std::pair<size_t, size_t> HandleExternalDeletedCols(std::string_view sheet, int first, int count) {
+        return cell_cache_.DeleteFromExternal(sheet, &Position::col, first, count);
+    }
+
+    // a range or a reference to another sheet deleted by a structural edit, which the expression writes as #REF!
+    bool HasDeletedRanges() const {
+        return cell_cache_.HasDeletedRanges();
+    }
+
 };
 
 class TreeBuilder {
 private:
+    // references are stored relative to it
+    Position origin_;
+    std::unique_ptr<Arena> arena_ = std::make_unique<Arena>();
     std::stack<Ast::Node> node_stack_;
     CellParamCache cell_cache_;
+    Program program_;
+    // slots of the ranges which are still waiting for their function call
+    std::vector<uint32_t> range_slot_stack_;
+    std::vector<uint32_t> external_slot_stack_;
 
 public:
 
-    TreeBuilder& AddLiteral(std::string literal);
+    // with an origin the tree is a template of the formula written in that cell
+    explicit TreeBuilder(Position origin = Position {0, 0}): origin_(origin) {}
+
+    TreeBuilder& AddLiteral(std::string_view literal);
+
+    TreeBuilder& AddCell(std::string_view cell_name);
 
-    TreeBuilder& AddCell(const std::string& cell_name);
+    // #REF!, which the formula prints for a deleted reference, evaluates to the same error again
+    TreeBuilder& AddDeletedCell();
 
     TreeBuilder& AddParentheses();
 
@@ -299,6 +671,16 @@ public:
 
     TreeBuilder& AddBinaryOp(BinaryOperator op);
 
+    // the corners are normalized, so B2:A1 is the same range as A1:B2
+    TreeBuilder& AddRange(std::string_view first_cell, std::string_view last_cell);
+
+    TreeBuilder& AddFunction(Function function, size_t arg_count);
+
+    // a cell or a range of the named sheet, the references to other sheets stay absolute in a template
+    TreeBuilder& AddExternalCell(std::string_view sheet, std::string_view cell_name);
+
+    TreeBuilder& AddExternalRange(std::string_view sheet, std::string_view first_cell, std::string_view last_cell);
+
     Ast::Tree Build();
 };
 
@@ -7,10 +7,19 @@
 
 class AstFormulaListener : public FormulaListener {
 private:
-    Ast::TreeBuilder builder_;
+    Ast::TreeBuilder& builder_;
+
+    // the token text ends with the exclamation mark
+    static std::string GetSheetName(antlr4::tree::TerminalNode* sheet) {
+        std::string text = sheet->getText();
+        text.pop_back();
+        return text;
+    }
 
 public:
 
+    explicit AstFormulaListener(Ast::TreeBuilder& builder): builder_(builder) {}
+
     ~AstFormulaListener() override = default;
 
     void exitUnaryOp(FormulaParser::UnaryOpContext *ctx) override {
@@ -32,7 +41,13 @@ public:
     }
 
     void exitCell(FormulaParser::CellContext* ctx) override {
-        builder_.AddCell(ctx->getText());
+        if (ctx->REF()) {
+            builder_.AddDeletedCell();
+        } else if (ctx->SHEET()) {
+            builder_.AddExternalCell(GetSheetName(ctx->SHEET()), ctx->CELL()->getText());
+        } else {
+            builder_.AddCell(ctx->CELL()->getText());
+        }
     }
 
     void exitBinaryOp(FormulaParser::BinaryOpContext* ctx) override {
@@ -47,6 +62,18 @@ public:
         builder_.AddBinaryOp(op);
     }
 
+    void exitFunction(FormulaParser::FunctionContext* ctx) override {
+        builder_.AddFunction(*Ast::FunctionFromString(ctx->FUNCTION()->getText()), ctx->arg().size());
+    }
+
+    void exitRange(FormulaParser::RangeContext* ctx) override {
+        if (ctx->SHEET()) {
+            builder_.AddExternalRange(GetSheetName(ctx->SHEET()), ctx->CELL(0)->getText(), ctx->CELL(1)->getText());
+        } else {
+            builder_.AddRange(ctx->CELL(0)->getText(), ctx->CELL(1)->getText());
+        }
+    }
+
     void visitTerminal(antlr4::tree::TerminalNode* node) override {}
 
     void visitErrorNode(antlr4::tree::ErrorNode* node) override {}
@@ -69,8 +96,12 @@ public:
 
     void enterBinaryOp(FormulaParser::BinaryOpContext* ctx) override {}
 
-    Ast::Tree GetResult() {
-        return builder_.Build();
-    }
+    void enterFunction(FormulaParser::FunctionContext* ctx) override {}
+
+    void enterRange(FormulaParser::RangeContext* ctx) override {}
+
+    void enterArgument(FormulaParser::ArgumentContext* ctx) override {}
+
+    void exitArgument(FormulaParser::ArgumentContext* ctx) override {}
 
 };
\ No newline at end of file
@@ -0,0 +1,60 @@
+#include "background_scheduler.h"
+
+BackgroundScheduler::BackgroundScheduler() : thread_(&BackgroundScheduler::Loop, this) {}
+
+BackgroundScheduler::~BackgroundScheduler() {
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+        job_ = nullptr;
+        cancelled_ = true;
+    }
+
+    wake_.notify_all();
+    thread_.join();
+}
+
+void BackgroundScheduler::Loop() {
+
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    while (true) {
+
+        wake_.wait(lock, [this] { return stopping_ || job_ != nullptr; });
+
+        if (stopping_) return;
+
+        Job job = std::move(job_);
+        job_ = nullptr;
+        running_ = true;
+        cancelled_ = false;
+
+        lock.unlock();
+        job(cancelled_);
+        lock.lock();
+
+        running_ = false;
+        idle_.notify_all();
+    }
+}
+
+void BackgroundScheduler::Schedule(Job job) {
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        job_ = std::move(job);
+    }
+
+    wake_.notify_one();
+}
+
+void BackgroundScheduler::Cancel() {
+
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    job_ = nullptr;
+    cancelled_ = true;
+
+    idle_.wait(lock, [this] { return !running_; });
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+// A thread running the latest scheduled job. A job polls the cancel flag it is given and returns early
+// once it is set, so Cancel() waits for the current step of the job only.
+class BackgroundScheduler {
+
+public:
+
+    using Job = std::function<void(const std::atomic<bool>& cancelled)>;
+
+private:
+
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable idle_;
+
+    Job job_;
+    bool running_ = false;
+    bool stopping_ = false;
+    std::atomic<bool> cancelled_ {false};
+
+    // started last, the members above are ready when it runs
+    std::thread thread_;
+
+    void Loop();
+
+public:
+
+    BackgroundScheduler();
+
+    BackgroundScheduler(const BackgroundScheduler&) = delete;
+    BackgroundScheduler& operator=(const BackgroundScheduler&) = delete;
+
+    ~BackgroundScheduler();
+
+    // replaces a job which has not started yet
+    void Schedule(Job job);
+
+    // drops the waiting job, stops the running one and returns once the thread is idle
+    void Cancel();
+};
@@ -0,0 +1,828 @@
+// Benchmarks of the spreadsheet engine. Every workload is repeated several times on a freshly built sheet
+// and reported as one JSON object per line, so results of two builds can be compared by a script:
+//
+//   spreadsheet_bench [--repetitions N] [--scale X] [--filter SUBSTRING]
+//
+// Workload inputs come from generators with fixed seeds, so every run measures the same operations.
+
+#include "common.h"
+#include "formula.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <optional>
+#include <random>
+#include <regex>
+#include <sstream>
+#include <stack>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace {
+
+std::atomic<size_t> allocation_count {0};
+std::atomic<size_t> allocated_bytes {0};
+
+}
+
+// counting replacements of the global allocation functions, the array forms call these by default
+void* operator new(size_t size) {
+
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+
+    if (void* ptr = std::malloc(size > 0 ? size : 1)) return ptr;
+
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+    std::free(ptr);
+}
+
+namespace {
+
+#if defined(__OPTIMIZE__) || defined(NDEBUG)
+constexpr bool OPTIMIZED_BUILD = true;
+#else
+constexpr bool OPTIMIZED_BUILD = false;
+#endif
+
+struct Options {
+    size_t repetitions = 10;
+    double scale = 1.;
+    std::string filter;
+};
+
+struct Workload {
+    std::string name;
+    size_t size;
+    // builds the initial state of a repetition, not measured
+    std::function<void()> setup;
+    // the measured part, returns the number of operations it did
+    std::function<size_t()> run;
+};
+
+struct Measurement {
+    double ns_per_op;
+    double allocations_per_op;
+    double bytes_per_op;
+};
+
+// keeps the results of the measured code observable, so the compiler can't drop it
+volatile double sink = 0.;
+
+void Consume(const ICell::Value& value) {
+    if (std::holds_alternative<double>(value)) sink = sink + std::get<double>(value);
+}
+
+std::string Cell(int row, int col) {
+    return Position {row, col}.ToString();
+}
+
+Workload FanIn(size_t size) {
+
+    auto sheet = std::make_shared<std::unique_ptr<ISheet>>();
+    const int n = static_cast<int>(size);
+
+    auto setup = [sheet, n] {
+
+        *sheet = CreateSheet();
+
+        std::string expression = "=";
+
+        for (int row = 0; row < n; ++row) {
+            (*sheet)->SetCell(Position {row, 0}, std::to_string(row));
+            if (row > 0) expression += '+';
+            expression += Cell(row, 0);
+        }
+
+        (*sheet)->SetCell(Position {0, 1}, expression);
+        Consume((*sheet)->GetCell(Position {0, 1})->GetValue());
+    };
+
+    // every update of an operand invalidates the aggregate which is read back right away
+    auto run = [sheet, n] {
+        for (int row = 0; row < n; ++row) {
+            (*sheet)->SetCell(Position {row, 0}, std::to_string(row + 1));
+            Consume((*sheet)->GetCell(Position {0, 1})->GetValue());
+        }
+        return static_cast<size_t>(n);
+    };
+
+    return Workload {"fan_in", size, setup, run};
+}
+
+// the same aggregate written as a single range
+Workload FanInRange(size_t size) {
+
+    auto sheet = std::make_shared<std::unique_ptr<ISheet>>();
+    const int n = static_cast<int>(size);
+
+    auto setup = [sheet, n] {
+
+        *sheet = CreateSheet();
+
+        for (int row = 0; row < n; ++row) {
+            (*sheet)->SetCell(Position {row, 0}, std::to_string(row));
+        }
+
+        (*sheet)->SetCell(Position {0, 1}, "=SUM(" + Range {Position {0, 0}, Position {n - 1, 0}}.ToString() + ")");
+        Consume((*sheet)->GetCell(Position {0, 1})->GetValue());
+    };
+
+    auto run = [sheet, n] {
+        for (int row = 0; row < n; ++row) {
+            (*sheet)->SetCell(Position {row, 0}, std::to_string(row + 1));
+            Consume((*sheet)->GetCell(Position {0, 1})->GetValue());
+        }
+        return static_cast<size_t>(n);
+    };
+
+    return Workload {"fan_in_range", size, setup, run};
+}
+
+Workload ChainBuild(size_t size) {
+
+    auto sheet = std::make_shared<std::unique_ptr<ISheet>>();
+    const int n = static_cast<int>(size);
+
+    auto setup = [sheet] {
+        *sheet = CreateSheet();
+        (*sheet)->SetRecalculationMode(RecalculationMode::Automatic);
+        (*sheet)->SetCell(Position {0, 0}, "1");
+    };
+
+    auto run = [sheet, n] {
+        for (int row = 1; row < n; ++row) {
+            (*sheet)->SetCell(Position {row, 0}, "=" + Cell(row - 1, 0) + "+1");
+        }
+        return static_cast<size_t>(n - 1);
+    };
+
+    return Workload {"chain_build", size, setup, run};
+}
+
+Workload ChainUpdate(size_t size) {
+
+    auto sheet = std::make_shared<std::unique_ptr<ISheet>>();
+    const int n = static_cast<int>(size);
+    const int updates = 20;
+
+    auto setup = [sheet, n] {
+
+        *sheet = CreateSheet();
+        (*sheet)->SetRecalculationMode(RecalculationMode::Automatic);
+        (*sheet)->SetCell(Position {0, 0}, "1");
+
+        for (int row = 1; row < n; ++row) {
+            (*sheet)->SetCell(Position {row, 0}, "=" + Cell(row - 1, 0) + "+1");
+        }
+    };
+
+    // every update recalculates the whole chain
+    auto run = [sheet, n, updates] {
+        for (int i = 0; i < updates; ++i) {
+            (*sheet)->SetCell(Position {0, 0}, std::to_string(i));
+            Consume((*sheet)->GetCell(Position {n - 1, 0})->GetValue());
+        }
+        return static_cast<size_t>(updates);
+    };
+
+    return Workload {"chain_update", size, setup, run};
+}
+
+Workload ChainOnDemand(size_t size) {
+
+    auto sheet = std::make_shared<std::unique_ptr<ISheet>>();
+    const int n = static_cast<int>(size);
+    const int updates = 20;
+
+    auto setup = [sheet, n] {
+
+        *sheet = CreateSheet();
+        (*sheet)->SetCell(Position {0, 0}, "1");
+
+        for (int row = 1; row < n; ++row) {
+            (*sheet)->SetCell(Position {row, 0}, "=" + Cell(row - 1, 0) + "+1");
+        }
+    };
+
+    // the whole chain is calculated by reading its last cell, nothing is recalculated before
+    auto run = [sheet, n, updates] {
+        for (int i = 0; i < updates; ++i) {
+            (*sheet)->SetCell(Position {0, 0}, std::to_string(i));
+            Consume((*sheet)->GetCell(Position {n - 1, 0})->GetValue());
+        }
+        return static_cast<size_t>(updates);
+    };
+
+    return Workload {"chain_on_demand", size, setup, run};
+}
+
+// the chain is recalculated by the background thread, the readers take the published values as they are
+Workload ChainBackground(size_t size) {
+
+    auto sheet = std::make_shared<std::unique_ptr<ISheet>>();
+    const int n = static_cast<int>(size);
+    const int updates = 20;
+
+    auto setup = [sheet, n] {
+
+        *sheet = CreateSheet();
+        (*sheet)->SetCell(Position {0, 0}, "1");
+
+        for (int row = 1; row < n; ++row) {
+            (*sheet)->SetCell(Position {row, 0}, "=" + Cell(row - 1, 0) + "+1");
+        }
+
+        (*sheet)->SetViewport(Range {Position {n - 1, 0}, Position {n - 1, 0}});
+        (*sheet)->SetRecalculationMode(RecalculationMode::Background);
+    };
+
+    auto run = [sheet, n, updates] {
+        for (int i = 0; i < updates; ++i) {
+            (*sheet)->SetCell(Position {0, 0}, std::to_string(i));
+            std::optional<ICell::Value> value = (*sheet)->GetValues()->GetValue(Position {n - 1, 0});
+            if (value) Consume(*value);
+        }
+        return static_cast<size_t>(updates);
+    };
+
+    return Workload {"chain_background", size, setup, run};
+}
+
+Workload ChainRewire(size_t size) {
+
+    auto sheet = std::make_shared<std::unique_ptr<ISheet>>();
+    const int n = static_cast<int>(size);
+    const int updates = 1'000;
+
+    auto setup = [sheet, n] {
+
+        *sheet = CreateSheet();
+        (*sheet)->SetCell(Position {0, 0}, "1");
+
+        for (int row = 1; row < n; ++row) {
+            (*sheet)->SetCell(Position {row, 0}, "=" + Cell(row - 1, 0) + "+1");
+        }
+    };
+
+    // the middle of the chain switches between two cells before it, values are calculated on demand,
+    // so the edit costs the cycle check and the invalidation only
+    auto run = [sheet, n, updates] {
+        const int middle = n / 2;
+        for (int i = 0; i < updates; ++i) {
+            (*sheet)->SetCell(Position {middle, 0}, "=" + Cell(middle - 1 - i % 2, 0) + "+1");
+        }
+        return static_cast<size_t>(updates);
+    };
+
+    return Workload {"chain_rewire", size, setup, run};
+}
+
+Workload RandomSparseFill(size_t size) {
+
+    auto sheet = std::make_shared<std::unique_ptr<ISheet>>();
+    auto edits = std::make_shared<std::vector<std::pair<Position, std::string>>>();
+
+    std::mt19937 generator(42);
+    std::uniform_int_distribution<int> row_distribution(0, Position::kMaxRows - 1);
+    std::uniform_int_distribution<int> col_distribution(0, Position::kMaxCols - 1);
+    std::uniform_int_distribution<int> kind_distribution(0, 9);
+
+    std::vector<Position> filled;
+
+    // formulas only reference cells filled before them, so the input never has cycles
+    for (size_t i = 0; i < size; ++i) {
+
+        Position pos {row_distribution(generator), col_distribution(generator)};
+        std::string text;
+
+        if (filled.size() < 2 || kind_distribution(generator) < 7) {
+            text = std::to_string(kind_distribution(generator));
+        } else {
+            std::uniform_int_distribution<size_t> ref_distribution(0, filled.size() - 1);
+            text = "=" + filled[ref_distribution(generator)].ToString() + "*2+" +
+                   filled[ref_distribution(generator)].ToString();
+        }
+
+        edits->emplace_back(pos, std::move(text));
+        filled.push_back(pos);
+    }
+
+    auto setup = [sheet] {
+        *sheet = CreateSheet();
+    };
+
+    auto run = [sheet, edits] {
+
+        for (const auto& [pos, text]: *edits) {
+            try {
+                (*sheet)->SetCell(pos, text);
+            } catch (const CircularDependencyException&) {
+                // a position can repeat and turn an earlier operand into a formula
+            }
+        }
+
+        (*sheet)->Recalculate();
+
+        return edits->size();
+    };
+
+    return Workload {"random_sparse_fill", size, setup, run};
+}
+
+void FillGrid(ISheet& sheet, int rows, int cols) {
+
+    for (int col = 0; col < cols; ++col) {
+        sheet.SetCell(Position {0, col}, std::to_string(col));
+    }
+
+    for (int row = 1; row < rows; ++row) {
+        for (int col = 0; col < cols; ++col) {
+            sheet.SetCell(Position {row, col}, "=" + Cell(row - 1, col) + "+" + Cell(row - 1, (col + 1) % cols));
+        }
+    }
+}
+
+Workload StructuralEdits(size_t size) {
+
+    auto sheet = std::make_shared<std::unique_ptr<ISheet>>();
+    const int cols = 10;
+    const int rows = std::max<int>(static_cast<int>(size) / cols, 2);
+    const int edits = 100;
+
+    auto setup = [sheet, rows, cols] {
+        *sheet = CreateSheet();
+        FillGrid(**sheet, rows, cols);
+    };
+
+    auto run = [sheet, rows, edits] {
+
+        std::mt19937 generator(7);
+        std::uniform_int_distribution<int> row_distribution(0, rows - 1);
+
+        for (int i = 0; i < edits; ++i) {
+            int row = row_distribution(generator);
+            (*sheet)->InsertRows(row, 2);
+            (*sheet)->DeleteRows(row, 1);
+        }
+
+        return static_cast<size_t>(2 * edits);
+    };
+
+    return Workload {"structural_edits", size, setup, run};
+}
+
+// a writer publishing the values after every edit of a large sheet, each edit changes two cells
+Workload PublishValues(size_t size) {
+
+    auto sheet = std::make_shared<std::unique_ptr<ISheet>>();
+    const int rows = std::max<int>(static_cast<int>(size) / 2, 2);
+    const int edits = 1'000;
+
+    auto setup = [sheet, rows] {
+
+        *sheet = CreateSheet();
+
+        for (int i = 0; i < rows; ++i) {
+            Position pos {i % 10'000, i / 10'000 * 2};
+            (*sheet)->SetCell(pos, std::to_string(i));
+            (*sheet)->SetCell(Position {pos.row, pos.col + 1}, "=" + pos.ToString() + "*2");
+        }
+
+        (*sheet)->PublishValues();
+    };
+
+    auto run = [sheet, rows, edits] {
+
+        std::mt19937 generator(11);
+        std::uniform_int_distribution<int> distribution(0, rows - 1);
+
+        for (int i = 0; i < edits; ++i) {
+            int cell = distribution(generator);
+            (*sheet)->SetCell(Position {cell % 10'000, cell / 10'000 * 2}, std::to_string(i));
+            (*sheet)->PublishValues();
+        }
+
+        return static_cast<size_t>(edits);
+    };
+
+    return Workload {"publish_values", size, setup, run};
+}
+
+Workload Print(size_t size, bool values) {
+
+    auto sheet = std::make_shared<std::unique_ptr<ISheet>>();
+    const int cols = 20;
+    const int rows = std::max<int>(static_cast<int>(size) / cols, 2);
+
+    auto setup = [sheet, rows, cols] {
+
+        *sheet = CreateSheet();
+        FillGrid(**sheet, rows, cols);
+
+        (*sheet)->Recalculate();
+    };
+
+    auto run = [sheet, rows, cols, values] {
+
+        std::ostringstream output;
+
+        if (values) {
+            (*sheet)->PrintValues(output);
+        } else {
+            (*sheet)->PrintTexts(output);
+        }
+
+        sink = sink + output.str().size();
+
+        return static_cast<size_t>(rows * cols);
+    };
+
+    return Workload {values ? "print_values" : "print_texts", size, setup, run};
+}
+
+Workload ImportTexts(size_t size) {
+
+    auto sheet = std::make_shared<std::unique_ptr<ISheet>>();
+    auto texts = std::make_shared<std::string>();
+    const int cols = 20;
+    const int rows = std::max<int>(static_cast<int>(size) / cols, 2);
+
+    auto source = CreateSheet();
+    FillGrid(*source, rows, cols);
+
+    std::ostringstream output;
+    source->PrintTexts(output);
+    *texts = output.str();
+
+    auto setup = [sheet] {
+        *sheet = CreateSheet();
+    };
+
+    auto run = [sheet, texts, rows, cols] {
+
+        std::istringstream input(*texts);
+        (*sheet)->ImportTexts(input);
+
+        return static_cast<size_t>(rows * cols);
+    };
+
+    return Workload {"import_texts", size, setup, run};
+}
+
+// generated models repeat subexpressions and arithmetic on constants within one formula
+Workload BoilerplateEvaluate(size_t size) {
+
+    auto sheet = std::make_shared<std::unique_ptr<ISheet>>();
+    auto formulas = std::make_shared<std::vector<std::unique_ptr<IFormula>>>();
+    const int rows = static_cast<int>(size);
+
+    auto setup = [sheet, formulas, rows] {
+
+        *sheet = CreateSheet();
+        formulas->clear();
+
+        for (int i = 0; i < rows; ++i) {
+
+            Position pos {i % 10'000, i / 10'000};
+            (*sheet)->SetCell(pos, std::to_string(i));
+
+            std::string term = "(" + pos.ToString() + "*12/100*(1+5/100))";
+            formulas->push_back(ParseFormula(term + "*" + term + "+" + term + "/(24*60*60)+" + pos.ToString()));
+        }
+    };
+
+    auto run = [sheet, formulas] {
+
+        for (const auto& formula: *formulas) {
+            IFormula::Value value = formula->Evaluate(**sheet);
+            if (std::holds_alternative<double>(value)) sink = sink + std::get<double>(value);
+        }
+
+        return formulas->size();
+    };
+
+    return Workload {"boilerplate_evaluate", size, setup, run};
+}
+
+// a column of values and a formula filled down next to it, as a model built by copying cells
+Workload FillDown(size_t size) {
+
+    auto sheet = std::make_shared<std::unique_ptr<ISheet>>();
+    auto texts = std::make_shared<std::vector<std::pair<Position, std::string>>>();
+
+    for (size_t i = 0; i < size; ++i) {
+        int row = static_cast<int>(i % 10'000);
+        int col = static_cast<int>(i / 10'000) * 3;
+        texts->emplace_back(Position {row, col + 2}, "=" + Cell(row, col) + "*1.2+" + Cell(row, col + 1) + "/100");
+    }
+
+    auto setup = [sheet] {
+        *sheet = CreateSheet();
+    };
+
+    auto run = [sheet, texts] {
+
+        for (const auto& [pos, text]: *texts) {
+            (*sheet)->SetCell(pos, text);
+        }
+
+        return texts->size();
+    };
+
+    return Workload {"fill_down", size, setup, run};
+}
+
+Workload ParseOnly(size_t size) {
+
+    auto expressions = std::make_shared<std::vector<std::string>>();
+
+    std::mt19937 generator(13);
+    std::uniform_int_distribution<int> operand_count_distribution(1, 8);
+    std::uniform_int_distribution<int> kind_distribution(0, 3);
+    std::uniform_int_distribution<int> row_distribution(0, 9999);
+    std::uniform_int_distribution<int> col_distribution(0, 700);
+    const char operators[] = "+-*/";
+
+    for (size_t i = 0; i < size; ++i) {
+
+        std::string expression;
+        int operand_count = operand_count_distribution(generator);
+
+        for (int j = 0; j < operand_count; ++j) {
+
+            if (j > 0) expression += operators[kind_distribution(generator)];
+
+            switch (kind_distribution(generator)) {
+                case 0: expression += std::to_string(row_distribution(generator)); break;
+                case 1: expression += "(" + Cell(row_distribution(generator), col_distribution(generator)) + "-1.5)"; break;
+                default: expression += Cell(row_distribution(generator), col_distribution(generator)); break;
+            }
+        }
+
+        expressions->push_back(std::move(expression));
+    }
+
+    auto run = [expressions] {
+
+        for (const std::string& expression: *expressions) {
+            sink = sink + ParseFormula(expression)->GetReferencedCells().size();
+        }
+
+        return expressions->size();
+    };
+
+    return Workload {"parse_only", size, [] {}, run};
+}
+
+// the regex and stack based conversions Position used before, the baselines of the position workloads
+Position LegacyPositionFromString(std::string_view str) {
+
+    static const std::regex cell_regex("([A-Z]{1,3})([1-9]\\d{0,4})");
+
+    std::match_results<std::string_view::const_iterator> match;
+
+    if (!std::regex_match(str.begin(), str.end(), match, cell_regex)) return Position {-1, -1};
+
+    int col = 0;
+
+    for (char c: match[1].str()) col = col * 26 + (c - 'A' + 1);
+
+    int row = std::stoi(match[2].str());
+
+    if (row > Position::kMaxRows || col > Position::kMaxCols) return Position {-1, -1};
+
+    return Position {row - 1, col - 1};
+}
+
+std::string LegacyPositionToString(Position pos) {
+
+    if (pos.row < 0 || pos.col < 0) return "";
+
+    std::stack<char> chars;
+    int current_col = pos.col;
+
+    while (current_col >= 26) {
+        chars.push('A' + current_col % 26);
+        current_col = current_col / 26 - 1;
+    }
+
+    chars.push('A' + current_col);
+
+    std::string result;
+
+    while (!chars.empty()) {
+        result += chars.top();
+        chars.pop();
+    }
+
+    return result + std::to_string(pos.row + 1);
+}
+
+std::shared_ptr<std::vector<Position>> GeneratePositions(size_t size) {
+
+    auto positions = std::make_shared<std::vector<Position>>();
+
+    std::mt19937 generator(17);
+    std::uniform_int_distribution<int> row_distribution(0, Position::kMaxRows - 1);
+    std::uniform_int_distribution<int> col_distribution(0, Position::kMaxCols - 1);
+
+    for (size_t i = 0; i < size; ++i) {
+        positions->push_back(Position {row_distribution(generator), col_distribution(generator)});
+    }
+
+    return positions;
+}
+
+Workload PositionParse(size_t size, bool legacy) {
+
+    auto names = std::make_shared<std::vector<std::string>>();
+
+    for (Position pos: *GeneratePositions(size)) names->push_back(pos.ToString());
+
+    auto run = [names, legacy] {
+
+        for (const std::string& name: *names) {
+            sink = sink + (legacy ? LegacyPositionFromString(name) : Position::FromString(name)).col;
+        }
+
+        return names->size();
+    };
+
+    return Workload {legacy ? "position_parse_regex" : "position_parse", size, [] {}, run};
+}
+
+Workload PositionFormat(size_t size, bool legacy) {
+
+    auto positions = GeneratePositions(size);
+
+    auto run = [positions, legacy] {
+
+        char buffer[Position::kMaxStringLength];
+
+        for (Position pos: *positions) {
+            sink = sink + (legacy ? LegacyPositionToString(pos).size() : pos.ToString(buffer));
+        }
+
+        return positions->size();
+    };
+
+    return Workload {legacy ? "position_format_stack" : "position_format", size, [] {}, run};
+}
+
+Measurement Measure(const Workload& workload) {
+
+    workload.setup();
+
+    size_t allocations_before = allocation_count.load();
+    size_t bytes_before = allocated_bytes.load();
+
+    auto start = std::chrono::steady_clock::now();
+    size_t ops = workload.run();
+    auto finish = std::chrono::steady_clock::now();
+
+    double ns = std::chrono::duration<double, std::nano>(finish - start).count();
+    double op_count = static_cast<double>(std::max<size_t>(ops, 1));
+
+    return Measurement {
+        ns / op_count,
+        static_cast<double>(allocation_count.load() - allocations_before) / op_count,
+        static_cast<double>(allocated_bytes.load() - bytes_before) / op_count
+    };
+}
+
+// nearest-rank percentile of a sorted sample
+double Percentile(const std::vector<double>& sorted, double percent) {
+    size_t rank = static_cast<size_t>(percent / 100. * static_cast<double>(sorted.size()) + 0.999999);
+    return sorted[std::clamp<size_t>(rank, 1, sorted.size()) - 1];
+}
+
+void Report(std::ostream& output, const Workload& workload, const std::vector<Measurement>& measurements) {
+
+    std::vector<double> ns_per_op;
+    double ns_sum = 0.;
+
+    for (const Measurement& measurement: measurements) {
+        ns_per_op.push_back(measurement.ns_per_op);
+        ns_sum += measurement.ns_per_op;
+    }
+
+    std::sort(ns_per_op.begin(), ns_per_op.end());
+
+    // allocations don't depend on timing, the last repetition is representative
+    const Measurement& last = measurements.back();
+
+    output << "{\"workload\":\"" << workload.name << "\""
+           << ",\"size\":" << workload.size
+           << ",\"repetitions\":" << measurements.size()
+           << ",\"optimized\":" << (OPTIMIZED_BUILD ? "true" : "false")
+           << ",\"ns_per_op\":{\"mean\":" << ns_sum / static_cast<double>(ns_per_op.size())
+           << ",\"min\":" << ns_per_op.front()
+           << ",\"p50\":" << Percentile(ns_per_op, 50.)
+           << ",\"p90\":" << Percentile(ns_per_op, 90.)
+           << ",\"p99\":" << Percentile(ns_per_op, 99.)
+           << ",\"max\":" << ns_per_op.back() << "}"
+           << ",\"allocations_per_op\":" << last.allocations_per_op
+           << ",\"bytes_per_op\":" << last.bytes_per_op
+           << "}" << std::endl;
+}
+
+Options ParseOptions(int argc, char** argv) {
+
+    Options options;
+
+    for (int i = 1; i < argc; ++i) {
+
+        std::string arg = argv[i];
+
+        if (i + 1 == argc) throw std::invalid_argument("missing value for " + arg);
+
+        std::string value = argv[++i];
+
+        if (arg == "--repetitions") {
+            options.repetitions = std::max<size_t>(std::stoul(value), 1);
+        } else if (arg == "--scale") {
+            options.scale = std::stod(value);
+        } else if (arg == "--filter") {
+            options.filter = value;
+        } else {
+            throw std::invalid_argument("unknown option " + arg);
+        }
+    }
+
+    return options;
+}
+
+}
+
+int main(int argc, char** argv) {
+
+    Options options;
+
+    try {
+        options = ParseOptions(argc, argv);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << "\n"
+                  << "usage: spreadsheet_bench [--repetitions N] [--scale X] [--filter SUBSTRING]" << std::endl;
+        return 1;
+    }
+
+    auto scaled = [&options](size_t size) {
+        return std::max<size_t>(static_cast<size_t>(static_cast<double>(size) * options.scale), 2);
+    };
+
+    std::vector<Workload> workloads = {
+        FanIn(scaled(1'000)),
+        FanInRange(scaled(1'000)),
+        ChainBuild(scaled(10'000)),
+        ChainUpdate(scaled(10'000)),
+        ChainRewire(scaled(10'000)),
+        ChainOnDemand(scaled(10'000)),
+        ChainBackground(scaled(10'000)),
+        RandomSparseFill(scaled(20'000)),
+        StructuralEdits(scaled(20'000)),
+        PublishValues(scaled(20'000)),
+        Print(scaled(20'000), true),
+        Print(scaled(20'000), false),
+        ImportTexts(scaled(20'000)),
+        ParseOnly(scaled(20'000)),
+        PositionParse(scaled(100'000), false),
+        PositionParse(scaled(100'000), true),
+        PositionFormat(scaled(100'000), false),
+        PositionFormat(scaled(100'000), true),
+        BoilerplateEvaluate(scaled(20'000)),
+        FillDown(scaled(20'000)),
+    };
+
+    for (const Workload& workload: workloads) {
+
+        if (workload.name.find(options.filter) == std::string::npos) continue;
+
+        // the first run warms up caches and the allocator and isn't reported
+        Measure(workload);
+
+        std::vector<Measurement> measurements;
+
+        for (size_t i = 0; i < options.repetitions; ++i) {
+            measurements.push_back(Measure(workload));
+        }
+
+        Report(std::cout, workload, measurements);
+    }
+
+    return 0;
+}
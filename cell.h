@@ -0,0 +1,452 @@
+#pragma once
+
+#include "common.h"
+#include "formula.h"
+#include "sheet_stats.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <variant>
+#include <vector>
+
+// stable id of a cell in its grid, it doesn't change when rows and columns are shifted
+using CellId = uint32_t;
+
+class Cell;
+
+// Calculates the uncached formulas a cell reads and the ones they read, without recursion, so the evaluation
+// of the cell finds its operands cached however long the chain behind them is.
+class DependencyCalculator {
+
+public:
+
+    virtual void CalculateDependencies(const Cell& cell) const = 0;
+
+protected:
+
+    ~DependencyCalculator() = default;
+};
+
+// what the cells of a sheet share, a cell keeps a single reference to it
+struct CellContext {
+    const ISheet& sheet;
+    StatsCounters& stats;
+    const DependencyCalculator& calculator;
+};
+
+class Cell : public ICell {
+
+private:
+
+    enum class CacheState : uint8_t {
+        EMPTY,
+        CALCULATING,
+        READY
+    };
+
+    // what the number slot holds: the number a text means, or the cached value of a formula
+    enum class NumberKind : uint8_t {
+        NONE,
+        NUMBER,
+        ERROR
+    };
+
+    // most cells are plain numbers, so a cell keeps the text it was given and a single number slot
+    // instead of copies of its value: short texts stay inside the string, a text is its own value
+    const CellContext& context_;
+    std::string text_;
+    std::unique_ptr<IFormula> formula_;
+    Position position_;
+    CellId id_;
+    mutable std::atomic<CacheState> cache_state_;
+
+    // a formula is worth a number or an error, never a text
+    mutable NumberKind number_kind_ = NumberKind::NONE;
+    mutable uint8_t error_category_ = 0;
+    mutable double number_ = 0.;
+
+    void ClearData() {
+        text_.clear();
+        formula_.reset();
+        number_kind_ = NumberKind::NONE;
+        InvalidateCache();
+    }
+
+    void SetNumber(const NumericValue& value) const {
+        if (std::holds_alternative<double>(value)) {
+            number_kind_ = NumberKind::NUMBER;
+            number_ = std::get<double>(value);
+        } else {
+            number_kind_ = NumberKind::ERROR;
+            error_category_ = static_cast<uint8_t>(std::get<FormulaError>(value).GetCategory());
+        }
+    }
+
+    std::optional<NumericValue> GetNumber() const {
+
+        switch (number_kind_) {
+
+            case NumberKind::NUMBER:
+                return number_;
+
+            case NumberKind::ERROR:
+                return FormulaError(static_cast<FormulaError::Category>(error_category_));
+
+            default:
+                return std::nullopt;
+        }
+    }
+
+    std::string_view GetTextValue() const {
+
+        std::string_view text = text_;
+
+        if (!text.empty() && text.front() == kEscapeSign) text.remove_prefix(1);
+
+        return text;
+    }
+
+    // the whole text must be a number as std::stod reads it, strtod fails on words without an exception
+    static NumericValue ParseNumber(const char* text, const char* text_end) {
+
+        char* end = nullptr;
+
+        errno = 0;
+        double value = std::strtod(text, &end);
+
+        if (end == text || end != text_end || errno == ERANGE) return FormulaError(FormulaError::Category::Value);
+
+        return value;
+    }
+
+    // a formula evaluated this deep inside others has the cells it reads calculated iteratively first
+    static constexpr int MAX_NESTED_EVALUATIONS = 64;
+
+    // the waits for the calculation of another thread which only yield, the later ones sleep
+    static constexpr int WAIT_YIELDS = 64;
+
+    // the formulas being evaluated by the thread, one inside another
+    static int& GetEvaluationDepth() {
+        thread_local int depth = 0;
+        return depth;
+    }
+
+    class NestedEvaluation {
+
+    private:
+
+        int& depth_;
+
+    public:
+
+        NestedEvaluation(): depth_(GetEvaluationDepth()) {
+            depth_++;
+        }
+
+        NestedEvaluation(const NestedEvaluation&) = delete;
+        NestedEvaluation& operator=(const NestedEvaluation&) = delete;
+
+        ~NestedEvaluation() {
+            depth_--;
+        }
+
+        int GetDepth() const {
+            return depth_;
+        }
+    };
+
+    // the text of a plain cell is its value already, so only formulas have one to calculate
+    void CalculateValue() const {
+
+        if (formula_ == nullptr) return;
+
+        NestedEvaluation evaluation;
+        context_.stats.RecordEvaluationDepth(evaluation.GetDepth());
+
+        SetNumber(formula_->Evaluate(context_.sheet));
+    }
+
+    // a short calculation is waited for by yielding, a long one by sleeps growing up to a millisecond
+    static void WaitForCalculation(int attempt) {
+
+        if (attempt < WAIT_YIELDS) {
+            std::this_thread::yield();
+            return;
+        }
+
+        std::this_thread::sleep_for(std::chrono::microseconds(1 << std::min(attempt - WAIT_YIELDS, 10)));
+    }
+
+    // the first thread to get here calculates the value and the others wait for it,
+    // so concurrent evaluations never see a half-written cache
+    void CalculateCache(bool with_dependencies) const {
+
+        // a reference is read by a nested evaluation, so the recursion through a long chain of them is cut
+        if (with_dependencies && formula_ && GetEvaluationDepth() >= MAX_NESTED_EVALUATIONS) {
+            context_.calculator.CalculateDependencies(*this);
+        }
+
+        // a calculation which threw leaves the cache empty, so a waiter takes the calculation over
+        // and gets the exception itself
+        for (int attempt = 0;; ++attempt) {
+
+            CacheState expected = CacheState::EMPTY;
+
+            if (cache_state_.compare_exchange_strong(expected, CacheState::CALCULATING, std::memory_order_acquire)) {
+
+                context_.stats.Add(StatsCounters::CACHE_MISSES);
+
+                try {
+                    CalculateValue();
+                } catch (...) {
+                    cache_state_.store(CacheState::EMPTY, std::memory_order_release);
+                    throw;
+                }
+
+                cache_state_.store(CacheState::READY, std::memory_order_release);
+                return;
+            }
+
+            if (expected == CacheState::READY) return;
+
+            WaitForCalculation(attempt);
+        }
+    }
+
+    void ReadCache() const {
+        if (!HasCache()) {
+            CalculateCache(true);
+        } else {
+            context_.stats.Add(StatsCounters::CACHE_HITS);
+        }
+    }
+
+    static Value ToValue(const NumericValue& value) {
+        if (std::holds_alternative<double>(value)) return std::get<double>(value);
+        return std::get<FormulaError>(value);
+    }
+
+public:
+
+    Cell(const CellContext& context, CellId id, Position position)
+        : context_(context),
+          text_(),
+          formula_(),
+          position_(position),
+          id_(id),
+          cache_state_(CacheState::EMPTY) {}
+
+    ~Cell() override = default;
+
+    // the dependencies of the formula are kept by the sheet
+    void SetFormula(std::unique_ptr<IFormula> formula) {
+        ClearData();
+        formula_ = std::move(formula);
+        text_ = '=' + formula_->GetExpression();
+    }
+
+    void SetPlainText(std::string text) {
+
+        ClearData();
+        text_ = std::move(text);
+
+        size_t value_begin = !text_.empty() && text_.front() == kEscapeSign ? 1 : 0;
+
+        if (text_.size() > value_begin) {
+            SetNumber(ParseNumber(text_.c_str() + value_begin, text_.c_str() + text_.size()));
+        }
+    }
+
+    Value GetValue() const override {
+
+        ReadCache();
+
+        if (formula_ == nullptr) return std::string(GetTextValue());
+
+        return ToValue(*GetNumber());
+    }
+
+    // the value once it is calculated, the text of a plain cell is passed as a view, so nothing is copied
+    template <typename Visitor>
+    void VisitValue(Visitor visitor) const {
+
+        ReadCache();
+
+        if (formula_ == nullptr) {
+            visitor(GetTextValue());
+        } else if (number_kind_ == NumberKind::NUMBER) {
+            visitor(number_);
+        } else {
+            visitor(FormulaError(static_cast<FormulaError::Category>(error_category_)));
+        }
+    }
+
+    std::optional<NumericValue> GetNumericValue() const override {
+
+        if (formula_ == nullptr) return GetNumber();
+
+        ReadCache();
+
+        return GetNumber();
+    }
+
+    std::optional<Value> GetCachedValue() const {
+        if (!HasCache()) return std::nullopt;
+
+        if (formula_ == nullptr) return std::string(GetTextValue());
+
+        return ToValue(*GetNumber());
+    }
+
+    // restores the value of a formula calculated before, e.g. by a loaded snapshot
+    void SetCache(NumericValue value) {
+        SetNumber(value);
+        cache_state_.store(CacheState::READY, std::memory_order_release);
+    }
+
+    bool HasCache() const {
+        return cache_state_.load(std::memory_order_acquire) == CacheState::READY;
+    }
+
+    // the cells the formula reads must be calculated already, as they are by the sheet recalculation
+    void UpdateCache() const {
+        if (!HasCache()) CalculateCache(false);
+    }
+
+    // must not run concurrently with evaluations, the sheet only invalidates while editing
+    void InvalidateCache() {
+        cache_state_.store(CacheState::EMPTY, std::memory_order_release);
+    }
+
+    std::string GetText() const override {
+        return text_;
+    }
+
+    std::string_view GetTextView() const override {
+        return text_;
+    }
+
+    bool HasText() const {
+        return !text_.empty();
+    }
+
+    std::vector<Position> GetReferencedCells() const override {
+        return formula_ ? formula_->GetReferencedCells() : std::vector<Position>();
+    }
+
+    std::vector<Range> GetReferencedRanges() const {
+        return formula_ ? formula_->GetReferencedRanges() : std::vector<Range>();
+    }
+
+    std::vector<ExternalReference> GetExternalReferences() const {
+        return formula_ ? formula_->GetExternalReferences() : std::vector<ExternalReference>();
+    }
+
+    bool HasFormula() const {
+        return formula_ != nullptr;
+    }
+
+    const IFormula* GetFormula() const {
+        return formula_.get();
+    }
+
+    CellId GetId() const {
+        return id_;
+    }
+
+    // kept up to date by the grid when rows and columns are shifted
+    Position GetPosition() const {
+        return position_;
+    }
+
+    void SetPosition(Position position) {
+        position_ = position;
+    }
+
+    bool HandleDeletedRows(int first, int count) {
+
+        if (formula_ == nullptr) return false;
+
+        IFormula::HandlingResult result = formula_->HandleDeletedRows(first, count);
+
+        switch (result) {
+
+            case IFormula::HandlingResult::NothingChanged:
+                return false;
+
+            case IFormula::HandlingResult::ReferencesRenamedOnly:
+                text_ = '=' + formula_->GetExpression();
+                return false;
+
+            case IFormula::HandlingResult::ReferencesChanged:
+                text_ = '=' + formula_->GetExpression();
+                return true;
+        }
+    }
+
+    bool HandleDeletedCols(int first, int count) {
+
+        if (formula_ == nullptr) return false;
+
+        IFormula::HandlingResult result = formula_->HandleDeletedCols(first, count);
+
+        switch (result) {
+
+            case IFormula::HandlingResult::NothingChanged:
+                return false;
+
+            case IFormula::HandlingResult::ReferencesRenamedOnly:
+                text_ = '=' + formula_->GetExpression();
+                return false;
+
+            case IFormula::HandlingResult::ReferencesChanged:
+                text_ = '=' + formula_->GetExpression();
+                return true;
+        }
+    }
+
+    void HandleInsertedRows(int before, int count) {
+
+        if (formula_ == nullptr) return;
+
+        IFormula::HandlingResult result = formula_->HandleInsertedRows(before, count);
+
+        if (result == IFormula::HandlingResult::ReferencesRenamedOnly) {
+            text_ = '=' + formula_->GetExpression();
+        }
+    }
+
+    void HandleInsertedCols(int before, int count) {
+
+        if (formula_ == nullptr) return;
+
+        IFormula::HandlingResult result = formula_->HandleInsertedCols(before, count);
+
+        if (result == IFormula::HandlingResult::ReferencesRenamedOnly) {
+            text_ = '=' + formula_->GetExpression();
+        }
+    }
+
+    // a structural edit of another sheet the formula reads
+    template <typename Handler>
+    IFormula::HandlingResult HandleExternalEdit(Handler handler) {
+
+        if (formula_ == nullptr) return IFormula::HandlingResult::NothingChanged;
+
+        IFormula::HandlingResult result = handler(*formula_);
+
+        if (result != IFormula::HandlingResult::NothingChanged) text_ = '=' + formula_->GetExpression();
+
+        return result;
+    }
+
+};
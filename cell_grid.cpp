@@ -0,0 +1,267 @@
+#include "cell_grid.h"
+
+#include <new>
+
+CellGrid::~CellGrid() {
+    ForEach([this](Position pos, Cell& cell) {
+        cell.~Cell();
+    });
+}
+
+CellGrid::Block* CellGrid::FindBlock(int block_row, int block_col) const {
+
+    if (block_row >= static_cast<int>(blocks_.size())) return nullptr;
+
+    const auto& row_blocks = blocks_[block_row];
+
+    if (block_col >= static_cast<int>(row_blocks.size())) return nullptr;
+
+    return row_blocks[block_col].get();
+}
+
+CellGrid::Block& CellGrid::GetOrCreateBlock(int block_row, int block_col) {
+
+    if (block_row >= static_cast<int>(blocks_.size())) {
+        blocks_.resize(block_row + 1);
+    }
+
+    auto& row_blocks = blocks_[block_row];
+
+    if (block_col >= static_cast<int>(row_blocks.size())) {
+        row_blocks.resize(block_col + 1);
+    }
+
+    auto& block = row_blocks[block_col];
+
+    if (block == nullptr) {
+        block = std::make_unique<Block>();
+    }
+
+    return *block;
+}
+
+CellGrid::Handle CellGrid::GetHandle(Position pos) const {
+    const Block* block = FindBlock(BlockIndex(pos.row), BlockIndex(pos.col));
+    return block != nullptr ? block->handles[SlotIndex(pos)] : EMPTY_HANDLE;
+}
+
+void CellGrid::SetHandle(Position pos, Handle handle) {
+
+    Block* block = handle != EMPTY_HANDLE
+        ? &GetOrCreateBlock(BlockIndex(pos.row), BlockIndex(pos.col))
+        : FindBlock(BlockIndex(pos.row), BlockIndex(pos.col));
+
+    if (block == nullptr) return;
+
+    Handle& slot = block->handles[SlotIndex(pos)];
+
+    if (slot == EMPTY_HANDLE && handle != EMPTY_HANDLE) block->count++;
+    if (slot != EMPTY_HANDLE && handle == EMPTY_HANDLE) block->count--;
+
+    slot = handle;
+}
+
+Cell& CellGrid::Resolve(Handle handle) const {
+    uint32_t index = handle - 1;
+    CellStorage& storage = chunks_[index / CHUNK_SIZE][index % CHUNK_SIZE];
+    return *std::launder(reinterpret_cast<Cell*>(storage.data));
+}
+
+CellGrid::Handle CellGrid::CreateCell(Position pos) {
+
+    Handle handle;
+
+    if (!free_handles_.empty()) {
+        handle = free_handles_.back();
+        free_handles_.pop_back();
+    } else {
+
+        handle = next_handle_++;
+
+        if ((handle - 1) / CHUNK_SIZE >= chunks_.size()) {
+            chunks_.push_back(std::make_unique<CellStorage[]>(CHUNK_SIZE));
+        }
+    }
+
+    uint32_t index = handle - 1;
+    new (chunks_[index / CHUNK_SIZE][index % CHUNK_SIZE].data) Cell(context_, handle, pos);
+
+    return handle;
+}
+
+void CellGrid::DestroyCell(Handle handle) {
+    Resolve(handle).~Cell();
+    free_handles_.push_back(handle);
+}
+
+void CellGrid::MoveRow(int from, int to) {
+
+    int block_row = BlockIndex(from);
+
+    if (block_row >= static_cast<int>(blocks_.size())) return;
+
+    int block_cols = static_cast<int>(blocks_[block_row].size());
+
+    for (int block_col = 0; block_col < block_cols; ++block_col) {
+
+        if (FindBlock(block_row, block_col) == nullptr) continue;
+
+        for (int col = block_col * BLOCK_SIZE; col < (block_col + 1) * BLOCK_SIZE; ++col) {
+
+            Handle handle = GetHandle(Position {from, col});
+
+            if (handle != EMPTY_HANDLE) {
+                SetHandle(Position {from, col}, EMPTY_HANDLE);
+                SetHandle(Position {to, col}, handle);
+                Resolve(handle).SetPosition(Position {to, col});
+            }
+        }
+    }
+}
+
+void CellGrid::MoveCol(int from, int to) {
+
+    int block_col = BlockIndex(from);
+
+    for (int block_row = 0; block_row < static_cast<int>(blocks_.size()); ++block_row) {
+
+        if (FindBlock(block_row, block_col) == nullptr) continue;
+
+        for (int row = block_row * BLOCK_SIZE; row < (block_row + 1) * BLOCK_SIZE; ++row) {
+
+            Handle handle = GetHandle(Position {row, from});
+
+            if (handle != EMPTY_HANDLE) {
+                SetHandle(Position {row, from}, EMPTY_HANDLE);
+                SetHandle(Position {row, to}, handle);
+                Resolve(handle).SetPosition(Position {row, to});
+            }
+        }
+    }
+}
+
+void CellGrid::ReleaseEmptyBlocks() {
+
+    for (auto& row_blocks: blocks_) {
+
+        for (auto& block: row_blocks) {
+            if (block != nullptr && block->count == 0) block.reset();
+        }
+
+        while (!row_blocks.empty() && row_blocks.back() == nullptr) row_blocks.pop_back();
+    }
+
+    while (!blocks_.empty() && blocks_.back().empty()) blocks_.pop_back();
+}
+
+Cell* CellGrid::Find(Position pos) const {
+    Handle handle = GetHandle(pos);
+    return handle != EMPTY_HANDLE ? &Resolve(handle) : nullptr;
+}
+
+Cell& CellGrid::GetOrCreate(Position pos) {
+
+    Handle handle = GetHandle(pos);
+
+    if (handle == EMPTY_HANDLE) {
+        handle = CreateCell(pos);
+        SetHandle(pos, handle);
+    }
+
+    return Resolve(handle);
+}
+
+void CellGrid::Erase(Position pos) {
+
+    Handle handle = GetHandle(pos);
+
+    if (handle == EMPTY_HANDLE) return;
+
+    SetHandle(pos, EMPTY_HANDLE);
+    DestroyCell(handle);
+
+    Block* block = FindBlock(BlockIndex(pos.row), BlockIndex(pos.col));
+
+    if (block->count == 0) ReleaseEmptyBlocks();
+}
+
+Size CellGrid::GetExtent() const {
+
+    Size extent;
+
+    for (int block_row = static_cast<int>(blocks_.size()) - 1; block_row >= 0 && extent.rows == 0; --block_row) {
+        for (const auto& block: blocks_[block_row]) {
+
+            if (block == nullptr) continue;
+
+            for (int slot = BLOCK_SIZE * BLOCK_SIZE - 1; slot >= 0; --slot) {
+                if (block->handles[slot] != EMPTY_HANDLE) {
+                    extent.rows = std::max(extent.rows, block_row * BLOCK_SIZE + slot / BLOCK_SIZE + 1);
+                    break;
+                }
+            }
+        }
+    }
+
+    for (int block_row = 0; block_row < static_cast<int>(blocks_.size()); ++block_row) {
+
+        const auto& row_blocks = blocks_[block_row];
+
+        for (int block_col = static_cast<int>(row_blocks.size()) - 1; block_col >= 0; --block_col) {
+
+            const Block* block = row_blocks[block_col].get();
+
+            if (block == nullptr) continue;
+
+            for (int slot = 0; slot < BLOCK_SIZE * BLOCK_SIZE; ++slot) {
+                if (block->handles[slot] != EMPTY_HANDLE) {
+                    extent.cols = std::max(extent.cols, block_col * BLOCK_SIZE + slot % BLOCK_SIZE + 1);
+                }
+            }
+
+            break;
+        }
+    }
+
+    return extent;
+}
+
+void CellGrid::InsertRows(int before, int count) {
+
+    for (int row = GetExtent().rows - 1; row >= before; --row) {
+        MoveRow(row, row + count);
+    }
+
+    ReleaseEmptyBlocks();
+}
+
+void CellGrid::InsertCols(int before, int count) {
+
+    for (int col = GetExtent().cols - 1; col >= before; --col) {
+        MoveCol(col, col + count);
+    }
+
+    ReleaseEmptyBlocks();
+}
+
+void CellGrid::DeleteRows(int first, int count) {
+
+    int rows = GetExtent().rows;
+
+    for (int row = first + count; row < rows; ++row) {
+        MoveRow(row, row - count);
+    }
+
+    ReleaseEmptyBlocks();
+}
+
+void CellGrid::DeleteCols(int first, int count) {
+
+    int cols = GetExtent().cols;
+
+    for (int col = first + count; col < cols; ++col) {
+        MoveCol(col, col - count);
+    }
+
+    ReleaseEmptyBlocks();
+}
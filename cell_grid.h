@@ -0,0 +1,146 @@
+#pragma once
+
+#include "cell.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Sparse cell storage. The sheet is split into BLOCK_SIZE x BLOCK_SIZE blocks which are allocated on the
+// first write into them. A block keeps 32-bit handles, the cells themselves live in a chunked pool, so
+// cells never move in memory and the pointers held by the sheet indexes stay valid while rows and columns
+// are shifted.
+class CellGrid {
+
+public:
+
+    static constexpr int BLOCK_SIZE = 64;
+
+private:
+
+    // handles are the cell ids, so a cell keeps its id however it moves
+    using Handle = CellId;
+
+    static constexpr Handle EMPTY_HANDLE = 0;
+    static constexpr uint32_t CHUNK_SIZE = 256;
+
+    struct Block {
+        std::array<Handle, BLOCK_SIZE * BLOCK_SIZE> handles {};
+        int count = 0;
+    };
+
+    struct CellStorage {
+        alignas(Cell) unsigned char data[sizeof(Cell)];
+    };
+
+    const CellContext& context_;
+
+    std::vector<std::vector<std::unique_ptr<Block>>> blocks_;
+
+    std::vector<std::unique_ptr<CellStorage[]>> chunks_;
+    std::vector<Handle> free_handles_;
+    Handle next_handle_ = 1;
+
+    static int BlockIndex(int index) {
+        return index / BLOCK_SIZE;
+    }
+
+    static int SlotIndex(Position pos) {
+        return (pos.row % BLOCK_SIZE) * BLOCK_SIZE + pos.col % BLOCK_SIZE;
+    }
+
+    Block* FindBlock(int block_row, int block_col) const;
+
+    Block& GetOrCreateBlock(int block_row, int block_col);
+
+    Handle GetHandle(Position pos) const;
+
+    void SetHandle(Position pos, Handle handle);
+
+    Cell& Resolve(Handle handle) const;
+
+    Handle CreateCell(Position pos);
+
+    void DestroyCell(Handle handle);
+
+    void MoveRow(int from, int to);
+
+    void MoveCol(int from, int to);
+
+    void ReleaseEmptyBlocks();
+
+public:
+
+    explicit CellGrid(const CellContext& context): context_(context) {}
+
+    CellGrid(const CellGrid&) = delete;
+    CellGrid& operator=(const CellGrid&) = delete;
+
+    ~CellGrid();
+
+    Cell* Find(Position pos) const;
+
+    Cell& Get(CellId id) const {
+        return Resolve(id);
+    }
+
+    Cell& GetOrCreate(Position pos);
+
+    void Erase(Position pos);
+
+    // bounding size of all created cells, including the ones with empty text
+    Size GetExtent() const;
+
+    // shift cells, the cells of deleted rows/cols must be erased beforehand
+    void InsertRows(int before, int count);
+
+    void InsertCols(int before, int count);
+
+    void DeleteRows(int first, int count);
+
+    void DeleteCols(int first, int count);
+
+    // visits created cells of the [first, last] rectangle in row-major order
+    template <typename Visitor>
+    void ForEachIn(Position first, Position last, Visitor visitor) const {
+
+        int last_block_row = std::min(BlockIndex(last.row), static_cast<int>(blocks_.size()) - 1);
+
+        for (int block_row = BlockIndex(first.row); block_row <= last_block_row; ++block_row) {
+
+            const auto& row_blocks = blocks_[block_row];
+
+            int last_block_col = std::min(BlockIndex(last.col), static_cast<int>(row_blocks.size()) - 1);
+
+            int row_begin = std::max(first.row, block_row * BLOCK_SIZE);
+            int row_end = std::min(last.row + 1, (block_row + 1) * BLOCK_SIZE);
+
+            for (int row = row_begin; row < row_end; ++row) {
+                for (int block_col = BlockIndex(first.col); block_col <= last_block_col; ++block_col) {
+
+                    const Block* block = row_blocks[block_col].get();
+
+                    if (block == nullptr) continue;
+
+                    int col_begin = std::max(first.col, block_col * BLOCK_SIZE);
+                    int col_end = std::min(last.col + 1, (block_col + 1) * BLOCK_SIZE);
+
+                    for (int col = col_begin; col < col_end; ++col) {
+
+                        Position pos {row, col};
+                        Handle handle = block->handles[SlotIndex(pos)];
+
+                        if (handle != EMPTY_HANDLE) visitor(pos, Resolve(handle));
+                    }
+                }
+            }
+        }
+    }
+
+    template <typename Visitor>
+    void ForEach(Visitor visitor) const {
+        ForEachIn(Position {0, 0}, Position {Position::kMaxRows - 1, Position::kMaxCols - 1}, visitor);
+    }
+};
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "common.h"
+
+#include <algorithm>
+#include <vector>
+
+// Positions of the cells whose values may have changed since a reader last took them. Until the reader
+// starts tracking, and after edits moving cells or too many edits, everything counts as changed.
+class ChangeSet {
+
+private:
+
+    static constexpr size_t MAX_SIZE = 1 << 20;
+
+    bool tracking_ = false;
+    bool all_ = false;
+    std::vector<Position> positions_;
+
+public:
+
+    void Add(Position pos) {
+
+        if (!tracking_ || all_) return;
+
+        positions_.push_back(pos);
+
+        // a reader taking the changes rarely reads everything again instead of keeping every edit
+        if (positions_.size() > MAX_SIZE) AddAll();
+    }
+
+    void AddAll() {
+        all_ = true;
+        positions_.clear();
+    }
+
+    bool IsAll() const {
+        return !tracking_ || all_;
+    }
+
+    bool IsEmpty() const {
+        return tracking_ && !all_ && positions_.empty();
+    }
+
+    // sorted and without repetitions
+    const std::vector<Position>& GetPositions() {
+        std::sort(positions_.begin(), positions_.end());
+        positions_.erase(std::unique(positions_.begin(), positions_.end()), positions_.end());
+        return positions_;
+    }
+
+    // the changes were taken, the following ones are tracked
+    void Clear() {
+        tracking_ = true;
+        all_ = false;
+        positions_.clear();
+    }
+
+    void StopTracking() {
+        tracking_ = false;
+        all_ = false;
+        positions_.clear();
+    }
+};
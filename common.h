@@ -1,7 +1,12 @@
 #pragma once
 
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
 #include <iosfwd>
 #include <memory>
+#include <optional>
 #include <stdexcept>
 #include <string>
 #include <string_view>
@@ -19,10 +24,90 @@ struct Position {
   bool IsValid() const;
   std::string ToString() const;
 
-  static Position FromString(std::string_view str);
+  // Записывает строковое представление позиции в buffer размером не менее
+  // kMaxStringLength без завершающего нуля и возвращает его длину. Для позиции
+  // с отрицательными координатами ничего не записывает и возвращает 0.
+  constexpr size_t ToString(char* buffer) const;
+
+  static constexpr Position FromString(std::string_view str);
 
   static const int kMaxRows = 16384;
   static const int kMaxCols = 16384;
+
+  // Достаточно для любых неотрицательных row и col: 7 букв и 10 цифр
+  static const size_t kMaxStringLength = 17;
+};
+
+constexpr size_t Position::ToString(char* buffer) const {
+  if (row < 0 || col < 0) return 0;
+
+  // столбцы нумеруются в биективной системе счисления по основанию 26
+  char letters[7] = {};
+  size_t letter_count = 0;
+
+  for (unsigned long long number = col + 1ull; number > 0;
+       number = (number - 1) / 26) {
+    letters[letter_count++] = static_cast<char>('A' + (number - 1) % 26);
+  }
+
+  char digits[10] = {};
+  size_t digit_count = 0;
+
+  for (unsigned long long number = row + 1ull; number > 0; number /= 10) {
+    digits[digit_count++] = static_cast<char>('0' + number % 10);
+  }
+
+  size_t length = 0;
+
+  while (letter_count > 0) buffer[length++] = letters[--letter_count];
+  while (digit_count > 0) buffer[length++] = digits[--digit_count];
+
+  return length;
+}
+
+// Принимает строки вида [A-Z]{1,3}[1-9][0-9]{0,4}, задающие позицию в
+// пределах таблицы. Для остальных строк возвращает позицию {-1, -1}.
+constexpr Position Position::FromString(std::string_view str) {
+  const Position invalid{-1, -1};
+
+  size_t i = 0;
+  int col = 0;
+
+  for (; i < str.size() && i < 3 && 'A' <= str[i] && str[i] <= 'Z'; ++i) {
+    col = col * 26 + (str[i] - 'A' + 1);
+  }
+
+  if (i == 0 || i == str.size() || str[i] < '1' || str[i] > '9') {
+    return invalid;
+  }
+
+  size_t digits_begin = i;
+  int row = 0;
+
+  for (; i < str.size() && i - digits_begin < 5; ++i) {
+    if (str[i] < '0' || str[i] > '9') return invalid;
+    row = row * 10 + (str[i] - '0');
+  }
+
+  if (i != str.size() || row > kMaxRows || col > kMaxCols) return invalid;
+
+  return Position{row - 1, col - 1};
+}
+
+// Прямоугольный диапазон ячеек от first (левый верхний угол) до last (правый
+// нижний угол) включительно.
+struct Range {
+  Position first;
+  Position last;
+
+  bool operator==(const Range& rhs) const;
+  bool operator<(const Range& rhs) const;
+
+  // Обе позиции корректны и first не правее и не ниже last.
+  bool IsValid() const;
+  bool Contains(Position pos) const;
+  // Строка вида "A1:B2"
+  std::string ToString() const;
 };
 
 struct Size {
@@ -82,11 +167,27 @@ public:
   using std::runtime_error::runtime_error;
 };
 
+// Исключение, выбрасываемое при попытке добавить в книгу лист с некорректным
+// или уже занятым именем
+class InvalidSheetNameException : public std::invalid_argument {
+public:
+  using std::invalid_argument::invalid_argument;
+};
+
+// Исключение, выбрасываемое при загрузке повреждённого или несовместимого
+// снимка таблицы
+class SnapshotException : public std::runtime_error {
+public:
+  using std::runtime_error::runtime_error;
+};
+
 class ICell {
 public:
   // Либо текст ячейки, либо значение формулы, либо сообщение об ошибке из
   // формулы
   using Value = std::variant<std::string, double, FormulaError>;
+  // Значение ячейки как операнда формулы
+  using NumericValue = std::variant<double, FormulaError>;
 
   virtual ~ICell() = default;
 
@@ -98,6 +199,15 @@ public:
   // редактирование. В случае текстовой ячейки это её текст (возможно,
   // содержащий экранирующие символы). В случае формулы - её выражение.
   virtual std::string GetText() const = 0;
+  // То же, что GetText(), но без копирования. Строка действительна до
+  // следующего изменения ячейки.
+  virtual std::string_view GetTextView() const = 0;
+
+  // Возвращает значение ячейки для вычисления формул: число, ошибку формулы
+  // или #VALUE!, если текст не является числом. Для ячейки с пустым
+  // значением возвращается std::nullopt. Текст разбирается один раз при
+  // изменении ячейки, а не при каждом обращении к ней.
+  virtual std::optional<NumericValue> GetNumericValue() const = 0;
 
   // Возвращает список ячеек, которые непосредственно задействованы в данной
   // формуле. Список отсортирован по возрастанию и не содержит повторяющихся
@@ -105,9 +215,72 @@ public:
   virtual std::vector<Position> GetReferencedCells() const = 0;
 };
 
+// Неизменяемый снимок значений таблицы, опубликованный PublishValues().
+// Снимок можно читать из любого числа потоков одновременно с изменениями
+// таблицы: он не меняется и не блокирует ни читателей, ни писателя.
+class IValueSnapshot {
+public:
+  virtual ~IValueSnapshot() = default;
+
+  // Возвращает значение ячейки на момент публикации или std::nullopt, если
+  // ячейки не было. Бросает InvalidPositionException, если позиция
+  // некорректна.
+  virtual std::optional<ICell::Value> GetValue(Position pos) const = 0;
+
+  // Возвращает true, если GetValue() возвращает прежнее значение ячейки,
+  // которое ещё пересчитывается в фоне (RecalculationMode::Background).
+  // Бросает InvalidPositionException, если позиция некорректна.
+  virtual bool IsPending(Position pos) const = 0;
+
+  // Размер печатаемой области на момент публикации
+  virtual Size GetPrintableSize() const = 0;
+
+  // Номер публикации, пустой снимок до первой публикации имеет номер 0
+  virtual uint64_t GetVersion() const = 0;
+};
+
+// Счётчики работы таблицы с момента её создания. Считаются, только если
+// библиотека собрана с SPREADSHEET_STATS, иначе все счётчики равны нулю.
+struct SheetStats {
+  uint64_t parses = 0;  // разобранные формулы
+  uint64_t parse_nanoseconds = 0;  // время их разбора
+  uint64_t cycle_check_cells = 0;  // ячейки, просмотренные при поиске циклов
+  uint64_t invalidated_cells = 0;  // ячейки, значения которых сброшены изменениями
+  uint64_t cache_hits = 0;  // значения формул, взятые из кеша
+  uint64_t cache_misses = 0;  // значения формул, вычисленные заново
+  uint64_t max_evaluation_depth = 0;  // наибольшая глубина вложенных вычислений формул
+  uint64_t structural_edit_cells = 0;  // ячейки, удалённые или изменённые вставкой и удалением строк/столбцов
+};
+
+// Операция таблицы, о которой сообщается обработчику трассировки
+struct SheetTraceEvent {
+  const char* operation;  // имя метода ISheet, например "SetCell"
+  std::chrono::nanoseconds duration;
+  // счётчики, набежавшие за операцию; max_evaluation_depth - за всё время
+  SheetStats stats;
+};
+
+// Ячейки, значения которых могли измениться с предыдущего уведомления
+struct SheetChanges {
+  // отсортированы, без повторов; удалённые ячейки тоже входят
+  std::vector<Position> positions;
+  // ячейки сдвинулись при вставке или удалении строк/столбцов либо изменений
+  // слишком много: значения нужно перечитать целиком, positions пуст
+  bool all = false;
+};
+
 inline constexpr char kFormulaSign = '=';
 inline constexpr char kEscapeSign = '\'';
 
+// Режим пересчёта значений формул
+enum class RecalculationMode {
+  OnDemand,  // значения вычисляются при обращении к ячейке или вызове Recalculate()
+  Automatic,  // затронутые изменением ячейки пересчитываются сразу после него
+  // затронутые изменением ячейки пересчитываются фоновым потоком, ячейки
+  // области просмотра первыми; по окончании публикуются значения
+  Background,
+};
+
 // Интерфейс таблицы
 class ISheet {
 public:
@@ -126,6 +299,11 @@ public:
   // * Если текст начинается с символа "'" (апостроф), то при выводе значения
   // ячейки методом GetValue() он опускается. Можно использовать, если нужно
   // начать текст со знака "=", но чтобы он не интерпретировался как формула.
+  // * Ссылка #REF!, которой формула выводит ячейку или диапазон, удалённые
+  // вставкой или удалением строк/столбцов, допустима и в задаваемой формуле:
+  // "=#REF!+1" разбирается как такая же удалённая ссылка, а значение формулы
+  // с ней — ошибка #REF!. Так текст любой формулы можно задать заново, в том
+  // числе при отмене изменений методом Undo().
   virtual void SetCell(Position pos, std::string text) = 0;
 
   // Возвращает значение ячейки.
@@ -133,6 +311,12 @@ public:
   virtual const ICell* GetCell(Position pos) const = 0;
   virtual ICell* GetCell(Position pos) = 0;
 
+  // Обходит непустые ячейки диапазона построчно, слева направо и сверху вниз.
+  // Бросает InvalidPositionException, если диапазон некорректен.
+  virtual void ForEachCellInRange(
+      Range range,
+      const std::function<void(Position, const ICell&)>& visitor) const = 0;
+
   // Очищает ячейку.
   // Последующий вызов GetCell() для этой ячейки вернёт либо nullptr, либо
   // объект с пустым текстом.
@@ -165,7 +349,174 @@ public:
   // соответственно. Пустая ячейка представляется пустой строкой в любом случае.
   virtual void PrintValues(std::ostream& output) const = 0;
   virtual void PrintTexts(std::ostream& output) const = 0;
+
+  // Загружает тексты ячеек из потока в формате PrintTexts(), начиная с
+  // позиции origin. Если separator не табуляция, поля могут быть взяты в
+  // кавычки, как в CSV. Пустое поле очищает ячейку. Поток читается блоками,
+  // ячейки записываются без сброса кешей, а формулы разбираются и
+  // проверяются на циклы одним проходом в конце. Бросает FormulaException,
+  // CircularDependencyException или InvalidPositionException, и тогда
+  // таблица остаётся в прежнем состоянии.
+  virtual void ImportTexts(std::istream& input, Position origin = Position {0, 0}, char separator = '\t') = 0;
+
+  // Пересчитывает значения всех ячеек, затронутых изменениями с момента
+  // предыдущего пересчёта. Ячейки вычисляются в топологическом порядке без
+  // рекурсии, поэтому глубина цепочки зависимостей не ограничена стеком.
+  virtual void Recalculate() = 0;
+
+  // Задаёт режим пересчёта. По умолчанию используется OnDemand. При
+  // переключении в Automatic сразу выполняется Recalculate().
+  // В режиме Background каждая изменяющая операция публикует снимок, в
+  // котором значения затронутых ячеек прежние и помечены IsPending(), а
+  // фоновый поток вычисляет их и публикует снимок с новыми значениями.
+  // Следующая изменяющая операция сначала останавливает фоновый пересчёт.
+  // GetCell()->GetValue() в потоке, изменяющем таблицу, не ждёт окончания
+  // фонового пересчёта: вычисленное значение возвращается сразу, а ещё не
+  // вычисленное поток вычисляет сам. Если же фоновый поток в этот момент
+  // вычисляет саму ячейку или ячейку, которую читает её формула, вызов ждёт,
+  // пока это вычисление закончится. Не ожидающее чтение даёт GetValues():
+  // в снимке такие ячейки имеют прежние значения и помечены IsPending().
+  virtual void SetRecalculationMode(RecalculationMode mode) = 0;
+  virtual RecalculationMode GetRecalculationMode() const = 0;
+
+  // Задаёт область просмотра, ячейки которой фоновый пересчёт вычисляет
+  // первыми, в том числе ещё ни разу не вычислявшиеся. std::nullopt
+  // (по умолчанию) означает отсутствие области просмотра. Бросает
+  // InvalidPositionException, если диапазон некорректен.
+  virtual void SetViewport(std::optional<Range> viewport) = 0;
+
+  // Задаёт число потоков, в которых Recalculate() вычисляет независимые друг от
+  // друга ячейки (с одинаковой глубиной в графе зависимостей). Значение 1
+  // (по умолчанию) означает вычисление в вызывающем потоке.
+  virtual void SetRecalculationThreads(size_t count) = 0;
+
+  // Открывает пакет изменений. Вызовы SetCell() и ClearCell() внутри пакета
+  // только проверяют синтаксис и запоминают изменения, таблица остаётся в
+  // прежнем состоянии до CommitBatch(). Пакеты могут быть вложенными,
+  // изменения применяются при закрытии внешнего.
+  virtual void BeginBatch() = 0;
+
+  // Применяет все изменения пакета, один раз ищет циклические зависимости в
+  // затронутой части графа и один раз сбрасывает кеши зависимых ячеек.
+  // Если изменения образуют циклическую зависимость, бросается исключение
+  // CircularDependencyException и ни одно из изменений пакета не применяется.
+  // Вставка и удаление строк/столбцов внутри пакета сначала применяют уже
+  // накопленные изменения.
+  virtual void CommitBatch() = 0;
+
+  // Отменяет последнее изменение таблицы: SetCell(), ClearCell(),
+  // ImportTexts(), вставку или удаление строк/столбцов либо пакет изменений
+  // целиком. Журнал хранит прежние тексты изменённых ячеек, поэтому отмена
+  // стоит пропорционально размеру изменения, а не таблицы. Возвращает false,
+  // если отменять нечего или открыт пакет. Если за это время другой лист
+  // книги стал читать эту таблицу и восстановленная формула замкнула бы цикл,
+  // бросается исключение CircularDependencyException и таблица остаётся в
+  // прежнем состоянии.
+  virtual bool Undo() = 0;
+
+  // Повторяет последнее отменённое изменение, как Undo(). Любое другое
+  // изменение таблицы забывает отменённые изменения.
+  virtual bool Redo() = 0;
+
+  // Задаёт объём памяти журнала отмены в байтах, по умолчанию 32 МиБ. Когда
+  // журнал превышает объём, забываются самые старые изменения, а изменение
+  // больше объёма забывает весь журнал. Значение 0 отключает журнал.
+  virtual void SetUndoLimit(size_t bytes) = 0;
+
+  // Записывает двоичный снимок таблицы: тексты ячеек, ссылки формул и, если
+  // with_values, уже вычисленные значения формул. Незакоммиченные изменения
+  // пакета в снимок не попадают.
+  virtual void SaveSnapshot(std::ostream& output, bool with_values = true) const = 0;
+
+  // Вычисляет значения, затронутые изменениями, и публикует новый снимок
+  // значений. Новый снимок разделяет с предыдущим все неизменившиеся части,
+  // поэтому публикация стоит пропорционально числу изменившихся ячеек
+  // (вставка и удаление строк/столбцов перестраивают снимок целиком).
+  // Вызывается потоком, изменяющим таблицу.
+  virtual void PublishValues() = 0;
+
+  // Возвращает последний опубликованный снимок значений. Вместе с
+  // GetStats() единственный метод таблицы, который можно вызывать из других
+  // потоков во время её изменения: остальные методы, включая
+  // GetCell()->GetValue(), требуют внешней синхронизации с изменениями.
+  virtual std::shared_ptr<const IValueSnapshot> GetValues() const = 0;
+
+  // Возвращает счётчики работы таблицы. Счётчики читаются без блокировок,
+  // поэтому во время изменений они могут быть согласованы между собой лишь
+  // приблизительно.
+  virtual SheetStats GetStats() const = 0;
+
+  // Задаёт обработчик, который вызывается по завершении каждой изменяющей
+  // операции таблицы, вычисления и печати, в том числе завершившихся
+  // исключением. Вложенные операции (например, SetCell() внутри пакета)
+  // отдельно не сообщаются. Обработчик вызывается в потоке операции и не
+  // должен бросать исключения. Пустой обработчик отключает трассировку.
+  virtual void SetTraceCallback(std::function<void(const SheetTraceEvent&)> callback) = 0;
+
+  // Задаёт обработчик изменений. Он вызывается по завершении SetCell(),
+  // ClearCell(), CommitBatch(), ImportTexts(), Undo(), Redo() и вставки или
+  // удаления строк/столбцов, если значения каких-то ячеек могли измениться,
+  // причём изменения пакета сообщаются одним вызовом. Сообщаются изменённые
+  // ячейки и ячейки со сброшенным кешем значения; ячейка, значение которой не
+  // вычислялось с предыдущего уведомления о ней, повторно не сообщается.
+  // Изменения отслеживаются с момента подписки. Обработчик вызывается в
+  // потоке операции и может читать таблицу. Пустой обработчик отключает
+  // уведомления.
+  virtual void SetChangeCallback(std::function<void(const SheetChanges&)> callback) = 0;
+
+  // Возвращает лист книги с заданным именем, ячейки которого читают формулы
+  // вида Sheet2!A1, либо nullptr, если такого листа нет или таблица не входит
+  // в книгу.
+  virtual const ISheet* FindSheet(std::string_view name) const = 0;
+};
+
+// Книга из нескольких листов, формулы которых могут ссылаться на ячейки и
+// диапазоны других листов: Sheet2!A1, SUM(Sheet2!A1:B10). Изменение листа
+// сбрасывает кеш ячеек других листов, читающих изменённые ячейки, и
+// сообщается их обработчикам изменений. Циклическая зависимость через
+// несколько листов отвергается так же, как внутри одного листа. Ссылка на
+// отсутствующий лист вычисляется в ошибку FormulaError::Ref. Вставка и
+// удаление строк/столбцов листа не меняют ссылки на него из других листов.
+// Все листы книги вместе требуют такой же внешней синхронизации изменений,
+// как один лист: фоновый пересчёт всех листов останавливается при изменении
+// любого из них.
+class IWorkbook {
+public:
+  virtual ~IWorkbook() = default;
+
+  // Добавляет пустой лист и возвращает его. Имя состоит из латинских букв,
+  // цифр и знаков подчёркивания и не начинается с цифры, регистр букв
+  // различается. Бросает InvalidSheetNameException, если имя некорректно
+  // или уже занято. Формулы, ссылавшиеся на лист до его добавления,
+  // вычисляются заново. Листы живут столько же, сколько книга.
+  virtual ISheet& AddSheet(std::string name) = 0;
+
+  // Возвращает лист с заданным именем, либо nullptr, если такого листа нет.
+  virtual ISheet* GetSheet(std::string_view name) = 0;
+  virtual const ISheet* GetSheet(std::string_view name) const = 0;
+
+  // Возвращает имена листов в порядке их добавления.
+  virtual std::vector<std::string> GetSheetNames() const = 0;
+
+  // Вычисляет все ячейки со сброшенным кешем на всех листах. Листы, которые
+  // не читают друг друга, вычисляются параллельно.
+  virtual void Recalculate() = 0;
+
+  // Задаёт число потоков, в которых Recalculate() вычисляет независимые друг
+  // от друга листы. Значение 1 (по умолчанию) означает вычисление в
+  // вызывающем потоке.
+  virtual void SetRecalculationThreads(size_t count) = 0;
 };
 
 // Создаёт готовую к работе пустую таблицу.
 std::unique_ptr<ISheet> CreateSheet();
+
+// Создаёт книгу без листов. Листы книги разделяют разобранные формулы.
+std::unique_ptr<IWorkbook> CreateWorkbook();
+
+// Открывает снимок, записанный SaveSnapshot(). Файл отображается в память и
+// читается при открытии один раз для проверки контрольной суммы, формулы
+// разбираются только при первом вычислении или изменении структуры таблицы,
+// сохранённые значения используются без пересчёта. Бросает SnapshotException,
+// если файл повреждён или записан другой версией формата.
+std::unique_ptr<ISheet> LoadSnapshot(const std::string& path);
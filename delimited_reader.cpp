@@ -0,0 +1,99 @@
+#include "delimited_reader.h"
+
+#include <algorithm>
+
+DelimitedReader::DelimitedReader(std::istream& input, char separator)
+    : input_(input), separator_(separator), quoting_(separator != '\t'), chunk_(CHUNK_SIZE) {}
+
+bool DelimitedReader::Fill() {
+
+    if (pos_ < size_) return true;
+
+    if (!input_) return false;
+
+    input_.read(chunk_.data(), static_cast<std::streamsize>(chunk_.size()));
+
+    pos_ = 0;
+    size_ = static_cast<size_t>(input_.gcount());
+
+    return size_ > 0;
+}
+
+void DelimitedReader::ReadQuoted() {
+
+    while (Fill()) {
+
+        const char* begin = chunk_.data() + pos_;
+        const char* end = chunk_.data() + size_;
+        const char* quote = std::find(begin, end, '"');
+
+        field_.append(begin, quote);
+        pos_ = quote - chunk_.data();
+
+        if (quote == end) continue;
+
+        pos_++;
+
+        if (Fill() && chunk_[pos_] == '"') {
+            field_ += '"';
+            pos_++;
+            continue;
+        }
+
+        return;
+    }
+}
+
+bool DelimitedReader::Next(std::string_view& field, bool& row_end) {
+
+    field_.clear();
+
+    if (!Fill() && !pending_field_) return false;
+
+    pending_field_ = false;
+
+    if (quoting_ && Fill() && chunk_[pos_] == '"') {
+        pos_++;
+        ReadQuoted();
+    }
+
+    // a carriage return inside quotes is the data, only an unquoted one belongs to the line break
+    size_t quoted_size = field_.size();
+
+    auto finish = [&] {
+        if (field_.size() > quoted_size && field_.back() == '\r') field_.pop_back();
+        field = field_;
+    };
+
+    while (Fill()) {
+
+        const char* begin = chunk_.data() + pos_;
+        const char* end = chunk_.data() + size_;
+        const char* stop = std::find_if(begin, end, [this](char c) {
+            return c == separator_ || c == '\n';
+        });
+
+        field_.append(begin, stop);
+        pos_ = stop - chunk_.data();
+
+        if (stop == end) continue;
+
+        pos_++;
+
+        row_end = *stop == '\n';
+        pending_field_ = !row_end;
+
+        if (row_end) {
+            finish();
+        } else {
+            field = field_;
+        }
+
+        return true;
+    }
+
+    row_end = true;
+    finish();
+
+    return true;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <istream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Reads separated fields from a stream in fixed chunks, rows end with '\n' or "\r\n". With a separator
+// other than a tab fields may be quoted as in CSV: a quoted field holds separators and line breaks,
+// a doubled quote stands for one. Tab-separated input is read as PrintTexts writes it, without quoting.
+class DelimitedReader {
+
+private:
+
+    static constexpr size_t CHUNK_SIZE = 1 << 16;
+
+    std::istream& input_;
+    char separator_;
+    bool quoting_;
+
+    std::vector<char> chunk_;
+    size_t pos_ = 0;
+    size_t size_ = 0;
+
+    std::string field_;
+
+    // the last field ended with a separator, so one more follows even at the end of the input
+    bool pending_field_ = false;
+
+    bool Fill();
+
+    void ReadQuoted();
+
+public:
+
+    DelimitedReader(std::istream& input, char separator);
+
+    // reads the next field, it stays valid until the next call. Returns false at the end of the input
+    bool Next(std::string_view& field, bool& row_end);
+};
@@ -0,0 +1,117 @@
+#include "dependency_graph.h"
+
+#include <algorithm>
+
+void DependencyGraph::EdgeList::PushBack(Entry entry) {
+
+    if (size_ == capacity_) {
+
+        uint32_t capacity = capacity_ * 2;
+        auto* data = new Entry[capacity];
+
+        std::copy(begin(), end(), data);
+
+        Release();
+
+        heap_ = data;
+        capacity_ = capacity;
+    }
+
+    begin()[size_++] = entry;
+}
+
+DependencyGraph::Node& DependencyGraph::GetNode(CellId cell) {
+
+    if (cell >= nodes_.size()) {
+        nodes_.resize(cell + 1);
+        marks_.resize(cell + 1, 0);
+    }
+
+    return nodes_[cell];
+}
+
+void DependencyGraph::RemoveEntry(CellId cell, bool out, uint32_t index) {
+
+    EdgeList& list = out ? nodes_[cell].out : nodes_[cell].in;
+
+    uint32_t last = list.Size() - 1;
+
+    if (index != last) {
+
+        Entry moved = list[last];
+        list[index] = moved;
+
+        EdgeList& twin_list = out ? nodes_[moved.cell].in : nodes_[moved.cell].out;
+        twin_list[moved.twin].twin = index;
+    }
+
+    list.PopBack();
+}
+
+void DependencyGraph::SetDependencies(CellId cell, const std::vector<CellId>& dependencies) {
+
+    ClearDependencies(cell);
+
+    for (CellId dependency: dependencies) {
+
+        // both nodes are created first, growing the vector invalidates references to the lists
+        GetNode(dependency);
+        Node& node = GetNode(cell);
+        EdgeList& in = nodes_[dependency].in;
+
+        uint32_t out_index = node.out.Size();
+        uint32_t in_index = in.Size();
+
+        node.out.PushBack(Entry {dependency, in_index});
+        in.PushBack(Entry {cell, out_index});
+    }
+}
+
+void DependencyGraph::ClearDependencies(CellId cell) {
+
+    if (cell >= nodes_.size()) return;
+
+    // removing from the back leaves the indexes of the remaining entries as they are
+    while (!nodes_[cell].out.Empty()) {
+        Entry entry = nodes_[cell].out.Back();
+        RemoveEntry(entry.cell, false, entry.twin);
+        nodes_[cell].out.PopBack();
+    }
+}
+
+void DependencyGraph::Remove(CellId cell) {
+
+    if (cell < ranks_.size()) ranks_[cell] = UNRANKED;
+
+    if (cell >= nodes_.size()) return;
+
+    ClearDependencies(cell);
+
+    while (!nodes_[cell].in.Empty()) {
+        Entry entry = nodes_[cell].in.Back();
+        RemoveEntry(entry.cell, true, entry.twin);
+        nodes_[cell].in.PopBack();
+    }
+
+    // the list may have grown into the heap, a reused id starts small again
+    nodes_[cell] = Node();
+}
+
+void DependencyGraph::BeginVisit() {
+
+    if (++epoch_ == 0) {
+        std::fill(marks_.begin(), marks_.end(), 0);
+        epoch_ = 1;
+    }
+}
+
+bool DependencyGraph::Visit(CellId cell) {
+
+    if (cell >= marks_.size()) marks_.resize(cell + 1, 0);
+
+    if (marks_[cell] == epoch_) return false;
+
+    marks_[cell] = epoch_;
+
+    return true;
+}
@@ -0,0 +1,209 @@
+#pragma once
+
+#include "cell.h"
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// Dependencies between the formula cells of a sheet, nodes are the stable cell ids of the grid.
+// Every edge is kept in the out-list of the formula cell and in the in-list of the referenced one,
+// each entry knows the index of its twin in the other list, so an edge is removed in constant time
+// without searching and without hash sets.
+class DependencyGraph {
+
+private:
+
+    struct Entry {
+        CellId cell;
+        // index of the reverse entry in the list of cell
+        uint32_t twin;
+    };
+
+    // Most cells reference one or two others, such lists live inline and don't allocate.
+    class EdgeList {
+
+    private:
+
+        static constexpr uint32_t INLINE_CAPACITY = 2;
+
+        uint32_t size_ = 0;
+        uint32_t capacity_ = INLINE_CAPACITY;
+
+        union {
+            Entry inline_[INLINE_CAPACITY];
+            Entry* heap_;
+        };
+
+        bool IsInline() const {
+            return capacity_ == INLINE_CAPACITY;
+        }
+
+        void Release() {
+            if (!IsInline()) delete[] heap_;
+        }
+
+    public:
+
+        EdgeList() {}
+
+        EdgeList(const EdgeList&) = delete;
+        EdgeList& operator=(const EdgeList&) = delete;
+
+        EdgeList(EdgeList&& other) noexcept {
+            *this = std::move(other);
+        }
+
+        EdgeList& operator=(EdgeList&& other) noexcept {
+
+            if (this == &other) return *this;
+
+            Release();
+
+            size_ = other.size_;
+            capacity_ = other.capacity_;
+
+            if (other.IsInline()) {
+                for (uint32_t i = 0; i < size_; ++i) inline_[i] = other.inline_[i];
+            } else {
+                heap_ = other.heap_;
+            }
+
+            other.size_ = 0;
+            other.capacity_ = INLINE_CAPACITY;
+
+            return *this;
+        }
+
+        ~EdgeList() {
+            Release();
+        }
+
+        uint32_t Size() const {
+            return size_;
+        }
+
+        bool Empty() const {
+            return size_ == 0;
+        }
+
+        Entry* begin() {
+            return IsInline() ? inline_ : heap_;
+        }
+
+        Entry* end() {
+            return begin() + size_;
+        }
+
+        const Entry* begin() const {
+            return IsInline() ? inline_ : heap_;
+        }
+
+        const Entry* end() const {
+            return begin() + size_;
+        }
+
+        Entry& operator[](uint32_t index) {
+            return begin()[index];
+        }
+
+        Entry& Back() {
+            return begin()[size_ - 1];
+        }
+
+        void PushBack(Entry entry);
+
+        void PopBack() {
+            size_--;
+        }
+    };
+
+    struct Node {
+        EdgeList out;
+        EdgeList in;
+    };
+
+    std::vector<Node> nodes_;
+
+    // a node is visited in the current traversal if its mark equals the epoch
+    std::vector<uint32_t> marks_;
+    uint32_t epoch_ = 0;
+
+    static constexpr int64_t UNRANKED = INT64_MIN;
+
+    // topological ranks kept by the sheet: a cell is ranked below the cells reading it, directly or
+    // through a range. A cell without a rank has no dependencies, so it may take one below all others
+    std::vector<int64_t> ranks_;
+    int64_t min_rank_ = 0;
+    int64_t max_rank_ = 0;
+
+    Node& GetNode(CellId cell);
+
+    // drops the entry at index from the out- or in-list of cell, the last entry takes its place
+    void RemoveEntry(CellId cell, bool out, uint32_t index);
+
+public:
+
+    // replaces the out-edges of the cell, the dependencies must be unique
+    void SetDependencies(CellId cell, const std::vector<CellId>& dependencies);
+
+    void ClearDependencies(CellId cell);
+
+    // removes all edges of the cell, so its id may be reused
+    void Remove(CellId cell);
+
+    bool HasDependents(CellId cell) const {
+        return cell < nodes_.size() && !nodes_[cell].in.Empty();
+    }
+
+    bool HasDependencies(CellId cell) const {
+        return cell < nodes_.size() && !nodes_[cell].out.Empty();
+    }
+
+    template <typename Visitor>
+    void ForEachDependency(CellId cell, Visitor visitor) const {
+        if (cell >= nodes_.size()) return;
+        for (const Entry& entry: nodes_[cell].out) visitor(entry.cell);
+    }
+
+    template <typename Visitor>
+    void ForEachDependent(CellId cell, Visitor visitor) const {
+        if (cell >= nodes_.size()) return;
+        for (const Entry& entry: nodes_[cell].in) visitor(entry.cell);
+    }
+
+    int64_t GetRank(CellId cell) {
+
+        if (cell >= ranks_.size()) ranks_.resize(cell + 1, UNRANKED);
+
+        if (ranks_[cell] == UNRANKED) ranks_[cell] = --min_rank_;
+
+        return ranks_[cell];
+    }
+
+    void SetRank(CellId cell, int64_t rank) {
+        GetRank(cell);
+        ranks_[cell] = rank;
+    }
+
+    // a rank above all others
+    int64_t TakeMaxRank() {
+        return ++max_rank_;
+    }
+
+    // the first of count consecutive ranks below all others
+    int64_t TakeMinRanks(size_t count) {
+        min_rank_ -= static_cast<int64_t>(count);
+        return min_rank_;
+    }
+
+    // starts a traversal, every node becomes unvisited without touching the marks
+    void BeginVisit();
+
+    // marks the node as visited, returns false if it was visited already
+    bool Visit(CellId cell);
+
+    bool IsVisited(CellId cell) const {
+        return cell < marks_.size() && marks_[cell] == epoch_;
+    }
+};
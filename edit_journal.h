@@ -0,0 +1,203 @@
+#pragma once
+
+#include "common.h"
+
+#include <deque>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+// The edits of a sheet as the edits undoing them, one step per outermost edit or batch. Applying the entries
+// of a step in reverse order undoes it, and the edits doing so record the step redoing it. The entries are
+// the changed texts and the structural edits, so a step costs as much as the edit itself and the cells it
+// didn't change are not copied. The oldest steps are dropped once the entries take more than the limit.
+class EditJournal {
+
+public:
+
+    enum class Kind : uint8_t {
+        TEXT,
+        INSERT_ROWS,
+        INSERT_COLS,
+        DELETE_ROWS,
+        DELETE_COLS
+    };
+
+    // sets the text of the cell, an empty one clears it, or inserts or deletes rows or columns
+    struct Entry {
+        Kind kind;
+        Position pos;
+        std::string text;
+        int count = 0;
+    };
+
+    using Step = std::vector<Entry>;
+
+    // where the step being recorded goes: an edit is undone by it, an undo redone, a redo undone again
+    enum class Direction : uint8_t {
+        EDIT,
+        UNDO,
+        REDO
+    };
+
+    static constexpr size_t DEFAULT_MAX_SIZE = 32 << 20;
+
+private:
+
+    std::deque<Step> undo_steps_;
+    std::vector<Step> redo_steps_;
+    size_t size_ = 0;
+    size_t max_size_ = DEFAULT_MAX_SIZE;
+
+    Step step_;
+    size_t step_size_ = 0;
+    Direction direction_ = Direction::EDIT;
+    bool recording_ = true;
+    // the edit is too big to be undone, so is everything before it
+    bool overflowed_ = false;
+
+    static size_t GetSize(const Entry& entry) {
+        return sizeof(Entry) + entry.text.size();
+    }
+
+    static size_t GetSize(const Step& step) {
+
+        size_t size = 0;
+
+        for (const Entry& entry: step) size += GetSize(entry);
+
+        return size;
+    }
+
+    void Add(Entry entry) {
+
+        // the step undoing an undo or a redo is about as big as the step replayed, it is kept whole
+        if (direction_ == Direction::EDIT && step_size_ + GetSize(entry) > max_size_) {
+            overflowed_ = true;
+            step_.clear();
+            step_size_ = 0;
+            return;
+        }
+
+        step_size_ += GetSize(entry);
+        step_.push_back(std::move(entry));
+    }
+
+    void DropOldest() {
+        while (size_ > max_size_ && !undo_steps_.empty()) {
+            size_ -= GetSize(undo_steps_.front());
+            undo_steps_.pop_front();
+        }
+    }
+
+public:
+
+    bool IsRecording() const {
+        return recording_ && max_size_ > 0 && !overflowed_;
+    }
+
+    void AddText(Position pos, std::string text) {
+        if (IsRecording()) Add(Entry {Kind::TEXT, pos, std::move(text)});
+    }
+
+    // the index of the first row or column goes into both coordinates of the position
+    void AddStructural(Kind kind, int index, int count) {
+        if (IsRecording()) Add(Entry {kind, Position {index, index}, std::string(), count});
+    }
+
+    // the replay records the opposite step, which the commit puts onto the other stack
+    std::optional<Step> Take(Direction direction) {
+
+        std::optional<Step> step;
+
+        if (direction == Direction::UNDO && !undo_steps_.empty()) {
+            step = std::move(undo_steps_.back());
+            undo_steps_.pop_back();
+        } else if (direction == Direction::REDO && !redo_steps_.empty()) {
+            step = std::move(redo_steps_.back());
+            redo_steps_.pop_back();
+        }
+
+        if (step) {
+            size_ -= GetSize(*step);
+            direction_ = direction;
+        }
+
+        return step;
+    }
+
+    // a replay which failed, returns the entries undoing what it applied and puts the step back
+    Step Abort(Step step) {
+
+        Step applied = std::exchange(step_, Step());
+
+        size_ += GetSize(step);
+
+        if (direction_ == Direction::UNDO) {
+            undo_steps_.push_back(std::move(step));
+        } else {
+            redo_steps_.push_back(std::move(step));
+        }
+
+        step_size_ = 0;
+        direction_ = Direction::EDIT;
+
+        return applied;
+    }
+
+    void SetRecording(bool recording) {
+        recording_ = recording;
+    }
+
+    // the end of the outermost edit
+    void Commit() {
+
+        Direction direction = std::exchange(direction_, Direction::EDIT);
+
+        if (std::exchange(overflowed_, false)) {
+            Clear();
+            return;
+        }
+
+        if (step_.empty()) return;
+
+        // a new edit makes the undone steps unreachable
+        if (direction == Direction::EDIT) {
+            for (const Step& step: redo_steps_) size_ -= GetSize(step);
+            redo_steps_.clear();
+        }
+
+        size_ += step_size_;
+
+        if (direction == Direction::UNDO) {
+            redo_steps_.push_back(std::move(step_));
+        } else {
+            undo_steps_.push_back(std::move(step_));
+        }
+
+        step_.clear();
+        step_size_ = 0;
+
+        DropOldest();
+    }
+
+    void SetMaxSize(size_t max_size) {
+
+        max_size_ = max_size;
+
+        if (max_size_ == 0) {
+            Clear();
+        } else {
+            DropOldest();
+        }
+    }
+
+    void Clear() {
+        undo_steps_.clear();
+        redo_steps_.clear();
+        size_ = 0;
+        step_.clear();
+        step_size_ = 0;
+    }
+};
@@ -0,0 +1,421 @@
+#include "expression_parser.h"
+
+#include <utility>
+
+namespace {
+
+class Lexer {
+
+public:
+
+    enum class TokenType {
+        END,
+        NUMBER,
+        CELL,
+        REF,
+        SHEET,
+        FUNCTION,
+        ADD,
+        SUB,
+        MUL,
+        DIV,
+        LEFT_PAREN,
+        RIGHT_PAREN,
+        COLON,
+        COMMA
+    };
+
+    struct Token {
+        TokenType type;
+        std::string_view text;
+    };
+
+private:
+
+    std::string_view input_;
+    size_t pos_ = 0;
+
+    static bool IsDigit(char c) {
+        return c >= '0' && c <= '9';
+    }
+
+    static bool IsLetter(char c) {
+        return c >= 'A' && c <= 'Z';
+    }
+
+    static bool IsNameChar(char c) {
+        return IsLetter(c) || IsDigit(c) || (c >= 'a' && c <= 'z') || c == '_';
+    }
+
+    static bool IsSpace(char c) {
+        return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+    }
+
+    size_t SkipDigits(size_t pos) const {
+        while (pos < input_.size() && IsDigit(input_[pos])) ++pos;
+        return pos;
+    }
+
+    // NUMBER: UINT EXPONENT? | UINT? '.' UINT EXPONENT?
+    size_t ScanNumber(size_t pos) const {
+
+        size_t end = SkipDigits(pos);
+
+        if (end < input_.size() && input_[end] == '.') {
+            size_t fraction_end = SkipDigits(end + 1);
+            if (fraction_end == end + 1) throw FormulaException("no digits after the decimal point");
+            end = fraction_end;
+        }
+
+        // the exponent is a part of the number only if it has digits, "1e" is lexed as "1" and an error
+        if (end < input_.size() && (input_[end] == 'e' || input_[end] == 'E')) {
+
+            size_t exponent_begin = end + 1;
+
+            if (exponent_begin < input_.size() && (input_[exponent_begin] == '+' || input_[exponent_begin] == '-')) {
+                ++exponent_begin;
+            }
+
+            size_t exponent_end = SkipDigits(exponent_begin);
+
+            if (exponent_end > exponent_begin) end = exponent_end;
+        }
+
+        return end;
+    }
+
+    // SHEET: [A-Za-z_][A-Za-z0-9_]* '!', the end of the sheet name or the position it starts at
+    size_t ScanSheet(size_t pos) const {
+
+        if (IsDigit(input_[pos])) return pos;
+
+        size_t end = pos;
+        while (end < input_.size() && IsNameChar(input_[end])) ++end;
+
+        return end < input_.size() && input_[end] == '!' ? end + 1 : pos;
+    }
+
+    // REF: '#REF!', a reference deleted by a structural edit, as the formulas print it
+    static constexpr std::string_view REF_TEXT = "#REF!";
+
+    // CELL: [A-Z]+[0-9]+, letters without digits are a function name
+    size_t ScanName(size_t pos) const {
+
+        size_t letters_end = pos;
+        while (letters_end < input_.size() && IsLetter(input_[letters_end])) ++letters_end;
+
+        return SkipDigits(letters_end);
+    }
+
+public:
+
+    explicit Lexer(std::string_view input): input_(input) {}
+
+    Token Next() {
+
+        while (pos_ < input_.size() && IsSpace(input_[pos_])) ++pos_;
+
+        if (pos_ == input_.size()) return Token {TokenType::END, std::string_view()};
+
+        size_t begin = pos_;
+        char c = input_[pos_];
+        TokenType type;
+
+        if (IsNameChar(c) && ScanSheet(pos_) > pos_) {
+            pos_ = ScanSheet(pos_);
+            type = TokenType::SHEET;
+        } else if (IsDigit(c) || c == '.') {
+            pos_ = ScanNumber(pos_);
+            type = TokenType::NUMBER;
+        } else if (IsLetter(c)) {
+            pos_ = ScanName(pos_);
+            type = IsDigit(input_[pos_ - 1]) ? TokenType::CELL : TokenType::FUNCTION;
+        } else if (input_.substr(pos_, REF_TEXT.size()) == REF_TEXT) {
+            pos_ += REF_TEXT.size();
+            type = TokenType::REF;
+        } else {
+
+            switch (c) {
+                case '+': type = TokenType::ADD; break;
+                case '-': type = TokenType::SUB; break;
+                case '*': type = TokenType::MUL; break;
+                case '/': type = TokenType::DIV; break;
+                case '(': type = TokenType::LEFT_PAREN; break;
+                case ')': type = TokenType::RIGHT_PAREN; break;
+                case ':': type = TokenType::COLON; break;
+                case ',': type = TokenType::COMMA; break;
+                default: throw FormulaException(std::string("unexpected character '") + c + "'");
+            }
+
+            ++pos_;
+        }
+
+        return Token {type, input_.substr(begin, pos_ - begin)};
+    }
+
+    Token Peek() const {
+        return Lexer(*this).Next();
+    }
+};
+
+// expr   : term ((ADD | SUB) term)*
+// term   : unary ((MUL | DIV) unary)*
+// unary  : (ADD | SUB) unary | primary
+// primary: '(' expr ')' | FUNCTION '(' arg (',' arg)* ')' | SHEET? CELL | REF | NUMBER
+// arg    : SHEET? CELL ':' CELL | expr
+//
+// this is the precedence ANTLR gives to the left-recursive rule of Formula.g4: the unary operators bind
+// tighter than the binary ones and the binary ones are left-associative
+class Parser {
+
+private:
+
+    using TokenType = Lexer::TokenType;
+
+    static constexpr int MAX_NESTING_DEPTH = 1000;
+
+    Lexer lexer_;
+    Lexer::Token token_;
+    Ast::TreeBuilder& builder_;
+    int depth_ = 0;
+
+    void Advance() {
+        token_ = lexer_.Next();
+    }
+
+    void ParseExpr() {
+
+        ParseTerm();
+
+        while (token_.type == TokenType::ADD || token_.type == TokenType::SUB) {
+            Ast::BinaryOperator op = token_.type == TokenType::ADD ? Ast::BinaryOperator::ADD : Ast::BinaryOperator::SUB;
+            Advance();
+            ParseTerm();
+            builder_.AddBinaryOp(op);
+        }
+    }
+
+    void ParseTerm() {
+
+        ParseUnary();
+
+        while (token_.type == TokenType::MUL || token_.type == TokenType::DIV) {
+            Ast::BinaryOperator op = token_.type == TokenType::MUL ? Ast::BinaryOperator::MUL : Ast::BinaryOperator::DIV;
+            Advance();
+            ParseUnary();
+            builder_.AddBinaryOp(op);
+        }
+    }
+
+    void ParseUnary() {
+
+        if (token_.type == TokenType::ADD || token_.type == TokenType::SUB) {
+            Ast::UnaryOperator op = token_.type == TokenType::ADD ? Ast::UnaryOperator::PLUS : Ast::UnaryOperator::MINUS;
+            Advance();
+            EnterNested();
+            ParseUnary();
+            depth_--;
+            builder_.AddUnaryOp(op);
+        } else {
+            ParsePrimary();
+        }
+    }
+
+    void ParsePrimary() {
+
+        switch (token_.type) {
+
+            case TokenType::LEFT_PAREN:
+                Advance();
+                EnterNested();
+                ParseExpr();
+                depth_--;
+                if (token_.type != TokenType::RIGHT_PAREN) throw FormulaException("missing closing parenthesis");
+                Advance();
+                builder_.AddParentheses();
+                break;
+
+            case TokenType::FUNCTION:
+                ParseFunction();
+                break;
+
+            case TokenType::CELL:
+                builder_.AddCell(token_.text);
+                Advance();
+                break;
+
+            case TokenType::REF:
+                builder_.AddDeletedCell();
+                Advance();
+                break;
+
+            case TokenType::SHEET: {
+                std::string_view sheet = GetSheetName(token_);
+                Advance();
+                if (token_.type != TokenType::CELL) throw FormulaException("missing cell of sheet reference");
+                builder_.AddExternalCell(sheet, token_.text);
+                Advance();
+                break;
+            }
+
+            case TokenType::NUMBER:
+                builder_.AddLiteral(token_.text);
+                Advance();
+                break;
+
+            case TokenType::END:
+                throw FormulaException("unexpected end of formula");
+
+            default:
+                throw FormulaException("unexpected token '" + std::string(token_.text) + "'");
+        }
+    }
+
+    void ParseFunction() {
+
+        std::optional<Ast::Function> function = Ast::FunctionFromString(token_.text);
+
+        if (!function) throw FormulaException("unknown function '" + std::string(token_.text) + "'");
+
+        Advance();
+
+        if (token_.type != TokenType::LEFT_PAREN) throw FormulaException("missing arguments of function");
+
+        EnterNested();
+
+        size_t arg_count = 0;
+
+        do {
+            Advance();
+            ParseArgument();
+            arg_count++;
+        } while (token_.type == TokenType::COMMA);
+
+        depth_--;
+
+        if (token_.type != TokenType::RIGHT_PAREN) throw FormulaException("missing closing parenthesis");
+
+        Advance();
+        builder_.AddFunction(*function, arg_count);
+    }
+
+    void ParseArgument() {
+
+        if (token_.type == TokenType::SHEET) {
+
+            // a range needs two more tokens to be told from a cell
+            Lexer ahead = lexer_;
+
+            if (ahead.Next().type == TokenType::CELL && ahead.Next().type == TokenType::COLON) {
+
+                std::string_view sheet = GetSheetName(token_);
+
+                Advance();
+                std::string_view first = token_.text;
+
+                Advance();
+                Advance();
+
+                if (token_.type != TokenType::CELL) throw FormulaException("invalid range");
+
+                builder_.AddExternalRange(sheet, first, token_.text);
+                Advance();
+                return;
+            }
+        }
+
+        if (token_.type == TokenType::CELL && lexer_.Peek().type == TokenType::COLON) {
+
+            std::string_view first = token_.text;
+
+            Advance();
+            Advance();
+
+            if (token_.type != TokenType::CELL) throw FormulaException("invalid range");
+
+            builder_.AddRange(first, token_.text);
+            Advance();
+        } else {
+            ParseExpr();
+        }
+    }
+
+    static std::string_view GetSheetName(Lexer::Token token) {
+        return token.text.substr(0, token.text.size() - 1);
+    }
+
+    void EnterNested() {
+        if (++depth_ > MAX_NESTING_DEPTH) throw FormulaException("formula is nested too deeply");
+    }
+
+public:
+
+    Parser(std::string_view expression, Ast::TreeBuilder& builder)
+        : lexer_(expression),
+          token_ {TokenType::END, std::string_view()},
+          builder_(builder) {}
+
+    void Parse() {
+
+        Advance();
+        ParseExpr();
+
+        if (token_.type != TokenType::END) {
+            throw FormulaException("unexpected token '" + std::string(token_.text) + "'");
+        }
+    }
+};
+
+}
+
+namespace Ast {
+
+void ParseExpression(std::string_view expression, TreeBuilder& builder) {
+    Parser(expression, builder).Parse();
+}
+
+std::string NormalizeExpression(std::string_view expression, Position origin) {
+
+    std::string result;
+    result.reserve(expression.size() + 8);
+
+    Lexer lexer(expression);
+
+    Lexer::TokenType previous = Lexer::TokenType::END;
+    bool external = false;
+
+    for (Lexer::Token token = lexer.Next(); token.type != Lexer::TokenType::END; token = lexer.Next()) {
+
+        // tokens are separated, so "1 2" doesn't become "12"
+        if (!result.empty()) result += ' ';
+
+        Lexer::TokenType type = std::exchange(previous, token.type);
+
+        if (token.type != Lexer::TokenType::CELL) {
+            result += token.text;
+            continue;
+        }
+
+        Position pos = Position::FromString(token.text);
+
+        if (!pos.IsValid()) throw FormulaException("invalid position");
+
+        // the cells of another sheet are absolute, both corners of its range as well
+        external = type == Lexer::TokenType::SHEET || (type == Lexer::TokenType::COLON && external);
+
+        if (external) {
+            result += token.text;
+            continue;
+        }
+
+        result += "R[";
+        result += std::to_string(pos.row - origin.row);
+        result += "]C[";
+        result += std::to_string(pos.col - origin.col);
+        result += ']';
+    }
+
+    return result;
+}
+
+}
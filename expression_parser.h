@@ -0,0 +1,30 @@
+#pragma once
+
+#include "ast.h"
+
+#include <memory>
+#include <string>
+#include <string_view>
+
+namespace Ast {
+
+// Hand-written recursive descent parser for the Formula.g4 grammar. It reads the expression in place and
+// passes tokens straight to the builder, so parsing itself doesn't allocate.
+// Throws FormulaException if the expression is syntactically incorrect.
+void ParseExpression(std::string_view expression, TreeBuilder& builder);
+
+// Writes the tokens of the expression separated by spaces, with cell references in the R1C1 notation
+// relative to the origin: B3 written in A1 is R[2]C[1]. A formula filled down or right gives the same
+// string in every cell. The cells of other sheets are absolute and stay as written.
+// Throws FormulaException on a lexical error or an invalid position.
+std::string NormalizeExpression(std::string_view expression, Position origin);
+
+// The same grammar parsed by the ANTLR generated parser, kept as the reference implementation
+// for conformance checks and as a fallback. Throws FormulaException as well.
+void ParseExpressionAntlr(const std::string& expression, TreeBuilder& builder);
+
+}
+
+// The formula of a tree built by a parser outside formula.cpp, so the ANTLR parser and its runtime are linked
+// only into the targets using them
+std::unique_ptr<IFormula> MakeFormula(Ast::Tree tree);
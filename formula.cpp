@@ -1,14 +1,36 @@
 #include "formula.h"
-#include "ast_formula_listener.h"
-#include "FormulaLexer.h"
+#include "expression_parser.h"
+#include "formula_templates.h"
 
+#include <algorithm>
 #include <set>
+#include <tuple>
+
+bool ExternalReference::operator==(const ExternalReference& rhs) const {
+    return sheet == rhs.sheet && range == rhs.range;
+}
+
+bool ExternalReference::operator<(const ExternalReference& rhs) const {
+    return std::tie(sheet, range) < std::tie(rhs.sheet, rhs.range);
+}
 
 class Formula : public IFormula {
 
 private:
     Ast::Tree tree_;
 
+    // A deleted range is scanned with the ranges of its call, while the #REF! written in its place is parsed
+    // as a value argument, which goes before them. The formula is parsed again, so its value is the one
+    // its text gives. A deleted reference to another sheet is parsed again the same way
+    void ReparseDeletedRanges() {
+
+        if (!tree_.HasDeletedRanges()) return;
+
+        Ast::TreeBuilder builder;
+        Ast::ParseExpression(tree_.BuildExpression(), builder);
+        tree_ = builder.Build();
+    }
+
 public:
 
     explicit Formula(Ast::Tree tree): tree_(std::move(tree)) {}
@@ -25,6 +47,14 @@ public:
         return tree_.GetReferencedCells();
     }
 
+    std::vector<Range> GetReferencedRanges() const override {
+        return tree_.GetReferencedRanges();
+    }
+
+    std::vector<ExternalReference> GetExternalReferences() const override {
+        return tree_.GetExternalReferences();
+    }
+
     HandlingResult HandleInsertedRows(int before, int count) override {
         size_t updated_cell_params = tree_.HandleInsertedRows(before, count);
         return updated_cell_params > 0 ? HandlingResult::ReferencesRenamedOnly : HandlingResult::NothingChanged;
@@ -39,7 +69,10 @@ public:
 
         auto result = tree_.HandleDeletedRows(first, count);
 
-        if (result.first > 0) return HandlingResult::ReferencesChanged;
+        if (result.first > 0) {
+            ReparseDeletedRanges();
+            return HandlingResult::ReferencesChanged;
+        }
         return result.second > 0 ? HandlingResult::ReferencesRenamedOnly : HandlingResult::NothingChanged;
     }
 
@@ -47,50 +80,267 @@ public:
 
         auto result = tree_.HandleDeletedCols(first, count);
 
-        if (result.first > 0) return HandlingResult::ReferencesChanged;
+        if (result.first > 0) {
+            ReparseDeletedRanges();
+            return HandlingResult::ReferencesChanged;
+        }
+        return result.second > 0 ? HandlingResult::ReferencesRenamedOnly : HandlingResult::NothingChanged;
+    }
+
+    HandlingResult HandleExternalInsertedRows(std::string_view sheet, int before, int count) override {
+        size_t updated_params = tree_.HandleExternalInsertedRows(sheet, before, count);
+        return updated_params > 0 ? HandlingResult::ReferencesRenamedOnly : HandlingResult::NothingChanged;
+    }
+
+    HandlingResult HandleExternalInsertedCols(std::string_view sheet, int before, int count) override {
+        size_t updated_params = tree_.HandleExternalInsertedCols(sheet, before, count);
+        return updated_params > 0 ? HandlingResult::ReferencesRenamedOnly : HandlingResult::NothingChanged;
+    }
+
+    HandlingResult HandleExternalDeletedRows(std::string_view sheet, int first, int count) override {
+
+        auto result = tree_.HandleExternalDeletedRows(sheet, first, count);
+
+        if (result.first > 0) {
+            ReparseDeletedRanges();
+            return HandlingResult::ReferencesChanged;
+        }
+        return result.second > 0 ? HandlingResult::ReferencesRenamedOnly : HandlingResult::NothingChanged;
+    }
+
+    HandlingResult HandleExternalDeletedCols(std::string_view sheet, int first, int count) override {
+
+        auto result = tree_.HandleExternalDeletedCols(sheet, first, count);
+
+        if (result.first > 0) {
+            ReparseDeletedRanges();
+            return HandlingResult::ReferencesChanged;
+        }
         return result.second > 0 ? HandlingResult::ReferencesRenamedOnly : HandlingResult::NothingChanged;
     }
 
 };
 
-class BailErrorListener : public antlr4::BaseErrorListener {
+// Formula of a cell sharing a template. A structural edit behind all of its references moves them by
+// the same offset, so only the origin moves and the template stays shared. Otherwise the formula is
+// edited as a parsed copy with absolute references and interned again by its new expression, #REF!
+// included: it is parsed as the same deleted reference.
+class TemplateFormula : public IFormula {
+
+private:
+    std::shared_ptr<FormulaTemplates> templates_;
+    // of the sheet of the cell, the templates may be shared by the sheets of a workbook
+    StatsCounters& stats_;
+    std::shared_ptr<const Ast::Tree> template_;
+    Position origin_;
+
+    template <typename Handler>
+    HandlingResult Edit(Handler handler) {
+
+        std::unique_ptr<IFormula> edited;
+
+        {
+            StatsCounters::ParseScope scope(stats_);
+            edited = ParseFormula(template_->BuildExpression(origin_));
+        }
+
+        HandlingResult result = handler(*edited);
+
+        template_ = templates_->GetTemplate(edited->GetExpression(), origin_, stats_);
+
+        return result;
+    }
+
+    // a formula not reading the sheet is left sharing its template
+    template <typename Handler>
+    HandlingResult EditExternal(std::string_view sheet, Handler handler) {
+
+        std::vector<ExternalReference> references = template_->GetExternalReferences();
+
+        bool reads_sheet = std::any_of(references.begin(), references.end(), [sheet](const auto& reference) {
+            return reference.sheet == sheet;
+        });
+
+        return reads_sheet ? Edit(handler) : HandlingResult::NothingChanged;
+    }
+
+    // the references from the given row or column on are moved, the origin moves with them
+    bool MovesAllReferences(int Position::* coordinate, int first) const {
+        std::optional<int> min_referenced = template_->GetMinReferenced(coordinate, origin_);
+        return min_referenced != std::nullopt && *min_referenced >= first;
+    }
+
 public:
-    void syntaxError(
-        antlr4::Recognizer* /* recognizer */,
-        antlr4::Token* /* offendingSymbol */,
-        size_t /* line */,
-        size_t /* charPositionInLine */,
-        const std::string& msg,
-        std::exception_ptr /* e */
-    ) override {
-        throw std::runtime_error("Error when lexing: " + msg);
+
+    TemplateFormula(
+        std::shared_ptr<FormulaTemplates> templates,
+        StatsCounters& stats,
+        std::shared_ptr<const Ast::Tree> formula_template,
+        Position origin
+    ) : templates_(std::move(templates)), stats_(stats), template_(std::move(formula_template)), origin_(origin) {}
+
+    Value Evaluate(const ISheet& sheet) const override {
+        return template_->Evaluate(sheet, origin_);
+    }
+
+    std::string GetExpression() const override {
+        return template_->BuildExpression(origin_);
+    }
+
+    std::vector<Position> GetReferencedCells() const override {
+        return template_->GetReferencedCells(origin_);
+    }
+
+    std::vector<Range> GetReferencedRanges() const override {
+        return template_->GetReferencedRanges(origin_);
+    }
+
+    std::vector<ExternalReference> GetExternalReferences() const override {
+        return template_->GetExternalReferences();
+    }
+
+    HandlingResult HandleInsertedRows(int before, int count) override {
+
+        if (MovesAllReferences(&Position::row, before)) {
+            origin_.row += count;
+            return HandlingResult::ReferencesRenamedOnly;
+        }
+
+        return Edit([=](IFormula& formula) { return formula.HandleInsertedRows(before, count); });
+    }
+
+    HandlingResult HandleInsertedCols(int before, int count) override {
+
+        if (MovesAllReferences(&Position::col, before)) {
+            origin_.col += count;
+            return HandlingResult::ReferencesRenamedOnly;
+        }
+
+        return Edit([=](IFormula& formula) { return formula.HandleInsertedCols(before, count); });
+    }
+
+    HandlingResult HandleDeletedRows(int first, int count) override {
+
+        if (MovesAllReferences(&Position::row, first + count)) {
+            origin_.row -= count;
+            return HandlingResult::ReferencesRenamedOnly;
+        }
+
+        return Edit([=](IFormula& formula) { return formula.HandleDeletedRows(first, count); });
+    }
+
+    HandlingResult HandleDeletedCols(int first, int count) override {
+
+        if (MovesAllReferences(&Position::col, first + count)) {
+            origin_.col -= count;
+            return HandlingResult::ReferencesRenamedOnly;
+        }
+
+        return Edit([=](IFormula& formula) { return formula.HandleDeletedCols(first, count); });
+    }
+
+    // the references to other sheets are absolute, a template shared by other cells is never moved in place
+    HandlingResult HandleExternalInsertedRows(std::string_view sheet, int before, int count) override {
+        return EditExternal(sheet, [=](IFormula& formula) {
+            return formula.HandleExternalInsertedRows(sheet, before, count);
+        });
+    }
+
+    HandlingResult HandleExternalInsertedCols(std::string_view sheet, int before, int count) override {
+        return EditExternal(sheet, [=](IFormula& formula) {
+            return formula.HandleExternalInsertedCols(sheet, before, count);
+        });
+    }
+
+    HandlingResult HandleExternalDeletedRows(std::string_view sheet, int first, int count) override {
+        return EditExternal(sheet, [=](IFormula& formula) {
+            return formula.HandleExternalDeletedRows(sheet, first, count);
+        });
+    }
+
+    HandlingResult HandleExternalDeletedCols(std::string_view sheet, int first, int count) override {
+        return EditExternal(sheet, [=](IFormula& formula) {
+            return formula.HandleExternalDeletedCols(sheet, first, count);
+        });
     }
 };
 
-std::unique_ptr<IFormula> ParseFormula(std::string expression) {
+std::unique_ptr<IFormula> FormulaTemplates::Parse(std::string_view expression, Position origin, StatsCounters& stats) {
+    return std::make_unique<TemplateFormula>(shared_from_this(), stats, GetTemplate(expression, origin, stats), origin);
+}
+
+std::shared_ptr<const Ast::Tree> FormulaTemplates::GetTemplate(
+    std::string_view expression,
+    Position origin,
+    StatsCounters& stats
+) {
+
+    std::string key = Ast::NormalizeExpression(expression, origin);
+
+    {
+        std::lock_guard lock(mutex_);
+
+        if (auto it = templates_.find(key); it != templates_.end()) {
+            if (auto formula_template = it->second.lock()) return formula_template;
+        }
+    }
+
+    // parsed without the lock, so an import parses its formulas in parallel
+    std::shared_ptr<const Ast::Tree> formula_template;
 
     try {
+        StatsCounters::ParseScope scope(stats);
+        Ast::TreeBuilder builder(origin);
+#ifdef SPREADSHEET_ANTLR_PARSER
+        Ast::ParseExpressionAntlr(std::string(expression), builder);
+#else
+        Ast::ParseExpression(expression, builder);
+#endif
+        formula_template = std::make_shared<const Ast::Tree>(builder.Build());
+    } catch (const FormulaException&) {
+        throw;
+    } catch (const std::exception& e) {
+        throw FormulaException(e.what());
+    }
+
+    std::lock_guard lock(mutex_);
 
-        antlr4::ANTLRInputStream input(expression);
+    std::weak_ptr<const Ast::Tree>& entry = templates_[std::move(key)];
 
-        FormulaLexer lexer(&input);
-        BailErrorListener error_listener;
-        lexer.removeErrorListeners();
-        lexer.addErrorListener(&error_listener);
+    // another thread may have parsed the same template meanwhile
+    if (auto existing = entry.lock()) return existing;
 
-        antlr4::CommonTokenStream tokens(&lexer);
-        FormulaParser parser(&tokens);
-        auto error_handler = std::make_shared<antlr4::BailErrorStrategy>();
-        parser.setErrorHandler(error_handler);
-        parser.removeErrorListeners();
+    entry = formula_template;
 
-        antlr4::tree::ParseTree* tree = parser.main();
-        AstFormulaListener listener;
-        antlr4::tree::ParseTreeWalker::DEFAULT.walk(&listener, tree);
+    if (templates_.size() >= purge_size_) {
+
+        for (auto it = templates_.begin(); it != templates_.end();) {
+            it = it->second.expired() ? templates_.erase(it) : std::next(it);
+        }
+
+        purge_size_ = std::max(MIN_PURGE_SIZE, templates_.size() * 2);
+    }
 
-        return std::make_unique<Formula>(listener.GetResult());
+    return formula_template;
+}
+
+std::unique_ptr<IFormula> ParseFormula(std::string expression) {
+
+#ifdef SPREADSHEET_ANTLR_PARSER
+    return ParseFormulaAntlr(std::move(expression));
+#else
+    try {
+        Ast::TreeBuilder builder;
+        Ast::ParseExpression(expression, builder);
+        return std::make_unique<Formula>(builder.Build());
+    } catch (const FormulaException&) {
+        throw;
     } catch (const std::exception& e) {
         throw FormulaException(e.what());
     }
+#endif
 }
 
+std::unique_ptr<IFormula> MakeFormula(Ast::Tree tree) {
+    return std::make_unique<Formula>(std::move(tree));
+}
@@ -3,12 +3,30 @@
 #include "common.h"
 
 #include <memory>
+#include <string>
+#include <string_view>
 #include <vector>
 
+// Ссылка формулы на ячейку или диапазон другого листа книги: Sheet2!A1 или
+// Sheet2!A1:B2. Ячейка задаётся диапазоном из одной ячейки. Ссылки на другие
+// листы абсолютные: вставка и удаление строк/столбцов листа формулы их не
+// меняют, а листа, на который они ссылаются, обновляют их так же, как ссылки
+// на ячейки своего листа.
+struct ExternalReference {
+  std::string sheet;
+  Range range;
+
+  bool operator==(const ExternalReference& rhs) const;
+  bool operator<(const ExternalReference& rhs) const;
+};
+
 // Формула, позволяющая вычислять и обновлять арифметическое выражение.
 // Поддерживаемые возможности:
 // * Простые бинарные операции и числа, скобки: 1+2*3, 2.5*(2+3.5/7)
 // * Значения ячеек в качестве переменных: A1+B2*C3
+// * Агрегирующие функции SUM, AVERAGE, MIN, MAX от чисел, выражений и
+// диапазонов ячеек: SUM(A1:B10,C1*2). Пустые ячейки диапазона пропускаются.
+// * Ячейки и диапазоны других листов книги: Sheet2!A1*2, SUM(Sheet2!A1:B10).
 // Ячейки указанные в формуле могут быть как формулами, так и текстом. Если это
 // текст, но он представляет число, тогда его нужно трактовать как число. Пустая
 // ячейка или ячейка с пустым текстом трактуется как число ноль.
@@ -42,10 +60,21 @@ public:
   // ячеек.
   virtual std::vector<Position> GetReferencedCells() const = 0;
 
+  // Возвращает список диапазонов, задействованных в формуле. Ячейки диапазонов
+  // не входят в GetReferencedCells(). Список отсортирован по возрастанию и не
+  // содержит повторяющихся диапазонов и диапазонов, удалённых целиком.
+  virtual std::vector<Range> GetReferencedRanges() const = 0;
+
+  // Возвращает список ссылок на другие листы. Они не входят ни в
+  // GetReferencedCells(), ни в GetReferencedRanges(). Список отсортирован по
+  // возрастанию и не содержит повторяющихся ссылок.
+  virtual std::vector<ExternalReference> GetExternalReferences() const = 0;
+
   // Обновляет формулу при вставке заданного числа строк/столбцов перед
   // строкой/столбцом с заданным индексом.
   // Все ссылки обновляются таким образом, чтобы указывать на те же ячейки, что
   // и до вставки. Обновляется как сама формула, так и её выражение.
+  // Строки/столбцы, вставленные внутрь диапазона, расширяют его.
   virtual HandlingResult HandleInsertedRows(int before, int count = 1) = 0;
   virtual HandlingResult HandleInsertedCols(int before, int count = 1) = 0;
 
@@ -56,10 +85,28 @@ public:
   // Если формула содержала ссылку на удалённую ячейку, то эта ссылка в
   // выражении должна замениться на строку, соответствующую ошибке
   // FormulaError::Ref. Попытка вычислить такую формулу вернёт эту же ошибку.
+  // Диапазон, задевающий удалённые строки/столбцы, сужается, а удалённый
+  // целиком тоже заменяется на ошибку FormulaError::Ref.
   virtual HandlingResult HandleDeletedRows(int first, int count = 1) = 0;
   virtual HandlingResult HandleDeletedCols(int first, int count = 1) = 0;
+
+  // Обновляют ссылки на лист с заданным именем при вставке/удалении его
+  // строк/столбцов по тем же правилам, что и методы выше. Ссылки на ячейки
+  // своего листа и на остальные листы не меняются.
+  virtual HandlingResult HandleExternalInsertedRows(std::string_view sheet, int before, int count) = 0;
+  virtual HandlingResult HandleExternalInsertedCols(std::string_view sheet, int before, int count) = 0;
+  virtual HandlingResult HandleExternalDeletedRows(std::string_view sheet, int first, int count) = 0;
+  virtual HandlingResult HandleExternalDeletedCols(std::string_view sheet, int first, int count) = 0;
 };
 
-// Парсит переданное выражение и возвращает объект формулы.
-// Бросает FormulaException в случае если формула синтаксически некорректна.
+// Парсит переданное выражение и возвращает объект формулы. Ссылка #REF!,
+// которой формула выводит удалённую ячейку или диапазон, разбирается как
+// такая же удалённая ссылка, поэтому выражение любой формулы разбирается
+// заново. Бросает FormulaException в случае если формула синтаксически
+// некорректна.
 std::unique_ptr<IFormula> ParseFormula(std::string expression);
+
+// То же, что ParseFormula(), но разбор выполняется парсером, сгенерированным
+// ANTLR по грамматике Formula.g4. Используется как эталон для проверки
+// соответствия основного парсера грамматике.
+std::unique_ptr<IFormula> ParseFormulaAntlr(std::string expression);
@@ -0,0 +1,61 @@
+#include "expression_parser.h"
+#include "ast_formula_listener.h"
+#include "FormulaLexer.h"
+
+class BailErrorListener : public antlr4::BaseErrorListener {
+public:
+    void syntaxError(
+        antlr4::Recognizer* /* recognizer */,
+        antlr4::Token* /* offendingSymbol */,
+        size_t /* line */,
+        size_t /* charPositionInLine */,
+        const std::string& msg,
+        std::exception_ptr /* e */
+    ) override {
+        throw std::runtime_error("Error when lexing: " + msg);
+    }
+};
+
+namespace Ast {
+
+void ParseExpressionAntlr(const std::string& expression, TreeBuilder& builder) {
+
+    try {
+
+        antlr4::ANTLRInputStream input(expression);
+
+        FormulaLexer lexer(&input);
+        BailErrorListener error_listener;
+        lexer.removeErrorListeners();
+        lexer.addErrorListener(&error_listener);
+
+        antlr4::CommonTokenStream tokens(&lexer);
+        FormulaParser parser(&tokens);
+        auto error_handler = std::make_shared<antlr4::BailErrorStrategy>();
+        parser.setErrorHandler(error_handler);
+        parser.removeErrorListeners();
+
+        antlr4::tree::ParseTree* tree = parser.main();
+        AstFormulaListener listener(builder);
+        antlr4::tree::ParseTreeWalker::DEFAULT.walk(&listener, tree);
+    } catch (const FormulaException&) {
+        throw;
+    } catch (const std::exception& e) {
+        throw FormulaException(e.what());
+    }
+}
+
+}
+
+std::unique_ptr<IFormula> ParseFormulaAntlr(std::string expression) {
+
+    try {
+        Ast::TreeBuilder builder;
+        Ast::ParseExpressionAntlr(expression, builder);
+        return MakeFormula(builder.Build());
+    } catch (const FormulaException&) {
+        throw;
+    } catch (const std::exception& e) {
+        throw FormulaException(e.what());
+    }
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "formula.h"
+#include "sheet_stats.h"
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace Ast {
+class Tree;
+}
+
+// Formulas shared by the cells of a sheet or of the sheets of a workbook. A formula filled down or right
+// (=A1+B1 in C1, =A2+B2 in C2) is parsed once into a template with references relative to the cell, a cell
+// keeps the template and its own position only. Templates are keyed by the R1C1 form of the expression and
+// live while formulas use them. Parsing is thread safe and counted into the stats of the sheet it parses for.
+class FormulaTemplates : public std::enable_shared_from_this<FormulaTemplates> {
+
+private:
+
+    static constexpr size_t MIN_PURGE_SIZE = 1024;
+
+    std::mutex mutex_;
+    std::unordered_map<std::string, std::weak_ptr<const Ast::Tree>> templates_;
+    // the templates no formula uses any more are dropped when the map grows this big
+    size_t purge_size_ = MIN_PURGE_SIZE;
+
+public:
+
+    // parses the expression of a formula written in the cell at origin, throws FormulaException.
+    // The stats belong to the sheet of the cell, which outlives its formulas
+    std::unique_ptr<IFormula> Parse(std::string_view expression, Position origin, StatsCounters& stats);
+
+    std::shared_ptr<const Ast::Tree> GetTemplate(std::string_view expression, Position origin, StatsCounters& stats);
+};
@@ -0,0 +1,667 @@
+// Differential stress test of the spreadsheet engine. Random scripts of formulas, texts, clears and structural
+// edits are applied to sheets in several modes. After every checkpoint their texts and values must be the same
+// as the ones of the reference sheet, which is calculated on demand in one thread and edited one cell at a time.
+// The formulas of the reference sheet are parsed again by both parsers and evaluated by walking their trees, so
+// the hand-written parser and the compiled programs are checked against the ANTLR grammar and the tree walk.
+// Every mode reports its throughput as one JSON object per line:
+//
+//   spreadsheet_fuzz [--seed N] [--scripts N] [--steps N]
+//
+// A mismatch prints the seed, the script and its edits so far, which reproduce it, and the exit code is 1.
+
+#include "ast.h"
+#include "common.h"
+#include "expression_parser.h"
+#include "formula.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+
+struct Options {
+    uint64_t seed = 1;
+    size_t scripts = 200;
+    size_t steps = 200;
+};
+
+// the edits land in a small area, so formulas read each other and structural edits move them
+constexpr int ROWS = 10;
+constexpr int COLS = 6;
+constexpr size_t CHECKPOINT_STEPS = 16;
+// the formulas of a filled row all read one cell of the area, so its edits recalculate a dependency level
+// wider than Sheet::PARALLEL_LEVEL_MIN_SIZE, which the thread pool calculates
+constexpr int FILL_COLS = 300;
+
+struct Edit {
+
+    enum class Kind {
+        SET,
+        CLEAR,
+        INSERT_ROWS,
+        INSERT_COLS,
+        DELETE_ROWS,
+        DELETE_COLS,
+        // sets the text to count cells of the row from pos on
+        FILL
+    };
+
+    Kind kind;
+    Position pos;
+    std::string text;
+    int count = 0;
+    // by the reference, edited one cell at a time
+    bool rejected = false;
+
+    bool IsStructural() const {
+        return kind != Kind::SET && kind != Kind::CLEAR && kind != Kind::FILL;
+    }
+
+    std::string ToString() const {
+        switch (kind) {
+            case Kind::SET: return "SetCell " + pos.ToString() + " \"" + text + "\"";
+            case Kind::CLEAR: return "ClearCell " + pos.ToString();
+            case Kind::INSERT_ROWS: return "InsertRows " + std::to_string(pos.row) + " " + std::to_string(count);
+            case Kind::INSERT_COLS: return "InsertCols " + std::to_string(pos.col) + " " + std::to_string(count);
+            case Kind::DELETE_ROWS: return "DeleteRows " + std::to_string(pos.row) + " " + std::to_string(count);
+            case Kind::DELETE_COLS: return "DeleteCols " + std::to_string(pos.col) + " " + std::to_string(count);
+            case Kind::FILL: return "Fill " + pos.ToString() + " " + std::to_string(count) + " \"" + text + "\"";
+        }
+        return std::string();
+    }
+};
+
+class ScriptGenerator {
+
+private:
+
+    std::mt19937_64 generator_;
+
+    int Uniform(int min, int max) {
+        return std::uniform_int_distribution<int>(min, max)(generator_);
+    }
+
+    bool Chance(int percent) {
+        return Uniform(1, 100) <= percent;
+    }
+
+    // a little beyond the edited area, so formulas read empty cells too
+    std::string GenerateCell() {
+        return Position {Uniform(0, ROWS + 1), Uniform(0, COLS + 1)}.ToString();
+    }
+
+    std::string GenerateRange() {
+        return GenerateCell() + ":" + GenerateCell();
+    }
+
+    std::string GenerateLiteral() {
+        switch (Uniform(0, 4)) {
+            case 0: return "0";
+            case 1: return std::to_string(Uniform(1, 9));
+            case 2: return "0.5";
+            case 3: return "1e3";
+            default: return std::to_string(Uniform(10, 99));
+        }
+    }
+
+    std::string GenerateFunction(int depth) {
+
+        static const char* const FUNCTIONS[] = {"SUM", "AVERAGE", "MIN", "MAX"};
+
+        std::string result = FUNCTIONS[Uniform(0, 3)];
+        result += '(';
+
+        int arg_count = Uniform(1, 3);
+
+        for (int i = 0; i < arg_count; ++i) {
+            if (i > 0) result += ',';
+            result += Chance(50) ? GenerateRange() : GenerateExpression(depth + 1);
+        }
+
+        return result + ')';
+    }
+
+    std::string GenerateExpression(int depth) {
+
+        // the leaves get likelier the deeper the expression is
+        int kind = depth >= 3 ? Uniform(0, 2) : Uniform(0, 8);
+
+        switch (kind) {
+            case 0: return GenerateLiteral();
+            case 1:
+            case 2: return GenerateCell();
+            case 3: return (Chance(50) ? "-" : "+") + GenerateExpression(depth + 1);
+            case 4: return "(" + GenerateExpression(depth + 1) + ")";
+            case 5: return GenerateFunction(depth);
+            case 6: return Chance(50) ? "#REF!" : "Other!" + GenerateCell();
+            default: {
+                static const char OPERATORS[] = {'+', '-', '*', '/'};
+                return GenerateExpression(depth + 1) + OPERATORS[Uniform(0, 3)] + GenerateExpression(depth + 1);
+            }
+        }
+    }
+
+    std::string GenerateText() {
+        switch (Uniform(0, 7)) {
+            case 0: return std::to_string(Uniform(-5, 20));
+            case 1: return "-1.5";
+            case 2: return "'" + std::to_string(Uniform(0, 9));
+            case 3: return "text";
+            case 4: return "=";
+            case 5: return "'=A1";
+            case 6: return "1e999";
+            default: return std::to_string(Uniform(0, 9));
+        }
+    }
+
+public:
+
+    explicit ScriptGenerator(uint64_t seed): generator_(seed) {}
+
+    // a formula reading the cell the way the formulas of the area do
+    std::string GenerateFill(const std::string& cell) {
+        switch (Uniform(0, 3)) {
+            case 0: return "=" + cell + "*" + GenerateLiteral();
+            case 1: return "=" + cell + "/" + GenerateLiteral();
+            case 2: return "=SUM(" + cell + ":" + cell + "," + GenerateLiteral() + ")";
+            default: return "=-" + cell;
+        }
+    }
+
+    Edit Next() {
+
+        int kind = Uniform(0, 99);
+        Position pos {Uniform(0, ROWS - 1), Uniform(0, COLS - 1)};
+
+        // below the cells the formulas of the area read, so a filled row doesn't make cycles as it is written
+        if (Chance(2)) {
+            Position first {ROWS + 2 + Uniform(0, 2), 0};
+            return Edit {Edit::Kind::FILL, first, GenerateFill(pos.ToString()), FILL_COLS};
+        }
+
+        if (kind < 45) return Edit {Edit::Kind::SET, pos, "=" + GenerateExpression(0)};
+        if (kind < 48) return Edit {Edit::Kind::SET, pos, "=" + GenerateExpression(0) + "+"};
+        if (kind < 70) return Edit {Edit::Kind::SET, pos, GenerateText()};
+        if (kind < 80) return Edit {Edit::Kind::CLEAR, pos, std::string()};
+
+        int count = Uniform(1, 2);
+
+        if (kind < 85) return Edit {Edit::Kind::INSERT_ROWS, pos, std::string(), count};
+        if (kind < 90) return Edit {Edit::Kind::INSERT_COLS, pos, std::string(), count};
+        if (kind < 95) return Edit {Edit::Kind::DELETE_ROWS, pos, std::string(), count};
+        return Edit {Edit::Kind::DELETE_COLS, pos, std::string(), count};
+    }
+};
+
+std::string ApplyEdit(ISheet& sheet, const Edit& edit);
+
+// the cells are set one by one, a cell rejected for a cycle made by structural edits doesn't stop the others
+std::string ApplyFill(ISheet& sheet, const Edit& edit) {
+
+    std::string outcome;
+
+    for (int col = edit.pos.col; col < edit.pos.col + edit.count; ++col) {
+
+        std::string cell_outcome = ApplyEdit(sheet, Edit {Edit::Kind::SET, Position {edit.pos.row, col}, edit.text});
+
+        if (outcome.empty()) outcome = std::move(cell_outcome);
+    }
+
+    return outcome;
+}
+
+// the exception an edit threw, the same edit must throw the same one in every mode
+std::string ApplyEdit(ISheet& sheet, const Edit& edit) {
+
+    try {
+
+        switch (edit.kind) {
+            case Edit::Kind::SET: sheet.SetCell(edit.pos, edit.text); break;
+            case Edit::Kind::CLEAR: sheet.ClearCell(edit.pos); break;
+            case Edit::Kind::INSERT_ROWS: sheet.InsertRows(edit.pos.row, edit.count); break;
+            case Edit::Kind::INSERT_COLS: sheet.InsertCols(edit.pos.col, edit.count); break;
+            case Edit::Kind::DELETE_ROWS: sheet.DeleteRows(edit.pos.row, edit.count); break;
+            case Edit::Kind::DELETE_COLS: sheet.DeleteCols(edit.pos.col, edit.count); break;
+            case Edit::Kind::FILL: return ApplyFill(sheet, edit);
+        }
+
+    } catch (const FormulaException&) {
+        return "FormulaException";
+    } catch (const CircularDependencyException&) {
+        return "CircularDependencyException";
+    }
+
+    return std::string();
+}
+
+std::string PrintTexts(const ISheet& sheet) {
+    std::ostringstream output;
+    sheet.PrintTexts(output);
+    return output.str();
+}
+
+std::string PrintValues(const ISheet& sheet) {
+    std::ostringstream output;
+    sheet.PrintValues(output);
+    return output.str();
+}
+
+// A way of running the edits. It returns the exception of an edit right away if it applies edits one at a time
+class Mode {
+
+private:
+
+    std::string name_;
+    std::chrono::nanoseconds duration_ {0};
+    size_t edits_ = 0;
+
+protected:
+
+    std::unique_ptr<ISheet> sheet_;
+
+    virtual std::optional<std::string> DoApply(const Edit& edit) = 0;
+
+    virtual void DoCheckpoint() {}
+
+public:
+
+    explicit Mode(std::string name): name_(std::move(name)) {}
+
+    virtual ~Mode() = default;
+
+    const std::string& GetName() const {
+        return name_;
+    }
+
+    virtual void Reset() = 0;
+
+    std::optional<std::string> Apply(const Edit& edit) {
+
+        auto start = std::chrono::steady_clock::now();
+        std::optional<std::string> outcome = DoApply(edit);
+        duration_ += std::chrono::steady_clock::now() - start;
+
+        edits_++;
+        return outcome;
+    }
+
+    // the texts and the values once the edits so far are applied, the printing counts into the throughput
+    std::pair<std::string, std::string> Checkpoint() {
+
+        auto start = std::chrono::steady_clock::now();
+        DoCheckpoint();
+        std::pair<std::string, std::string> result {PrintTexts(*sheet_), PrintValues(*sheet_)};
+        duration_ += std::chrono::steady_clock::now() - start;
+
+        return result;
+    }
+
+    const ISheet& GetSheet() const {
+        return *sheet_;
+    }
+
+    void Report(std::ostream& output, size_t scripts) const {
+
+        double ns = static_cast<double>(duration_.count());
+
+        output << "{\"mode\":\"" << name_ << "\""
+               << ",\"scripts\":" << scripts
+               << ",\"edits\":" << edits_
+               << ",\"ns_per_edit\":" << ns / static_cast<double>(std::max<size_t>(edits_, 1))
+               << ",\"edits_per_second\":" << (ns > 0. ? static_cast<double>(edits_) * 1e9 / ns : 0.)
+               << "}" << std::endl;
+    }
+};
+
+// on demand in one thread, the state every other mode is compared to
+class ReferenceMode : public Mode {
+
+protected:
+
+    std::optional<std::string> DoApply(const Edit& edit) override {
+        return ApplyEdit(*sheet_, edit);
+    }
+
+public:
+
+    ReferenceMode(): Mode("reference") {}
+
+    void Reset() override {
+        sheet_ = CreateSheet();
+    }
+};
+
+// recalculated after every edit by a thread pool, some edits are undone and redone right away
+class AutomaticMode : public Mode {
+
+private:
+
+    std::mt19937_64 generator_ {0};
+
+protected:
+
+    std::optional<std::string> DoApply(const Edit& edit) override {
+
+        std::string outcome = ApplyEdit(*sheet_, edit);
+
+        if (outcome.empty() && generator_() % 8 == 0 && sheet_->Undo()) sheet_->Redo();
+
+        return outcome;
+    }
+
+public:
+
+    AutomaticMode(): Mode("automatic") {}
+
+    void Reset() override {
+        sheet_ = CreateSheet();
+        sheet_->SetRecalculationThreads(4);
+        sheet_->SetRecalculationMode(RecalculationMode::Automatic);
+    }
+};
+
+// The texts are set in batches. A batch is checked for cycles once it is committed, so an edit making a cycle
+// the next edit of the batch breaks would be accepted, while the reference rejects it. The batches get only
+// the edits the reference accepted, which can't make a cycle together either. A filled row the reference took
+// in part is set outside of the batches, in the same order
+class BatchMode : public Mode {
+
+private:
+
+    std::vector<Edit> batch_;
+
+    void Flush() {
+
+        if (batch_.empty()) return;
+
+        std::vector<Edit> batch = std::move(batch_);
+        batch_.clear();
+
+        sheet_->BeginBatch();
+
+        for (const Edit& edit: batch) {
+
+            std::string outcome = ApplyEdit(*sheet_, edit);
+
+            if (!outcome.empty()) throw std::runtime_error(edit.ToString() + " threw " + outcome + " in a batch");
+        }
+
+        sheet_->CommitBatch();
+    }
+
+protected:
+
+    std::optional<std::string> DoApply(const Edit& edit) override {
+
+        if (!edit.IsStructural() && !(edit.kind == Edit::Kind::FILL && edit.rejected)) {
+            if (!edit.rejected) batch_.push_back(edit);
+            return std::nullopt;
+        }
+
+        Flush();
+        return ApplyEdit(*sheet_, edit);
+    }
+
+    void DoCheckpoint() override {
+        Flush();
+        sheet_->Recalculate();
+    }
+
+public:
+
+    BatchMode(): Mode("batch") {}
+
+    void Reset() override {
+        batch_.clear();
+        sheet_ = CreateSheet();
+        sheet_->SetRecalculationThreads(4);
+    }
+};
+
+// a background thread recalculates the changed cells, the viewport first, while the edits go on
+class BackgroundMode : public Mode {
+
+protected:
+
+    std::optional<std::string> DoApply(const Edit& edit) override {
+        return ApplyEdit(*sheet_, edit);
+    }
+
+public:
+
+    BackgroundMode(): Mode("background") {}
+
+    void Reset() override {
+        sheet_ = CreateSheet();
+        sheet_->SetViewport(Range {Position {0, 0}, Position {3, 3}});
+        sheet_->SetRecalculationMode(RecalculationMode::Background);
+    }
+};
+
+// a new sheet imports the texts of the reference at every checkpoint, so its values are calculated from scratch
+class ImportMode : public Mode {
+
+private:
+
+    const Mode& reference_;
+
+protected:
+
+    std::optional<std::string> DoApply(const Edit&) override {
+        return std::nullopt;
+    }
+
+    // a filled row is enough formulas for the import to parse them in parallel
+    void DoCheckpoint() override {
+        std::istringstream input(PrintTexts(reference_.GetSheet()));
+        sheet_ = CreateSheet();
+        sheet_->SetRecalculationThreads(4);
+        sheet_->ImportTexts(input);
+    }
+
+public:
+
+    explicit ImportMode(const Mode& reference): Mode("import"), reference_(reference) {}
+
+    void Reset() override {
+        sheet_ = CreateSheet();
+    }
+};
+
+ICell::Value ToCellValue(const IFormula::Value& value) {
+    if (std::holds_alternative<double>(value)) return std::get<double>(value);
+    return std::get<FormulaError>(value);
+}
+
+std::string ToString(const ICell::Value& value) {
+    std::ostringstream output;
+    std::visit([&output](const auto& alternative) { output << alternative; }, value);
+    return output.str();
+}
+
+// every formula of the sheet parsed by both parsers and evaluated by the program and by the tree walk, against
+// the values of the cells it reads. Returns the first difference
+std::optional<std::string> CheckFormulas(const ISheet& sheet) {
+
+    std::optional<std::string> mismatch;
+    Size size = sheet.GetPrintableSize();
+
+    if (size.rows == 0 || size.cols == 0) return mismatch;
+
+    Range range {Position {0, 0}, Position {size.rows - 1, size.cols - 1}};
+
+    sheet.ForEachCellInRange(range, [&](Position pos, const ICell& cell) {
+
+        std::string text = cell.GetText();
+
+        if (mismatch || text.size() < 2 || text.front() != kFormulaSign) return;
+
+        std::string expression = text.substr(1);
+
+        Ast::TreeBuilder builder;
+        Ast::ParseExpression(expression, builder);
+        Ast::Tree tree = builder.Build();
+
+        Ast::TreeBuilder antlr_builder;
+        Ast::ParseExpressionAntlr(expression, antlr_builder);
+        Ast::Tree antlr_tree = antlr_builder.Build();
+
+        ICell::Value value = cell.GetValue();
+        ICell::Value program_value = ToCellValue(tree.Evaluate(sheet));
+        ICell::Value tree_value = ToCellValue(antlr_tree.EvaluateTree(sheet));
+
+        if (tree.BuildExpression() != expression || antlr_tree.BuildExpression() != expression) {
+            mismatch = pos.ToString() + ": " + text + " is parsed as =" + tree.BuildExpression() + " and ="
+                + antlr_tree.BuildExpression();
+        } else if (!(value == program_value && value == tree_value)) {
+            mismatch = pos.ToString() + ": " + text + " is " + ToString(value) + ", the program gives "
+                + ToString(program_value) + ", the tree walk " + ToString(tree_value);
+        }
+    });
+
+    return mismatch;
+}
+
+void RunScript(uint64_t seed, size_t steps, Mode& reference, const std::vector<std::unique_ptr<Mode>>& modes) {
+
+    ScriptGenerator generator(seed);
+
+    reference.Reset();
+    for (const auto& mode: modes) mode->Reset();
+
+    std::vector<Edit> edits;
+
+    auto fail = [&edits](const std::string& message) {
+
+        std::ostringstream output;
+        output << message << "\nedits:\n";
+
+        for (const Edit& edit: edits) output << "  " << edit.ToString() << "\n";
+
+        throw std::runtime_error(output.str());
+    };
+
+    for (size_t step = 1; step <= steps; ++step) {
+
+        edits.push_back(generator.Next());
+
+        std::string outcome = *reference.Apply(edits.back());
+        edits.back().rejected = !outcome.empty();
+
+        for (const auto& mode: modes) {
+
+            std::optional<std::string> mode_outcome;
+
+            try {
+                mode_outcome = mode->Apply(edits.back());
+            } catch (const std::exception& e) {
+                fail(mode->GetName() + ": " + e.what());
+            }
+
+            if (mode_outcome && *mode_outcome != outcome) {
+                fail(mode->GetName() + " threw \"" + *mode_outcome + "\" instead of \"" + outcome + "\"");
+            }
+        }
+
+        if (step % CHECKPOINT_STEPS != 0 && step != steps) continue;
+
+        auto [texts, values] = reference.Checkpoint();
+
+        if (std::optional<std::string> mismatch = CheckFormulas(reference.GetSheet())) fail(*mismatch);
+
+        for (const auto& mode: modes) {
+
+            std::pair<std::string, std::string> checkpoint;
+
+            try {
+                checkpoint = mode->Checkpoint();
+            } catch (const std::exception& e) {
+                fail(mode->GetName() + ": " + e.what());
+            }
+
+            const auto& [mode_texts, mode_values] = checkpoint;
+
+            if (mode_texts != texts) {
+                fail(mode->GetName() + " texts:\n" + mode_texts + "reference texts:\n" + texts);
+            } else if (mode_values != values) {
+                fail(mode->GetName() + " values:\n" + mode_values + "reference values:\n" + values);
+            }
+        }
+    }
+}
+
+Options ParseOptions(int argc, char** argv) {
+
+    Options options;
+
+    for (int i = 1; i < argc; ++i) {
+
+        std::string arg = argv[i];
+
+        if (i + 1 == argc) throw std::invalid_argument("missing value for " + arg);
+
+        std::string value = argv[++i];
+
+        if (arg == "--seed") {
+            options.seed = std::stoull(value);
+        } else if (arg == "--scripts") {
+            options.scripts = std::stoul(value);
+        } else if (arg == "--steps") {
+            options.steps = std::max<size_t>(std::stoul(value), 1);
+        } else {
+            throw std::invalid_argument("unknown option " + arg);
+        }
+    }
+
+    return options;
+}
+
+}
+
+int main(int argc, char** argv) {
+
+    Options options;
+
+    try {
+        options = ParseOptions(argc, argv);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << "\n"
+                  << "usage: spreadsheet_fuzz [--seed N] [--scripts N] [--steps N]" << std::endl;
+        return 1;
+    }
+
+    ReferenceMode reference;
+
+    std::vector<std::unique_ptr<Mode>> modes;
+    modes.push_back(std::make_unique<AutomaticMode>());
+    modes.push_back(std::make_unique<BatchMode>());
+    modes.push_back(std::make_unique<BackgroundMode>());
+    modes.push_back(std::make_unique<ImportMode>(reference));
+
+    for (size_t script = 0; script < options.scripts; ++script) {
+
+        uint64_t seed = options.seed + script;
+
+        try {
+            RunScript(seed, options.steps, reference, modes);
+        } catch (const std::exception& e) {
+            std::cerr << "seed " << seed << " (--seed " << seed << " --scripts 1 --steps " << options.steps << "): "
+                      << e.what() << std::endl;
+            return 1;
+        }
+    }
+
+    reference.Report(std::cout, options.scripts);
+    for (const auto& mode: modes) mode->Report(std::cout, options.scripts);
+
+    return 0;
+}
@@ -3,6 +3,12 @@
 #include "test_runner.h"
 #include "profile.h"
 
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <thread>
+
 std::ostream& operator<<(std::ostream& output, Position pos) {
   return output << "(" << pos.row << ", " << pos.col << ")";
 }
@@ -90,6 +96,27 @@ namespace {
     ASSERT(!Position::FromString("ABCDEFGHIJKLMNOPQRS8").IsValid());
   }
 
+  void TestPositionConversionRoundTrip() {
+
+      static_assert(Position::FromString("C137").row == 136 && Position::FromString("C137").col == 2);
+      static_assert(Position::FromString("XFE1").row == -1);
+
+      char buffer[Position::kMaxStringLength];
+
+      for (int col = 0; col < Position::kMaxCols; ++col) {
+          for (int row: {0, 8, 9, 98, 99, 998, 999, 9998, 9999, Position::kMaxRows - 1}) {
+              Position pos {row, col};
+              std::string name = pos.ToString();
+              ASSERT_EQUAL(std::string(buffer, pos.ToString(buffer)), name);
+              ASSERT_EQUAL(Position::FromString(name), pos);
+          }
+      }
+
+      for (std::string_view name: {"", "A", "A0", "a1", "AAAA1", "A123456", "XFD16385", "XFE1", "A01", "A1 "}) {
+          ASSERT(!Position::FromString(name).IsValid());
+      }
+  }
+
   void TestEmpty() {
     auto sheet = CreateSheet();
     ASSERT_EQUAL(sheet->GetPrintableSize(), (Size{0, 0}));
@@ -386,6 +413,19 @@ namespace {
       ASSERT_EQUAL(sheet->GetCell("A1"_pos)->GetValue(),
                    ICell::Value(FormulaError::Category::Div0));
     }
+
+    sheet->SetCell("A1"_pos, "=1e400");
+    ASSERT_EQUAL(sheet->GetCell("A1"_pos)->GetValue(),
+                 ICell::Value(FormulaError::Category::Div0));
+
+    sheet->SetCell("A1"_pos, "=-1e400");
+    ASSERT_EQUAL(sheet->GetCell("A1"_pos)->GetValue(),
+                 ICell::Value(FormulaError::Category::Div0));
+
+    sheet->SetCell("A2"_pos, "=(1e400)");
+    sheet->SetCell("A3"_pos, "=A2+1");
+    ASSERT_EQUAL(sheet->GetCell("A3"_pos)->GetValue(),
+                 ICell::Value(FormulaError::Category::Div0));
   }
 
   void TestEmptyCellTreatedAsZero() {
@@ -675,6 +715,1430 @@ namespace {
       Size expected {3, 2};
 
       ASSERT_EQUAL(sheet->GetPrintableSize(), expected);
+
+      // the bounds follow edits without a scan of the sheet
+      sheet->SetCell("C5"_pos, "=A3/3");
+      ASSERT_EQUAL(sheet->GetPrintableSize(), (Size{5, 3}));
+      sheet->InsertRows(0, 2);
+      sheet->InsertCols(1);
+      ASSERT_EQUAL(sheet->GetPrintableSize(), (Size{7, 4}));
+      sheet->ClearCell("D7"_pos);
+      ASSERT_EQUAL(sheet->GetPrintableSize(), (Size{5, 3}));
+      sheet->SetCell("B2"_pos, "x");
+      sheet->DeleteRows(0, 3);
+      ASSERT_EQUAL(sheet->GetPrintableSize(), (Size{2, 3}));
+      sheet->DeleteCols(0);
+      ASSERT_EQUAL(sheet->GetPrintableSize(), (Size{1, 2}));
+      sheet->SetCell("A2"_pos, "=1/3");
+      sheet->SetCell("A3"_pos, "=1099511627776/7");
+      sheet->SetCell("A4"_pos, "=1/0");
+
+      std::ostringstream values;
+      sheet->PrintValues(values);
+      ASSERT_EQUAL(values.str(), "\t2\n0.333333\t\n1.57073e+11\t\n#DIV/0!\t\n");
+
+      sheet->ClearCell("B1"_pos);
+      sheet->ClearCell("A2"_pos);
+      sheet->ClearCell("A3"_pos);
+      sheet->ClearCell("A4"_pos);
+      ASSERT_EQUAL(sheet->GetPrintableSize(), (Size{0, 0}));
+  }
+
+  void TestSparseSheetStructuralEdits() {
+
+      auto sheet = CreateSheet();
+
+      const Position far {16000, 5000};
+      const Position block_corner {63, 63};
+
+      sheet->SetCell(far, "2");
+      sheet->SetCell(block_corner, "=" + far.ToString() + "*3");
+      sheet->SetCell("A1"_pos, "=" + block_corner.ToString());
+
+      ASSERT_EQUAL(sheet->GetCell("A1"_pos)->GetValue(), ICell::Value(6.));
+      ASSERT_EQUAL(sheet->GetPrintableSize(), (Size{16001, 5001}));
+
+      sheet->InsertRows(10, 3);
+      sheet->InsertCols(64, 2);
+
+      const Position shifted_far {16003, 5002};
+      const Position shifted_corner {66, 63};
+
+      ASSERT_EQUAL(sheet->GetCell(shifted_corner)->GetText(), "=" + shifted_far.ToString() + "*3");
+      ASSERT_EQUAL(sheet->GetCell(shifted_far)->GetText(), "2");
+      ASSERT_EQUAL(sheet->GetCell("A1"_pos)->GetText(), "=" + shifted_corner.ToString());
+
+      sheet->DeleteRows(0, 12);
+
+      const Position moved_corner {54, 63};
+
+      ASSERT_EQUAL(sheet->GetCell(moved_corner)->GetValue(), ICell::Value(6.));
+      ASSERT(sheet->GetCell(shifted_corner) == nullptr);
+
+      sheet->ClearCell(Position {15991, 5002});
+      ASSERT_EQUAL(sheet->GetCell(moved_corner)->GetValue(), ICell::Value(0.));
+      ASSERT_EQUAL(sheet->GetPrintableSize(), (Size{55, 64}));
+  }
+
+  void TestStructuralEditsNearBottom() {
+
+      auto sheet = CreateSheet();
+      auto at = [](int row, int col) { return Position {row, col}; };
+
+      const int rows = 2000;
+      const int cols = 20;
+
+      for (int row = 0; row < rows; ++row) {
+          for (int col = 0; col < cols; ++col) {
+              sheet->SetCell(at(row, col), std::to_string(row));
+          }
+          sheet->SetCell(at(row, cols), "=" + at(row, 0).ToString() + "+1");
+      }
+
+      sheet->SetCell(at(0, cols + 1), "=" + at(rows - 1, cols).ToString());
+
+      {
+          LOG_DURATION("100 row insertions near the bottom");
+          for (int i = 0; i < 100; ++i) {
+              sheet->InsertRows(rows - 10);
+          }
+      }
+
+      ASSERT_EQUAL(sheet->GetCell(at(rows - 11, cols))->GetText(), "=" + at(rows - 11, 0).ToString() + "+1");
+      ASSERT_EQUAL(sheet->GetCell(at(rows + 99, cols))->GetText(), "=" + at(rows + 99, 0).ToString() + "+1");
+      ASSERT_EQUAL(sheet->GetCell(at(0, cols + 1))->GetText(), "=" + at(rows + 99, cols).ToString());
+      ASSERT_EQUAL(sheet->GetCell(at(0, cols + 1))->GetValue(), ICell::Value(double(rows)));
+
+      sheet->DeleteCols(0);
+      ASSERT_EQUAL(sheet->GetCell(at(5, cols - 1))->GetText(), "=#REF!+1");
+      ASSERT_EQUAL(sheet->GetCell(at(0, cols))->GetText(), "=" + at(rows + 99, cols - 1).ToString());
+      ASSERT_EQUAL(sheet->GetCell(at(0, cols))->GetValue(), ICell::Value(FormulaError::Category::Ref));
+
+      sheet->DeleteRows(rows + 99);
+      ASSERT_EQUAL(sheet->GetCell(at(0, cols))->GetText(), "=#REF!");
+      sheet->InsertRows(0);
+      ASSERT_EQUAL(sheet->GetCell(at(1, cols))->GetText(), "=#REF!");
+  }
+
+  void TestParserConformance() {
+
+      auto throws = [](auto parse, const std::string& expression) {
+          try {
+              parse(expression);
+          } catch (const FormulaException&) {
+              return true;
+          }
+          return false;
+      };
+
+      const std::vector<std::pair<std::string, std::string>> valid = {
+          {"1", "1"},
+          {" 1 + 2 ", "1+2"},
+          {"1-2-3", "1-2-3"},
+          {"1-(2-3)", "1-(2-3)"},
+          {"2*3+4/5", "2*3+4/5"},
+          {"-A1*B2", "-A1*B2"},
+          {"-(A1+B2)", "-(A1+B2)"},
+          {"--1", "--1"},
+          {"1e5+.5+2.5E-3+7e+2", "1e5+.5+2.5E-3+7e+2"},
+          {"((A1))", "A1"},
+          {"ZZ10\t*\n(1)", "ZZ10*1"},
+          {"SUM(A1:B2, 1)", "SUM(A1:B2,1)"},
+          {"-SUM((A1+B1), B2:A1)", "-SUM(A1+B1,A1:B2)"},
+          {"MAX(MIN(1,2),AVERAGE(A1 : A3))*2", "MAX(MIN(1,2),AVERAGE(A1:A3))*2"},
+          {"(SUM(A1))", "SUM(A1)"},
+          {"#REF! + SUM(#REF!, A1)", "#REF!+SUM(#REF!,A1)"},
+      };
+
+      for (const auto& [expression, expected]: valid) {
+          ASSERT_EQUAL(ParseFormula(expression)->GetExpression(), expected);
+          ASSERT_EQUAL(ParseFormulaAntlr(expression)->GetExpression(), expected);
+      }
+
+      const std::vector<std::string> invalid = {
+          "", " ", "1+", "*1", "(1", "1)", "()", "a1", "A", "1e", "3.", "1A1", "A1 B1", "1..2", "1 % 2",
+          "SUM()", "SUM(1", "SUM", "FOO(1)", "A1:B2", "SUM(A1:)", "SUM(1:A2)", "SUM(A1:B2+1)", "SUM(1,)",
+          "#REF", "#", "#REF!:A1", "SUM(A1:#REF!)"
+      };
+
+      for (const std::string& expression: invalid) {
+          ASSERT(throws(ParseFormula, expression));
+          ASSERT(throws(ParseFormulaAntlr, expression));
+      }
+  }
+
+  void TestFormulaDeepNesting() {
+
+      auto sheet = CreateSheet();
+      sheet->SetCell("A1"_pos, "2");
+
+      std::string expression = "A1";
+
+      for (int i = 0; i < 40; ++i) {
+          expression = "1+(" + expression + "-1)";
+      }
+
+      ASSERT_EQUAL(std::get<double>(ParseFormula(expression)->Evaluate(*sheet)), 2.);
+
+      sheet->SetCell("A1"_pos, "text");
+      ASSERT(ParseFormula(expression)->Evaluate(*sheet) ==
+             IFormula::Value(FormulaError::Category::Value));
+  }
+
+  void TestRecalculateLongChain() {
+
+      auto sheet = CreateSheet();
+      sheet->SetRecalculationMode(RecalculationMode::Automatic);
+
+      const int rows = 10'000;
+      const int cols = 5;
+
+      sheet->SetCell("A1"_pos, "1");
+
+      Position last {0, 0};
+
+      for (int col = 0; col < cols; ++col) {
+          for (int row = col == 0 ? 1 : 0; row < rows; ++row) {
+              Position pos {row, col};
+              sheet->SetCell(pos, "=" + last.ToString() + "+1");
+              last = pos;
+          }
+      }
+
+      ASSERT_EQUAL(sheet->GetCell(last)->GetValue(), ICell::Value(double(rows * cols)));
+
+      sheet->SetCell("A1"_pos, "=2-2");
+      ASSERT_EQUAL(sheet->GetCell(last)->GetValue(), ICell::Value(double(rows * cols - 1)));
+
+      sheet->SetRecalculationMode(RecalculationMode::OnDemand);
+      sheet->SetCell("A1"_pos, "10");
+      sheet->Recalculate();
+      ASSERT_EQUAL(sheet->GetCell(last)->GetValue(), ICell::Value(double(rows * cols + 9)));
+  }
+
+  void TestParallelRecalculation() {
+
+      auto serial_sheet = CreateSheet();
+      auto parallel_sheet = CreateSheet();
+      parallel_sheet->SetRecalculationThreads(4);
+
+      const int rows = 40;
+      const int cols = 600;
+
+      for (ISheet* sheet: {serial_sheet.get(), parallel_sheet.get()}) {
+          for (int col = 0; col < cols; ++col) {
+              sheet->SetCell(Position {0, col}, std::to_string(col % 7));
+          }
+
+          for (int row = 1; row < rows; ++row) {
+              for (int col = 0; col < cols; ++col) {
+                  std::string text = "=" + Position {row - 1, col}.ToString() + "/2";
+                  if (col + 1 < cols) text += "+" + Position {row - 1, col + 1}.ToString() + "/2";
+                  sheet->SetCell(Position {row, col}, text);
+              }
+          }
+
+          sheet->SetCell("A1"_pos, "text");
+          sheet->Recalculate();
+          sheet->SetCell(Position {0, cols / 2}, "1e300");
+          sheet->SetCell(Position {0, cols / 2 + 1}, "1e300");
+          sheet->Recalculate();
+      }
+
+      std::ostringstream serial_values;
+      serial_sheet->PrintValues(serial_values);
+
+      std::ostringstream parallel_values;
+      parallel_sheet->PrintValues(parallel_values);
+
+      ASSERT_EQUAL(parallel_values.str(), serial_values.str());
+  }
+
+  void TestBatchEdits() {
+
+      auto sheet = CreateSheet();
+      sheet->SetCell("A1"_pos, "1");
+      sheet->SetCell("B1"_pos, "=A1+1");
+      ASSERT_EQUAL(sheet->GetCell("B1"_pos)->GetValue(), ICell::Value(2.0));
+
+      const int chain_length = 10000;
+
+      sheet->BeginBatch();
+      sheet->SetCell("A1"_pos, "10");
+      for (int row = 1; row < chain_length; ++row) {
+          sheet->SetCell(Position {row, 0}, "=" + Position {row - 1, 0}.ToString() + "+1");
+      }
+      sheet->ClearCell("C1"_pos);
+
+      // nothing is applied before the commit
+      ASSERT(sheet->GetCell(Position {1, 0}) == nullptr);
+      ASSERT_EQUAL(sheet->GetCell("B1"_pos)->GetValue(), ICell::Value(2.0));
+
+      sheet->CommitBatch();
+      sheet->Recalculate();
+
+      ASSERT_EQUAL(sheet->GetCell("B1"_pos)->GetValue(), ICell::Value(11.0));
+      ASSERT_EQUAL(sheet->GetCell(Position {chain_length - 1, 0})->GetValue(), ICell::Value(10.0 + chain_length - 1));
+      ASSERT(sheet->GetCell("C1"_pos) == nullptr);
+
+      // nested batches are applied by the outer commit
+      sheet->BeginBatch();
+      sheet->BeginBatch();
+      sheet->SetCell("A1"_pos, "0");
+      sheet->CommitBatch();
+      ASSERT_EQUAL(sheet->GetCell("A1"_pos)->GetText(), "10");
+      sheet->CommitBatch();
+      sheet->Recalculate();
+      ASSERT_EQUAL(sheet->GetCell(Position {chain_length - 1, 0})->GetValue(), ICell::Value(chain_length - 1.0));
+
+      // a cycle rejects the whole batch
+      sheet->BeginBatch();
+      sheet->SetCell("C2"_pos, "5");
+      sheet->SetCell("A1"_pos, "=" + Position {chain_length - 1, 0}.ToString());
+      try {
+          sheet->CommitBatch();
+          ASSERT(false);
+      } catch (const CircularDependencyException&) {
+      }
+
+      sheet->Recalculate();
+      ASSERT_EQUAL(sheet->GetCell("A1"_pos)->GetText(), "0");
+      ASSERT(sheet->GetCell("C2"_pos) == nullptr);
+      ASSERT_EQUAL(sheet->GetCell(Position {chain_length - 1, 0})->GetValue(), ICell::Value(chain_length - 1.0));
+
+      // syntax errors are reported by SetCell
+      sheet->BeginBatch();
+      try {
+          sheet->SetCell("A1"_pos, "=1+");
+          ASSERT(false);
+      } catch (const FormulaException&) {
+      }
+      sheet->CommitBatch();
+      ASSERT_EQUAL(sheet->GetCell("A1"_pos)->GetText(), "0");
+  }
+
+  void TestRangeAggregates() {
+
+      auto sheet = CreateSheet();
+
+      auto at = [&sheet](const std::string& cell) {
+          return sheet->GetCell(Position::FromString(cell))->GetValue();
+      };
+
+      sheet->SetCell("A1"_pos, "1");
+      sheet->SetCell("A2"_pos, "2");
+      sheet->SetCell("B1"_pos, "'3");
+      sheet->SetCell("B3"_pos, "=A1+A2");
+
+      sheet->SetCell("D1"_pos, "=SUM(A1:B3)");
+      sheet->SetCell("D2"_pos, "=AVERAGE(B3:A1)");
+      sheet->SetCell("D3"_pos, "=MIN(A1:B3, 0.5) + MAX(A1:B3)");
+      sheet->SetCell("D4"_pos, "=SUM(A1:A3, A1, A1*10)");
+
+      ASSERT_EQUAL(at("D1"), ICell::Value(9.0));
+      ASSERT_EQUAL(at("D2"), ICell::Value(2.25));
+      ASSERT_EQUAL(at("D3"), ICell::Value(3.5));
+      ASSERT_EQUAL(at("D4"), ICell::Value(14.0));
+      ASSERT_EQUAL(sheet->GetCell("D2"_pos)->GetText(), "=AVERAGE(A1:B3)");
+      ASSERT(sheet->GetCell("D1"_pos)->GetReferencedCells().empty());
+
+      // a range is one dependency, yet a cell created inside it updates the formula
+      sheet->SetCell("A3"_pos, "4");
+      ASSERT_EQUAL(at("D1"), ICell::Value(13.0));
+      sheet->ClearCell("A3"_pos);
+      ASSERT_EQUAL(at("D1"), ICell::Value(9.0));
+      sheet->SetCell("A1"_pos, "5");
+      ASSERT_EQUAL(at("D1"), ICell::Value(17.0));
+
+      // empty ranges and errors
+      sheet->SetCell("E1"_pos, "=SUM(X1:Y5)");
+      sheet->SetCell("E2"_pos, "=AVERAGE(X1:Y5)");
+      sheet->SetCell("E3"_pos, "=MAX(X1:Y5)");
+      ASSERT_EQUAL(at("E1"), ICell::Value(0.0));
+      ASSERT_EQUAL(at("E2"), ICell::Value(FormulaError(FormulaError::Category::Div0)));
+      ASSERT_EQUAL(at("E3"), ICell::Value(0.0));
+
+      sheet->SetCell("B2"_pos, "text");
+      ASSERT_EQUAL(at("D1"), ICell::Value(FormulaError(FormulaError::Category::Value)));
+      sheet->SetCell("B2"_pos, "=1/0");
+      ASSERT_EQUAL(at("D1"), ICell::Value(FormulaError(FormulaError::Category::Div0)));
+      sheet->ClearCell("B2"_pos);
+
+      // cycles through a range
+      auto throws_cycle = [&sheet](Position pos, const std::string& text) {
+          try {
+              sheet->SetCell(pos, text);
+          } catch (const CircularDependencyException&) {
+              return true;
+          }
+          return false;
+      };
+
+      ASSERT(throws_cycle("B2"_pos, "=SUM(A1:C3)"));
+      ASSERT(throws_cycle("A2"_pos, "=D1"));
+      ASSERT(throws_cycle("F1"_pos, "=SUM(D1:D3)+SUM(F1:F1)"));
+      ASSERT_EQUAL(sheet->GetCell("A2"_pos)->GetText(), "2");
+
+      sheet->BeginBatch();
+      sheet->SetCell("A2"_pos, "=D4");
+      try {
+          sheet->CommitBatch();
+          ASSERT(false);
+      } catch (const CircularDependencyException&) {
+      }
+      ASSERT_EQUAL(sheet->GetCell("A2"_pos)->GetText(), "2");
+
+      // structural edits move, grow and shrink ranges
+      sheet->InsertRows(1, 2);
+      ASSERT_EQUAL(sheet->GetCell("D1"_pos)->GetText(), "=SUM(A1:B5)");
+      ASSERT_EQUAL(at("D1"), ICell::Value(17.0));
+
+      sheet->InsertCols(0);
+      ASSERT_EQUAL(sheet->GetCell("E1"_pos)->GetText(), "=SUM(B1:C5)");
+      ASSERT_EQUAL(sheet->GetCell("F1"_pos)->GetText(), "=SUM(Y1:Z7)");
+
+      sheet->DeleteRows(1);
+      ASSERT_EQUAL(sheet->GetCell("E1"_pos)->GetText(), "=SUM(B1:C4)");
+      ASSERT_EQUAL(at("E1"), ICell::Value(17.0));
+      sheet->DeleteRows(2);
+      ASSERT_EQUAL(sheet->GetCell("E1"_pos)->GetText(), "=SUM(B1:C3)");
+      ASSERT_EQUAL(sheet->GetCell("C3"_pos)->GetText(), "=B1+#REF!");
+      ASSERT_EQUAL(at("E1"), ICell::Value(FormulaError(FormulaError::Category::Ref)));
+
+      sheet->DeleteCols(1, 2);
+      ASSERT_EQUAL(sheet->GetCell("C1"_pos)->GetText(), "=SUM(#REF!)");
+      ASSERT_EQUAL(at("C1"), ICell::Value(FormulaError(FormulaError::Category::Ref)));
+
+      // a deleted range is the #REF! its text has, a value argument going before the ranges
+      auto deleted = CreateSheet();
+      deleted->SetCell("A1"_pos, "text");
+      deleted->SetCell("C1"_pos, "=MAX(A1:A2,B1:B2)");
+      ASSERT_EQUAL(deleted->GetCell("C1"_pos)->GetValue(), ICell::Value(FormulaError(FormulaError::Category::Value)));
+
+      deleted->DeleteCols(1);
+      ASSERT_EQUAL(deleted->GetCell("B1"_pos)->GetText(), "=MAX(A1:A2,#REF!)");
+      ASSERT_EQUAL(deleted->GetCell("B1"_pos)->GetValue(), ICell::Value(FormulaError(FormulaError::Category::Ref)));
+
+      // a wide range instead of a long chain of additions
+      const int rows = 5000;
+
+      auto wide = CreateSheet();
+      for (int row = 0; row < rows; ++row) {
+          wide->SetCell(Position {row, 0}, std::to_string(row + 1));
+      }
+      wide->SetCell("B1"_pos, "=SUM(A1:A5000)");
+      wide->SetCell("B2"_pos, "=MAX(A1:A5000)-MIN(A1:A5000)");
+      wide->SetCell("B3"_pos, "=B1/AVERAGE(A1:A5000)");
+
+      ASSERT_EQUAL(wide->GetCell("B1"_pos)->GetValue(), ICell::Value(rows * (rows + 1) / 2.0));
+      ASSERT_EQUAL(wide->GetCell("B2"_pos)->GetValue(), ICell::Value(rows - 1.0));
+      ASSERT_EQUAL(wide->GetCell("B3"_pos)->GetValue(), ICell::Value(static_cast<double>(rows)));
+
+      wide->SetCell("A2500"_pos, "0");
+      wide->Recalculate();
+      ASSERT_EQUAL(wide->GetCell("B1"_pos)->GetValue(), ICell::Value(rows * (rows + 1) / 2.0 - 2500));
+  }
+
+  void TestDependencyGraphEdits() {
+
+      // many formulas referencing the same cells, their edges are removed from the middle of long lists
+      auto sheet = CreateSheet();
+      const int rows = 300;
+
+      sheet->SetCell("A1"_pos, "1");
+      sheet->SetCell("B1"_pos, "2");
+
+      for (int row = 0; row < rows; ++row) {
+          sheet->SetCell(Position {row, 2}, "=A1+B1");
+      }
+
+      for (int row = 0; row < rows; row += 2) {
+          sheet->SetCell(Position {row, 2}, "=B1*" + std::to_string(row));
+      }
+
+      for (int row = 1; row < rows; row += 4) {
+          sheet->ClearCell(Position {row, 2});
+      }
+
+      sheet->SetCell("A1"_pos, "10");
+      sheet->SetCell("B1"_pos, "20");
+
+      for (int row = 0; row < rows; ++row) {
+          const ICell* cell = sheet->GetCell(Position {row, 2});
+          if (row % 2 == 0) {
+              ASSERT_EQUAL(cell->GetValue(), ICell::Value(20.0 * row));
+          } else if (row % 4 == 1) {
+              ASSERT(cell == nullptr);
+          } else {
+              ASSERT_EQUAL(cell->GetValue(), ICell::Value(30.0));
+          }
+      }
+
+      // ids of deleted cells are reused by new ones without stale edges
+      sheet->DeleteCols(0);
+      ASSERT_EQUAL(sheet->GetCell("B4"_pos)->GetText(), "=#REF!+A1");
+      for (int row = 0; row < rows; ++row) {
+          sheet->SetCell(Position {row, 3}, "=" + Position {row, 1}.ToString() + "+1");
+      }
+      ASSERT_EQUAL(sheet->GetCell("D4"_pos)->GetValue(), ICell::Value(FormulaError(FormulaError::Category::Ref)));
+      ASSERT_EQUAL(sheet->GetCell("D5"_pos)->GetValue(), ICell::Value(81.0));
+
+      sheet->SetCell("A1"_pos, "1");
+      ASSERT_EQUAL(sheet->GetCell("D5"_pos)->GetValue(), ICell::Value(5.0));
+      ASSERT_EQUAL(sheet->GetCell("D4"_pos)->GetValue(), ICell::Value(FormulaError(FormulaError::Category::Ref)));
+  }
+
+  std::unique_ptr<ISheet> SaveAndLoad(const ISheet& sheet, const std::string& path, bool with_values = true) {
+      {
+          std::ofstream output(path, std::ios::binary);
+          sheet.SaveSnapshot(output, with_values);
+      }
+      auto loaded = LoadSnapshot(path);
+      std::remove(path.c_str());
+      return loaded;
+  }
+
+  void TestSnapshot() {
+
+      const std::string path = "snapshot_test.bin";
+
+      auto sheet = CreateSheet();
+      sheet->SetCell("A1"_pos, "1");
+      sheet->SetCell("A2"_pos, "text");
+      sheet->SetCell("B1"_pos, "=A1+C5");
+      sheet->SetCell("B2"_pos, "=1/0");
+      sheet->SetCell("B3"_pos, "=SUM(A1:B1)*2");
+      sheet->SetCell("B4"_pos, "=A2");
+      sheet->SetCell("D1"_pos, "=B1+B3");
+      sheet->GetCell("D1"_pos)->GetValue();
+
+      for (bool with_values: {true, false}) {
+          auto loaded = SaveAndLoad(*sheet, path, with_values);
+
+          ASSERT_EQUAL(loaded->GetPrintableSize(), sheet->GetPrintableSize());
+          ASSERT_EQUAL(loaded->GetCell("A2"_pos)->GetText(), "text");
+          ASSERT_EQUAL(loaded->GetCell("B3"_pos)->GetText(), "=SUM(A1:B1)*2");
+          ASSERT_EQUAL(loaded->GetCell("B1"_pos)->GetReferencedCells(), sheet->GetCell("B1"_pos)->GetReferencedCells());
+          ASSERT(loaded->GetCell("C5"_pos) != nullptr);
+          ASSERT_EQUAL(loaded->GetCell("D1"_pos)->GetValue(), ICell::Value(5.0));
+          ASSERT_EQUAL(loaded->GetCell("B2"_pos)->GetValue(), ICell::Value(FormulaError(FormulaError::Category::Div0)));
+          ASSERT_EQUAL(loaded->GetCell("B4"_pos)->GetValue(), ICell::Value(FormulaError(FormulaError::Category::Value)));
+
+          // the restored graph invalidates stored values, the range sees a new cell
+          loaded->SetCell("C5"_pos, "2");
+          ASSERT_EQUAL(loaded->GetCell("D1"_pos)->GetValue(), ICell::Value(11.0));
+          loaded->SetCell("A1"_pos, "2");
+          ASSERT_EQUAL(loaded->GetCell("D1"_pos)->GetValue(), ICell::Value(16.0));
+
+          try {
+              loaded->SetCell("A1"_pos, "=D1");
+              ASSERT(false);
+          } catch (const CircularDependencyException&) {
+          }
+
+          // structural edits parse the stored expressions
+          loaded->InsertRows(0);
+          ASSERT_EQUAL(loaded->GetCell("D2"_pos)->GetText(), "=B2+B4");
+          ASSERT_EQUAL(loaded->GetCell("B4"_pos)->GetText(), "=SUM(A2:B2)*2");
+          loaded->DeleteCols(0);
+          ASSERT_EQUAL(loaded->GetCell("A4"_pos)->GetText(), "=SUM(A2:A2)*2");
+          ASSERT_EQUAL(loaded->GetCell("A2"_pos)->GetText(), "=#REF!+B6");
+          ASSERT_EQUAL(loaded->GetCell("C2"_pos)->GetValue(), ICell::Value(FormulaError(FormulaError::Category::Ref)));
+      }
+
+      // a snapshot of the loaded sheet is the same
+      std::ostringstream first;
+      sheet->SaveSnapshot(first);
+      std::ostringstream second;
+      SaveAndLoad(*sheet, path)->SaveSnapshot(second);
+      ASSERT_EQUAL(first.str(), second.str());
+
+      auto expect_broken = [&path](const std::string& data) {
+          {
+              std::ofstream output(path, std::ios::binary);
+              output << data;
+          }
+          try {
+              LoadSnapshot(path);
+              ASSERT(false);
+          } catch (const SnapshotException&) {
+          }
+          std::remove(path.c_str());
+      };
+
+      expect_broken("");
+      expect_broken(first.str().substr(0, first.str().size() - 1));
+      expect_broken("NOTASNAP" + first.str().substr(8));
+      std::string other_version = first.str();
+      other_version[8] = 1;
+      expect_broken(other_version);
+
+      // the texts are parsed after the load only, the checksum finds a damaged one
+      std::string damaged_text = first.str();
+      damaged_text[damaged_text.rfind("SUM(A1:B1)")] = 'X';
+      expect_broken(damaged_text);
+      std::string damaged_reference = first.str();
+      damaged_reference[damaged_reference.rfind("B1+B3")] = 'C';
+      expect_broken(damaged_reference);
+
+      try {
+          LoadSnapshot(path);
+          ASSERT(false);
+      } catch (const SnapshotException&) {
+      }
+  }
+
+  void TestImportTexts() {
+
+      auto sheet = CreateSheet();
+      sheet->SetCell("A1"_pos, "1");
+      sheet->SetCell("B1"_pos, "=A1+C2");
+      sheet->SetCell("C2"_pos, "'=text");
+      sheet->SetCell("A3"_pos, "=SUM(A1:C2)");
+      sheet->SetCell("D3"_pos, "x");
+
+      std::ostringstream texts;
+      sheet->PrintTexts(texts);
+
+      // the formula of the first row references a cell of a later one
+      auto imported = CreateSheet();
+      std::istringstream input(texts.str());
+      imported->ImportTexts(input);
+
+      std::ostringstream imported_texts;
+      imported->PrintTexts(imported_texts);
+      ASSERT_EQUAL(imported_texts.str(), texts.str());
+      ASSERT_EQUAL(imported->GetCell("B1"_pos)->GetValue(), ICell::Value(FormulaError(FormulaError::Category::Value)));
+      imported->SetCell("C2"_pos, "2");
+      ASSERT_EQUAL(imported->GetCell("B1"_pos)->GetValue(), ICell::Value(3.0));
+      ASSERT_EQUAL(imported->GetCell("A3"_pos)->GetValue(), ICell::Value(6.0));
+
+      // an import over existing cells updates their dependents, empty fields clear cells
+      std::istringstream update("5\r\n\t\t\r\n");
+      imported->ImportTexts(update);
+      ASSERT_EQUAL(imported->GetCell("B1"_pos)->GetValue(), ICell::Value(5.0));
+      ASSERT_EQUAL(imported->GetCell("A3"_pos)->GetValue(), ICell::Value(10.0));
+      ASSERT_EQUAL(imported->GetCell("C2"_pos)->GetText(), "");
+
+      std::istringstream csv("x,\"a,\"\"b\"\"\nc\",=A1*2\n,7,");
+      imported->ImportTexts(csv, "B5"_pos, ',');
+      ASSERT_EQUAL(imported->GetCell("C5"_pos)->GetText(), "a,\"b\"\nc");
+      ASSERT_EQUAL(imported->GetCell("D5"_pos)->GetValue(), ICell::Value(10.0));
+      ASSERT_EQUAL(imported->GetCell("C6"_pos)->GetText(), "7");
+      ASSERT(imported->GetCell("D6"_pos) == nullptr);
+
+      // a failed import leaves the sheet as it was
+      std::ostringstream before;
+      imported->PrintTexts(before);
+
+      auto expect_unchanged = [&imported, &before] {
+          std::ostringstream after;
+          imported->PrintTexts(after);
+          ASSERT_EQUAL(after.str(), before.str());
+          ASSERT_EQUAL(imported->GetCell("D5"_pos)->GetValue(), ICell::Value(10.0));
+      };
+
+      try {
+          std::istringstream cycle("=B1\n=A1\t8\t9");
+          imported->ImportTexts(cycle, "A1"_pos);
+          ASSERT(false);
+      } catch (const CircularDependencyException&) {
+      }
+      expect_unchanged();
+
+      try {
+          std::istringstream broken("1\t2\n=1+\t3");
+          imported->ImportTexts(broken, "A7"_pos);
+          ASSERT(false);
+      } catch (const FormulaException&) {
+      }
+      expect_unchanged();
+
+      try {
+          std::istringstream wide("1\t2\t3");
+          imported->ImportTexts(wide, Position {0, Position::kMaxCols - 2});
+          ASSERT(false);
+      } catch (const InvalidPositionException&) {
+      }
+      expect_unchanged();
+      ASSERT_EQUAL(imported->GetPrintableSize(), (Size {6, 4}));
+  }
+
+  void TestNumericText() {
+
+      auto sheet = CreateSheet();
+
+      sheet->SetCell("A1"_pos, "12.5");
+      sheet->SetCell("A2"_pos, "'3");
+      sheet->SetCell("A3"_pos, "1e999");
+      sheet->SetCell("A4"_pos, "4 apples");
+      sheet->SetCell("A5"_pos, "'");
+      sheet->SetCell("B1"_pos, "=A1*2");
+
+      const ICell* cell = sheet->GetCell("A1"_pos);
+
+      ASSERT_EQUAL(cell->GetTextView(), "12.5");
+      ASSERT(cell->GetNumericValue() == ICell::NumericValue(12.5));
+      ASSERT(sheet->GetCell("A2"_pos)->GetNumericValue() == ICell::NumericValue(3.0));
+      ASSERT(sheet->GetCell("A3"_pos)->GetNumericValue() == ICell::NumericValue(FormulaError(FormulaError::Category::Value)));
+      ASSERT(sheet->GetCell("A4"_pos)->GetNumericValue() == ICell::NumericValue(FormulaError(FormulaError::Category::Value)));
+      ASSERT(sheet->GetCell("A5"_pos)->GetNumericValue() == std::nullopt);
+      ASSERT(sheet->GetCell("B1"_pos)->GetNumericValue() == ICell::NumericValue(25.0));
+
+      // the value of a text is the text, a number included
+      ASSERT_EQUAL(cell->GetValue(), ICell::Value(std::string("12.5")));
+      ASSERT_EQUAL(sheet->GetCell("A2"_pos)->GetValue(), ICell::Value(std::string("3")));
+      ASSERT_EQUAL(sheet->GetCell("A5"_pos)->GetValue(), ICell::Value(std::string()));
+
+      // the number follows edits of the text
+      sheet->SetCell("A1"_pos, "-1");
+      ASSERT_EQUAL(sheet->GetCell("B1"_pos)->GetValue(), ICell::Value(-2.0));
+      sheet->SetCell("B2"_pos, "=SUM(A1:A2)+AVERAGE(A5:A6)");
+      ASSERT_EQUAL(sheet->GetCell("B2"_pos)->GetValue(), ICell::Value(FormulaError(FormulaError::Category::Div0)));
+      sheet->SetCell("B2"_pos, "=SUM(A1:A2)+A5");
+      ASSERT_EQUAL(sheet->GetCell("B2"_pos)->GetValue(), ICell::Value(2.0));
+      sheet->SetCell("A2"_pos, "three");
+      ASSERT_EQUAL(sheet->GetCell("B2"_pos)->GetValue(), ICell::Value(FormulaError(FormulaError::Category::Value)));
+
+      // a formula and a text replace each other in the same cell
+      sheet->SetCell("B2"_pos, "=A4");
+      ASSERT_EQUAL(sheet->GetCell("B2"_pos)->GetValue(), ICell::Value(FormulaError(FormulaError::Category::Value)));
+      sheet->SetCell("B2"_pos, "7");
+      ASSERT(sheet->GetCell("B2"_pos)->GetNumericValue() == ICell::NumericValue(7.0));
+      ASSERT_EQUAL(sheet->GetCell("B2"_pos)->GetValue(), ICell::Value(std::string("7")));
+      sheet->SetCell("B2"_pos, "=B1+1");
+      ASSERT_EQUAL(sheet->GetCell("B2"_pos)->GetValue(), ICell::Value(-1.0));
+  }
+
+  void TestFormulaOptimization() {
+
+      auto sheet = CreateSheet();
+      sheet->SetCell("A1"_pos, "3");
+      sheet->SetCell("B1"_pos, "4");
+
+      auto check = [&sheet](const std::string& text, ICell::Value expected) {
+          sheet->SetCell("C1"_pos, text);
+          ASSERT_EQUAL(sheet->GetCell("C1"_pos)->GetText(), text);
+          ASSERT_EQUAL(sheet->GetCell("C1"_pos)->GetValue(), expected);
+      };
+
+      // folded literals keep the written expression
+      check("=2*3/7+A1", ICell::Value(2.0 * 3 / 7 + 3));
+      check("=--A1-+B1", ICell::Value(-1.0));
+      check("=--2*A1", ICell::Value(6.0));
+      check("=SUM(1,2)*MAX(4,5)", ICell::Value(15.0));
+      check("=1e308*10/10", ICell::Value(FormulaError(FormulaError::Category::Div0)));
+      check("=AVERAGE(A2:A3)+2*3", ICell::Value(FormulaError(FormulaError::Category::Div0)));
+      check("=A1+1/0", ICell::Value(FormulaError(FormulaError::Category::Div0)));
+
+      // shared subexpressions are evaluated once, the first error met is still the result
+      check("=(A1+B1)*(A1+B1)-(A1+B1)", ICell::Value(42.0));
+      check("=A1*A1*A1+SUM(A1:B1)/SUM(A1:B1)", ICell::Value(28.0));
+      check("=A1/(B1-B1)*(B1-B1)", ICell::Value(FormulaError(FormulaError::Category::Div0)));
+      sheet->SetCell("A2"_pos, "x");
+      check("=(A1+A2)*(A1+A2)", ICell::Value(FormulaError(FormulaError::Category::Value)));
+      check("=B1/(A1-3)*(A1+A2)", ICell::Value(FormulaError(FormulaError::Category::Div0)));
+
+      sheet->SetCell("C1"_pos, "=(A1+B1)*(A1+B1)+A1*2");
+      sheet->InsertRows(0);
+      ASSERT_EQUAL(sheet->GetCell("C2"_pos)->GetText(), "=(A2+B2)*(A2+B2)+A2*2");
+      sheet->SetCell("A2"_pos, "1");
+      ASSERT_EQUAL(sheet->GetCell("C2"_pos)->GetValue(), ICell::Value(27.0));
+      sheet->DeleteCols(1);
+      ASSERT_EQUAL(sheet->GetCell("B2"_pos)->GetValue(), ICell::Value(FormulaError(FormulaError::Category::Ref)));
+  }
+
+  void TestFormulaTemplates() {
+
+      auto sheet = CreateSheet();
+
+      for (int row = 0; row < 100; ++row) {
+          std::string n = std::to_string(row + 1);
+          sheet->SetCell(Position {row, 0}, n);
+          sheet->SetCell(Position {row, 1}, "1");
+          sheet->SetCell(Position {row, 2}, "=A" + n + "+B" + n + "*2");
+          sheet->SetCell(Position {row, 3}, "=SUM(A" + n + ":B" + n + ")-C" + n);
+          sheet->SetCell(Position {row, 4}, "=SUM(A1:A" + n + ")");
+      }
+
+      // the cells of a filled column share a template, each formula reads its own references
+      ASSERT_EQUAL(sheet->GetCell("C5"_pos)->GetText(), "=A5+B5*2");
+      ASSERT_EQUAL(sheet->GetCell("C5"_pos)->GetValue(), ICell::Value(7.0));
+      ASSERT_EQUAL(sheet->GetCell("D100"_pos)->GetText(), "=SUM(A100:B100)-C100");
+      ASSERT_EQUAL(sheet->GetCell("D100"_pos)->GetValue(), ICell::Value(-1.0));
+      ASSERT_EQUAL(sheet->GetCell("E100"_pos)->GetValue(), ICell::Value(5050.0));
+      ASSERT(sheet->GetCell("C7"_pos)->GetReferencedCells() == std::vector<Position>({"A7"_pos, "B7"_pos}));
+
+      // references may go up and left of the cell, spaces don't change the template
+      sheet->SetCell("F2"_pos, "= A1 + E3");
+      sheet->SetCell("F3"_pos, "=A2+E4");
+      ASSERT_EQUAL(sheet->GetCell("F2"_pos)->GetText(), "=A1+E3");
+      ASSERT_EQUAL(sheet->GetCell("F3"_pos)->GetValue(), ICell::Value(12.0));
+
+      // tokens of the key are separated, so "12" doesn't accept "1 2"
+      sheet->SetCell("G1"_pos, "=12");
+      try {
+          sheet->SetCell("G2"_pos, "=1 2");
+          ASSERT(false);
+      } catch (const FormulaException&) {}
+
+      // structural edits move the references of each cell their own way
+      sheet->InsertRows(50, 2);
+      ASSERT_EQUAL(sheet->GetCell("C50"_pos)->GetText(), "=A50+B50*2");
+      ASSERT_EQUAL(sheet->GetCell("C53"_pos)->GetText(), "=A53+B53*2");
+      ASSERT_EQUAL(sheet->GetCell("E53"_pos)->GetText(), "=SUM(A1:A53)");
+      ASSERT_EQUAL(sheet->GetCell("C53"_pos)->GetValue(), ICell::Value(53.0));
+      sheet->SetCell("A51"_pos, "1000");
+      ASSERT_EQUAL(sheet->GetCell("E102"_pos)->GetValue(), ICell::Value(6050.0));
+
+      sheet->DeleteRows(0);
+      ASSERT_EQUAL(sheet->GetCell("F1"_pos)->GetText(), "=#REF!+E2");
+      ASSERT_EQUAL(sheet->GetCell("F2"_pos)->GetText(), "=A1+E3");
+      ASSERT_EQUAL(sheet->GetCell("C1"_pos)->GetText(), "=A1+B1*2");
+      ASSERT_EQUAL(sheet->GetCell("C1"_pos)->GetValue(), ICell::Value(4.0));
+
+      // a formula with #REF! keeps being edited
+      sheet->InsertCols(0);
+      ASSERT_EQUAL(sheet->GetCell("G1"_pos)->GetText(), "=#REF!+F2");
+      ASSERT_EQUAL(sheet->GetCell("G1"_pos)->GetValue(), ICell::Value(FormulaError(FormulaError::Category::Ref)));
+      ASSERT_EQUAL(sheet->GetCell("D1"_pos)->GetText(), "=B1+C1*2");
+
+      // #REF! written by hand is the same deleted reference, and the template of G1 is shared
+      sheet->SetCell("G2"_pos, "=#REF!+F3");
+      ASSERT_EQUAL(sheet->GetCell("G2"_pos)->GetText(), "=#REF!+F3");
+      ASSERT_EQUAL(sheet->GetCell("G2"_pos)->GetValue(), ICell::Value(FormulaError(FormulaError::Category::Ref)));
+      ASSERT(sheet->GetCell("G2"_pos)->GetReferencedCells() == std::vector<Position> {"F3"_pos});
+
+      sheet->InsertRows(0);
+      ASSERT_EQUAL(sheet->GetCell("G2"_pos)->GetText(), "=#REF!+F3");
+      ASSERT_EQUAL(sheet->GetCell("G3"_pos)->GetText(), "=#REF!+F4");
+      sheet->DeleteCols(5);
+      ASSERT_EQUAL(sheet->GetCell("F3"_pos)->GetText(), "=#REF!+#REF!");
+      ASSERT_EQUAL(sheet->GetCell("F3"_pos)->GetValue(), ICell::Value(FormulaError(FormulaError::Category::Ref)));
+
+      // imported formulas share templates as well
+      std::string texts;
+      for (int row = 1; row <= 300; ++row) {
+          texts += std::to_string(row) + "\t=A" + std::to_string(row) + "*2\n";
+      }
+
+      auto imported = CreateSheet();
+      imported->SetRecalculationThreads(4);
+      std::istringstream input(texts);
+      imported->ImportTexts(input);
+      ASSERT_EQUAL(imported->GetCell("B300"_pos)->GetText(), "=A300*2");
+      ASSERT_EQUAL(imported->GetCell("B300"_pos)->GetValue(), ICell::Value(600.0));
+  }
+
+  void TestValueSnapshots() {
+
+      auto sheet = CreateSheet();
+      ASSERT_EQUAL(sheet->GetValues()->GetVersion(), 0u);
+      ASSERT(!sheet->GetValues()->GetValue("A1"_pos));
+
+      sheet->SetCell("A1"_pos, "2");
+      sheet->SetCell("B1"_pos, "=A1*2");
+      sheet->SetCell("C3"_pos, "'text");
+      sheet->PublishValues();
+
+      auto first = sheet->GetValues();
+      ASSERT_EQUAL(first->GetVersion(), 1u);
+      ASSERT_EQUAL(*first->GetValue("B1"_pos), ICell::Value(4.0));
+      ASSERT_EQUAL(*first->GetValue("C3"_pos), ICell::Value("text"));
+      ASSERT_EQUAL(first->GetPrintableSize(), (Size {3, 3}));
+
+      // a published snapshot doesn't change, the next one shares the cells that didn't
+      sheet->SetCell("A1"_pos, "5");
+      sheet->ClearCell("C3"_pos);
+      ASSERT_EQUAL(*sheet->GetValues()->GetValue("B1"_pos), ICell::Value(4.0));
+      sheet->PublishValues();
+
+      auto second = sheet->GetValues();
+      ASSERT_EQUAL(second->GetVersion(), 2u);
+      ASSERT_EQUAL(*second->GetValue("B1"_pos), ICell::Value(10.0));
+      ASSERT(!second->GetValue("C3"_pos));
+      ASSERT_EQUAL(*first->GetValue("B1"_pos), ICell::Value(4.0));
+      ASSERT_EQUAL(*first->GetValue("C3"_pos), ICell::Value("text"));
+
+      // structural edits move every value
+      sheet->InsertRows(0);
+      sheet->PublishValues();
+      ASSERT(!sheet->GetValues()->GetValue("B1"_pos));
+      ASSERT_EQUAL(*sheet->GetValues()->GetValue("B2"_pos), ICell::Value(10.0));
+
+      try {
+          sheet->GetValues()->GetValue(Position {-1, 0});
+          ASSERT(false);
+      } catch (const InvalidPositionException&) {}
+
+      // readers see whole publications while the writer edits: B stays twice A in every row.
+      // Texts are values as they are, so A holds formulas
+      const int rows = 64;
+      for (int row = 0; row < rows; ++row) {
+          sheet->SetCell(Position {row, 0}, "=0");
+          sheet->SetCell(Position {row, 1}, "=A" + std::to_string(row + 1) + "*2");
+      }
+      sheet->PublishValues();
+
+      std::atomic<bool> done {false};
+      std::atomic<int> inconsistent {0};
+      std::vector<std::thread> readers;
+
+      for (int i = 0; i < 4; ++i) {
+          readers.emplace_back([&] {
+              while (!done.load()) {
+                  auto values = sheet->GetValues();
+                  for (int row = 0; row < rows; ++row) {
+                      double a = std::get<double>(*values->GetValue(Position {row, 0}));
+                      double b = std::get<double>(*values->GetValue(Position {row, 1}));
+                      if (b != a * 2) inconsistent++;
+                  }
+              }
+          });
+      }
+
+      for (int i = 1; i <= 200; ++i) {
+          sheet->SetCell(Position {i % rows, 0}, "=" + std::to_string(i));
+          sheet->PublishValues();
+      }
+
+      done = true;
+      for (std::thread& reader: readers) reader.join();
+
+      ASSERT_EQUAL(inconsistent.load(), 0);
+      ASSERT_EQUAL(*sheet->GetValues()->GetValue(Position {200 % rows, 1}), ICell::Value(400.0));
+  }
+
+  void TestCycleRanks() {
+
+      auto sheet = CreateSheet();
+      sheet->SetCell("A1"_pos, "=1");
+      for (int row = 1; row < 100; ++row) {
+          sheet->SetCell(Position {row, 0}, "=A" + std::to_string(row) + "+1");
+      }
+
+      try {
+          sheet->SetCell("A1"_pos, "=A100");
+          ASSERT(false);
+      } catch (const CircularDependencyException&) {}
+
+      // D1 is created after the chain, reading it from A1 reorders D1 below the chain
+      sheet->SetCell("D1"_pos, "=5");
+      sheet->SetCell("A1"_pos, "=D1");
+      ASSERT_EQUAL(sheet->GetCell("A100"_pos)->GetValue(), ICell::Value(104.0));
+
+      try {
+          sheet->SetCell("D1"_pos, "=A50");
+          ASSERT(false);
+      } catch (const CircularDependencyException&) {}
+
+      sheet->SetCell("E1"_pos, "=SUM(A1:A100)");
+      try {
+          sheet->SetCell("D1"_pos, "=E1");
+          ASSERT(false);
+      } catch (const CircularDependencyException&) {}
+
+      sheet->SetCell("D1"_pos, "=F1");
+      sheet->SetCell("F1"_pos, "=2");
+      ASSERT_EQUAL(sheet->GetCell("A100"_pos)->GetValue(), ICell::Value(101.0));
+
+      // references keep their cells after a deletion shifts them onto the rows of deleted ones
+      auto shifted = CreateSheet();
+      shifted->SetCell("A2"_pos, "=D5+A6");
+      shifted->DeleteCols(3);
+      shifted->DeleteRows(2);
+      ASSERT_EQUAL(shifted->GetCell("A2"_pos)->GetText(), "=#REF!+A5");
+      try {
+          shifted->SetCell("A5"_pos, "=A2");
+          ASSERT(false);
+      } catch (const CircularDependencyException&) {}
+
+      shifted->SetCell("A6"_pos, "=E6+C5");
+      shifted->DeleteRows(1);
+      ASSERT_EQUAL(shifted->GetCell("A5"_pos)->GetText(), "=E5+C4");
+      try {
+          shifted->SetCell("E5"_pos, "=A5");
+          ASSERT(false);
+      } catch (const CircularDependencyException&) {}
+  }
+
+  void TestSheetStats() {
+
+      auto sheet = CreateSheet();
+      std::vector<SheetTraceEvent> events;
+      sheet->SetTraceCallback([&events](const SheetTraceEvent& event) {
+          events.push_back(event);
+      });
+
+      sheet->SetCell("A1"_pos, "=1");
+      sheet->SetCell("A2"_pos, "=A1+1");
+      sheet->SetCell("A3"_pos, "=A2+1");
+      ASSERT_EQUAL(sheet->GetCell("A3"_pos)->GetValue(), ICell::Value(3.0));
+      ASSERT_EQUAL(sheet->GetCell("A3"_pos)->GetValue(), ICell::Value(3.0));
+
+      ASSERT_EQUAL(events.size(), 3u);
+      ASSERT_EQUAL(std::string(events[0].operation), "SetCell");
+
+      // the edits inside the commit are not reported on their own
+      sheet->BeginBatch();
+      sheet->SetCell("B1"_pos, "=A3*2");
+      sheet->CommitBatch();
+      [[maybe_unused]] SheetStats stats = sheet->GetStats();
+      sheet->InsertRows(0);
+
+      ASSERT_EQUAL(events.size(), 6u);
+      ASSERT_EQUAL(std::string(events[4].operation), "CommitBatch");
+      ASSERT_EQUAL(std::string(events[5].operation), "InsertRows");
+
+#ifdef SPREADSHEET_STATS
+      // A3 shares the template of A2, so only one formula of them is parsed
+      ASSERT_EQUAL(stats.parses, 3u);
+      ASSERT_EQUAL(stats.cache_misses, 3u);
+      ASSERT_EQUAL(stats.cache_hits, 1u);
+      ASSERT_EQUAL(stats.max_evaluation_depth, 3u);
+      ASSERT_EQUAL(events[0].stats.parses, 1u);
+      ASSERT_EQUAL(events[2].stats.parses, 0u);
+      ASSERT_EQUAL(events[5].stats.structural_edit_cells, 3u);
+#endif
+
+      // A3 and A4 were calculated, B2 never was
+      sheet->GetCell("A4"_pos)->GetValue();
+      sheet->SetCell("A3"_pos, "=5");
+      ASSERT_EQUAL(events.size(), 7u);
+#ifdef SPREADSHEET_STATS
+      ASSERT_EQUAL(events.back().stats.invalidated_cells, 2u);
+#endif
+
+      sheet->SetTraceCallback(nullptr);
+      sheet->ClearCell("A3"_pos);
+      ASSERT_EQUAL(events.size(), 7u);
+  }
+
+  void TestOnDemandLongChain() {
+
+      // the last cell is read before anything was calculated, the chain is far deeper than the stack
+      // would allow a cell to recurse into the cells it reads
+      auto sheet = CreateSheet();
+      const int rows = 10'000;
+      const int cols = 5;
+
+      sheet->SetCell("A1"_pos, "1");
+
+      Position last {0, 0};
+
+      for (int col = 0; col < cols; ++col) {
+          for (int row = col == 0 ? 1 : 0; row < rows; ++row) {
+              Position pos {row, col};
+              sheet->SetCell(pos, "=" + last.ToString() + "+1");
+              last = pos;
+          }
+      }
+
+      ASSERT_EQUAL(sheet->GetCell(last)->GetValue(), ICell::Value(double(rows * cols)));
+
+      // only the invalidated part is calculated again, through a range as well
+      sheet->SetCell("A2"_pos, "=SUM(A1:A1)+2");
+      sheet->SetCell("F1"_pos, "=SUM(" + last.ToString() + ":" + last.ToString() + ")");
+      ASSERT_EQUAL(sheet->GetCell("F1"_pos)->GetValue(), ICell::Value(double(rows * cols + 1)));
+  }
+
+  void TestStructuralEditsKeepTemplates() {
+
+      auto sheet = CreateSheet();
+      const int rows = 100;
+
+      sheet->SetCell("A1"_pos, "=1");
+      sheet->SetCell("B1"_pos, "=A1*2");
+
+      for (int row = 1; row < rows; ++row) {
+          sheet->SetCell(Position {row, 0}, "=" + Position {row - 1, 0}.ToString() + "+1");
+          sheet->SetCell(Position {row, 1}, "=" + Position {row, 0}.ToString() + "*2");
+      }
+
+      [[maybe_unused]] SheetStats stats = sheet->GetStats();
+
+      // every reference is behind the edit, the filled formulas keep their templates
+      sheet->InsertRows(0, 2);
+      sheet->InsertCols(0);
+      sheet->DeleteRows(0, 1);
+
+#ifdef SPREADSHEET_STATS
+      ASSERT_EQUAL(sheet->GetStats().parses, stats.parses);
+#endif
+
+      ASSERT_EQUAL(sheet->GetCell("C101"_pos)->GetText(), "=B101*2");
+      ASSERT_EQUAL(sheet->GetCell("B3"_pos)->GetText(), "=B2+1");
+      ASSERT_EQUAL(sheet->GetCell("C101"_pos)->GetValue(), ICell::Value(200.0));
+
+      // the edit splits the chain, only the formulas on both sides of it are edited
+      sheet->InsertRows(50, 3);
+      ASSERT_EQUAL(sheet->GetCell("B54"_pos)->GetText(), "=B50+1");
+      ASSERT_EQUAL(sheet->GetCell("B55"_pos)->GetText(), "=B54+1");
+      ASSERT_EQUAL(sheet->GetCell("C54"_pos)->GetText(), "=B54*2");
+      ASSERT_EQUAL(sheet->GetCell("C104"_pos)->GetValue(), ICell::Value(200.0));
+
+      sheet->DeleteRows(50, 3);
+      sheet->DeleteCols(0);
+      ASSERT_EQUAL(sheet->GetCell("A51"_pos)->GetText(), "=A50+1");
+      ASSERT_EQUAL(sheet->GetCell("B101"_pos)->GetValue(), ICell::Value(200.0));
+
+      sheet->DeleteRows(9);
+      ASSERT_EQUAL(sheet->GetCell("A10"_pos)->GetText(), "=#REF!+1");
+      ASSERT_EQUAL(sheet->GetCell("A11"_pos)->GetText(), "=A10+1");
+      ASSERT_EQUAL(sheet->GetCell("B9"_pos)->GetText(), "=A9*2");
+
+      // the shifted formulas are still found by the next edits
+      sheet->InsertRows(0);
+      ASSERT_EQUAL(sheet->GetCell("A12"_pos)->GetText(), "=A11+1");
+      ASSERT_EQUAL(sheet->GetCell("B101"_pos)->GetText(), "=A101*2");
+      ASSERT_EQUAL(sheet->GetPrintableSize(), (Size {101, 2}));
+  }
+
+  void TestChangeCallback() {
+
+      auto sheet = CreateSheet();
+      sheet->SetCell("A1"_pos, "1");
+      sheet->SetCell("B1"_pos, "=A1*2");
+      sheet->SetCell("C1"_pos, "=B1+1");
+      sheet->SetCell("D1"_pos, "=1");
+      ASSERT_EQUAL(sheet->GetCell("C1"_pos)->GetValue(), ICell::Value(3.0));
+
+      std::vector<SheetChanges> notifications;
+      sheet->SetChangeCallback([&notifications](const SheetChanges& changes) {
+          notifications.push_back(changes);
+      });
+
+      sheet->SetCell("A1"_pos, "2");
+      ASSERT_EQUAL(notifications.size(), 1u);
+      ASSERT(!notifications.back().all);
+      ASSERT_EQUAL(notifications.back().positions, (std::vector<Position> {"A1"_pos, "B1"_pos, "C1"_pos}));
+
+      // the dependents were not calculated since they were reported
+      sheet->SetCell("A1"_pos, "3");
+      ASSERT_EQUAL(notifications.back().positions, (std::vector<Position> {"A1"_pos}));
+
+      // a commit is reported once, the edits of the batch are not
+      ASSERT_EQUAL(sheet->GetCell("C1"_pos)->GetValue(), ICell::Value(7.0));
+      sheet->BeginBatch();
+      sheet->SetCell("A2"_pos, "x");
+      sheet->SetCell("A1"_pos, "4");
+      sheet->ClearCell("D1"_pos);
+      ASSERT_EQUAL(notifications.size(), 2u);
+      sheet->CommitBatch();
+      ASSERT_EQUAL(notifications.size(), 3u);
+      ASSERT_EQUAL(
+          notifications.back().positions,
+          (std::vector<Position> {"A1"_pos, "B1"_pos, "C1"_pos, "D1"_pos, "A2"_pos})
+      );
+
+      sheet->InsertRows(0);
+      ASSERT_EQUAL(notifications.size(), 4u);
+      ASSERT(notifications.back().all);
+      ASSERT(notifications.back().positions.empty());
+
+      sheet->SetChangeCallback(nullptr);
+      sheet->SetCell("A3"_pos, "1");
+      ASSERT_EQUAL(notifications.size(), 4u);
+  }
+
+  void TestBackgroundRecalculation() {
+
+      auto sheet = CreateSheet();
+      const int rows = 2000;
+
+      sheet->SetCell("A1"_pos, "1");
+
+      for (int row = 1; row < rows; ++row) {
+          sheet->SetCell(Position {row, 0}, "=" + Position {row - 1, 0}.ToString() + "+1");
+      }
+
+      sheet->SetCell("B1"_pos, "=A2000*2");
+
+      auto wait_calculated = [&sheet](Position pos) {
+          auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(60);
+          auto values = sheet->GetValues();
+          while (values->IsPending(pos) || !values->GetValue(pos)) {
+              ASSERT(std::chrono::steady_clock::now() < deadline);
+              std::this_thread::sleep_for(std::chrono::milliseconds(1));
+              values = sheet->GetValues();
+          }
+          return *values->GetValue(pos);
+      };
+
+      sheet->SetViewport(Range {"B1"_pos, "B1"_pos});
+      sheet->SetRecalculationMode(RecalculationMode::Background);
+      ASSERT_EQUAL(wait_calculated("B1"_pos), ICell::Value(4000.0));
+
+      // the callback runs before the recalculation is scheduled, so it sees the pending values
+      std::shared_ptr<const IValueSnapshot> pending;
+      sheet->SetChangeCallback([&sheet, &pending](const SheetChanges&) {
+          pending = sheet->GetValues();
+      });
+
+      sheet->SetCell("A1"_pos, "2");
+      ASSERT(pending->IsPending("A1"_pos));
+      ASSERT(pending->IsPending("B1"_pos));
+      ASSERT(!pending->IsPending("C1"_pos));
+      ASSERT_EQUAL(*pending->GetValue("B1"_pos), ICell::Value(4000.0));
+      ASSERT_EQUAL(wait_calculated("B1"_pos), ICell::Value(4002.0));
+
+      // the editing thread calculates a pending value itself
+      sheet->SetCell("A1"_pos, "3");
+      ASSERT_EQUAL(sheet->GetCell("B1"_pos)->GetValue(), ICell::Value(4004.0));
+
+      sheet->InsertRows(0);
+      ASSERT(pending->IsPending("B1"_pos));
+      ASSERT_EQUAL(wait_calculated("B2"_pos), ICell::Value(4004.0));
+      sheet->SetChangeCallback(nullptr);
+
+      sheet->SetRecalculationMode(RecalculationMode::OnDemand);
+      sheet->SetCell("A2"_pos, "4");
+      sheet->PublishValues();
+      ASSERT(!sheet->GetValues()->IsPending("B2"_pos));
+      ASSERT_EQUAL(*sheet->GetValues()->GetValue("B2"_pos), ICell::Value(4006.0));
+
+      try {
+          sheet->SetViewport(Range {"B2"_pos, Position {Position::kMaxRows, 0}});
+          ASSERT(false);
+      } catch (const InvalidPositionException&) {}
+  }
+
+  void TestWorkbook() {
+
+      auto workbook = CreateWorkbook();
+      ISheet& first = workbook->AddSheet("First");
+      ISheet& second = workbook->AddSheet("Sheet_2");
+      ASSERT_EQUAL(workbook->GetSheetNames(), (std::vector<std::string> {"First", "Sheet_2"}));
+      ASSERT_EQUAL(workbook->GetSheet("First"), &first);
+      ASSERT(workbook->GetSheet("first") == nullptr);
+
+      first.SetCell("A1"_pos, "1");
+      first.SetCell("A2"_pos, "2");
+      second.SetCell("A1"_pos, "= First!A1 + 1");
+      second.SetCell("B1"_pos, "=SUM(First!A1:A2)");
+      ASSERT_EQUAL(second.GetCell("A1"_pos)->GetText(), "=First!A1+1");
+      ASSERT_EQUAL(second.GetCell("A1"_pos)->GetValue(), ICell::Value(2.0));
+      ASSERT_EQUAL(second.GetCell("B1"_pos)->GetValue(), ICell::Value(3.0));
+
+      auto formula = ParseFormula("Sheet_2!B3+A1");
+      ASSERT_EQUAL(formula->GetReferencedCells(), (std::vector<Position> {"A1"_pos}));
+      ASSERT(formula->GetExternalReferences() ==
+             (std::vector<ExternalReference> {{"Sheet_2", Range {"B3"_pos, "B3"_pos}}}));
+
+      // an edit of a sheet invalidates the cells of the sheets reading it
+      first.SetCell("A2"_pos, "5");
+      ASSERT_EQUAL(second.GetCell("B1"_pos)->GetValue(), ICell::Value(6.0));
+
+      ISheet& third = workbook->AddSheet("Third");
+      third.SetCell("A1"_pos, "=Sheet_2!A1*10");
+      ASSERT_EQUAL(third.GetCell("A1"_pos)->GetValue(), ICell::Value(20.0));
+      first.SetCell("A1"_pos, "3");
+      ASSERT_EQUAL(third.GetCell("A1"_pos)->GetValue(), ICell::Value(40.0));
+
+      // a missing sheet is calculated once it is added
+      third.SetCell("B1"_pos, "=Later!A1+1");
+      ASSERT_EQUAL(third.GetCell("B1"_pos)->GetValue(), ICell::Value(FormulaError::Category::Ref));
+      workbook->AddSheet("Later").SetCell("A1"_pos, "=4");
+      ASSERT_EQUAL(third.GetCell("B1"_pos)->GetValue(), ICell::Value(5.0));
+
+      try {
+          first.SetCell("B1"_pos, "=Third!A1");
+          first.SetCell("A1"_pos, "=B1");
+          ASSERT(false);
+      } catch (const CircularDependencyException&) {}
+      ASSERT_EQUAL(first.GetCell("A1"_pos)->GetText(), "3");
+      ASSERT_EQUAL(first.GetCell("B1"_pos)->GetValue(), ICell::Value(40.0));
+
+      for (const std::string name: {"", "1st", "Bad name", "First"}) {
+          try {
+              workbook->AddSheet(name);
+              ASSERT(false);
+          } catch (const InvalidSheetNameException&) {}
+      }
+
+      // structural edits of a sheet move the references of the formulas reading it, a filled down formula
+      // reading it shares its template
+      auto edited = CreateWorkbook();
+      ISheet& data = edited->AddSheet("Data");
+      ISheet& calc = edited->AddSheet("Calc");
+      data.SetCell("A1"_pos, "5");
+      data.SetCell("A2"_pos, "7");
+      data.SetCell("C5"_pos, "=Data!A2");
+      calc.SetCell("A1"_pos, "=Data!A1*2+B1");
+      calc.SetCell("A2"_pos, "=Data!A1*2+B2");
+      calc.SetCell("B1"_pos, "=SUM(Data!A1:A2)");
+      ASSERT_EQUAL(calc.GetCell("A1"_pos)->GetValue(), ICell::Value(22.0));
+
+      data.InsertRows(0);
+      ASSERT_EQUAL(calc.GetCell("A1"_pos)->GetText(), "=Data!A2*2+B1");
+      ASSERT_EQUAL(calc.GetCell("A2"_pos)->GetText(), "=Data!A2*2+B2");
+      ASSERT_EQUAL(calc.GetCell("B1"_pos)->GetText(), "=SUM(Data!A2:A3)");
+      ASSERT_EQUAL(data.GetCell("C6"_pos)->GetText(), "=Data!A3");
+      ASSERT_EQUAL(calc.GetCell("A1"_pos)->GetValue(), ICell::Value(22.0));
+      ASSERT_EQUAL(calc.GetCell("A2"_pos)->GetValue(), ICell::Value(10.0));
+
+      data.InsertRows(2);
+      data.InsertCols(0);
+      ASSERT_EQUAL(calc.GetCell("B1"_pos)->GetText(), "=SUM(Data!B2:B4)");
+      data.SetCell("B3"_pos, "1");
+      ASSERT_EQUAL(calc.GetCell("A1"_pos)->GetValue(), ICell::Value(23.0));
+
+      data.DeleteRows(1);
+      ASSERT_EQUAL(calc.GetCell("A1"_pos)->GetText(), "=#REF!*2+B1");
+      ASSERT_EQUAL(calc.GetCell("B1"_pos)->GetText(), "=SUM(Data!B2:B3)");
+      ASSERT_EQUAL(calc.GetCell("A1"_pos)->GetValue(), ICell::Value(FormulaError::Category::Ref));
+      ASSERT_EQUAL(calc.GetCell("B1"_pos)->GetValue(), ICell::Value(8.0));
+      ASSERT_EQUAL(data.GetCell("D6"_pos)->GetText(), "=Data!B3");
+      ASSERT_EQUAL(data.GetCell("D6"_pos)->GetValue(), ICell::Value(7.0));
+
+      data.DeleteCols(0, 2);
+      ASSERT_EQUAL(calc.GetCell("B1"_pos)->GetText(), "=SUM(#REF!)");
+      ASSERT_EQUAL(calc.GetCell("B1"_pos)->GetValue(), ICell::Value(FormulaError::Category::Ref));
+      ASSERT_EQUAL(data.GetCell("B6"_pos)->GetText(), "=#REF!");
+      data.SetCell("A1"_pos, "3");
+      ASSERT_EQUAL(calc.GetCell("A2"_pos)->GetValue(), ICell::Value(FormulaError::Category::Ref));
+
+      // without a workbook the references to other sheets are missing sheets
+      auto sheet = CreateSheet();
+      ASSERT(sheet->FindSheet("First") == nullptr);
+      sheet->SetCell("A1"_pos, "=First!A1");
+      ASSERT_EQUAL(sheet->GetCell("A1"_pos)->GetValue(), ICell::Value(FormulaError::Category::Ref));
+
+      // a long chain going back and forth between two sheets
+      auto chain = CreateWorkbook();
+      ISheet& left = chain->AddSheet("L");
+      ISheet& right = chain->AddSheet("R");
+      const int rows = 5000;
+
+      left.SetCell("A1"_pos, "1");
+
+      for (int row = 1; row < rows; ++row) {
+          ISheet& sheet = row % 2 == 0 ? left : right;
+          std::string previous = row % 2 == 0 ? "R!" : "L!";
+          sheet.SetCell(Position {row, 0}, "=" + previous + Position {row - 1, 0}.ToString() + "+1");
+      }
+
+      ISheet& last = (rows - 1) % 2 == 0 ? left : right;
+      ASSERT_EQUAL(last.GetCell(Position {rows - 1, 0})->GetValue(), ICell::Value(double(rows)));
+      left.SetCell("A1"_pos, "2");
+
+      chain->SetRecalculationThreads(2);
+      chain->Recalculate();
+      ASSERT_EQUAL(last.GetCell(Position {rows - 1, 0})->GetValue(), ICell::Value(double(rows + 1)));
+  }
+
+  void TestUndoRedo() {
+
+      auto sheet = CreateSheet();
+
+      auto texts = [&sheet] {
+          std::ostringstream output;
+          sheet->PrintTexts(output);
+          return output.str();
+      };
+
+      ASSERT(!sheet->Undo());
+      ASSERT(!sheet->Redo());
+
+      sheet->SetCell("A1"_pos, "1");
+      sheet->SetCell("A2"_pos, "=A1+1");
+      sheet->SetCell("A1"_pos, "5");
+      ASSERT_EQUAL(sheet->GetCell("A2"_pos)->GetValue(), ICell::Value(6.0));
+
+      ASSERT(sheet->Undo());
+      ASSERT_EQUAL(sheet->GetCell("A1"_pos)->GetText(), "1");
+      ASSERT_EQUAL(sheet->GetCell("A2"_pos)->GetValue(), ICell::Value(2.0));
+      ASSERT(sheet->Redo());
+      ASSERT_EQUAL(sheet->GetCell("A2"_pos)->GetValue(), ICell::Value(6.0));
+      ASSERT(!sheet->Redo());
+
+      sheet->ClearCell("A1"_pos);
+      ASSERT(sheet->Undo());
+      ASSERT_EQUAL(sheet->GetCell("A1"_pos)->GetText(), "5");
+
+      // a new edit drops the undone ones
+      ASSERT(sheet->Undo());
+      sheet->SetCell("B1"_pos, "x");
+      ASSERT(!sheet->Redo());
+      ASSERT(sheet->Undo());
+      ASSERT(sheet->Undo());
+      ASSERT(sheet->GetCell("A2"_pos) == nullptr || sheet->GetCell("A2"_pos)->GetText().empty());
+
+      // a batch is undone at once, even when it swaps formulas reading each other
+      sheet->SetCell("A1"_pos, "=B1");
+      sheet->SetCell("B1"_pos, "1");
+      const std::string before_batch = texts();
+      sheet->BeginBatch();
+      sheet->SetCell("B1"_pos, "=A1");
+      sheet->SetCell("A1"_pos, "2");
+      ASSERT(!sheet->Undo());
+      sheet->CommitBatch();
+      ASSERT(sheet->Undo());
+      ASSERT_EQUAL(texts(), before_batch);
+      ASSERT_EQUAL(sheet->GetCell("A1"_pos)->GetValue(), ICell::Value(1.0));
+      ASSERT(sheet->Redo());
+      ASSERT_EQUAL(sheet->GetCell("B1"_pos)->GetValue(), ICell::Value(2.0));
+
+      // the texts the deletion changed come back, #REF! included
+      sheet->SetCell("C1"_pos, "=SUM(A1:A3)+A3");
+      sheet->SetCell("C2"_pos, "=#REF!+A4");
+      sheet->SetCell("A3"_pos, "3");
+      sheet->SetCell("A4"_pos, "=A3*2");
+      sheet->InsertCols(1);
+      const std::string before_delete = texts();
+      sheet->DeleteRows(1, 2);
+      const std::string after_delete = texts();
+      ASSERT_EQUAL(sheet->GetCell("D1"_pos)->GetText(), "=SUM(A1:A1)+#REF!");
+      ASSERT(sheet->Undo());
+      ASSERT_EQUAL(texts(), before_delete);
+      ASSERT_EQUAL(sheet->GetCell("D1"_pos)->GetValue(), ICell::Value(8.0));
+      ASSERT_EQUAL(sheet->GetCell("D2"_pos)->GetValue(), ICell::Value(FormulaError(FormulaError::Category::Ref)));
+      ASSERT(sheet->Redo());
+      ASSERT_EQUAL(texts(), after_delete);
+      ASSERT(sheet->Undo());
+      ASSERT(sheet->Undo());
+      ASSERT_EQUAL(sheet->GetCell("C1"_pos)->GetText(), "=SUM(A1:A3)+A3");
+
+      std::istringstream input("7\t=A1*3\n\tz");
+      sheet->ImportTexts(input, "A1"_pos);
+      ASSERT_EQUAL(sheet->GetCell("B1"_pos)->GetValue(), ICell::Value(21.0));
+      ASSERT(sheet->Undo());
+      ASSERT_EQUAL(sheet->GetCell("A1"_pos)->GetText(), "2");
+      ASSERT_EQUAL(sheet->GetCell("B1"_pos)->GetText(), "=A1");
+      ASSERT(sheet->GetCell("B2"_pos) == nullptr || sheet->GetCell("B2"_pos)->GetText().empty());
+
+      // the oldest steps are dropped once the journal is full
+      auto limited = CreateSheet();
+      limited->SetUndoLimit(1000);
+      for (int i = 0; i < 100; ++i) {
+          limited->SetCell("A1"_pos, std::to_string(i));
+      }
+
+      int undone = 0;
+      while (limited->Undo()) undone++;
+      ASSERT(undone > 0 && undone < 99);
+
+      limited->SetUndoLimit(0);
+      limited->SetCell("A1"_pos, "x");
+      ASSERT(!limited->Undo());
+
+      // a formula which would close a cycle through another sheet is not restored
+      auto workbook = CreateWorkbook();
+      ISheet& first = workbook->AddSheet("First");
+      ISheet& second = workbook->AddSheet("Second");
+      first.SetCell("A1"_pos, "=Second!A1");
+      first.SetCell("A1"_pos, "1");
+      second.SetCell("A1"_pos, "=First!A1+1");
+
+      try {
+          first.Undo();
+          ASSERT(false);
+      } catch (const CircularDependencyException&) {}
+      ASSERT_EQUAL(first.GetCell("A1"_pos)->GetText(), "1");
+      ASSERT_EQUAL(second.GetCell("A1"_pos)->GetValue(), ICell::Value(2.0));
+      second.ClearCell("A1"_pos);
+      ASSERT(first.Undo());
+      ASSERT_EQUAL(first.GetCell("A1"_pos)->GetText(), "=Second!A1");
   }
 
   void TestSetCellSameValue() {
@@ -746,6 +2210,7 @@ int main() {
   RUN_TEST(tr, TestPositionAndStringConversion);
   RUN_TEST(tr, TestPositionToStringInvalid);
   RUN_TEST(tr, TestStringToPositionInvalid);
+  RUN_TEST(tr, TestPositionConversionRoundTrip);
   RUN_TEST(tr, TestEmpty);
   RUN_TEST(tr, TestInvalidPosition);
   RUN_TEST(tr, TestSetCellPlainText);
@@ -773,6 +2238,29 @@ int main() {
   RUN_TEST(tr, TestHandleBeforeDelete);
   RUN_TEST(tr, TestHandleInsertion);
   RUN_TEST(tr, TestPrintableSize);
+  RUN_TEST(tr, TestSparseSheetStructuralEdits);
+  RUN_TEST(tr, TestStructuralEditsNearBottom);
+  RUN_TEST(tr, TestParserConformance);
+  RUN_TEST(tr, TestFormulaDeepNesting);
+  RUN_TEST(tr, TestRecalculateLongChain);
+  RUN_TEST(tr, TestParallelRecalculation);
+  RUN_TEST(tr, TestBatchEdits);
+  RUN_TEST(tr, TestRangeAggregates);
+  RUN_TEST(tr, TestDependencyGraphEdits);
+  RUN_TEST(tr, TestSnapshot);
+  RUN_TEST(tr, TestImportTexts);
+  RUN_TEST(tr, TestNumericText);
+  RUN_TEST(tr, TestFormulaOptimization);
+  RUN_TEST(tr, TestFormulaTemplates);
+  RUN_TEST(tr, TestValueSnapshots);
+  RUN_TEST(tr, TestCycleRanks);
+  RUN_TEST(tr, TestSheetStats);
+  RUN_TEST(tr, TestOnDemandLongChain);
+  RUN_TEST(tr, TestStructuralEditsKeepTemplates);
+  RUN_TEST(tr, TestChangeCallback);
+  RUN_TEST(tr, TestBackgroundRecalculation);
+  RUN_TEST(tr, TestWorkbook);
+  RUN_TEST(tr, TestUndoRedo);
   RUN_TEST(tr, TestSetCellSameValue);
   RUN_TEST(tr, TestPascalTriangle);
   return 0;
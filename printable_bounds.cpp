@@ -0,0 +1,54 @@
+#include "printable_bounds.h"
+
+#include <iterator>
+
+void PrintableBounds::Add(std::map<int, int>& counts, int key) {
+    counts[key]++;
+}
+
+void PrintableBounds::Remove(std::map<int, int>& counts, int key) {
+
+    auto it = counts.find(key);
+
+    if (--it->second == 0) counts.erase(it);
+}
+
+void PrintableBounds::Insert(std::map<int, int>& counts, int before, int count) {
+
+    // keys are moved from the largest one, so a shifted key never meets one still to be moved
+    auto it = counts.end();
+
+    while (it != counts.begin() && std::prev(it)->first >= before) {
+
+        auto node = counts.extract(std::prev(it));
+        node.key() += count;
+
+        it = counts.insert(std::move(node)).position;
+    }
+}
+
+void PrintableBounds::Delete(std::map<int, int>& counts, int first, int count) {
+
+    auto it = counts.lower_bound(first);
+
+    while (it != counts.end()) {
+
+        auto node = counts.extract(it++);
+        node.key() -= count;
+
+        counts.insert(std::move(node));
+    }
+}
+
+void PrintableBounds::Update(Position pos, bool had_text, bool has_text) {
+
+    if (had_text == has_text) return;
+
+    if (has_text) {
+        Add(rows_, pos.row);
+        Add(cols_, pos.col);
+    } else {
+        Remove(rows_, pos.row);
+        Remove(cols_, pos.col);
+    }
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "common.h"
+
+#include <map>
+
+// Bounding box of the cells with non-empty text, kept up to date on every edit instead of scanning the
+// sheet. Counts of such cells are stored per row and per column, the box ends at the largest keys.
+class PrintableBounds {
+
+private:
+
+    std::map<int, int> rows_;
+    std::map<int, int> cols_;
+
+    static void Add(std::map<int, int>& counts, int key);
+
+    static void Remove(std::map<int, int>& counts, int key);
+
+    static void Insert(std::map<int, int>& counts, int before, int count);
+
+    // the keys of the deleted lines must be removed already
+    static void Delete(std::map<int, int>& counts, int first, int count);
+
+public:
+
+    // records a change of the cell text between empty and non-empty
+    void Update(Position pos, bool had_text, bool has_text);
+
+    void InsertRows(int before, int count) {
+        Insert(rows_, before, count);
+    }
+
+    void InsertCols(int before, int count) {
+        Insert(cols_, before, count);
+    }
+
+    void DeleteRows(int first, int count) {
+        Delete(rows_, first, count);
+    }
+
+    void DeleteCols(int first, int count) {
+        Delete(cols_, first, count);
+    }
+
+    Size GetSize() const {
+        return rows_.empty() ? Size {} : Size {rows_.rbegin()->first + 1, cols_.rbegin()->first + 1};
+    }
+};
@@ -0,0 +1,66 @@
+#include "range_index.h"
+
+#include <algorithm>
+
+void RangeIndex::Update(Cell& cell) {
+
+    Erase(cell);
+
+    std::vector<Range> ref_ranges = cell.GetReferencedRanges();
+
+    if (ref_ranges.empty()) return;
+
+    for (const Range& range: ref_ranges) {
+        ForEachTile(range, [&](int key) {
+            tiles_[key].push_back(Entry {&cell, range});
+        });
+    }
+
+    ranges_.emplace(&cell, std::move(ref_ranges));
+}
+
+void RangeIndex::Erase(Cell& cell) {
+
+    auto it = ranges_.find(&cell);
+
+    if (it == ranges_.end()) return;
+
+    for (const Range& range: it->second) {
+        ForEachTile(range, [&](int key) {
+
+            auto tile_it = tiles_.find(key);
+
+            if (tile_it == tiles_.end()) return;
+
+            auto& entries = tile_it->second;
+
+            entries.erase(std::remove_if(entries.begin(), entries.end(), [&](const Entry& entry) {
+                return entry.cell == &cell;
+            }), entries.end());
+
+            if (entries.empty()) tiles_.erase(tile_it);
+        });
+    }
+
+    ranges_.erase(it);
+}
+
+const std::vector<Range>& RangeIndex::GetRanges(const Cell& cell) const {
+
+    static const std::vector<Range> NO_RANGES;
+
+    auto it = ranges_.find(&cell);
+
+    return it != ranges_.end() ? it->second : NO_RANGES;
+}
+
+bool RangeIndex::HasDependents(Position pos) const {
+
+    bool found = false;
+
+    ForEachDependent(pos, [&found](Cell*) {
+        found = true;
+    });
+
+    return found;
+}
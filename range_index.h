@@ -0,0 +1,64 @@
+#pragma once
+
+#include "cell.h"
+#include "cell_grid.h"
+
+#include <unordered_map>
+#include <vector>
+
+// Formula cells indexed by the ranges they reference. A range is a single dependency of its formula, the
+// cells inside it don't know about it, so the cells depending on a position are found here. The sheet is
+// split into tiles of the grid block size and every range is listed in the tiles it overlaps, a lookup
+// checks only the ranges of one tile.
+class RangeIndex {
+
+private:
+
+    static constexpr int TILE_SIZE = CellGrid::BLOCK_SIZE;
+    static constexpr int TILE_COLS = Position::kMaxCols / TILE_SIZE;
+
+    struct Entry {
+        Cell* cell;
+        Range range;
+    };
+
+    std::unordered_map<int, std::vector<Entry>> tiles_;
+    std::unordered_map<const Cell*, std::vector<Range>> ranges_;
+
+    static int TileKey(int tile_row, int tile_col) {
+        return tile_row * TILE_COLS + tile_col;
+    }
+
+    template <typename Visitor>
+    static void ForEachTile(const Range& range, Visitor visitor) {
+        for (int tile_row = range.first.row / TILE_SIZE; tile_row <= range.last.row / TILE_SIZE; ++tile_row) {
+            for (int tile_col = range.first.col / TILE_SIZE; tile_col <= range.last.col / TILE_SIZE; ++tile_col) {
+                visitor(TileKey(tile_row, tile_col));
+            }
+        }
+    }
+
+public:
+
+    // re-reads the ranges of the cell, cells without ranges are not indexed
+    void Update(Cell& cell);
+
+    void Erase(Cell& cell);
+
+    const std::vector<Range>& GetRanges(const Cell& cell) const;
+
+    bool HasDependents(Position pos) const;
+
+    // visits the cells with a range containing pos, once per such range
+    template <typename Visitor>
+    void ForEachDependent(Position pos, Visitor visitor) const {
+
+        auto it = tiles_.find(TileKey(pos.row / TILE_SIZE, pos.col / TILE_SIZE));
+
+        if (it == tiles_.end()) return;
+
+        for (const Entry& entry: it->second) {
+            if (entry.range.Contains(pos)) visitor(entry.cell);
+        }
+    }
+};
@@ -0,0 +1,136 @@
+#include "reference_index.h"
+
+#include <algorithm>
+
+void ReferenceIndex::Remove(std::map<int, std::unordered_set<Cell*>>& cells, int key, Cell* cell) {
+
+    auto it = cells.find(key);
+
+    it->second.erase(cell);
+
+    if (it->second.empty()) cells.erase(it);
+}
+
+std::vector<Cell*> ReferenceIndex::CollectFrom(const std::map<int, std::unordered_set<Cell*>>& cells, int first) {
+
+    std::vector<Cell*> result;
+
+    for (auto it = cells.lower_bound(first); it != cells.end(); ++it) {
+        result.insert(result.end(), it->second.begin(), it->second.end());
+    }
+
+    return result;
+}
+
+void ReferenceIndex::Shift(std::map<int, std::unordered_set<Cell*>>& cells, int Bounds::* bound, int first, int offset) {
+
+    std::vector<int> keys;
+
+    for (auto it = cells.lower_bound(first); it != cells.end(); ++it) {
+        keys.push_back(it->first);
+    }
+
+    // the keys are moved starting from the side they move to, so a moved key never meets one still waiting
+    if (offset > 0) std::reverse(keys.begin(), keys.end());
+
+    for (int key: keys) {
+
+        auto entry = cells.extract(key);
+
+        for (Cell* cell: entry.mapped()) {
+            bounds_.at(cell).*bound += offset;
+        }
+
+        entry.key() += offset;
+        cells.insert(std::move(entry));
+    }
+}
+
+void ReferenceIndex::Delete(std::map<int, std::unordered_set<Cell*>>& cells, int Bounds::* bound, int first, int count) {
+
+    std::vector<Cell*> bounded_inside;
+
+    for (auto it = cells.lower_bound(first); it != cells.end() && it->first < first + count; ++it) {
+        bounded_inside.insert(bounded_inside.end(), it->second.begin(), it->second.end());
+    }
+
+    for (Cell* cell: bounded_inside) {
+        Erase(*cell);
+    }
+
+    Shift(cells, bound, first + count, -count);
+
+    for (Cell* cell: bounded_inside) {
+        Update(*cell);
+    }
+}
+
+void ReferenceIndex::Update(Cell& cell) {
+
+    Erase(cell);
+
+    std::vector<Position> ref_positions = cell.GetReferencedCells();
+    std::vector<Range> ref_ranges = cell.GetReferencedRanges();
+
+    if (ref_positions.empty() && ref_ranges.empty()) return;
+
+    // positions are sorted by row first, so only the column needs a scan
+    Bounds bounds {ref_positions.empty() ? 0 : ref_positions.back().row, 0};
+
+    for (Position pos: ref_positions) {
+        bounds.max_col = std::max(bounds.max_col, pos.col);
+    }
+
+    for (const Range& range: ref_ranges) {
+        bounds.max_row = std::max(bounds.max_row, range.last.row);
+        bounds.max_col = std::max(bounds.max_col, range.last.col);
+    }
+
+    bounds_.emplace(&cell, bounds);
+    cells_by_row_[bounds.max_row].insert(&cell);
+    cells_by_col_[bounds.max_col].insert(&cell);
+}
+
+void ReferenceIndex::Erase(Cell& cell) {
+
+    auto it = bounds_.find(&cell);
+
+    if (it == bounds_.end()) return;
+
+    Remove(cells_by_row_, it->second.max_row, &cell);
+    Remove(cells_by_col_, it->second.max_col, &cell);
+
+    bounds_.erase(it);
+}
+
+void ReferenceIndex::InsertRows(int before, int count) {
+    Shift(cells_by_row_, &Bounds::max_row, before, count);
+}
+
+void ReferenceIndex::InsertCols(int before, int count) {
+    Shift(cells_by_col_, &Bounds::max_col, before, count);
+}
+
+void ReferenceIndex::DeleteRows(int first, int count) {
+    Delete(cells_by_row_, &Bounds::max_row, first, count);
+}
+
+void ReferenceIndex::DeleteCols(int first, int count) {
+    Delete(cells_by_col_, &Bounds::max_col, first, count);
+}
+
+std::vector<Cell*> ReferenceIndex::FindReferencingRowsFrom(int row) const {
+    return CollectFrom(cells_by_row_, row);
+}
+
+std::vector<Cell*> ReferenceIndex::FindReferencingColsFrom(int col) const {
+    return CollectFrom(cells_by_col_, col);
+}
+
+int ReferenceIndex::GetMaxRow() const {
+    return cells_by_row_.empty() ? -1 : cells_by_row_.rbegin()->first;
+}
+
+int ReferenceIndex::GetMaxCol() const {
+    return cells_by_col_.empty() ? -1 : cells_by_col_.rbegin()->first;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "cell.h"
+
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Formula cells indexed by the largest row and the largest column they reference, ranges included.
+// Inserting or deleting rows starting at some row only changes the formulas referencing that row or
+// the rows below it, so structural edits ask the index for those cells instead of visiting the whole sheet.
+class ReferenceIndex {
+
+private:
+
+    struct Bounds {
+        int max_row;
+        int max_col;
+    };
+
+    std::unordered_map<Cell*, Bounds> bounds_;
+    std::map<int, std::unordered_set<Cell*>> cells_by_row_;
+    std::map<int, std::unordered_set<Cell*>> cells_by_col_;
+
+    static void Remove(std::map<int, std::unordered_set<Cell*>>& cells, int key, Cell* cell);
+
+    static std::vector<Cell*> CollectFrom(const std::map<int, std::unordered_set<Cell*>>& cells, int first);
+
+    void Shift(std::map<int, std::unordered_set<Cell*>>& cells, int Bounds::* bound, int first, int offset);
+
+    void Delete(std::map<int, std::unordered_set<Cell*>>& cells, int Bounds::* bound, int first, int count);
+
+public:
+
+    // re-reads the references of the cell, cells without references are not indexed
+    void Update(Cell& cell);
+
+    void Erase(Cell& cell);
+
+    // A structural edit moves the references of the formulas behind it by the same offset, so their bounds
+    // are moved instead of read again. Inserting moves the bounds >= before.
+    void InsertRows(int before, int count);
+
+    void InsertCols(int before, int count);
+
+    // Deleting moves the bounds behind the deleted ones and re-reads the cells bounded by a deleted
+    // row/column, so it follows the deletion in the formulas. A formula whose references changed
+    // may have another bound of the other coordinate and needs an Update as well.
+    void DeleteRows(int first, int count);
+
+    void DeleteCols(int first, int count);
+
+    // cells with a formula referencing a row >= row
+    std::vector<Cell*> FindReferencingRowsFrom(int row) const;
+
+    // cells with a formula referencing a column >= col
+    std::vector<Cell*> FindReferencingColsFrom(int col) const;
+
+    // the largest referenced row/column or -1 if nothing is referenced
+    int GetMaxRow() const;
+
+    int GetMaxCol() const;
+};
@@ -0,0 +1,1673 @@
+#include "sheet.h"
+#include "delimited_reader.h"
+#include "workbook.h"
+
+#include <algorithm>
+#include <charconv>
+#include <iostream>
+#include <map>
+#include <stack>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace {
+
+// Collects the printed table in large blocks, so the stream is called once per block and not per cell
+class PrintBuffer {
+
+private:
+
+    static constexpr size_t CAPACITY = 1 << 16;
+
+    // enough for any double in the general format with the default stream precision
+    static constexpr size_t NUMBER_SIZE = 32;
+
+    std::ostream& output_;
+    std::string buffer_;
+
+    void Reserve(size_t size) {
+        if (buffer_.size() + size > CAPACITY) Flush();
+    }
+
+public:
+
+    explicit PrintBuffer(std::ostream& output): output_(output) {
+        buffer_.reserve(CAPACITY);
+    }
+
+    void Append(char c) {
+        Reserve(1);
+        buffer_ += c;
+    }
+
+    void Append(std::string_view text) {
+        Reserve(text.size());
+        buffer_.append(text);
+    }
+
+    // same as output << value with the default precision, without the locale and the stream state
+    void Append(double value) {
+        Reserve(NUMBER_SIZE);
+        char number[NUMBER_SIZE];
+        buffer_.append(number, std::to_chars(number, number + NUMBER_SIZE, value, std::chars_format::general, 6).ptr);
+    }
+
+    void Flush() {
+        output_.write(buffer_.data(), static_cast<std::streamsize>(buffer_.size()));
+        buffer_.clear();
+    }
+};
+
+void PrintCellValue(PrintBuffer& buffer, const Cell* cell_ptr) {
+
+    if (cell_ptr == nullptr) return;
+
+    cell_ptr->VisitValue([&buffer](const auto& value) {
+        if constexpr (std::is_same_v<std::decay_t<decltype(value)>, FormulaError>) {
+            buffer.Append(value.ToString());
+        } else {
+            buffer.Append(value);
+        }
+    });
+}
+
+// the sorted positions have one inside the range
+bool ContainsAny(const std::vector<Position>& positions, const Range& range) {
+
+    auto it = std::lower_bound(positions.begin(), positions.end(), range.first);
+
+    while (it != positions.end() && it->row <= range.last.row) {
+
+        if (it->col >= range.first.col && it->col <= range.last.col) return true;
+
+        // skips to the columns of the range in this row or the next one
+        Position next {it->col < range.first.col ? it->row : it->row + 1, range.first.col};
+        it = std::lower_bound(it, positions.end(), next);
+    }
+
+    return false;
+}
+
+}
+
+Sheet::Sheet(Workbook& workbook, std::string name, std::shared_ptr<FormulaTemplates> templates)
+    : cells_(cell_context_),
+      templates_(std::move(templates)),
+      workbook_(&workbook),
+      name_(std::move(name)) {}
+
+Sheet::EditScope::EditScope(Sheet& sheet) : sheet_(sheet) {
+
+    if (sheet_.edit_depth_++ > 0) return;
+
+    if (sheet_.workbook_ != nullptr) {
+        sheet_.workbook_->BeginEdit();
+    } else if (sheet_.scheduler_ != nullptr) {
+        sheet_.scheduler_->Cancel();
+    }
+}
+
+Sheet::EditScope::~EditScope() {
+
+    if (sheet_.edit_depth_ > 1) {
+        sheet_.edit_depth_--;
+        return;
+    }
+
+    // a batch is a single step, it ends with the outermost commit
+    if (sheet_.batch_depth_ == 0) sheet_.journal_.Commit();
+
+    // the invalidation of the sheet by the sheets reading it nests in this edit
+    if (sheet_.workbook_ != nullptr) sheet_.workbook_->PropagateChanges();
+
+    sheet_.edit_depth_--;
+
+    sheet_.PublishPendingValues();
+    sheet_.NotifyChanges();
+
+    if (sheet_.workbook_ != nullptr) {
+        sheet_.workbook_->EndEdit();
+    } else {
+        sheet_.ScheduleRecalculation();
+    }
+}
+
+void Sheet::DeleteCell(Position pos) {
+
+    if (!pos.IsValid()) throw InvalidPositionException("invalid position for delete: " + pos.ToString());
+
+    Cell* cell_ptr = cells_.Find(pos);
+
+    if (cell_ptr == nullptr) return;
+
+    graph_.Remove(cell_ptr->GetId());
+
+    printable_bounds_.Update(pos, cell_ptr->HasText(), false);
+    dirty_cells_.erase(cell_ptr);
+    MarkChanged(pos);
+    UnindexReferences(*cell_ptr);
+
+    cells_.Erase(pos);
+}
+
+void Sheet::IndexReferences(Cell& cell) {
+    references_.Update(cell);
+    ranges_.Update(cell);
+    if (workbook_ != nullptr) IndexExternalReferences(cell);
+}
+
+void Sheet::UnindexReferences(Cell& cell) {
+    references_.Erase(cell);
+    ranges_.Erase(cell);
+    if (workbook_ != nullptr) UnindexExternalReferences(cell);
+}
+
+void Sheet::IndexExternalReferences(Cell& cell) {
+
+    UnindexExternalReferences(cell);
+
+    for (ExternalReference& reference: cell.GetExternalReferences()) {
+        external_readers_[std::move(reference.sheet)][&cell].push_back(reference.range);
+    }
+}
+
+void Sheet::UnindexExternalReferences(Cell& cell) {
+
+    // a workbook has few sheets, so every one of them is looked at
+    for (auto it = external_readers_.begin(); it != external_readers_.end();) {
+        it->second.erase(&cell);
+        it = it->second.empty() ? external_readers_.erase(it) : std::next(it);
+    }
+}
+
+const Sheet* Sheet::FindWorkbookSheet(std::string_view name) const {
+    return workbook_->FindSheet(name);
+}
+
+const ISheet* Sheet::FindSheet(std::string_view name) const {
+    return workbook_ != nullptr ? workbook_->FindSheet(name) : nullptr;
+}
+
+void Sheet::FindCycle(Position updated_pos, const Cell& updated_cell, const IFormula& formula) {
+
+    std::vector<Position> ref_positions = formula.GetReferencedCells();
+    std::vector<Range> ref_ranges = formula.GetReferencedRanges();
+
+    bool self_reference = std::binary_search(ref_positions.begin(), ref_positions.end(), updated_pos)
+        || std::any_of(ref_ranges.begin(), ref_ranges.end(), [updated_pos](const Range& range) {
+            return range.Contains(updated_pos);
+        });
+
+    if (self_reference) throw CircularDependencyException("circular dependency exception");
+
+    CellId updated_id = updated_cell.GetId();
+
+    // nothing reads the cell, so it can't close a cycle and goes above everything it may read
+    if (!HasDependents(updated_cell)) {
+        graph_.SetRank(updated_id, graph_.TakeMaxRank());
+        return;
+    }
+
+    // a dependency ranked below the cell can't read it, only the ones above have to be looked at
+    int64_t updated_rank = graph_.GetRank(updated_id);
+    int64_t max_misplaced_rank = updated_rank;
+    std::vector<const Cell*> misplaced;
+    uint64_t checked = 0;
+
+    auto check = [&](const Cell& dependency) {
+
+        checked++;
+
+        int64_t rank = graph_.GetRank(dependency.GetId());
+
+        if (rank > updated_rank) {
+            misplaced.push_back(&dependency);
+            max_misplaced_rank = std::max(max_misplaced_rank, rank);
+        }
+    };
+
+    for (Position ref_pos: ref_positions) {
+        const Cell* ref_cell_ptr = ref_pos.IsValid() ? cells_.Find(ref_pos) : nullptr;
+        if (ref_cell_ptr != nullptr) check(*ref_cell_ptr);
+    }
+
+    for (const Range& range: ref_ranges) {
+        cells_.ForEachIn(range.first, range.last, [&check](Position, const Cell& range_cell) {
+            check(range_cell);
+        });
+    }
+
+    stats_.Add(StatsCounters::CYCLE_CHECK_CELLS, checked);
+
+    if (misplaced.empty()) return;
+
+    // Pearce-Kelly: the cells reading the updated one up to the highest misplaced rank, ranks only grow
+    // along the dependents, so a misplaced dependency reading the cell is among them
+    std::vector<const Cell*> forward = CollectRanked({&updated_cell}, updated_rank, max_misplaced_rank, true);
+
+    for (const Cell* dependency: misplaced) {
+        if (graph_.IsVisited(dependency->GetId())) throw CircularDependencyException("circular dependency exception");
+    }
+
+    // the cells the misplaced dependencies read down to the rank of the updated one
+    std::vector<const Cell*> backward = CollectRanked(misplaced, updated_rank, max_misplaced_rank, false);
+
+    // the cells the updated one will read take the lowest ranks of both sets, each set keeps its order
+    auto by_rank = [this](const Cell* lhs, const Cell* rhs) {
+        return graph_.GetRank(lhs->GetId()) < graph_.GetRank(rhs->GetId());
+    };
+
+    std::sort(forward.begin(), forward.end(), by_rank);
+    std::sort(backward.begin(), backward.end(), by_rank);
+
+    std::vector<int64_t> ranks;
+
+    for (const auto* cells: {&backward, &forward}) {
+        for (const Cell* cell: *cells) ranks.push_back(graph_.GetRank(cell->GetId()));
+    }
+
+    std::sort(ranks.begin(), ranks.end());
+
+    size_t next = 0;
+
+    for (const auto* cells: {&backward, &forward}) {
+        for (const Cell* cell: *cells) graph_.SetRank(cell->GetId(), ranks[next++]);
+    }
+}
+
+std::vector<const Cell*> Sheet::CollectRanked(
+    const std::vector<const Cell*>& starts,
+    int64_t min_rank,
+    int64_t max_rank,
+    bool dependents
+) {
+
+    std::vector<const Cell*> result;
+    std::vector<const Cell*> stack;
+
+    // the collected cells stay visited until the next traversal
+    graph_.BeginVisit();
+
+    for (const Cell* start: starts) {
+        if (graph_.Visit(start->GetId())) stack.push_back(start);
+    }
+
+    while (!stack.empty()) {
+
+        const Cell* current_cell = stack.back();
+        stack.pop_back();
+
+        result.push_back(current_cell);
+
+        auto visit = [&](Cell* next_cell) {
+            int64_t rank = graph_.GetRank(next_cell->GetId());
+            if (rank > min_rank && rank <= max_rank && graph_.Visit(next_cell->GetId())) stack.push_back(next_cell);
+        };
+
+        if (dependents) {
+            ForEachDependent(*current_cell, visit);
+        } else {
+            ForEachDependency(*current_cell, visit);
+        }
+    }
+
+    stats_.Add(StatsCounters::CYCLE_CHECK_CELLS, result.size());
+
+    return result;
+}
+
+bool Sheet::HasExternalCycle(const std::vector<Cell*>& cells) {
+
+    if (workbook_ == nullptr || !workbook_->HasExternalReferences()) return false;
+
+    // a cycle goes into an edited cell, so the ones nothing reads can't be on it
+    std::vector<const Cell*> roots;
+
+    for (const Cell* cell: cells) {
+        if (cell->HasFormula() && (HasDependents(*cell) || workbook_->IsReadExternally(name_, cell->GetPosition()))) {
+            roots.push_back(cell);
+        }
+    }
+
+    if (roots.empty()) return false;
+
+    // the same three-colour DFS as HasCycle, over the cells of all sheets
+    enum Color {IN_PROGRESS, DONE};
+
+    using SheetCell = std::pair<const Sheet*, const Cell*>;
+
+    struct Frame {
+        const Cell* cell;
+        std::vector<SheetCell> dependencies;
+        size_t next;
+    };
+
+    std::unordered_map<const Cell*, Color> colors;
+
+    std::vector<Frame> stack;
+
+    auto enter = [&](const Sheet& sheet, const Cell* cell) {
+
+        colors[cell] = IN_PROGRESS;
+
+        Frame frame {cell, {}, 0};
+
+        sheet.ForEachDependency(*cell, [&](const Cell* dependency) {
+            frame.dependencies.emplace_back(&sheet, dependency);
+        });
+
+        sheet.ForEachExternalDependency(*cell, [&](const Sheet& external_sheet, const Cell* dependency) {
+            frame.dependencies.emplace_back(&external_sheet, dependency);
+        });
+
+        stack.push_back(std::move(frame));
+    };
+
+    bool found = false;
+
+    for (const Cell* root: roots) {
+
+        if (found || colors.count(root) > 0) continue;
+
+        enter(*this, root);
+
+        while (!stack.empty() && !found) {
+
+            Frame& frame = stack.back();
+
+            if (frame.next == frame.dependencies.size()) {
+                colors[frame.cell] = DONE;
+                stack.pop_back();
+                continue;
+            }
+
+            auto [next_sheet, next_cell] = frame.dependencies[frame.next++];
+
+            auto color_it = colors.find(next_cell);
+
+            if (color_it == colors.end()) {
+                enter(*next_sheet, next_cell);
+            } else if (color_it->second == IN_PROGRESS) {
+                found = true;
+            }
+        }
+    }
+
+    stats_.Add(StatsCounters::CYCLE_CHECK_CELLS, colors.size());
+
+    return found;
+}
+
+void Sheet::InvalidateCache(Cell& cell) {
+
+    // the cell passes the invalidation on even without a cache of its own: a cell just created inside
+    // a range was never calculated, while the formulas over the range were
+    graph_.BeginVisit();
+    graph_.Visit(cell.GetId());
+
+    std::stack<Cell*> stack;
+
+    cell.InvalidateCache();
+    MarkDirty(cell);
+    stats_.Add(StatsCounters::INVALIDATED_CELLS);
+
+    ForEachDependent(cell, [&stack](Cell* dependent) {
+        stack.push(dependent);
+    });
+
+    InvalidateCachedDependents(stack);
+}
+
+void Sheet::InvalidateDependentCaches(const std::vector<Cell*>& cells) {
+
+    // the edited cells have lost their caches already, so they pass the invalidation on unconditionally
+    graph_.BeginVisit();
+
+    std::stack<Cell*> stack;
+    uint64_t invalidated = 0;
+
+    for (Cell* cell: cells) {
+
+        if (!graph_.Visit(cell->GetId())) continue;
+
+        cell->InvalidateCache();
+        MarkDirty(*cell);
+        invalidated++;
+
+        ForEachDependent(*cell, [&stack](Cell* dependent) {
+            stack.push(dependent);
+        });
+    }
+
+    stats_.Add(StatsCounters::INVALIDATED_CELLS, invalidated);
+
+    InvalidateCachedDependents(stack);
+}
+
+void Sheet::InvalidateCachedDependents(std::stack<Cell*>& stack) {
+
+    uint64_t invalidated = 0;
+
+    // a cell without a cache has no cached dependents, so the walk stops there
+    while (!stack.empty()) {
+
+        Cell* current_cell = stack.top();
+        stack.pop();
+
+        if (!graph_.Visit(current_cell->GetId())) continue;
+
+        if (current_cell->HasCache()) {
+
+            current_cell->InvalidateCache();
+            MarkDirty(*current_cell);
+            invalidated++;
+
+            ForEachDependent(*current_cell, [&](Cell* dependent) {
+                if (!graph_.IsVisited(dependent->GetId())) stack.push(dependent);
+            });
+        }
+    }
+
+    stats_.Add(StatsCounters::INVALIDATED_CELLS, invalidated);
+}
+
+bool Sheet::HasCycle(const std::vector<Cell*>& cells) {
+
+    // iterative three-colour DFS from the edited cells, each cell of the affected subgraph is visited once
+    enum Color {IN_PROGRESS, DONE};
+
+    struct Frame {
+        const Cell* cell;
+        std::vector<Cell*> dependencies;
+        size_t next;
+    };
+
+    std::unordered_map<const Cell*, Color> colors;
+
+    std::vector<Frame> stack;
+
+    // the cells in post-order, every cell after the ones it reads
+    std::vector<const Cell*> order;
+
+    auto enter = [&](const Cell* cell) {
+
+        colors[cell] = IN_PROGRESS;
+
+        Frame frame {cell, {}, 0};
+
+        ForEachDependency(*cell, [&frame](Cell* dependency) {
+            frame.dependencies.push_back(dependency);
+        });
+
+        stack.push_back(std::move(frame));
+    };
+
+    for (const Cell* root: cells) {
+
+        if (colors.count(root) > 0) continue;
+
+        enter(root);
+
+        while (!stack.empty()) {
+
+            Frame& frame = stack.back();
+
+            if (frame.next == frame.dependencies.size()) {
+                colors[frame.cell] = DONE;
+                order.push_back(frame.cell);
+                stack.pop_back();
+                continue;
+            }
+
+            const Cell* next_cell = frame.dependencies[frame.next++];
+
+            auto color_it = colors.find(next_cell);
+
+            if (color_it == colors.end()) {
+                enter(next_cell);
+            } else if (color_it->second == IN_PROGRESS) {
+                stats_.Add(StatsCounters::CYCLE_CHECK_CELLS, colors.size());
+                return true;
+            }
+        }
+    }
+
+    stats_.Add(StatsCounters::CYCLE_CHECK_CELLS, colors.size());
+
+    // the reached cells read only each other, so ranked in post-order below all others they stay below
+    // the cells reading them
+    int64_t rank = graph_.TakeMinRanks(order.size());
+
+    for (const Cell* cell: order) {
+        graph_.SetRank(cell->GetId(), rank++);
+    }
+
+    return false;
+}
+
+void Sheet::RestoreTexts(const std::map<Position, std::string>& texts) {
+
+    for (const auto& [pos, text]: texts) {
+
+        Cell& cell = GetOrCreateCell(pos);
+
+        // the texts were accepted before, so the formulas parse again
+        if (!text.empty() && text.front() == kFormulaSign) {
+            SetFormulaForCell(cell, templates_->Parse(std::string_view(text).substr(1), pos, stats_));
+        } else {
+            SetPlainTextForCell(cell, text);
+        }
+
+        MarkDirty(cell);
+    }
+
+    for (const auto& [pos, text]: texts) {
+        if (text.empty() && !graph_.HasDependents(cells_.Find(pos)->GetId())) DeleteCell(pos);
+    }
+}
+
+void Sheet::ApplyPendingEdits() {
+
+    if (pending_edits_.empty()) return;
+
+    std::vector<PendingEdit> edits = std::move(pending_edits_);
+    pending_edits_.clear();
+
+    std::map<Position, std::string> previous_texts;
+    std::vector<Cell*> edited_cells;
+    std::vector<Position> cleared_positions;
+
+    edited_cells.reserve(edits.size());
+
+    for (PendingEdit& edit: edits) {
+
+        Cell& cell = GetOrCreateCell(edit.pos);
+
+        previous_texts.emplace(edit.pos, cell.GetText());
+
+        if (edit.formula != nullptr) {
+            if (edit.text != cell.GetTextView()) SetFormulaForCell(cell, std::move(edit.formula));
+        } else {
+            SetPlainTextForCell(cell, std::move(edit.text));
+        }
+
+        if (edit.clear) cleared_positions.push_back(edit.pos);
+
+        edited_cells.push_back(&cell);
+    }
+
+    // checked before HasCycle ranks the cells again, so the restored formulas keep their order
+    if (HasExternalCycle(edited_cells) || HasCycle(edited_cells)) {
+        RestoreTexts(previous_texts);
+        throw CircularDependencyException("circular dependency exception");
+    }
+
+    for (auto& [pos, text]: previous_texts) {
+        if (text != cells_.Find(pos)->GetTextView()) journal_.AddText(pos, std::move(text));
+    }
+
+    InvalidateDependentCaches(edited_cells);
+
+    // referenced cells stay as empty ones, so the formulas using them keep valid pointers
+    for (Position pos: cleared_positions) {
+        Cell* cell_ptr = cells_.Find(pos);
+        if (cell_ptr != nullptr && !cell_ptr->HasText() && !graph_.HasDependents(cell_ptr->GetId())) DeleteCell(pos);
+    }
+
+    HandleChanges();
+}
+
+void Sheet::HandleChanges() {
+    if (recalculation_mode_ == RecalculationMode::Automatic) Recalculate();
+}
+
+void Sheet::SetFormulaForCell(Cell& cell, std::unique_ptr<IFormula> formula) {
+
+    //update dependency graph, the referenced positions are unique and so are their cells
+    std::vector<CellId> dependencies;
+
+    for (Position ref_pos: formula->GetReferencedCells()) {
+        dependencies.push_back(GetOrCreateCell(ref_pos).GetId());
+    }
+
+    printable_bounds_.Update(cell.GetPosition(), cell.HasText(), true);
+
+    cell.SetFormula(std::move(formula));
+    graph_.SetDependencies(cell.GetId(), dependencies);
+
+    IndexReferences(cell);
+}
+
+void Sheet::SetPlainTextForCell(Cell& cell, std::string text) {
+    printable_bounds_.Update(cell.GetPosition(), cell.HasText(), !text.empty());
+    cell.SetPlainText(std::move(text));
+    graph_.ClearDependencies(cell.GetId());
+    UnindexReferences(cell);
+}
+
+void Sheet::SetCell(Position pos, std::string text) {
+
+    EditScope edit(*this);
+    SheetTracer::Scope trace(tracer_, stats_, "SetCell");
+
+    if (batch_depth_ > 0) {
+
+        if (!pos.IsValid()) throw InvalidPositionException("invalid position: " + pos.ToString());
+
+        // the syntax is checked right away, the graph is updated on commit
+        std::unique_ptr<IFormula> formula;
+
+        if (!text.empty() && text.front() == kFormulaSign) {
+            formula = templates_->Parse(std::string_view(text).substr(1), pos, stats_);
+        }
+
+        pending_edits_.push_back(PendingEdit {pos, std::move(text), std::move(formula), false});
+        return;
+    }
+
+    Cell& cell = GetOrCreateCell(pos);
+
+    // recorded once the edit succeeded
+    std::optional<std::string> undo_text;
+    if (journal_.IsRecording() && text != cell.GetTextView()) undo_text = cell.GetText();
+
+    if (!text.empty() && text.front() == kFormulaSign) {
+
+        if (text == cell.GetTextView()) {
+            InvalidateCache(cell);
+            HandleChanges();
+            return;
+        }
+
+        std::unique_ptr<IFormula> formula = templates_->Parse(std::string_view(text).substr(1), pos, stats_);
+
+        FindCycle(pos, cell, *formula);
+
+        // a cycle through other sheets is searched once the formula is set, the previous text is restored then
+        std::optional<std::string> previous_text;
+        if (workbook_ != nullptr) previous_text = cell.GetText();
+
+        InvalidateCache(cell);
+
+        SetFormulaForCell(cell, std::move(formula));
+
+        if (previous_text && HasExternalCycle({&cell})) {
+            RestoreTexts({{pos, std::move(*previous_text)}});
+            throw CircularDependencyException("circular dependency exception");
+        }
+    } else {
+        InvalidateCache(cell);
+        SetPlainTextForCell(cell, std::move(text));
+    }
+
+    if (undo_text) journal_.AddText(pos, std::move(*undo_text));
+
+    HandleChanges();
+}
+
+Cell& Sheet::GetOrCreateCell(Position pos) {
+
+    if (!pos.IsValid()) throw InvalidPositionException("invalid position: " + pos.ToString());
+
+    return cells_.GetOrCreate(pos);
+}
+
+const ICell* Sheet::GetCell(Position pos) const {
+
+    if (!pos.IsValid()) throw InvalidPositionException("invalid position: " + pos.ToString());
+
+    return cells_.Find(pos);
+}
+
+ICell* Sheet::GetCell(Position pos) {
+
+    if (!pos.IsValid()) throw InvalidPositionException("invalid position: " + pos.ToString());
+
+    return cells_.Find(pos);
+}
+
+void Sheet::ForEachCellInRange(Range range, const std::function<void(Position, const ICell&)>& visitor) const {
+
+    if (!range.IsValid()) throw InvalidPositionException("invalid range: " + range.ToString());
+
+    cells_.ForEachIn(range.first, range.last, [&visitor](Position pos, const Cell& cell) {
+        visitor(pos, cell);
+    });
+}
+
+void Sheet::ClearCell(Position pos) {
+
+    EditScope edit(*this);
+    SheetTracer::Scope trace(tracer_, stats_, "ClearCell");
+
+    if (!pos.IsValid()) throw InvalidPositionException("invalid position: " + pos.ToString());
+
+    if (batch_depth_ > 0) {
+        pending_edits_.push_back(PendingEdit {pos, std::string(), nullptr, true});
+        return;
+    }
+
+    Cell* cell_ptr = cells_.Find(pos);
+
+    if (cell_ptr == nullptr) return;
+
+    if (cell_ptr->HasText()) journal_.AddText(pos, cell_ptr->GetText());
+
+    InvalidateCache(*cell_ptr);
+
+    // referenced cells stay as empty ones, so the formulas using them keep valid pointers
+    if (!graph_.HasDependents(cell_ptr->GetId())) {
+        DeleteCell(pos);
+    } else {
+        SetPlainTextForCell(*cell_ptr, std::string());
+    }
+
+    HandleChanges();
+}
+
+void Sheet::InsertRows(int before, int count) {
+
+    EditScope edit(*this);
+    SheetTracer::Scope trace(tracer_, stats_, "InsertRows");
+
+    if (batch_depth_ > 0) ApplyPendingEdits();
+
+    // ranges may reach beyond the created cells, the ones of other sheets as well
+    int rows = std::max(cells_.GetExtent().rows, references_.GetMaxRow() + 1);
+    if (workbook_ != nullptr) rows = std::max(rows, workbook_->GetMaxReadExternally(name_, &Position::row) + 1);
+
+    if (rows + count > Position::kMaxRows) throw TableTooBigException("table too big");
+
+    if (rows <= before) return;
+
+    std::vector<Cell*> referencing_cells = references_.FindReferencingRowsFrom(before);
+
+    if (loaded_formulas_) ParseLoadedFormulas(referencing_cells);
+
+    for (Cell* cell: referencing_cells) {
+        cell->HandleInsertedRows(before, count);
+        ranges_.Update(*cell);
+    }
+
+    references_.InsertRows(before, count);
+
+    stats_.Add(StatsCounters::STRUCTURAL_EDIT_CELLS, referencing_cells.size());
+
+    cells_.InsertRows(before, count);
+    MarkAllChanged();
+    printable_bounds_.InsertRows(before, count);
+
+    if (workbook_ != nullptr) {
+        workbook_->HandleStructuralEdit(name_, [this, before, count](IFormula& formula) {
+            return formula.HandleExternalInsertedRows(name_, before, count);
+        });
+    }
+
+    journal_.AddStructural(EditJournal::Kind::DELETE_ROWS, before, count);
+}
+
+void Sheet::InsertCols(int before, int count) {
+
+    EditScope edit(*this);
+    SheetTracer::Scope trace(tracer_, stats_, "InsertCols");
+
+    if (batch_depth_ > 0) ApplyPendingEdits();
+
+    int cols = std::max(cells_.GetExtent().cols, references_.GetMaxCol() + 1);
+    if (workbook_ != nullptr) cols = std::max(cols, workbook_->GetMaxReadExternally(name_, &Position::col) + 1);
+
+    if (cols + count > Position::kMaxCols) throw TableTooBigException("table too big");
+
+    if (cols <= before) return;
+
+    std::vector<Cell*> referencing_cells = references_.FindReferencingColsFrom(before);
+
+    if (loaded_formulas_) ParseLoadedFormulas(referencing_cells);
+
+    for (Cell* cell: referencing_cells) {
+        cell->HandleInsertedCols(before, count);
+        ranges_.Update(*cell);
+    }
+
+    references_.InsertCols(before, count);
+
+    stats_.Add(StatsCounters::STRUCTURAL_EDIT_CELLS, referencing_cells.size());
+
+    cells_.InsertCols(before, count);
+    MarkAllChanged();
+    printable_bounds_.InsertCols(before, count);
+
+    if (workbook_ != nullptr) {
+        workbook_->HandleStructuralEdit(name_, [this, before, count](IFormula& formula) {
+            return formula.HandleExternalInsertedCols(name_, before, count);
+        });
+    }
+
+    journal_.AddStructural(EditJournal::Kind::DELETE_COLS, before, count);
+}
+
+void Sheet::DeleteRows(int first, int count) {
+
+    EditScope edit(*this);
+    SheetTracer::Scope trace(tracer_, stats_, "DeleteRows");
+
+    if (batch_depth_ > 0) ApplyPendingEdits();
+
+    int rows = std::max(cells_.GetExtent().rows, references_.GetMaxRow() + 1);
+    if (workbook_ != nullptr) rows = std::max(rows, workbook_->GetMaxReadExternally(name_, &Position::row) + 1);
+
+    if (rows <= first || count <= 0) return;
+
+    int last = std::min(rows, first + count);
+
+    if (loaded_formulas_) ParseLoadedFormulas(references_.FindReferencingRowsFrom(first));
+
+    // clear cells
+    std::vector<Position> cells_to_delete;
+
+    cells_.ForEachIn(Position {first, 0}, Position {last - 1, Position::kMaxCols - 1}, [&](Position pos, Cell&) {
+        cells_to_delete.push_back(pos);
+    });
+
+    for (Position pos: cells_to_delete) {
+        const Cell& cell = *cells_.Find(pos);
+        if (cell.HasText()) journal_.AddText(pos, cell.GetText());
+        DeleteCell(pos);
+    }
+
+    // update the formulas referencing the deleted rows or the rows below them
+    std::vector<Cell*> changed_cells;
+
+    std::vector<Cell*> referencing_cells = references_.FindReferencingRowsFrom(first);
+
+    // the insertion undoing the deletion moves the references back, the ones it doesn't restore get their texts
+    for (Cell* cell: referencing_cells) {
+
+        std::optional<std::string> undo_text;
+        if (journal_.IsRecording()) undo_text = cell->GetText();
+
+        if (cell->HandleDeletedRows(first, count)) {
+            changed_cells.push_back(cell);
+            if (undo_text) journal_.AddText(cell->GetPosition(), std::move(*undo_text));
+        }
+
+        ranges_.Update(*cell);
+    }
+
+    references_.DeleteRows(first, count);
+
+    for (Cell* cell: changed_cells) {
+        references_.Update(*cell);
+    }
+
+    stats_.Add(StatsCounters::STRUCTURAL_EDIT_CELLS, cells_to_delete.size() + referencing_cells.size());
+
+    cells_.DeleteRows(first, last - first);
+    MarkAllChanged();
+    printable_bounds_.DeleteRows(first, last - first);
+
+    if (workbook_ != nullptr) {
+        workbook_->HandleStructuralEdit(name_, [this, first, last](IFormula& formula) {
+            return formula.HandleExternalDeletedRows(name_, first, last - first);
+        });
+    }
+
+    // applied in reverse order, so the texts are set once the rows are back
+    journal_.AddStructural(EditJournal::Kind::INSERT_ROWS, first, last - first);
+
+    // invalidated after the shift, when range dependents are found by the new positions
+    InvalidateDependentCaches(changed_cells);
+
+    HandleChanges();
+}
+
+void Sheet::DeleteCols(int first, int count) {
+
+    EditScope edit(*this);
+    SheetTracer::Scope trace(tracer_, stats_, "DeleteCols");
+
+    if (batch_depth_ > 0) ApplyPendingEdits();
+
+    int cols = std::max(cells_.GetExtent().cols, references_.GetMaxCol() + 1);
+    if (workbook_ != nullptr) cols = std::max(cols, workbook_->GetMaxReadExternally(name_, &Position::col) + 1);
+
+    if (cols <= first || count <= 0) return;
+
+    int last = std::min(cols, first + count);
+
+    if (loaded_formulas_) ParseLoadedFormulas(references_.FindReferencingColsFrom(first));
+
+    // clear cells
+    std::vector<Position> cells_to_delete;
+
+    cells_.ForEachIn(Position {0, first}, Position {Position::kMaxRows - 1, last - 1}, [&](Position pos, Cell&) {
+        cells_to_delete.push_back(pos);
+    });
+
+    for (Position pos: cells_to_delete) {
+        const Cell& cell = *cells_.Find(pos);
+        if (cell.HasText()) journal_.AddText(pos, cell.GetText());
+        DeleteCell(pos);
+    }
+
+    // update the formulas referencing the deleted columns or the columns to the right of them
+    std::vector<Cell*> changed_cells;
+
+    std::vector<Cell*> referencing_cells = references_.FindReferencingColsFrom(first);
+
+    // the insertion undoing the deletion moves the references back, the ones it doesn't restore get their texts
+    for (Cell* cell: referencing_cells) {
+
+        std::optional<std::string> undo_text;
+        if (journal_.IsRecording()) undo_text = cell->GetText();
+
+        if (cell->HandleDeletedCols(first, count)) {
+            changed_cells.push_back(cell);
+            if (undo_text) journal_.AddText(cell->GetPosition(), std::move(*undo_text));
+        }
+
+        ranges_.Update(*cell);
+    }
+
+    references_.DeleteCols(first, count);
+
+    for (Cell* cell: changed_cells) {
+        references_.Update(*cell);
+    }
+
+    stats_.Add(StatsCounters::STRUCTURAL_EDIT_CELLS, cells_to_delete.size() + referencing_cells.size());
+
+    cells_.DeleteCols(first, last - first);
+    MarkAllChanged();
+    printable_bounds_.DeleteCols(first, last - first);
+
+    if (workbook_ != nullptr) {
+        workbook_->HandleStructuralEdit(name_, [this, first, last](IFormula& formula) {
+            return formula.HandleExternalDeletedCols(name_, first, last - first);
+        });
+    }
+
+    // applied in reverse order, so the texts are set once the columns are back
+    journal_.AddStructural(EditJournal::Kind::INSERT_COLS, first, last - first);
+
+    InvalidateDependentCaches(changed_cells);
+
+    HandleChanges();
+}
+
+Size Sheet::GetPrintableSize() const {
+    return printable_bounds_.GetSize();
+}
+
+void Sheet::PrintValues(std::ostream& output) const {
+
+    SheetTracer::Scope trace(tracer_, stats_, "PrintValues");
+
+    Size size = GetPrintableSize();
+    PrintBuffer buffer(output);
+
+    for (int i = 0; i < size.rows; ++i) {
+        for (int j = 0; j < size.cols; ++j) {
+            if (j > 0) buffer.Append('\t');
+            PrintCellValue(buffer, cells_.Find(Position {i, j}));
+        }
+
+        buffer.Append('\n');
+    }
+
+    buffer.Flush();
+}
+
+void Sheet::PrintTexts(std::ostream& output) const {
+
+    SheetTracer::Scope trace(tracer_, stats_, "PrintTexts");
+
+    Size size = GetPrintableSize();
+    PrintBuffer buffer(output);
+
+    for (int i = 0; i < size.rows; ++i) {
+
+        for (int j = 0; j < size.cols; ++j) {
+
+            if (j > 0) buffer.Append('\t');
+
+            const Cell* cell_ptr = cells_.Find(Position {i, j});
+
+            if (cell_ptr != nullptr) {
+                buffer.Append(cell_ptr->GetTextView());
+            }
+        }
+
+        buffer.Append('\n');
+    }
+
+    buffer.Flush();
+}
+
+void Sheet::ImportTexts(std::istream& input, Position origin, char separator) {
+
+    EditScope edit(*this);
+    SheetTracer::Scope trace(tracer_, stats_, "ImportTexts");
+
+    if (!origin.IsValid()) throw InvalidPositionException("invalid position: " + origin.ToString());
+
+    if (batch_depth_ > 0) ApplyPendingEdits();
+
+    struct ImportedFormula {
+        Position pos;
+        std::string expression;
+    };
+
+    // the import overwrites these texts, cells of other imported fields were empty or missing
+    std::map<Position, std::string> previous_texts;
+    std::vector<int> row_sizes;
+    std::vector<Cell*> edited_cells;
+    std::vector<ImportedFormula> imported_formulas;
+
+    auto restore = [&] {
+
+        std::map<Position, std::string> texts = std::move(previous_texts);
+
+        for (size_t row = 0; row < row_sizes.size(); ++row) {
+            for (int col = 0; col < row_sizes[row]; ++col) {
+                texts.emplace(Position {origin.row + static_cast<int>(row), origin.col + col}, std::string());
+            }
+        }
+
+        RestoreTexts(texts);
+    };
+
+    DelimitedReader reader(input, separator);
+
+    std::string_view field;
+    bool row_end = false;
+    Position pos = origin;
+    row_sizes.push_back(0);
+
+    while (reader.Next(field, row_end)) {
+
+        if (!pos.IsValid()) {
+            restore();
+            throw InvalidPositionException("invalid position: " + pos.ToString());
+        }
+
+        Cell* cell_ptr = cells_.Find(pos);
+
+        if (cell_ptr != nullptr && cell_ptr->HasText()) previous_texts.emplace(pos, cell_ptr->GetText());
+
+        if (!field.empty() && field.front() == kFormulaSign) {
+            imported_formulas.push_back(ImportedFormula {pos, std::string(field.substr(1))});
+        } else if (cell_ptr != nullptr) {
+            SetPlainTextForCell(*cell_ptr, std::string(field));
+            edited_cells.push_back(cell_ptr);
+        } else if (!field.empty()) {
+            // a new cell has only the dependents through ranges, without them its caches need no care
+            Cell& cell = cells_.GetOrCreate(pos);
+            cell.SetPlainText(std::string(field));
+            printable_bounds_.Update(pos, false, true);
+            MarkChanged(pos);
+            if (ranges_.HasDependents(pos)) edited_cells.push_back(&cell);
+        }
+
+        row_sizes.back()++;
+        pos.col++;
+
+        if (row_end) {
+            row_sizes.push_back(0);
+            pos = Position {pos.row + 1, origin.col};
+        }
+    }
+
+    // formulas are parsed after the whole input is read, in parallel with enough of them
+    std::vector<std::unique_ptr<IFormula>> formulas(imported_formulas.size());
+
+    auto parse = [this, &imported_formulas, &formulas](size_t i) {
+        formulas[i] = templates_->Parse(imported_formulas[i].expression, imported_formulas[i].pos, stats_);
+    };
+
+    std::vector<Cell*> formula_cells;
+    formula_cells.reserve(formulas.size());
+
+    try {
+
+        if (thread_pool_ != nullptr && formulas.size() >= PARALLEL_LEVEL_MIN_SIZE) {
+            thread_pool_->ParallelFor(formulas.size(), parse);
+        } else {
+            for (size_t i = 0; i < formulas.size(); ++i) parse(i);
+        }
+
+        for (size_t i = 0; i < formulas.size(); ++i) {
+            Cell& cell = GetOrCreateCell(imported_formulas[i].pos);
+            SetFormulaForCell(cell, std::move(formulas[i]));
+            formula_cells.push_back(&cell);
+        }
+
+    } catch (const FormulaException&) {
+        restore();
+        throw;
+    }
+
+    if (HasExternalCycle(formula_cells) || HasCycle(formula_cells)) {
+        restore();
+        throw CircularDependencyException("circular dependency exception");
+    }
+
+    // the fields get back the texts they replaced, the cells which were empty or missing are cleared
+    for (size_t row = 0; row < row_sizes.size(); ++row) {
+        for (int col = 0; col < row_sizes[row]; ++col) {
+
+            Position field_pos {origin.row + static_cast<int>(row), origin.col + col};
+
+            auto it = previous_texts.find(field_pos);
+            const Cell* cell_ptr = cells_.Find(field_pos);
+
+            if (it != previous_texts.end()) {
+                journal_.AddText(field_pos, std::move(it->second));
+            } else if (cell_ptr != nullptr && cell_ptr->HasText()) {
+                journal_.AddText(field_pos, std::string());
+            }
+        }
+    }
+
+    edited_cells.insert(edited_cells.end(), formula_cells.begin(), formula_cells.end());
+
+    InvalidateDependentCaches(edited_cells);
+
+    HandleChanges();
+}
+
+void Sheet::Recalculate() {
+
+    EditScope edit(*this);
+    SheetTracer::Scope trace(tracer_, stats_, "Recalculate");
+
+    CalculateDirtyCells();
+}
+
+void Sheet::CalculateDirtyCells() {
+
+    if (dirty_cells_.empty()) return;
+
+    // collect dirty cells together with the uncached cells they depend on and count for every
+    // collected cell how many of its dependencies are still not calculated
+    std::unordered_map<Cell*, size_t> pending_dependencies;
+
+    std::vector<Cell*> stack(dirty_cells_.begin(), dirty_cells_.end());
+    dirty_cells_.clear();
+
+    while (!stack.empty()) {
+
+        Cell* current_cell = stack.back();
+        stack.pop_back();
+
+        if (current_cell->HasCache() || pending_dependencies.count(current_cell) > 0) continue;
+
+        size_t& pending = pending_dependencies[current_cell];
+
+        ForEachDependency(*current_cell, [&](Cell* dependency) {
+            if (!dependency->HasCache()) {
+                pending++;
+                stack.push_back(dependency);
+            }
+        });
+    }
+
+    // calculate cells level by level, every cell of a level depends only on cells of previous ones,
+    // so evaluation always finds its operands cached
+    std::vector<Cell*> level;
+    std::vector<Cell*> next_level;
+
+    for (const auto& [cell, pending]: pending_dependencies) {
+        if (pending == 0) level.push_back(cell);
+    }
+
+    while (!level.empty()) {
+
+        CalculateLevel(level);
+
+        for (Cell* cell: level) {
+            ForEachDependent(*cell, [&](Cell* dependent) {
+                auto it = pending_dependencies.find(dependent);
+                if (it != pending_dependencies.end() && --it->second == 0) next_level.push_back(dependent);
+            });
+        }
+
+        level.swap(next_level);
+        next_level.clear();
+    }
+}
+
+void Sheet::CalculateLevel(const std::vector<Cell*>& level) {
+
+    if (thread_pool_ == nullptr || level.size() < PARALLEL_LEVEL_MIN_SIZE) {
+        for (Cell* cell: level) {
+            cell->UpdateCache();
+        }
+        return;
+    }
+
+    // cells of a level don't depend on each other and their operands are already cached,
+    // so every task only reads the sheet and writes the cache of its own cell
+    thread_pool_->ParallelFor(level.size(), [&level](size_t i) {
+        level[i]->UpdateCache();
+    });
+}
+
+void Sheet::CalculateDependencies(const Cell& cell) const {
+    CalculateDependencies(cell, nullptr);
+}
+
+bool Sheet::CalculateDependencies(const Cell& cell, const std::atomic<bool>* cancelled) const {
+
+    // iterative post-order DFS over the uncached formulas, a cell is calculated after the ones it reads.
+    // In a workbook the chain may go through other sheets, so every cell comes with its own sheet
+    using SheetCell = std::pair<const Sheet*, const Cell*>;
+
+    struct Frame {
+        const Cell* cell;
+        std::vector<SheetCell> dependencies;
+        size_t next;
+    };
+
+    std::unordered_set<const Cell*> visited;
+    std::vector<Frame> stack;
+
+    auto enter = [&](const Sheet& sheet, const Cell* current_cell) {
+
+        Frame frame {current_cell, {}, 0};
+
+        auto add = [&](const Sheet& dependency_sheet, const Cell* dependency) {
+            if (dependency->HasFormula() && !dependency->HasCache() && visited.insert(dependency).second) {
+                frame.dependencies.emplace_back(&dependency_sheet, dependency);
+            }
+        };
+
+        sheet.ForEachDependency(*current_cell, [&](const Cell* dependency) {
+            add(sheet, dependency);
+        });
+
+        sheet.ForEachExternalDependency(*current_cell, add);
+
+        stack.push_back(std::move(frame));
+    };
+
+    enter(*this, &cell);
+
+    while (!stack.empty()) {
+
+        if (cancelled != nullptr && cancelled->load(std::memory_order_relaxed)) return false;
+
+        Frame& frame = stack.back();
+
+        if (frame.next < frame.dependencies.size()) {
+            auto [next_sheet, next_cell] = frame.dependencies[frame.next++];
+            enter(*next_sheet, next_cell);
+            continue;
+        }
+
+        // the cell itself is calculated by its caller
+        if (frame.cell != &cell) frame.cell->UpdateCache();
+
+        stack.pop_back();
+    }
+
+    return true;
+}
+
+void Sheet::PublishValues() {
+
+    EditScope edit(*this);
+    SheetTracer::Scope trace(tracer_, stats_, "PublishValues");
+
+    Recalculate();
+    PublishChangedValues();
+}
+
+void Sheet::PublishChangedValues() {
+
+    std::shared_ptr<const ValueSnapshot> previous = std::atomic_load(&published_values_);
+
+    bool from_scratch = unpublished_.IsAll();
+    ValueSnapshot::Builder builder(*previous, from_scratch);
+
+    if (from_scratch) {
+
+        cells_.ForEach([&builder](Position pos, const Cell& cell) {
+            builder.Set(pos, cell.GetValue());
+        });
+
+    } else {
+
+        for (Position pos: unpublished_.GetPositions()) {
+            const Cell* cell_ptr = cells_.Find(pos);
+            builder.Set(pos, cell_ptr != nullptr ? std::optional<ICell::Value>(cell_ptr->GetValue()) : std::nullopt);
+        }
+    }
+
+    std::atomic_store(&published_values_, builder.Build(GetPrintableSize()));
+
+    unpublished_.Clear();
+}
+
+void Sheet::PublishPendingValues() {
+
+    if (scheduler_ == nullptr || unmarked_.IsEmpty()) return;
+
+    // the values changed by the previous edits are still pending in the published snapshot
+    ValueSnapshot::Builder builder(*std::atomic_load(&published_values_));
+
+    if (unmarked_.IsAll()) {
+        builder.MarkAllPending();
+    } else {
+        for (Position pos: unmarked_.GetPositions()) {
+            builder.MarkPending(pos);
+        }
+    }
+
+    std::atomic_store(&published_values_, builder.Build(GetPrintableSize()));
+
+    unmarked_.Clear();
+}
+
+void Sheet::ScheduleRecalculation() {
+
+    if (scheduler_ == nullptr) return;
+
+    // the cells calculated by the previous jobs or read since are not dirty anymore
+    std::vector<const Cell*> dirty_cells;
+
+    for (auto it = dirty_cells_.begin(); it != dirty_cells_.end();) {
+        if ((*it)->HasCache()) {
+            it = dirty_cells_.erase(it);
+        } else {
+            dirty_cells.push_back(*it);
+            ++it;
+        }
+    }
+
+    // the job only calculates cells, as concurrent readers of a sheet may, until the next edit cancels it.
+    // A cell is calculated after its dependencies one by one, so cancelling doesn't wait for a long chain
+    scheduler_->Schedule([this, dirty_cells = std::move(dirty_cells)](const std::atomic<bool>& cancelled) {
+
+        auto calculate = [this, &cancelled](const Cell& cell) {
+            if (cell.HasCache() || !CalculateDependencies(cell, &cancelled)) return;
+            cell.UpdateCache();
+        };
+
+        if (viewport_) {
+            cells_.ForEachIn(viewport_->first, viewport_->last, [&](Position, const Cell& cell) {
+                if (!cancelled) calculate(cell);
+            });
+        }
+
+        for (const Cell* cell: dirty_cells) {
+            if (cancelled) return;
+            calculate(*cell);
+        }
+
+        if (!cancelled && !unpublished_.IsEmpty()) PublishChangedValues();
+    });
+}
+
+std::shared_ptr<const IValueSnapshot> Sheet::GetValues() const {
+    return std::atomic_load(&published_values_);
+}
+
+SheetStats Sheet::GetStats() const {
+    return stats_.Get();
+}
+
+void Sheet::SetTraceCallback(std::function<void(const SheetTraceEvent&)> callback) {
+    tracer_.SetCallback(std::move(callback));
+}
+
+void Sheet::SetChangeCallback(std::function<void(const SheetChanges&)> callback) {
+
+    change_callback_ = std::move(callback);
+
+    if (change_callback_) {
+        unnotified_.Clear();
+    } else {
+        unnotified_.StopTracking();
+    }
+}
+
+void Sheet::NotifyChanges() {
+
+    if (!change_callback_ || unnotified_.IsEmpty()) return;
+
+    SheetChanges changes;
+    changes.all = unnotified_.IsAll();
+    if (!changes.all) changes.positions = unnotified_.GetPositions();
+
+    // taken before the call, the callback may edit the sheet again
+    unnotified_.Clear();
+
+    change_callback_(changes);
+}
+
+std::optional<SheetChanges> Sheet::TakeChanges() {
+
+    if (unpropagated_.IsEmpty()) return std::nullopt;
+
+    SheetChanges changes;
+    changes.all = unpropagated_.IsAll();
+    if (!changes.all) changes.positions = unpropagated_.GetPositions();
+
+    unpropagated_.Clear();
+
+    return changes;
+}
+
+void Sheet::InvalidateExternal(std::string_view sheet, const SheetChanges& changes) {
+
+    auto readers_it = external_readers_.find(sheet);
+
+    if (readers_it == external_readers_.end()) return;
+
+    EditScope edit(*this);
+
+    // the readers are invalidated like the dependents of an edited cell, an uncached one has no cached
+    // dependents, the values it read were never calculated
+    graph_.BeginVisit();
+
+    std::stack<Cell*> stack;
+
+    for (const auto& [cell, ranges]: readers_it->second) {
+
+        bool reads_changes = changes.all || std::any_of(ranges.begin(), ranges.end(), [&changes](const Range& range) {
+            return ContainsAny(changes.positions, range);
+        });
+
+        if (reads_changes) stack.push(cell);
+    }
+
+    if (stack.empty()) return;
+
+    InvalidateCachedDependents(stack);
+
+    HandleChanges();
+}
+
+std::vector<std::string_view> Sheet::GetReadSheets() const {
+
+    std::vector<std::string_view> result;
+
+    for (const auto& [sheet, _]: external_readers_) {
+        result.push_back(sheet);
+    }
+
+    return result;
+}
+
+bool Sheet::ReadsExternally(std::string_view sheet, Position pos) const {
+
+    auto readers_it = external_readers_.find(sheet);
+
+    if (readers_it == external_readers_.end()) return false;
+
+    for (const auto& [_, ranges]: readers_it->second) {
+        for (const Range& range: ranges) {
+            if (range.Contains(pos)) return true;
+        }
+    }
+
+    return false;
+}
+
+int Sheet::GetMaxReadExternally(std::string_view sheet, int Position::* coordinate) const {
+
+    auto readers_it = external_readers_.find(sheet);
+
+    if (readers_it == external_readers_.end()) return -1;
+
+    int result = -1;
+
+    for (const auto& [_, ranges]: readers_it->second) {
+        for (const Range& range: ranges) {
+            result = std::max(result, range.last.*coordinate);
+        }
+    }
+
+    return result;
+}
+
+void Sheet::SetRecalculationMode(RecalculationMode mode) {
+
+    EditScope edit(*this);
+
+    recalculation_mode_ = mode;
+
+    if (mode != RecalculationMode::Background) {
+        scheduler_.reset();
+        unmarked_.StopTracking();
+    } else if (scheduler_ == nullptr) {
+        scheduler_ = std::make_unique<BackgroundScheduler>();
+    }
+
+    HandleChanges();
+}
+
+RecalculationMode Sheet::GetRecalculationMode() const {
+    return recalculation_mode_;
+}
+
+void Sheet::SetRecalculationThreads(size_t count) {
+    thread_pool_ = count > 1 ? std::make_unique<ThreadPool>(count) : nullptr;
+}
+
+void Sheet::SetViewport(std::optional<Range> viewport) {
+
+    if (viewport && !viewport->IsValid()) throw InvalidPositionException("invalid viewport: " + viewport->ToString());
+
+    // the running job starts again with the new viewport
+    EditScope edit(*this);
+
+    viewport_ = viewport;
+}
+
+void Sheet::ApplyJournalStep(const EditJournal::Step& step) {
+
+    // the texts are set together, as a step of a batch may swap formulas reading each other
+    batch_depth_++;
+
+    try {
+
+        for (auto it = step.rbegin(); it != step.rend(); ++it) {
+
+            const EditJournal::Entry& entry = *it;
+
+            switch (entry.kind) {
+
+                case EditJournal::Kind::TEXT:
+                    if (entry.text.empty()) {
+                        ClearCell(entry.pos);
+                    } else {
+                        SetCell(entry.pos, entry.text);
+                    }
+                    break;
+
+                case EditJournal::Kind::INSERT_ROWS:
+                    InsertRows(entry.pos.row, entry.count);
+                    break;
+
+                case EditJournal::Kind::INSERT_COLS:
+                    InsertCols(entry.pos.col, entry.count);
+                    break;
+
+                case EditJournal::Kind::DELETE_ROWS:
+                    DeleteRows(entry.pos.row, entry.count);
+                    break;
+
+                case EditJournal::Kind::DELETE_COLS:
+                    DeleteCols(entry.pos.col, entry.count);
+                    break;
+            }
+        }
+
+    } catch (...) {
+        batch_depth_--;
+        pending_edits_.clear();
+        throw;
+    }
+
+    batch_depth_--;
+    ApplyPendingEdits();
+}
+
+bool Sheet::ReplayJournal(EditJournal::Direction direction, const char* operation) {
+
+    EditScope edit(*this);
+    SheetTracer::Scope trace(tracer_, stats_, operation);
+
+    // the step of the open batch is not recorded yet
+    if (batch_depth_ > 0) return false;
+
+    std::optional<EditJournal::Step> step = journal_.Take(direction);
+
+    if (!step) return false;
+
+    try {
+        ApplyJournalStep(*step);
+    } catch (const CircularDependencyException&) {
+
+        // a formula reads another sheet which reads this one by now, the entries applied so far are undone
+        EditJournal::Step applied = journal_.Abort(std::move(*step));
+
+        journal_.SetRecording(false);
+        ApplyJournalStep(applied);
+        journal_.SetRecording(true);
+
+        throw;
+    }
+
+    return true;
+}
+
+bool Sheet::Undo() {
+    return ReplayJournal(EditJournal::Direction::UNDO, "Undo");
+}
+
+bool Sheet::Redo() {
+    return ReplayJournal(EditJournal::Direction::REDO, "Redo");
+}
+
+void Sheet::SetUndoLimit(size_t bytes) {
+    journal_.SetMaxSize(bytes);
+}
+
+void Sheet::BeginBatch() {
+    batch_depth_++;
+}
+
+void Sheet::CommitBatch() {
+
+    EditScope edit(*this);
+    SheetTracer::Scope trace(tracer_, stats_, "CommitBatch");
+
+    if (batch_depth_ == 0 || --batch_depth_ > 0) return;
+
+    ApplyPendingEdits();
+}
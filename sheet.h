@@ -0,0 +1,401 @@
+#pragma once
+
+#include "background_scheduler.h"
+#include "cell_grid.h"
+#include "change_set.h"
+#include "common.h"
+#include "dependency_graph.h"
+#include "edit_journal.h"
+#include "formula_templates.h"
+#include "printable_bounds.h"
+#include "range_index.h"
+#include "reference_index.h"
+#include "sheet_stats.h"
+#include "snapshot.h"
+#include "thread_pool.h"
+#include "value_snapshot.h"
+
+#include <atomic>
+#include <iosfwd>
+#include <map>
+#include <memory>
+#include <optional>
+#include <stack>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+class Workbook;
+
+class Sheet : public ISheet, private DependencyCalculator {
+
+private:
+
+    struct PendingEdit {
+        Position pos;
+        std::string text;
+        std::unique_ptr<IFormula> formula;
+        bool clear;
+    };
+
+    // declared first, the cells and the formulas count into it until they are destroyed
+    StatsCounters stats_;
+    mutable SheetTracer tracer_;
+    CellContext cell_context_ {*this, stats_, *this};
+
+    CellGrid cells_;
+    DependencyGraph graph_;
+    ReferenceIndex references_;
+    RangeIndex ranges_;
+    PrintableBounds printable_bounds_;
+    std::shared_ptr<FormulaTemplates> templates_ = std::make_shared<FormulaTemplates>();
+    // loaded from a snapshot, the formulas of the cells may be still unparsed
+    bool loaded_formulas_ = false;
+
+    // the workbook of the sheet, its sheets find each other by name
+    Workbook* workbook_ = nullptr;
+    std::string name_;
+    // the cells reading other sheets by the name of the sheet and the ranges they read there, in a workbook only
+    std::map<std::string, std::unordered_map<Cell*, std::vector<Range>>, std::less<>> external_readers_;
+    // positions changed since the workbook passed the changes on to the cells of other sheets reading them
+    ChangeSet unpropagated_;
+
+    static constexpr size_t PARALLEL_LEVEL_MIN_SIZE = 256;
+
+    RecalculationMode recalculation_mode_ = RecalculationMode::OnDemand;
+    std::unordered_set<Cell*> dirty_cells_;
+    std::unique_ptr<ThreadPool> thread_pool_;
+
+    int batch_depth_ = 0;
+    std::vector<PendingEdit> pending_edits_;
+
+    // the inverse of the edits, a step is recorded by the outermost edit outside of a batch
+    EditJournal journal_;
+
+    // read by other threads with the atomic shared_ptr functions, replaced by PublishValues only
+    std::shared_ptr<const ValueSnapshot> published_values_ = std::make_shared<ValueSnapshot>();
+    // positions changed since the last publication, they are tracked once values were published
+    ChangeSet unpublished_;
+
+    // positions changed since the last notification, tracked while there is a change callback
+    std::function<void(const SheetChanges&)> change_callback_;
+    ChangeSet unnotified_;
+    int edit_depth_ = 0;
+
+    std::optional<Range> viewport_;
+    // positions changed since the last publication of the pending values, tracked in the background mode
+    ChangeSet unmarked_;
+    // declared last to be stopped first, its job reads the sheet. Runs only between the edits
+    std::unique_ptr<BackgroundScheduler> scheduler_;
+
+    // The outermost operation changing the sheet stops the background recalculation first, in a workbook
+    // the one of every sheet, as a job reads the other sheets. At its end the changes are passed on to the
+    // cells of other sheets reading them, the changed values are published as pending, the change callback
+    // is notified, so a commit is reported once, and the recalculation is scheduled
+    class EditScope {
+
+    private:
+
+        Sheet& sheet_;
+
+    public:
+
+        explicit EditScope(Sheet& sheet);
+
+        EditScope(const EditScope&) = delete;
+        EditScope& operator=(const EditScope&) = delete;
+
+        ~EditScope();
+    };
+
+    void MarkChanged(Position pos) {
+        unpublished_.Add(pos);
+        unnotified_.Add(pos);
+        unmarked_.Add(pos);
+        unpropagated_.Add(pos);
+    }
+
+    // the edit moved cells
+    void MarkAllChanged() {
+        unpublished_.AddAll();
+        unnotified_.AddAll();
+        unmarked_.AddAll();
+        unpropagated_.AddAll();
+    }
+
+    void MarkDirty(Cell& cell) {
+        dirty_cells_.insert(&cell);
+        MarkChanged(cell.GetPosition());
+    }
+
+    void DeleteCell(Position pos);
+
+    void IndexReferences(Cell& cell);
+
+    void UnindexReferences(Cell& cell);
+
+    // parses the formulas loaded from a snapshot, so a damaged one fails a structural edit before it changes anything
+    void ParseLoadedFormulas(const std::vector<Cell*>& cells) const;
+
+    void IndexExternalReferences(Cell& cell);
+
+    void UnindexExternalReferences(Cell& cell);
+
+    const Sheet* FindWorkbookSheet(std::string_view name) const;
+
+    // the cells the formula of the cell reads: its direct references and the existing cells of its ranges
+    template <typename Visitor>
+    void ForEachDependency(const Cell& cell, Visitor visitor) const {
+
+        graph_.ForEachDependency(cell.GetId(), [this, &visitor](CellId id) {
+            visitor(&cells_.Get(id));
+        });
+
+        for (const Range& range: ranges_.GetRanges(cell)) {
+            cells_.ForEachIn(range.first, range.last, [&visitor](Position, Cell& range_cell) {
+                visitor(&range_cell);
+            });
+        }
+    }
+
+    // the cells reading the cell, directly or through a range. Both helpers list a cell once per edge,
+    // so counting dependencies with one and releasing them with the other is consistent
+    template <typename Visitor>
+    void ForEachDependent(const Cell& cell, Visitor visitor) const {
+
+        graph_.ForEachDependent(cell.GetId(), [this, &visitor](CellId id) {
+            visitor(&cells_.Get(id));
+        });
+
+        ranges_.ForEachDependent(cell.GetPosition(), visitor);
+    }
+
+    // the existing cells of other sheets the formula of the cell reads, with the sheet of each
+    template <typename Visitor>
+    void ForEachExternalDependency(const Cell& cell, Visitor visitor) const {
+
+        if (workbook_ == nullptr || !cell.HasFormula()) return;
+
+        for (const ExternalReference& reference: cell.GetExternalReferences()) {
+
+            const Sheet* sheet = FindWorkbookSheet(reference.sheet);
+
+            if (sheet == nullptr) continue;
+
+            sheet->cells_.ForEachIn(reference.range.first, reference.range.last, [&](Position, Cell& external_cell) {
+                visitor(*sheet, &external_cell);
+            });
+        }
+    }
+
+    bool HasDependents(const Cell& cell) const {
+        return graph_.HasDependents(cell.GetId()) || ranges_.HasDependents(cell.GetPosition());
+    }
+
+    void SetFormulaForCell(Cell& cell, std::unique_ptr<IFormula> formula);
+
+    void SetPlainTextForCell(Cell& cell, std::string text);
+
+    void ApplyPendingEdits();
+
+    // applies the entries in reverse order as a batch, the edits record their inverse into the journal
+    void ApplyJournalStep(const EditJournal::Step& step);
+
+    // undoes or redoes the last step, a step failing with a cycle through other sheets is rolled back
+    bool ReplayJournal(EditJournal::Direction direction, const char* operation);
+
+    void RestoreTexts(const std::map<Position, std::string>& texts);
+
+    // without a cycle the cells and everything they read are ranked again
+    bool HasCycle(const std::vector<Cell*>& cells);
+
+    // checks the formula against the topological ranks, the cyclic ones throw CircularDependencyException.
+    // Most edits read cells ranked below the updated one and are accepted without a search
+    void FindCycle(Position updated_pos, const Cell& updated_cell, const IFormula& formula);
+
+    // the cycles through the references to other sheets, which the ranks of one sheet don't order. They are
+    // searched from the edited cells some cell reads only, the edited formulas must be set already
+    bool HasExternalCycle(const std::vector<Cell*>& cells);
+
+    // the cells reached from the starts through dependents or dependencies with ranks in (min_rank, max_rank]
+    std::vector<const Cell*> CollectRanked(
+        const std::vector<const Cell*>& starts,
+        int64_t min_rank,
+        int64_t max_rank,
+        bool dependents
+    );
+
+    void InvalidateCache(Cell& cell);
+
+    void InvalidateDependentCaches(const std::vector<Cell*>& cells);
+
+    // the visits of the traversal are marked in the graph
+    void InvalidateCachedDependents(std::stack<Cell*>& stack);
+
+    void HandleChanges();
+
+    void NotifyChanges();
+
+    // with the background recalculation the previous values stay published until it is done
+    void PublishPendingValues();
+
+    // the changed values must be calculated already
+    void PublishChangedValues();
+
+    void CalculateLevel(const std::vector<Cell*>& level);
+
+    // may run in several threads at once, so the traversal keeps its own visited set
+    void CalculateDependencies(const Cell& cell) const override;
+
+    // stops once cancelled is set and returns false, the dependencies are calculated partially then
+    bool CalculateDependencies(const Cell& cell, const std::atomic<bool>* cancelled) const;
+
+public:
+
+    Sheet(): cells_(cell_context_) {}
+
+    // a sheet of the workbook, the formulas are parsed with the templates of the workbook
+    Sheet(Workbook& workbook, std::string name, std::shared_ptr<FormulaTemplates> templates);
+
+    ~Sheet() override = default;
+
+    void SetCell(Position pos, std::string text) override;
+
+    Cell& GetOrCreateCell(Position pos);
+
+    const ICell* GetCell(Position pos) const override;
+
+    ICell* GetCell(Position pos) override;
+
+    void ForEachCellInRange(Range range, const std::function<void(Position, const ICell&)>& visitor) const override;
+
+    void ClearCell(Position pos) override;
+
+    void InsertRows(int before, int count) override;
+
+    void InsertCols(int before, int count) override;
+
+    void DeleteRows(int first, int count) override;
+
+    void DeleteCols(int first, int count) override;
+
+    Size GetPrintableSize() const override;
+
+    void PrintValues(std::ostream& output) const override;
+
+    void PrintTexts(std::ostream& output) const override;
+
+    void ImportTexts(std::istream& input, Position origin, char separator) override;
+
+    void Recalculate() override;
+
+    void SetRecalculationMode(RecalculationMode mode) override;
+
+    RecalculationMode GetRecalculationMode() const override;
+
+    void SetRecalculationThreads(size_t count) override;
+
+    void SetViewport(std::optional<Range> viewport) override;
+
+    void BeginBatch() override;
+
+    void CommitBatch() override;
+
+    bool Undo() override;
+
+    bool Redo() override;
+
+    void SetUndoLimit(size_t bytes) override;
+
+    void SaveSnapshot(std::ostream& output, bool with_values) const override;
+
+    void PublishValues() override;
+
+    std::shared_ptr<const IValueSnapshot> GetValues() const override;
+
+    SheetStats GetStats() const override;
+
+    void SetTraceCallback(std::function<void(const SheetTraceEvent&)> callback) override;
+
+    void SetChangeCallback(std::function<void(const SheetChanges&)> callback) override;
+
+    const ISheet* FindSheet(std::string_view name) const override;
+
+    // fills an empty sheet, the file stays mapped while formulas read from it
+    void LoadSnapshot(std::shared_ptr<const SnapshotFile> file);
+
+    //region used by the workbook
+
+    const std::string& GetName() const {
+        return name_;
+    }
+
+    void CancelRecalculation() {
+        if (scheduler_ != nullptr) scheduler_->Cancel();
+    }
+
+    // lets the scheduler calculate the changed values and publish them
+    void ScheduleRecalculation();
+
+    // calculates the cells with invalidated caches, the background recalculation must be stopped
+    void CalculateDirtyCells();
+
+    // the positions changed since the previous call, nullopt without changes
+    std::optional<SheetChanges> TakeChanges();
+
+    // invalidates the cells reading the changed positions of the named sheet and the ones depending on them
+    void InvalidateExternal(std::string_view sheet, const SheetChanges& changes);
+
+    // the names of the sheets the formulas read, existing or not
+    std::vector<std::string_view> GetReadSheets() const;
+
+    bool HasExternalReferences() const {
+        return !external_readers_.empty();
+    }
+
+    // a formula of the sheet reads the cell of the named sheet
+    bool ReadsExternally(std::string_view sheet, Position pos) const;
+
+    // the last row or column of the named sheet the formulas read, -1 if they don't read it
+    int GetMaxReadExternally(std::string_view sheet, int Position::* coordinate) const;
+
+    // applies a structural edit of the named sheet to the formulas reading it, the handler edits a formula
+    template <typename Handler>
+    void HandleExternalEdit(std::string_view sheet, Handler handler) {
+
+        if (external_readers_.count(sheet) == 0) return;
+
+        EditScope edit(*this);
+
+        if (batch_depth_ > 0) ApplyPendingEdits();
+
+        std::vector<Cell*> readers;
+
+        if (auto readers_it = external_readers_.find(sheet); readers_it != external_readers_.end()) {
+            for (const auto& [cell, _]: readers_it->second) readers.push_back(cell);
+        }
+
+        // a reader whose references were deleted reads the sheet no more, so no propagation reaches it
+        std::vector<Cell*> changed_cells;
+
+        for (Cell* cell: readers) {
+
+            IFormula::HandlingResult result = cell->HandleExternalEdit(handler);
+
+            if (result == IFormula::HandlingResult::NothingChanged) continue;
+
+            if (result == IFormula::HandlingResult::ReferencesChanged) changed_cells.push_back(cell);
+
+            IndexExternalReferences(*cell);
+            MarkChanged(cell->GetPosition());
+        }
+
+        InvalidateDependentCaches(changed_cells);
+
+        HandleChanges();
+    }
+
+    //endregion
+};
@@ -0,0 +1,189 @@
+#pragma once
+
+#include "common.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+
+// Counters of the work of a sheet for ISheet::GetStats(). They are compiled in with SPREADSHEET_STATS only,
+// otherwise every method is empty and the counters stay zero. Formulas are evaluated by several threads,
+// so a counter is kept in stripes on their own cache lines and every thread adds to its own stripe.
+class StatsCounters {
+
+public:
+
+    enum Counter {
+        PARSES,
+        PARSE_NANOSECONDS,
+        CYCLE_CHECK_CELLS,
+        INVALIDATED_CELLS,
+        CACHE_HITS,
+        CACHE_MISSES,
+        STRUCTURAL_EDIT_CELLS,
+        COUNTER_COUNT
+    };
+
+private:
+
+#ifdef SPREADSHEET_STATS
+    static constexpr size_t STRIPE_COUNT = 16;
+
+    struct alignas(64) Stripe {
+        std::array<std::atomic<uint64_t>, COUNTER_COUNT> values {};
+    };
+
+    std::array<Stripe, STRIPE_COUNT> stripes_;
+    std::atomic<uint64_t> max_evaluation_depth_ {0};
+
+    static size_t GetStripe() {
+        static std::atomic<size_t> next_stripe {0};
+        thread_local size_t stripe = next_stripe.fetch_add(1, std::memory_order_relaxed) % STRIPE_COUNT;
+        return stripe;
+    }
+#endif
+
+public:
+
+    void Add(Counter counter, uint64_t count = 1) {
+#ifdef SPREADSHEET_STATS
+        stripes_[GetStripe()].values[counter].fetch_add(count, std::memory_order_relaxed);
+#endif
+    }
+
+    // depth of the formula evaluations nested in each other by a thread
+    void RecordEvaluationDepth([[maybe_unused]] int depth) {
+#ifdef SPREADSHEET_STATS
+        uint64_t max_depth = max_evaluation_depth_.load(std::memory_order_relaxed);
+
+        while (static_cast<uint64_t>(depth) > max_depth) {
+            if (max_evaluation_depth_.compare_exchange_weak(max_depth, static_cast<uint64_t>(depth), std::memory_order_relaxed)) break;
+        }
+#endif
+    }
+
+    SheetStats Get() const {
+
+        SheetStats stats;
+
+#ifdef SPREADSHEET_STATS
+        std::array<uint64_t, COUNTER_COUNT> totals {};
+
+        for (const Stripe& stripe: stripes_) {
+            for (size_t i = 0; i < COUNTER_COUNT; ++i) totals[i] += stripe.values[i].load(std::memory_order_relaxed);
+        }
+
+        stats.parses = totals[PARSES];
+        stats.parse_nanoseconds = totals[PARSE_NANOSECONDS];
+        stats.cycle_check_cells = totals[CYCLE_CHECK_CELLS];
+        stats.invalidated_cells = totals[INVALIDATED_CELLS];
+        stats.cache_hits = totals[CACHE_HITS];
+        stats.cache_misses = totals[CACHE_MISSES];
+        stats.max_evaluation_depth = max_evaluation_depth_.load(std::memory_order_relaxed);
+        stats.structural_edit_cells = totals[STRUCTURAL_EDIT_CELLS];
+#endif
+
+        return stats;
+    }
+
+    // counts one parse and its time
+    class ParseScope {
+
+    private:
+
+#ifdef SPREADSHEET_STATS
+        StatsCounters& counters_;
+        std::chrono::steady_clock::time_point start_ = std::chrono::steady_clock::now();
+#endif
+
+    public:
+
+        explicit ParseScope([[maybe_unused]] StatsCounters& counters)
+#ifdef SPREADSHEET_STATS
+            : counters_(counters)
+#endif
+        {}
+
+        ParseScope(const ParseScope&) = delete;
+        ParseScope& operator=(const ParseScope&) = delete;
+
+        ~ParseScope() {
+#ifdef SPREADSHEET_STATS
+            auto duration = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start_);
+            counters_.Add(PARSES);
+            counters_.Add(PARSE_NANOSECONDS, static_cast<uint64_t>(duration.count()));
+#endif
+        }
+    };
+};
+
+// The trace callback of a sheet. Operations call each other, e.g. CommitBatch applies the edits with the
+// helpers of SetCell, so only the outermost scope is reported.
+class SheetTracer {
+
+private:
+
+    std::function<void(const SheetTraceEvent&)> callback_;
+    int depth_ = 0;
+
+public:
+
+    void SetCallback(std::function<void(const SheetTraceEvent&)> callback) {
+        callback_ = std::move(callback);
+    }
+
+    class Scope {
+
+    private:
+
+        SheetTracer& tracer_;
+        const StatsCounters& counters_;
+        const char* operation_;
+        bool active_;
+        SheetStats start_stats_;
+        std::chrono::steady_clock::time_point start_;
+
+    public:
+
+        Scope(SheetTracer& tracer, const StatsCounters& counters, const char* operation)
+            : tracer_(tracer), counters_(counters), operation_(operation) {
+
+            active_ = tracer_.depth_++ == 0 && tracer_.callback_;
+
+            if (active_) {
+                start_stats_ = counters_.Get();
+                start_ = std::chrono::steady_clock::now();
+            }
+        }
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+        ~Scope() {
+
+            tracer_.depth_--;
+
+            if (!active_) return;
+
+            SheetStats stats = counters_.Get();
+
+            stats.parses -= start_stats_.parses;
+            stats.parse_nanoseconds -= start_stats_.parse_nanoseconds;
+            stats.cycle_check_cells -= start_stats_.cycle_check_cells;
+            stats.invalidated_cells -= start_stats_.invalidated_cells;
+            stats.cache_hits -= start_stats_.cache_hits;
+            stats.cache_misses -= start_stats_.cache_misses;
+            stats.structural_edit_cells -= start_stats_.structural_edit_cells;
+
+            auto duration = std::chrono::steady_clock::now() - start_;
+
+            tracer_.callback_(SheetTraceEvent {
+                operation_,
+                std::chrono::duration_cast<std::chrono::nanoseconds>(duration),
+                stats
+            });
+        }
+    };
+};
@@ -0,0 +1,427 @@
+#include "snapshot.h"
+#include "sheet.h"
+
+#include <mutex>
+#include <ostream>
+
+#ifdef _WIN32
+#include <fstream>
+#include <iterator>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+constexpr size_t CELL_RECORD_SIZE = 44;
+constexpr size_t POSITION_SIZE = 8;
+constexpr size_t RANGE_SIZE = 16;
+
+std::string_view Slice(std::string_view data, size_t offset, size_t size) {
+    if (offset > data.size() || size > data.size() - offset) throw SnapshotException("corrupted snapshot");
+    return data.substr(offset, size);
+}
+
+// Formula of a loaded snapshot. The expression and the references are read from the mapped file,
+// the formula is parsed on the first evaluation or structural edit only, so cells with stored values
+// are never parsed unless they change.
+class LazyFormula : public IFormula {
+
+private:
+
+    std::shared_ptr<const SnapshotFile> file_;
+    StatsCounters& stats_;
+    std::string_view expression_;
+    std::string_view references_;
+    std::string_view ranges_;
+
+    // a cell is evaluated by one thread at a time, the flag only makes the parse itself safe to publish
+    mutable std::once_flag parse_flag_;
+    mutable std::unique_ptr<IFormula> formula_;
+
+    // the stored references are stale after a structural edit
+    bool edited_ = false;
+
+    IFormula& GetParsed() const {
+        std::call_once(parse_flag_, [this] {
+            StatsCounters::ParseScope scope(stats_);
+            formula_ = ParseFormula(std::string(expression_));
+        });
+        return *formula_;
+    }
+
+    IFormula& Edit() {
+        IFormula& formula = GetParsed();
+        edited_ = true;
+        return formula;
+    }
+
+public:
+
+    LazyFormula(
+        std::shared_ptr<const SnapshotFile> file,
+        StatsCounters& stats,
+        std::string_view expression,
+        std::string_view references,
+        std::string_view ranges
+    ) : file_(std::move(file)), stats_(stats), expression_(expression), references_(references), ranges_(ranges) {}
+
+    // throws FormulaException if the stored expression is damaged
+    void Parse() const {
+        GetParsed();
+    }
+
+    Value Evaluate(const ISheet& sheet) const override {
+        return GetParsed().Evaluate(sheet);
+    }
+
+    std::string GetExpression() const override {
+        return edited_ ? formula_->GetExpression() : std::string(expression_);
+    }
+
+    std::vector<Position> GetReferencedCells() const override {
+
+        if (edited_) return formula_->GetReferencedCells();
+
+        std::vector<Position> result(references_.size() / POSITION_SIZE);
+        Snapshot::Reader reader(references_);
+
+        for (Position& pos: result) {
+            pos = reader.ReadPosition();
+        }
+
+        return result;
+    }
+
+    std::vector<Range> GetReferencedRanges() const override {
+
+        if (edited_) return formula_->GetReferencedRanges();
+
+        std::vector<Range> result(ranges_.size() / RANGE_SIZE);
+        Snapshot::Reader reader(ranges_);
+
+        for (Range& range: result) {
+            range.first = reader.ReadPosition();
+            range.last = reader.ReadPosition();
+        }
+
+        return result;
+    }
+
+    // a loaded sheet is not in a workbook, so its formulas read other sheets only as #REF! errors
+    std::vector<ExternalReference> GetExternalReferences() const override {
+        return GetParsed().GetExternalReferences();
+    }
+
+    HandlingResult HandleInsertedRows(int before, int count) override {
+        return Edit().HandleInsertedRows(before, count);
+    }
+
+    HandlingResult HandleInsertedCols(int before, int count) override {
+        return Edit().HandleInsertedCols(before, count);
+    }
+
+    HandlingResult HandleDeletedRows(int first, int count) override {
+        return Edit().HandleDeletedRows(first, count);
+    }
+
+    HandlingResult HandleDeletedCols(int first, int count) override {
+        return Edit().HandleDeletedCols(first, count);
+    }
+
+    HandlingResult HandleExternalInsertedRows(std::string_view sheet, int before, int count) override {
+        return Edit().HandleExternalInsertedRows(sheet, before, count);
+    }
+
+    HandlingResult HandleExternalInsertedCols(std::string_view sheet, int before, int count) override {
+        return Edit().HandleExternalInsertedCols(sheet, before, count);
+    }
+
+    HandlingResult HandleExternalDeletedRows(std::string_view sheet, int first, int count) override {
+        return Edit().HandleExternalDeletedRows(sheet, first, count);
+    }
+
+    HandlingResult HandleExternalDeletedCols(std::string_view sheet, int first, int count) override {
+        return Edit().HandleExternalDeletedCols(sheet, first, count);
+    }
+};
+
+}
+
+#ifdef _WIN32
+
+SnapshotFile::SnapshotFile(const std::string& path) {
+
+    std::ifstream input(path, std::ios::binary);
+
+    if (!input) throw SnapshotException("can't open snapshot " + path);
+
+    buffer_.assign(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>());
+
+    data_ = buffer_.data();
+    size_ = buffer_.size();
+}
+
+SnapshotFile::~SnapshotFile() = default;
+
+#else
+
+SnapshotFile::SnapshotFile(const std::string& path) {
+
+    int fd = open(path.c_str(), O_RDONLY);
+
+    if (fd < 0) throw SnapshotException("can't open snapshot " + path);
+
+    struct stat file_stat {};
+
+    if (fstat(fd, &file_stat) != 0) {
+        close(fd);
+        throw SnapshotException("can't open snapshot " + path);
+    }
+
+    size_ = static_cast<size_t>(file_stat.st_size);
+
+    if (size_ > 0) {
+
+        void* mapping = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if (mapping == MAP_FAILED) {
+            close(fd);
+            throw SnapshotException("can't map snapshot " + path);
+        }
+
+        data_ = static_cast<const char*>(mapping);
+    }
+
+    // the mapping stays valid after the descriptor is closed
+    close(fd);
+}
+
+SnapshotFile::~SnapshotFile() {
+    if (data_ != nullptr) munmap(const_cast<char*>(data_), size_);
+}
+
+#endif
+
+void Sheet::SaveSnapshot(std::ostream& output, bool with_values) const {
+
+    SheetTracer::Scope trace(tracer_, stats_, "SaveSnapshot");
+
+    using namespace Snapshot;
+
+    Writer cells;
+    Writer references;
+    Writer ranges;
+    Writer texts;
+
+    uint32_t cell_count = 0;
+
+    cells_.ForEach([&](Position pos, const Cell& cell) {
+
+        std::string_view stored_text = cell.GetTextView();
+
+        CellKind kind = cell.HasFormula() ? CellKind::FORMULA : CellKind::TEXT;
+        ValueKind value_kind = ValueKind::NONE;
+        uint8_t error_category = 0;
+        double number = 0.;
+
+        std::vector<Position> ref_positions;
+        std::vector<Range> ref_ranges;
+
+        if (kind == CellKind::FORMULA) {
+
+            stored_text.remove_prefix(1);
+
+            ref_positions = cell.GetReferencedCells();
+            ref_ranges = cell.GetReferencedRanges();
+
+            std::optional<ICell::Value> value = with_values ? cell.GetCachedValue() : std::nullopt;
+
+            if (value && std::holds_alternative<double>(*value)) {
+                value_kind = ValueKind::NUMBER;
+                number = std::get<double>(*value);
+            } else if (value && std::holds_alternative<FormulaError>(*value)) {
+                value_kind = ValueKind::ERROR;
+                error_category = static_cast<uint8_t>(std::get<FormulaError>(*value).GetCategory());
+            }
+        }
+
+        cells.Write<int32_t>(pos.row);
+        cells.Write<int32_t>(pos.col);
+        cells.Write(kind);
+        cells.Write(value_kind);
+        cells.Write(error_category);
+        cells.Write<uint8_t>(0);
+        cells.Write(number);
+        cells.Write(static_cast<uint32_t>(texts.GetSize()));
+        cells.Write(static_cast<uint32_t>(stored_text.size()));
+        cells.Write(static_cast<uint32_t>(references.GetSize() / POSITION_SIZE));
+        cells.Write(static_cast<uint32_t>(ref_positions.size()));
+        cells.Write(static_cast<uint32_t>(ranges.GetSize() / RANGE_SIZE));
+        cells.Write(static_cast<uint32_t>(ref_ranges.size()));
+
+        texts.WriteBytes(stored_text);
+
+        for (Position ref_pos: ref_positions) {
+            references.Write<int32_t>(ref_pos.row);
+            references.Write<int32_t>(ref_pos.col);
+        }
+
+        for (const Range& range: ref_ranges) {
+            ranges.Write<int32_t>(range.first.row);
+            ranges.Write<int32_t>(range.first.col);
+            ranges.Write<int32_t>(range.last.row);
+            ranges.Write<int32_t>(range.last.col);
+        }
+
+        cell_count++;
+    });
+
+    Writer header;
+
+    header.WriteBytes(std::string_view(MAGIC, sizeof(MAGIC)));
+    header.Write(VERSION);
+    header.Write(BYTE_ORDER_MARK);
+    header.Write(with_values ? FLAG_VALUES : 0u);
+    header.Write(cell_count);
+    header.Write(static_cast<uint32_t>(references.GetSize() / POSITION_SIZE));
+    header.Write(static_cast<uint32_t>(ranges.GetSize() / RANGE_SIZE));
+    header.Write(static_cast<uint64_t>(texts.GetSize()));
+
+    uint64_t checksum = Checksum(cells.GetData());
+    checksum = Checksum(references.GetData(), checksum);
+    checksum = Checksum(ranges.GetData(), checksum);
+    header.Write(Checksum(texts.GetData(), checksum));
+
+    for (const Writer* section: {&header, &cells, &references, &ranges, &texts}) {
+        output.write(section->GetData().data(), static_cast<std::streamsize>(section->GetSize()));
+    }
+}
+
+void Sheet::LoadSnapshot(std::shared_ptr<const SnapshotFile> file) {
+
+    using namespace Snapshot;
+
+    Reader reader(file->GetData());
+
+    if (reader.ReadBytes(sizeof(MAGIC)) != std::string_view(MAGIC, sizeof(MAGIC))) {
+        throw SnapshotException("not a snapshot");
+    }
+
+    auto version = reader.Read<uint32_t>();
+
+    if (version != VERSION) throw SnapshotException("unsupported snapshot version " + std::to_string(version));
+
+    if (reader.Read<uint32_t>() != BYTE_ORDER_MARK) throw SnapshotException("snapshot of another byte order");
+
+    reader.Read<uint32_t>();
+
+    auto cell_count = reader.Read<uint32_t>();
+    auto reference_count = reader.Read<uint32_t>();
+    auto range_count = reader.Read<uint32_t>();
+    auto text_size = reader.Read<uint64_t>();
+    auto checksum = reader.Read<uint64_t>();
+
+    std::string_view records = reader.ReadBytes(cell_count * CELL_RECORD_SIZE);
+    std::string_view references = reader.ReadBytes(reference_count * POSITION_SIZE);
+    std::string_view ranges = reader.ReadBytes(range_count * RANGE_SIZE);
+    std::string_view texts = reader.ReadBytes(text_size);
+
+    // the expressions are parsed long after the load, a damaged text must not get that far
+    uint64_t computed_checksum = Checksum(records);
+    computed_checksum = Checksum(references, computed_checksum);
+    computed_checksum = Checksum(ranges, computed_checksum);
+
+    if (Checksum(texts, computed_checksum) != checksum) throw SnapshotException("corrupted snapshot");
+
+    Reader record_reader(records);
+    std::vector<Cell*> formula_cells;
+
+    for (uint32_t i = 0; i < cell_count; ++i) {
+
+        Position pos = record_reader.ReadPosition();
+        auto kind = record_reader.Read<CellKind>();
+        auto value_kind = record_reader.Read<ValueKind>();
+        auto error_category = record_reader.Read<uint8_t>();
+        record_reader.Read<uint8_t>();
+        auto number = record_reader.Read<double>();
+        auto text_offset = record_reader.Read<uint32_t>();
+        auto text_length = record_reader.Read<uint32_t>();
+        auto references_offset = record_reader.Read<uint32_t>();
+        auto references_size = record_reader.Read<uint32_t>();
+        auto ranges_offset = record_reader.Read<uint32_t>();
+        auto ranges_size = record_reader.Read<uint32_t>();
+
+        if (!pos.IsValid() || cells_.Find(pos) != nullptr) throw SnapshotException("corrupted snapshot");
+
+        std::string_view text = Slice(texts, text_offset, text_length);
+
+        Cell& cell = cells_.GetOrCreate(pos);
+
+        if (kind == CellKind::TEXT) {
+            cell.SetPlainText(std::string(text));
+            printable_bounds_.Update(pos, false, cell.HasText());
+            continue;
+        }
+
+        if (kind != CellKind::FORMULA) throw SnapshotException("corrupted snapshot");
+
+        cell.SetFormula(std::make_unique<LazyFormula>(
+            file,
+            stats_,
+            text,
+            Slice(references, size_t {references_offset} * POSITION_SIZE, size_t {references_size} * POSITION_SIZE),
+            Slice(ranges, size_t {ranges_offset} * RANGE_SIZE, size_t {ranges_size} * RANGE_SIZE)
+        ));
+        printable_bounds_.Update(pos, false, true);
+
+        if (value_kind == ValueKind::NUMBER) {
+            cell.SetCache(number);
+        } else if (value_kind == ValueKind::ERROR && error_category <= static_cast<uint8_t>(FormulaError::Category::Div0)) {
+            cell.SetCache(FormulaError(static_cast<FormulaError::Category>(error_category)));
+        } else if (value_kind == ValueKind::NONE) {
+            MarkDirty(cell);
+        } else {
+            throw SnapshotException("corrupted snapshot");
+        }
+
+        formula_cells.push_back(&cell);
+    }
+
+    // every referenced cell is stored, so the graph is linked without parsing a formula
+    for (Cell* cell: formula_cells) {
+
+        std::vector<CellId> dependencies;
+
+        for (Position ref_pos: cell->GetReferencedCells()) {
+
+            Cell* ref_cell_ptr = ref_pos.IsValid() ? cells_.Find(ref_pos) : nullptr;
+
+            if (ref_cell_ptr == nullptr) throw SnapshotException("corrupted snapshot");
+
+            dependencies.push_back(ref_cell_ptr->GetId());
+        }
+
+        for (const Range& range: cell->GetReferencedRanges()) {
+            if (!range.IsValid()) throw SnapshotException("corrupted snapshot");
+        }
+
+        graph_.SetDependencies(cell->GetId(), dependencies);
+        IndexReferences(*cell);
+    }
+
+    // one linear pass instead of a cycle search per cell, a corrupted file must not hang evaluation
+    if (HasCycle(formula_cells)) throw SnapshotException("corrupted snapshot");
+
+    loaded_formulas_ = true;
+    MarkAllChanged();
+}
+
+void Sheet::ParseLoadedFormulas(const std::vector<Cell*>& cells) const {
+    for (const Cell* cell: cells) {
+        if (auto formula = dynamic_cast<const LazyFormula*>(cell->GetFormula())) formula->Parse();
+    }
+}
@@ -0,0 +1,148 @@
+#pragma once
+
+#include "common.h"
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+// Binary snapshot of a sheet, version 2. Integers are stored in the byte order of the writer, the reader
+// rejects a file of another order by the byte order mark.
+//
+//   header     magic, version, byte order mark, flags, cell count, reference count, range count, text size,
+//              checksum of the other sections
+//   cells      row, col, kind, value kind, error category, padding, number,
+//              text offset and length, references offset and count, ranges offset and count
+//   references row and col of the cells referenced by formulas, sorted per formula
+//   ranges     first row, first col, last row and last col of the ranges of formulas
+//   texts      texts of text cells and expressions of formulas without the leading '='
+//
+// Every cell of the sheet is stored, empty cells included, so the referenced cells of a formula always
+// exist and the dependency graph is restored from the references without parsing.
+namespace Snapshot {
+
+inline constexpr char MAGIC[8] = {'S', 'H', 'E', 'E', 'T', 'S', 'N', 'P'};
+inline constexpr uint32_t VERSION = 2;
+inline constexpr uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+// the values of calculated formulas are stored
+inline constexpr uint32_t FLAG_VALUES = 1;
+
+enum class CellKind : uint8_t {
+    TEXT,
+    FORMULA
+};
+
+enum class ValueKind : uint8_t {
+    NONE,
+    NUMBER,
+    ERROR
+};
+
+// 64-bit FNV-1a of the bytes, continued from the hash of the preceding bytes
+inline uint64_t Checksum(std::string_view data, uint64_t hash = 0xcbf29ce484222325) {
+    for (char c: data) {
+        hash = (hash ^ static_cast<unsigned char>(c)) * 0x100000001b3;
+    }
+    return hash;
+}
+
+// Fields are written one by one without padding, so records may be unaligned in a mapped file
+class Writer {
+
+private:
+
+    std::string buffer_;
+
+public:
+
+    template <typename T>
+    void Write(T value) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        buffer_.append(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    void WriteBytes(std::string_view bytes) {
+        buffer_.append(bytes);
+    }
+
+    size_t GetSize() const {
+        return buffer_.size();
+    }
+
+    const std::string& GetData() const {
+        return buffer_;
+    }
+};
+
+class Reader {
+
+private:
+
+    std::string_view data_;
+    size_t pos_ = 0;
+
+    void Require(size_t size) const {
+        if (size > data_.size() - pos_) throw SnapshotException("truncated snapshot");
+    }
+
+public:
+
+    explicit Reader(std::string_view data): data_(data) {}
+
+    template <typename T>
+    T Read() {
+        static_assert(std::is_trivially_copyable_v<T>);
+        Require(sizeof(T));
+        T value;
+        std::memcpy(&value, data_.data() + pos_, sizeof(T));
+        pos_ += sizeof(T);
+        return value;
+    }
+
+    std::string_view ReadBytes(size_t size) {
+        Require(size);
+        std::string_view bytes = data_.substr(pos_, size);
+        pos_ += size;
+        return bytes;
+    }
+
+    Position ReadPosition() {
+        Position pos;
+        pos.row = Read<int32_t>();
+        pos.col = Read<int32_t>();
+        return pos;
+    }
+};
+
+}
+
+// Bytes of a snapshot file. The file is memory mapped, so opening it costs nothing until the pages are
+// read, on Windows it is read into memory instead.
+class SnapshotFile {
+
+private:
+
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+
+#ifdef _WIN32
+    std::string buffer_;
+#endif
+
+public:
+
+    // throws SnapshotException if the file can't be opened
+    explicit SnapshotFile(const std::string& path);
+
+    SnapshotFile(const SnapshotFile&) = delete;
+    SnapshotFile& operator=(const SnapshotFile&) = delete;
+
+    ~SnapshotFile();
+
+    std::string_view GetData() const {
+        return std::string_view(data_, size_);
+    }
+};
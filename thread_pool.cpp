@@ -0,0 +1,153 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(size_t thread_count) {
+
+    thread_count = std::max<size_t>(thread_count, 1);
+
+    for (size_t i = 0; i < thread_count; ++i) {
+        queues_.push_back(std::make_unique<WorkQueue>());
+    }
+
+    // queue 0 belongs to the thread calling ParallelFor
+    for (size_t i = 1; i < thread_count; ++i) {
+        workers_.emplace_back(&ThreadPool::WorkerLoop, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+
+    wake_.notify_all();
+
+    for (std::thread& worker: workers_) {
+        worker.join();
+    }
+}
+
+bool ThreadPool::TryPop(size_t queue_index, Range& range) {
+
+    WorkQueue& queue = *queues_[queue_index];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+
+    if (queue.ranges.empty()) return false;
+
+    range = queue.ranges.back();
+    queue.ranges.pop_back();
+
+    return true;
+}
+
+bool ThreadPool::TrySteal(size_t thief_index, Range& range) {
+
+    for (size_t i = 1; i < queues_.size(); ++i) {
+
+        WorkQueue& queue = *queues_[(thief_index + i) % queues_.size()];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+
+        if (!queue.ranges.empty()) {
+            range = queue.ranges.front();
+            queue.ranges.pop_front();
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void ThreadPool::RunTasks(size_t queue_index) {
+
+    Range range {};
+
+    while (TryPop(queue_index, range) || TrySteal(queue_index, range)) {
+
+        try {
+            for (size_t i = range.begin; i < range.end; ++i) {
+                (*task_)(i);
+            }
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!error_) error_ = std::current_exception();
+        }
+
+        if (remaining_.fetch_sub(range.end - range.begin) == range.end - range.begin) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            done_.notify_all();
+        }
+    }
+}
+
+void ThreadPool::WorkerLoop(size_t queue_index) {
+
+    size_t seen_generation = 0;
+
+    while (true) {
+
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            wake_.wait(lock, [&] { return stopping_ || generation_ != seen_generation; });
+
+            if (stopping_) return;
+
+            seen_generation = generation_;
+            active_workers_++;
+        }
+
+        RunTasks(queue_index);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            active_workers_--;
+        }
+
+        done_.notify_all();
+    }
+}
+
+void ThreadPool::ParallelFor(size_t count, const std::function<void(size_t)>& task) {
+
+    if (count == 0) return;
+
+    if (workers_.empty()) {
+        for (size_t i = 0; i < count; ++i) task(i);
+        return;
+    }
+
+    size_t range_count = std::min(count, queues_.size() * RANGES_PER_THREAD);
+    size_t range_size = (count + range_count - 1) / range_count;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        task_ = &task;
+        error_ = nullptr;
+        remaining_.store(count);
+
+        size_t queue_index = 0;
+
+        for (size_t begin = 0; begin < count; begin += range_size) {
+            WorkQueue& queue = *queues_[queue_index];
+            std::lock_guard<std::mutex> queue_lock(queue.mutex);
+            queue.ranges.push_back(Range {begin, std::min(count, begin + range_size)});
+            queue_index = (queue_index + 1) % queues_.size();
+        }
+
+        generation_++;
+    }
+
+    wake_.notify_all();
+
+    RunTasks(0);
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_.wait(lock, [this] { return remaining_.load() == 0 && active_workers_ == 0; });
+
+    task_ = nullptr;
+
+    if (error_) std::rethrow_exception(error_);
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed-size pool for data-parallel loops. Every ParallelFor call splits the index space into ranges
+// spread over per-thread queues; a thread takes work from the back of its own queue and steals from the
+// front of the others once it runs dry. The calling thread takes part in the loop as well.
+class ThreadPool {
+
+private:
+
+    struct Range {
+        size_t begin;
+        size_t end;
+    };
+
+    struct WorkQueue {
+        std::mutex mutex;
+        std::deque<Range> ranges;
+    };
+
+    static constexpr size_t RANGES_PER_THREAD = 4;
+
+    std::vector<std::unique_ptr<WorkQueue>> queues_;
+    std::vector<std::thread> workers_;
+
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable done_;
+
+    const std::function<void(size_t)>* task_ = nullptr;
+    size_t generation_ = 0;
+    size_t active_workers_ = 0;
+    bool stopping_ = false;
+
+    std::atomic<size_t> remaining_ {0};
+    std::exception_ptr error_;
+
+    bool TryPop(size_t queue_index, Range& range);
+
+    bool TrySteal(size_t thief_index, Range& range);
+
+    void RunTasks(size_t queue_index);
+
+    void WorkerLoop(size_t queue_index);
+
+public:
+
+    // thread_count includes the calling thread, so a pool of one thread runs loops inline
+    explicit ThreadPool(size_t thread_count);
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    ~ThreadPool();
+
+    size_t GetThreadCount() const {
+        return queues_.size();
+    }
+
+    // calls task for every index of [0, count) and returns when all calls are finished,
+    // the first exception thrown by a task is rethrown here
+    void ParallelFor(size_t count, const std::function<void(size_t)>& task);
+};
@@ -0,0 +1,91 @@
+#include "value_snapshot.h"
+
+const ValueSnapshot::Leaf* ValueSnapshot::FindLeaf(const Node* root, Position pos) {
+
+    const Node* node = root;
+
+    for (int level = DEPTH - 1; level > 0 && node != nullptr; --level) {
+        node = static_cast<const Branch*>(node)->children[GetIndex(pos, level)].get();
+    }
+
+    return static_cast<const Leaf*>(node);
+}
+
+std::optional<ICell::Value> ValueSnapshot::GetValue(Position pos) const {
+
+    if (!pos.IsValid()) throw InvalidPositionException("invalid position: " + pos.ToString());
+
+    const Leaf* leaf = FindLeaf(root_.get(), pos);
+
+    return leaf != nullptr ? leaf->values[GetIndex(pos, 0)] : std::nullopt;
+}
+
+bool ValueSnapshot::IsPending(Position pos) const {
+
+    if (!pos.IsValid()) throw InvalidPositionException("invalid position: " + pos.ToString());
+
+    if (all_pending_) return true;
+
+    const Leaf* leaf = FindLeaf(root_.get(), pos);
+
+    return leaf != nullptr && leaf->pending[GetIndex(pos, 0)];
+}
+
+ValueSnapshot::Builder::Builder(const ValueSnapshot& previous, bool from_scratch)
+    : root_(from_scratch ? nullptr : previous.root_),
+      version_(previous.version_ + 1),
+      all_pending_(!from_scratch && previous.all_pending_) {}
+
+template <typename T>
+T& ValueSnapshot::Builder::Own(std::shared_ptr<const Node>& node) {
+
+    // nodes of the published versions are copied, the ones of this version are already private
+    if (node != nullptr && node->version == version_) return const_cast<T&>(static_cast<const T&>(*node));
+
+    auto owned = node != nullptr ? std::make_shared<T>(static_cast<const T&>(*node)) : std::make_shared<T>();
+    owned->version = version_;
+
+    T& result = *owned;
+    node = std::move(owned);
+
+    return result;
+}
+
+ValueSnapshot::Leaf& ValueSnapshot::Builder::OwnLeaf(Position pos) {
+
+    std::shared_ptr<const Node>* node = &root_;
+
+    for (int level = DEPTH - 1; level > 0; --level) {
+        node = &Own<Branch>(*node).children[GetIndex(pos, level)];
+    }
+
+    return Own<Leaf>(*node);
+}
+
+void ValueSnapshot::Builder::Set(Position pos, std::optional<ICell::Value> value) {
+
+    // a missing block has no values to clear
+    if (!value && FindLeaf(root_.get(), pos) == nullptr) return;
+
+    Leaf& leaf = OwnLeaf(pos);
+    size_t index = GetIndex(pos, 0);
+
+    leaf.values[index] = std::move(value);
+    leaf.pending[index] = false;
+}
+
+void ValueSnapshot::Builder::MarkPending(Position pos) {
+    OwnLeaf(pos).pending[GetIndex(pos, 0)] = true;
+}
+
+std::shared_ptr<const ValueSnapshot> ValueSnapshot::Builder::Build(Size size) {
+
+    auto snapshot = std::make_shared<ValueSnapshot>();
+
+    snapshot->root_ = std::move(root_);
+    snapshot->version_ = version_;
+    snapshot->size_ = size;
+    snapshot->all_pending_ = all_pending_;
+
+    return snapshot;
+}
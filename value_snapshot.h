@@ -0,0 +1,101 @@
+#pragma once
+
+#include "common.h"
+
+#include <array>
+#include <bitset>
+#include <cstdint>
+#include <memory>
+#include <optional>
+
+// Published values of a sheet. They are kept in a trie of 8x8 blocks, five levels cover the largest
+// sheet. A new version copies the path to every changed block and shares the rest with the previous one,
+// so publishing costs the number of changed cells and not the size of the sheet.
+class ValueSnapshot : public IValueSnapshot {
+
+private:
+
+    static constexpr int BLOCK_BITS = 3;
+    static constexpr int BLOCK_SIZE = 1 << BLOCK_BITS;
+    static constexpr size_t FANOUT = BLOCK_SIZE * BLOCK_SIZE;
+    static constexpr int DEPTH = 5;
+
+    static_assert(BLOCK_SIZE << (BLOCK_BITS * (DEPTH - 1)) >= Position::kMaxRows);
+    static_assert(BLOCK_SIZE << (BLOCK_BITS * (DEPTH - 1)) >= Position::kMaxCols);
+
+    // a node is only changed by the builder of its own version, before it is published
+    struct Node {
+        uint64_t version;
+    };
+
+    struct Branch : Node {
+        std::array<std::shared_ptr<const Node>, FANOUT> children;
+    };
+
+    struct Leaf : Node {
+        std::array<std::optional<ICell::Value>, FANOUT> values;
+        // the values are the previous ones and are being recalculated
+        std::bitset<FANOUT> pending;
+    };
+
+    static size_t GetIndex(Position pos, int level) {
+        int shift = BLOCK_BITS * level;
+        return ((pos.row >> shift) & (BLOCK_SIZE - 1)) * BLOCK_SIZE + ((pos.col >> shift) & (BLOCK_SIZE - 1));
+    }
+
+    std::shared_ptr<const Node> root_;
+    uint64_t version_ = 0;
+    Size size_;
+    bool all_pending_ = false;
+
+    static const Leaf* FindLeaf(const Node* root, Position pos);
+
+public:
+
+    // the values of one version, the builder must not be used after Build()
+    class Builder {
+
+    private:
+
+        std::shared_ptr<const Node> root_;
+        uint64_t version_;
+        bool all_pending_;
+
+        template <typename T>
+        T& Own(std::shared_ptr<const Node>& node);
+
+        Leaf& OwnLeaf(Position pos);
+
+    public:
+
+        // the next version of previous, from scratch it starts without the previous values
+        explicit Builder(const ValueSnapshot& previous, bool from_scratch = false);
+
+        // the value is calculated, it is not pending anymore
+        void Set(Position pos, std::optional<ICell::Value> value);
+
+        // keeps the previous value, marked as pending
+        void MarkPending(Position pos);
+
+        // the cells moved, every previous value is pending until the values are built from scratch
+        void MarkAllPending() {
+            all_pending_ = true;
+        }
+
+        std::shared_ptr<const ValueSnapshot> Build(Size size);
+    };
+
+    ValueSnapshot() = default;
+
+    std::optional<ICell::Value> GetValue(Position pos) const override;
+
+    bool IsPending(Position pos) const override;
+
+    Size GetPrintableSize() const override {
+        return size_;
+    }
+
+    uint64_t GetVersion() const override {
+        return version_;
+    }
+};
@@ -0,0 +1,209 @@
+#include "workbook.h"
+
+#include <algorithm>
+#include <optional>
+#include <unordered_map>
+
+Workbook::~Workbook() {
+    // a background job of one sheet reads the others, so all of them stop before any is destroyed
+    for (const auto& sheet: sheets_) sheet->CancelRecalculation();
+}
+
+bool Workbook::IsValidName(std::string_view name) {
+
+    if (name.empty() || (name.front() >= '0' && name.front() <= '9')) return false;
+
+    return std::all_of(name.begin(), name.end(), [](char c) {
+        return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '_';
+    });
+}
+
+ISheet& Workbook::AddSheet(std::string name) {
+
+    if (!IsValidName(name)) throw InvalidSheetNameException("invalid sheet name: " + name);
+
+    if (sheets_by_name_.count(name) > 0) throw InvalidSheetNameException("sheet already exists: " + name);
+
+    EditScope edit(*this);
+
+    sheets_.push_back(std::make_unique<Sheet>(*this, name, templates_));
+    sheets_by_name_.emplace(std::move(name), sheets_.back().get());
+
+    // the changes of a new sheet are all of its cells, so the formulas which read it as a missing sheet
+    // are invalidated
+    PropagateChanges();
+
+    return *sheets_.back();
+}
+
+ISheet* Workbook::GetSheet(std::string_view name) {
+    return FindSheet(name);
+}
+
+const ISheet* Workbook::GetSheet(std::string_view name) const {
+    return FindSheet(name);
+}
+
+std::vector<std::string> Workbook::GetSheetNames() const {
+
+    std::vector<std::string> result;
+
+    for (const auto& sheet: sheets_) {
+        result.push_back(sheet->GetName());
+    }
+
+    return result;
+}
+
+Sheet* Workbook::FindSheet(std::string_view name) const {
+    auto it = sheets_by_name_.find(name);
+    return it != sheets_by_name_.end() ? it->second : nullptr;
+}
+
+std::vector<std::vector<Sheet*>> Workbook::GetLevels() const {
+
+    // Kahn's algorithm over the sheets: for every sheet the sheets it reads which are not in a group yet
+    std::unordered_map<const Sheet*, size_t> pending;
+    std::unordered_map<const Sheet*, std::vector<Sheet*>> readers;
+
+    for (const auto& sheet: sheets_) {
+
+        size_t& sheet_pending = pending[sheet.get()];
+
+        for (std::string_view name: sheet->GetReadSheets()) {
+
+            Sheet* read_sheet = FindSheet(name);
+
+            if (read_sheet == nullptr || read_sheet == sheet.get()) continue;
+
+            sheet_pending++;
+            readers[read_sheet].push_back(sheet.get());
+        }
+    }
+
+    std::vector<std::vector<Sheet*>> levels;
+    std::vector<Sheet*> level;
+
+    for (const auto& sheet: sheets_) {
+        if (pending[sheet.get()] == 0) level.push_back(sheet.get());
+    }
+
+    size_t leveled = 0;
+
+    while (!level.empty()) {
+
+        std::vector<Sheet*> next_level;
+
+        for (Sheet* sheet: level) {
+            for (Sheet* reader: readers[sheet]) {
+                if (--pending[reader] == 0) next_level.push_back(reader);
+            }
+        }
+
+        leveled += level.size();
+        levels.push_back(std::move(level));
+        level = std::move(next_level);
+    }
+
+    // sheets reading each other have no cyclic cells, their formulas read the other sheets on demand
+    if (leveled < sheets_.size()) {
+
+        for (const auto& sheet: sheets_) {
+            if (pending[sheet.get()] > 0) level.push_back(sheet.get());
+        }
+
+        levels.push_back(std::move(level));
+    }
+
+    return levels;
+}
+
+void Workbook::Recalculate() {
+
+    EditScope edit(*this);
+
+    // a sheet reads the cells of other sheets only, the ones of its own group are calculated on demand
+    // with the same compare-and-swap on the cache concurrent readers use
+    for (const std::vector<Sheet*>& level: GetLevels()) {
+
+        if (thread_pool_ == nullptr || level.size() == 1) {
+            for (Sheet* sheet: level) sheet->CalculateDirtyCells();
+            continue;
+        }
+
+        thread_pool_->ParallelFor(level.size(), [&level](size_t i) {
+            level[i]->CalculateDirtyCells();
+        });
+    }
+}
+
+void Workbook::SetRecalculationThreads(size_t count) {
+    thread_pool_ = count > 1 ? std::make_unique<ThreadPool>(count) : nullptr;
+}
+
+void Workbook::BeginEdit() {
+
+    if (edit_depth_++ > 0) return;
+
+    for (const auto& sheet: sheets_) sheet->CancelRecalculation();
+}
+
+void Workbook::EndEdit() {
+
+    if (--edit_depth_ > 0) return;
+
+    for (const auto& sheet: sheets_) sheet->ScheduleRecalculation();
+}
+
+void Workbook::PropagateChanges() {
+
+    // the reading sheets are invalidated as edits nested in the propagation, their own changes are taken
+    // by the loop below
+    if (propagating_) return;
+
+    propagating_ = true;
+
+    // there are no cyclic cells, so the invalidation ends once it reaches the cells nothing else reads
+    for (bool changed = true; changed;) {
+
+        changed = false;
+
+        for (const auto& sheet: sheets_) {
+
+            std::optional<SheetChanges> changes = sheet->TakeChanges();
+
+            if (!changes) continue;
+
+            changed = true;
+
+            for (const auto& reader: sheets_) {
+                reader->InvalidateExternal(sheet->GetName(), *changes);
+            }
+        }
+    }
+
+    propagating_ = false;
+}
+
+bool Workbook::HasExternalReferences() const {
+    return std::any_of(sheets_.begin(), sheets_.end(), [](const auto& sheet) {
+        return sheet->HasExternalReferences();
+    });
+}
+
+bool Workbook::IsReadExternally(std::string_view sheet, Position pos) const {
+    return std::any_of(sheets_.begin(), sheets_.end(), [&](const auto& reader) {
+        return reader->ReadsExternally(sheet, pos);
+    });
+}
+
+int Workbook::GetMaxReadExternally(std::string_view sheet, int Position::* coordinate) const {
+
+    int result = -1;
+
+    for (const auto& reader: sheets_) {
+        result = std::max(result, reader->GetMaxReadExternally(sheet, coordinate));
+    }
+
+    return result;
+}
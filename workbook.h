@@ -0,0 +1,106 @@
+#pragma once
+
+#include "common.h"
+#include "formula_templates.h"
+#include "sheet.h"
+#include "thread_pool.h"
+
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Sheets whose formulas read each other by name. Every sheet keeps the graph of its own cells and the
+// cells reading other sheets, the workbook passes the changes of a sheet on to the sheets reading it, so
+// the caches stay consistent across sheets. The sheets share the formula templates.
+class Workbook : public IWorkbook {
+
+private:
+
+    std::shared_ptr<FormulaTemplates> templates_ = std::make_shared<FormulaTemplates>();
+
+    // in the order they were added
+    std::vector<std::unique_ptr<Sheet>> sheets_;
+    std::map<std::string, Sheet*, std::less<>> sheets_by_name_;
+
+    std::unique_ptr<ThreadPool> thread_pool_;
+
+    int edit_depth_ = 0;
+    bool propagating_ = false;
+
+    // an edit of the workbook itself
+    class EditScope {
+
+    private:
+
+        Workbook& workbook_;
+
+    public:
+
+        explicit EditScope(Workbook& workbook) : workbook_(workbook) {
+            workbook_.BeginEdit();
+        }
+
+        EditScope(const EditScope&) = delete;
+        EditScope& operator=(const EditScope&) = delete;
+
+        ~EditScope() {
+            workbook_.EndEdit();
+        }
+    };
+
+    static bool IsValidName(std::string_view name);
+
+    // the sheets in groups, a sheet reads the sheets of the previous groups only. Sheets reading each other
+    // go into the last group together
+    std::vector<std::vector<Sheet*>> GetLevels() const;
+
+public:
+
+    Workbook() = default;
+
+    Workbook(const Workbook&) = delete;
+    Workbook& operator=(const Workbook&) = delete;
+
+    ~Workbook() override;
+
+    ISheet& AddSheet(std::string name) override;
+
+    ISheet* GetSheet(std::string_view name) override;
+
+    const ISheet* GetSheet(std::string_view name) const override;
+
+    std::vector<std::string> GetSheetNames() const override;
+
+    void Recalculate() override;
+
+    void SetRecalculationThreads(size_t count) override;
+
+    // read by the formulas, possibly by several threads at once
+    Sheet* FindSheet(std::string_view name) const;
+
+    // the edits of the sheets nest in each other: the outermost one stops the background recalculation
+    // of all sheets and schedules it again at its end
+    void BeginEdit();
+
+    void EndEdit();
+
+    // passes the changes of every sheet on to the cells reading them, until the invalidated cells of the
+    // reading sheets have been passed on as well
+    void PropagateChanges();
+
+    bool HasExternalReferences() const;
+
+    // a formula of some sheet reads the cell of the named sheet
+    bool IsReadExternally(std::string_view sheet, Position pos) const;
+
+    // the last row or column of the named sheet the formulas of the sheets read, -1 if none reads it
+    int GetMaxReadExternally(std::string_view sheet, int Position::* coordinate) const;
+
+    // moves the references of the formulas of every sheet to the named one, which a structural edit changed
+    template <typename Handler>
+    void HandleStructuralEdit(std::string_view sheet, Handler handler) {
+        for (const auto& reader: sheets_) reader->HandleExternalEdit(sheet, handler);
+    }
+};